@@ -134,6 +134,12 @@ bool AABB::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance)
 	return true;
 }
 
+bool AABB::Occluded(const Ray& ray, float maxDistance) const
+{
+	float tMin, tMax;
+	return IntersectRay(ray, tMin, tMax) && tMin <= maxDistance;
+}
+
 bool AABB::Contains(const Vector3& point) const
 {
 	return point[0] >= minTransformed[0] && point[1] >= minTransformed[1] && point[2] >= minTransformed[2] &&
@@ -30,6 +30,7 @@ namespace AwesomeRenderer
 
 		bool IntersectRay(const Ray& ray, float& tMin, float& tMax) const;
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 		bool Contains(const Vector3& point) const;
 		
 		int SideOfPlane(const Plane& plane) const;
@@ -0,0 +1,7 @@
+#include "awesomerenderer.h"
+
+#include "accelerationstructure.h"
+
+using namespace AwesomeRenderer;
+
+const char* AwesomeRenderer::ACCELERATION_STRUCTURE_NAMES[ACCELERATION_STRUCTURE_COUNT] = { "kdtree", "bvh", "bvh4" };
\ No newline at end of file
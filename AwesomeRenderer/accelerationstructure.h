@@ -0,0 +1,19 @@
+#ifndef _ACCELERATION_STRUCTURE_H_
+#define _ACCELERATION_STRUCTURE_H_
+
+namespace AwesomeRenderer
+{
+	// Acceleration structures that meshes and render contexts can be built with
+	enum AccelerationStructure
+	{
+		ACCELERATION_KDTREE,
+		ACCELERATION_BVH,		// Bounding volume hierarchy with two children per node
+		ACCELERATION_BVH4,		// The same hierarchy collapsed to four children per node, which are tested at once with SSE
+
+		ACCELERATION_STRUCTURE_COUNT
+	};
+
+	extern const char* ACCELERATION_STRUCTURE_NAMES[ACCELERATION_STRUCTURE_COUNT];
+}
+
+#endif
\ No newline at end of file
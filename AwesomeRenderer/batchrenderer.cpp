@@ -0,0 +1,384 @@
+#include "batchrenderer.h"
+
+#include "buffer.h"
+#include "memorybufferallocator.h"
+
+#include "scheduler.h"
+#include "timer.h"
+#include "camera.h"
+
+#include "texture.h"
+#include "lightdata.h"
+#include "rendertarget.h"
+#include "rendercontext.h"
+#include "raytracer.h"
+#include "statistics.h"
+
+#include "texturefactory.h"
+#include "texturecache.h"
+#include "objloader.h"
+
+#include "context.h"
+#include "setup.h"
+
+using namespace AwesomeRenderer;
+using namespace AwesomeRenderer::RayTracing;
+
+const uint32_t BatchRenderer::DEFAULT_SAMPLES = 64;
+
+BatchRenderer::Settings::Settings() : 
+	scene("sponza"), integrator("montecarlo"), outputPath("../Renders/batch"), tileOrder("hilbert"), mipmaps("eager"), structure("kdtree"),
+	width(960), height(640), maxDepth(5), tileSize(16), textureCacheSize(0), meshCache(true), perfectSplits(false), samples(0), samplesPerFrame(4), timeBudget(0.0f), adaptiveThreshold(0.0f), seed(0)
+{
+
+}
+
+BatchRenderer::BatchRenderer(const Settings& settings) : settings(settings)
+{
+
+}
+
+int BatchRenderer::Main(int argc, char** argv)
+{
+	Settings settings;
+
+	if (!ParseArguments(argc, argv, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	BatchRenderer batchRenderer(settings);
+	return batchRenderer.Run();
+}
+
+bool BatchRenderer::ParseArguments(int argc, char** argv, Settings& settings)
+{
+	for (int argIdx = 0; argIdx < argc; ++argIdx)
+	{
+		const char* option = argv[argIdx];
+
+		// All options take a value
+		if (argIdx + 1 >= argc)
+		{
+			printf("[BatchRenderer]: Missing value for option \"%s\"\n", option);
+			return false;
+		}
+
+		const char* value = argv[++argIdx];
+
+		if (strcmp(option, "--scene") == 0)
+			settings.scene = value;
+		else if (strcmp(option, "--integrator") == 0)
+			settings.integrator = value;
+		else if (strcmp(option, "--output") == 0)
+			settings.outputPath = value;
+		else if (strcmp(option, "--width") == 0)
+			settings.width = atoi(value);
+		else if (strcmp(option, "--height") == 0)
+			settings.height = atoi(value);
+		else if (strcmp(option, "--depth") == 0)
+			settings.maxDepth = atoi(value);
+		else if (strcmp(option, "--samples") == 0)
+			settings.samples = atoi(value);
+		else if (strcmp(option, "--spf") == 0)
+			settings.samplesPerFrame = atoi(value);
+		else if (strcmp(option, "--time") == 0)
+			settings.timeBudget = (float) atof(value);
+		else if (strcmp(option, "--adaptive") == 0)
+			settings.adaptiveThreshold = (float) atof(value);
+		else if (strcmp(option, "--seed") == 0)
+			settings.seed = strtoull(value, NULL, 10);
+		else if (strcmp(option, "--tile-size") == 0)
+			settings.tileSize = atoi(value);
+		else if (strcmp(option, "--tile-order") == 0)
+			settings.tileOrder = value;
+		else if (strcmp(option, "--mipmaps") == 0)
+			settings.mipmaps = value;
+		else if (strcmp(option, "--texture-cache") == 0)
+			settings.textureCacheSize = atoi(value);
+		else if (strcmp(option, "--mesh-cache") == 0)
+			settings.meshCache = strcmp(value, "off") != 0;
+		else if (strcmp(option, "--tree-cache") == 0)
+			settings.treeCache = value;
+		else if (strcmp(option, "--structure") == 0)
+			settings.structure = value;
+		else if (strcmp(option, "--perfect-splits") == 0)
+			settings.perfectSplits = strcmp(value, "on") == 0;
+		else if (strcmp(option, "--stats") == 0)
+			settings.statisticsFile = value;
+		else
+		{
+			printf("[BatchRenderer]: Unknown option \"%s\"\n", option);
+			return false;
+		}
+	}
+
+	if (settings.width == 0 || settings.height == 0 || settings.samplesPerFrame == 0 || settings.tileSize == 0)
+	{
+		printf("[BatchRenderer]: Resolution, samples per frame and tile size should be larger than zero\n");
+		return false;
+	}
+
+	// Without a sample count or time budget the render would never finish
+	if (settings.samples == 0 && settings.timeBudget <= 0.0f)
+		settings.samples = DEFAULT_SAMPLES;
+
+	return true;
+}
+
+void BatchRenderer::PrintUsage()
+{
+	printf(
+		"Usage: AwesomeRenderer --batch [options]\n"
+		"  --scene <name>        cornell, spheres, sponza or fractal (default: sponza)\n"
+		"  --integrator <name>   debug, whitted, montecarlo or wavefront (default: montecarlo)\n"
+		"  --output <path>       Output path without extension, writes <path>.png and <path>.raw (default: ../Renders/batch)\n"
+		"  --width <pixels>      Image width (default: 960)\n"
+		"  --height <pixels>     Image height (default: 640)\n"
+		"  --depth <bounces>     Maximum path depth (default: 5)\n"
+		"  --samples <count>     Samples per pixel (default: %u when no time budget is given)\n"
+		"  --spf <count>         Samples per pixel rendered per frame (default: 4)\n"
+		"  --time <seconds>      Time budget, no frames are started that would exceed it\n"
+		"  --adaptive <error>    Relative error at which pixels stop receiving samples (default: 0, disabled)\n"
+		"  --seed <seed>         Base seed for the random streams (default: 0)\n"
+		"  --tile-size <pixels>  Width and height of the tiles rendered by a single job (default: 16)\n"
+		"  --tile-order <name>   random, scanline, morton, hilbert or spiral (default: hilbert)\n"
+		"  --mipmaps <mode>      eager builds all mip levels while loading, lazy when they are first sampled (default: eager)\n"
+		"  --texture-cache <MB>  Stream textures through a cache with this memory budget (default: 0, disabled)\n"
+		"  --mesh-cache <on|off> Load models from binary mesh cache files, written next to the source files (default: on)\n"
+		"  --tree-cache <dir>    Load optimized mesh trees from this directory, and save the trees that had to be built\n"
+		"  --structure <name>    Acceleration structure of the meshes and the scene: kdtree, bvh or bvh4 (default: kdtree)\n"
+		"  --perfect-splits <on|off> Clip triangles to the nodes while building mesh trees, slower to build but faster to trace (default: off)\n"
+		"  --stats <file>        Append render statistics of every frame, as JSON if the file ends in .json and CSV otherwise\n"
+		"The .raw file contains the linear frame buffer as 32-bit float RGBA, starting with the bottom row.\n",
+		DEFAULT_SAMPLES);
+}
+
+int BatchRenderer::Run()
+{
+	Timer timer(0.0f, FLT_MAX);
+	timer.Tick();
+
+	// Job scheduler
+	uint32_t cores = std::thread::hardware_concurrency();
+	if (!cores)
+		cores = 4;
+
+	Scheduler scheduler(cores);
+	scheduler.Start();
+
+	// Frame buffer in linear HDR, so that it can be exported without loss
+	Texture depthBuffer(new MemoryBufferAllocator(), Buffer::LINEAR);
+	depthBuffer.Allocate(settings.width, settings.height, Buffer::FLOAT32);
+
+	Texture frameBuffer(new MemoryBufferAllocator(), Buffer::LINEAR);
+	frameBuffer.Allocate(settings.width, settings.height, Buffer::FLOAT128);
+
+	RenderTarget renderTarget;
+	renderTarget.SetupBuffers(&frameBuffer, &depthBuffer);
+
+	Camera camera(cml::left_handed);
+	camera.SetPerspective(45.0f, ((float) settings.width) / settings.height, 0.1f, 5000.0f);
+	camera.SetViewport(0.0f, 0.0f, (float) settings.width, (float) settings.height);
+
+	RenderContext renderContext;
+	renderContext.camera = &camera;
+	renderContext.renderTarget = &renderTarget;
+
+	LightData lightData;
+	renderContext.lightData = &lightData;
+
+	TextureCache textureCache((uint64_t) settings.textureCacheSize << 20);
+
+	TextureFactory textureFactory;
+	textureFactory.scheduler = &scheduler;
+	textureFactory.mipmapMode = settings.mipmaps == "lazy" ? TextureFactory::MIPMAPS_LAZY : TextureFactory::MIPMAPS_EAGER;
+
+	if (settings.textureCacheSize > 0)
+		textureFactory.textureCache = &textureCache;
+
+	ObjLoader objLoader(textureFactory);
+	objLoader.scheduler = &scheduler;
+	objLoader.useMeshCache = settings.meshCache;
+
+	RayTracer rayTracer(scheduler);
+	rayTracer.Initialize();
+
+	// Select the integrator
+	SurfaceIntegrator* integrators[] = { &rayTracer.debugIntegrator, &rayTracer.whittedIntegrator, &rayTracer.monteCarloIntegrator, &rayTracer.wavefrontIntegrator };
+	const char* integratorNames[] = { "debug", "whitted", "montecarlo", "wavefront" };
+
+	rayTracer.currentIntegrator = NULL;
+
+	for (uint32_t integratorIdx = 0; integratorIdx < 4; ++integratorIdx)
+	{
+		if (settings.integrator == integratorNames[integratorIdx])
+			rayTracer.currentIntegrator = integrators[integratorIdx];
+	}
+
+	if (rayTracer.currentIntegrator == NULL)
+	{
+		printf("[BatchRenderer]: Unknown integrator \"%s\"\n", settings.integrator.c_str());
+		scheduler.Stop();
+
+		return 1;
+	}
+
+	// Select the tile layout
+	uint32_t tileOrder = RayTracer::TILE_ORDER_COUNT;
+
+	for (uint32_t orderIdx = 0; orderIdx < RayTracer::TILE_ORDER_COUNT; ++orderIdx)
+	{
+		if (settings.tileOrder == RayTracer::TILE_ORDER_NAMES[orderIdx])
+			tileOrder = orderIdx;
+	}
+
+	if (tileOrder == RayTracer::TILE_ORDER_COUNT)
+	{
+		printf("[BatchRenderer]: Unknown tile order \"%s\"\n", settings.tileOrder.c_str());
+		scheduler.Stop();
+
+		return 1;
+	}
+
+	rayTracer.SetTileLayout(settings.tileSize, (RayTracer::TileOrder) tileOrder);
+
+	// Select the acceleration structure
+	uint32_t structure = ACCELERATION_STRUCTURE_COUNT;
+
+	for (uint32_t structureIdx = 0; structureIdx < ACCELERATION_STRUCTURE_COUNT; ++structureIdx)
+	{
+		if (settings.structure == ACCELERATION_STRUCTURE_NAMES[structureIdx])
+			structure = structureIdx;
+	}
+
+	if (structure == ACCELERATION_STRUCTURE_COUNT)
+	{
+		printf("[BatchRenderer]: Unknown acceleration structure \"%s\"\n", settings.structure.c_str());
+		scheduler.Stop();
+
+		return 1;
+	}
+
+	renderContext.accelerationStructure = (AccelerationStructure) structure;
+
+	// Setup the scene the same way the interactive renderer does
+	Context context;
+	context.window = NULL;
+
+	context.mainCamera = &camera;
+	context.mainContext = &renderContext;
+
+	context.hudCamera = NULL;
+	context.hudContext = NULL;
+
+	context.objLoader = &objLoader;
+	context.textureFactory = &textureFactory;
+
+	context.scheduler = &scheduler;
+	context.treeCacheDirectory = settings.treeCache.empty() ? NULL : settings.treeCache.c_str();
+	context.perfectSplits = settings.perfectSplits;
+	context.accelerationStructure = (AccelerationStructure) structure;
+
+	// The ray tracer needs the extended mesh data for its triangle trees
+	Setup setup(context, true);
+	setup.SetupLighting();
+	setup.SetupScene();
+
+	if (settings.scene == "cornell")
+		setup.SetupCornellBox();
+	else if (settings.scene == "spheres")
+		setup.SetupSpheres();
+	else if (settings.scene == "sponza")
+		setup.SetupSponza();
+	else if (settings.scene == "fractal")
+		setup.SetupFractal();
+	else
+	{
+		printf("[BatchRenderer]: Unknown scene \"%s\"\n", settings.scene.c_str());
+		scheduler.Stop();
+
+		return 1;
+	}
+
+	camera.UpdateViewMtx();
+
+	printf("[BatchRenderer]: Building scene tree...\n");
+	renderContext.Optimize(&scheduler);
+
+	printf("[BatchRenderer]: Scene loaded in %.0fms\n", timer.Poll() * 1000.0f);
+
+	rayTracer.SetRenderContext(&renderContext);
+	rayTracer.maxDepth = settings.maxDepth;
+	rayTracer.adaptiveThreshold = settings.adaptiveThreshold;
+	rayTracer.seed = settings.seed;
+	rayTracer.statisticsFile = settings.statisticsFile;
+
+#if !AR_STATISTICS
+	if (!settings.statisticsFile.empty())
+		printf("[BatchRenderer]: Warning! Statistics are disabled in this build, define AR_STATISTICS to enable them\n");
+#endif
+
+	renderTarget.Clear(Color::BLACK, RenderTarget::BUFFER_ALL);
+
+	// Render frames until the sample count is reached, the time budget runs out, or all pixels have converged
+	timer.Tick();
+
+	uint32_t frames = 0;
+
+	while (true)
+	{
+		uint32_t samplesLeft = settings.samples > 0 ? settings.samples - rayTracer.renderedSamples : settings.samplesPerFrame;
+		rayTracer.samplesPerPixel = std::min(settings.samplesPerFrame, samplesLeft);
+
+		// Without a window there is nothing to update between polls, so every frame is waited on
+		rayTracer.RenderFrame();
+
+		++frames;
+
+		float renderTime = timer.Poll();
+		float frameTime = renderTime / frames;
+
+		if (settings.samples > 0 && rayTracer.renderedSamples >= settings.samples)
+			break;
+
+		if (settings.timeBudget > 0.0f && renderTime + frameTime > settings.timeBudget)
+			break;
+
+		if (settings.adaptiveThreshold > 0.0f && rayTracer.GetProgress(RayTracer::PROGRESS_CONVERGENCE) >= 1.0f)
+			break;
+	}
+
+	printf("[BatchRenderer]: Rendered %u samples per pixel in %.1fs\n", rayTracer.renderedSamples, timer.Poll());
+
+	if (settings.textureCacheSize > 0)
+	{
+		TextureCache::Statistics cacheStatistics;
+		textureCache.GetStatistics(cacheStatistics);
+
+		uint64_t lookups = cacheStatistics.hits + cacheStatistics.misses;
+
+		printf("[BatchRenderer]: Texture cache hit rate %.2f%% (%llu hits, %llu misses, %llu evictions), %u tiles resident using %.1fMB\n",
+			lookups > 0 ? 100.0 * cacheStatistics.hits / lookups : 0.0, cacheStatistics.hits, cacheStatistics.misses, cacheStatistics.evictions,
+			cacheStatistics.residentTiles, cacheStatistics.residentBytes / (1024.0 * 1024.0));
+	}
+
+	rayTracer.Cleanup();
+
+	// Export the image, tonemapped and gamma corrected as PNG, and the linear frame buffer as raw floats
+	std::string imageFileName = settings.outputPath + ".png";
+	std::string rawFileName = settings.outputPath + ".raw";
+
+	bool success = textureFactory.WritePNG(imageFileName, frameBuffer) && textureFactory.WriteRAW(rawFileName, frameBuffer);
+
+	if (success)
+		printf("[BatchRenderer]: Written \"%s\" and \"%s\"\n", imageFileName.c_str(), rawFileName.c_str());
+
+	frameBuffer.Destroy();
+	depthBuffer.Destroy();
+
+	scheduler.Stop();
+
+	return success ? 0 : 1;
+}
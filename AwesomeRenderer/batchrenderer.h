@@ -0,0 +1,80 @@
+#ifndef _BATCH_RENDERER_H_
+#define _BATCH_RENDERER_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+
+	// Renders a scene with the ray tracer without opening a window, and writes the result to disk.
+	// Used for offline renders, started with "--batch" followed by the options listed by PrintUsage.
+	// The batch mode is part of the Windows executable. It doesn't create a window or an OpenGL context, but the executable still
+	// links them, and the renderer uses the Win32 file, mapping and timing functions. There is no build target for other platforms.
+	class BatchRenderer
+	{
+
+	public:
+		struct Settings
+		{
+			std::string scene;
+			std::string integrator;
+			std::string outputPath;
+			std::string tileOrder;
+			std::string mipmaps;
+
+			// Acceleration structure of the meshes and the scene
+			std::string structure;
+
+			// Optimized mesh trees are cached in this directory if set
+			std::string treeCache;
+
+			// Per frame render statistics are appended to this file if set, see Statistics::Export
+			std::string statisticsFile;
+
+			uint32_t width, height;
+			uint32_t maxDepth;
+			uint32_t tileSize;
+
+			// Memory budget of the texture cache in megabytes, zero keeps all textures in memory
+			uint32_t textureCacheSize;
+
+			// Whether models are loaded from and stored in mesh cache files
+			bool meshCache;
+
+			// Whether mesh trees are built with perfect splits
+			bool perfectSplits;
+
+			// Total samples per pixel, and the samples rendered per frame. Zero samples renders until the time budget runs out
+			uint32_t samples;
+			uint32_t samplesPerFrame;
+
+			// Time budget in seconds, zero means no budget. A frame is only started if it is expected to finish in time
+			float timeBudget;
+
+			float adaptiveThreshold;
+			uint64_t seed;
+
+			Settings();
+		};
+
+	private:
+		static const uint32_t DEFAULT_SAMPLES;
+
+		Settings settings;
+
+	public:
+		BatchRenderer(const Settings& settings);
+
+		// Renders the scene, returns the process exit code
+		int Run();
+
+		// Parses the command line options and renders. Returns the process exit code
+		static int Main(int argc, char** argv);
+
+		static bool ParseArguments(int argc, char** argv, Settings& settings);
+		static void PrintUsage();
+	};
+
+}
+
+#endif
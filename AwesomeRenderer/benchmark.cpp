@@ -0,0 +1,590 @@
+#include "benchmark.h"
+
+#include "buffer.h"
+#include "memorybufferallocator.h"
+
+#include "scheduler.h"
+#include "timer.h"
+#include "camera.h"
+#include "ray.h"
+#include "raycasthit.h"
+#include "aabb.h"
+
+#include "node.h"
+#include "transformation.h"
+#include "renderable.h"
+#include "mesh.h"
+#include "model.h"
+#include "meshex.h"
+#include "meshtriangle.h"
+#include "modelex.h"
+
+#include "texture.h"
+#include "lightdata.h"
+#include "sixsidedskybox.h"
+#include "rendertarget.h"
+#include "rendercontext.h"
+#include "raytracer.h"
+
+#include "texturefactory.h"
+#include "objloader.h"
+
+using namespace AwesomeRenderer;
+using namespace AwesomeRenderer::RayTracing;
+
+const Benchmark::SceneDescription Benchmark::SCENES[] =
+{
+	{ "bunny_lowpoly",	"bunny_lowpoly.obj",		1.0f, 1.5f },
+	{ "bunny",			"bunny.obj",				1.0f, 1.5f },
+	{ "sponza",			"CrytekSponza/sponza.obj",	0.1f, 0.6f },
+};
+
+const uint64_t Benchmark::SEED = 1337;
+
+const uint32_t Benchmark::TILE_SIZES[] = { 8, 16, 32, 64 };
+
+Benchmark::Settings::Settings() :
+	assetRoot("../Assets"), scene(), width(320), height(240), views(8), randomRays(1 << 20), samplesPerPixel(4), frames(2), maxDepth(5), compareTiles(false), perfectSplits(false), structure()
+{
+
+}
+
+Benchmark::Benchmark(const Settings& settings) : settings(settings)
+{
+
+}
+
+int Benchmark::Main(int argc, char** argv)
+{
+	Settings settings;
+
+	if (!ParseArguments(argc, argv, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	Benchmark benchmark(settings);
+	return benchmark.Run();
+}
+
+bool Benchmark::ParseArguments(int argc, char** argv, Settings& settings)
+{
+	for (int argIdx = 0; argIdx < argc; ++argIdx)
+	{
+		const char* option = argv[argIdx];
+
+		// All options take a value
+		if (argIdx + 1 >= argc)
+		{
+			printf("[Benchmark]: Missing value for option \"%s\"\n", option);
+			return false;
+		}
+
+		const char* value = argv[++argIdx];
+
+		if (strcmp(option, "--assets") == 0)
+			settings.assetRoot = value;
+		else if (strcmp(option, "--scene") == 0)
+			settings.scene = value;
+		else if (strcmp(option, "--width") == 0)
+			settings.width = atoi(value);
+		else if (strcmp(option, "--height") == 0)
+			settings.height = atoi(value);
+		else if (strcmp(option, "--views") == 0)
+			settings.views = atoi(value);
+		else if (strcmp(option, "--rays") == 0)
+			settings.randomRays = atoi(value);
+		else if (strcmp(option, "--spp") == 0)
+			settings.samplesPerPixel = atoi(value);
+		else if (strcmp(option, "--frames") == 0)
+			settings.frames = atoi(value);
+		else if (strcmp(option, "--depth") == 0)
+			settings.maxDepth = atoi(value);
+		else if (strcmp(option, "--tiles") == 0)
+			settings.compareTiles = atoi(value) != 0;
+		else if (strcmp(option, "--perfect-splits") == 0)
+			settings.perfectSplits = atoi(value) != 0;
+		else if (strcmp(option, "--structure") == 0)
+			settings.structure = value;
+		else
+		{
+			printf("[Benchmark]: Unknown option \"%s\"\n", option);
+			return false;
+		}
+	}
+
+	if (settings.width == 0 || settings.height == 0 || settings.views == 0)
+	{
+		printf("[Benchmark]: Resolution and view count should be larger than zero\n");
+		return false;
+	}
+
+	if (!settings.structure.empty())
+	{
+		bool found = false;
+
+		for (uint32_t structure = 0; structure < ACCELERATION_STRUCTURE_COUNT; ++structure)
+			found |= settings.structure == ACCELERATION_STRUCTURE_NAMES[structure];
+
+		if (!found)
+		{
+			printf("[Benchmark]: Unknown acceleration structure \"%s\"\n", settings.structure.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Benchmark::PrintUsage()
+{
+	printf(
+		"Usage: AwesomeRenderer --benchmark [options]\n"
+		"  --assets <path>       Asset directory (default: ../Assets)\n"
+		"  --scene <name>        Only run bunny_lowpoly, bunny or sponza (default: all scenes)\n"
+		"  --width <pixels>      Width of the primary ray views and frames (default: 320)\n"
+		"  --height <pixels>     Height of the primary ray views and frames (default: 240)\n"
+		"  --views <count>       Camera positions on the path around the scene (default: 8)\n"
+		"  --rays <count>        Random rays traced through the scene (default: 1048576)\n"
+		"  --spp <count>         Samples per pixel per Monte Carlo frame (default: 4)\n"
+		"  --frames <count>      Monte Carlo frames to render, zero skips the integrator (default: 2)\n"
+		"  --depth <bounces>     Maximum path depth of the Monte Carlo integrator (default: 5)\n"
+		"  --tiles <0|1>         Compare the Monte Carlo frames with all tile orders and sizes (default: 0)\n"
+		"  --perfect-splits <0|1> Build the mesh trees with triangles clipped to the nodes (default: 0)\n"
+		"  --structure <name>    Only use kdtree, bvh or bvh4 (default: compare all structures)\n");
+}
+
+int Benchmark::Run()
+{
+	std::vector<Result> results;
+
+	for (uint32_t sceneIdx = 0; sceneIdx < SCENE_COUNT; ++sceneIdx)
+	{
+		const SceneDescription& scene = SCENES[sceneIdx];
+
+		if (!settings.scene.empty() && settings.scene != scene.name)
+			continue;
+
+		// The scene is loaded and built again for every structure, so that the build times are measured the same way
+		for (uint32_t structure = 0; structure < ACCELERATION_STRUCTURE_COUNT; ++structure)
+		{
+			if (!settings.structure.empty() && settings.structure != ACCELERATION_STRUCTURE_NAMES[structure])
+				continue;
+
+			Result result;
+
+			if (RunScene(scene, (AccelerationStructure) structure, result))
+				results.push_back(result);
+		}
+	}
+
+	if (results.empty())
+	{
+		printf("[Benchmark]: No scenes were run\n");
+		return 1;
+	}
+
+	PrintResults(results);
+
+	if (!tileResults.empty())
+		PrintTileResults(tileResults);
+
+	return 0;
+}
+
+bool Benchmark::RunScene(const SceneDescription& scene, AccelerationStructure structure, Result& result)
+{
+	printf("[Benchmark]: Running scene \"%s\" with %s...\n", scene.name, ACCELERATION_STRUCTURE_NAMES[structure]);
+
+	result.scene = scene.name;
+	result.structure = structure;
+
+	Timer timer(0.0f, FLT_MAX);
+
+	// Every scene gets its own scheduler, so that the thread pools of different scenes don't add up
+	uint32_t cores = std::thread::hardware_concurrency();
+	if (!cores)
+		cores = 4;
+
+	Scheduler scheduler(cores);
+	scheduler.Start();
+
+	Texture depthBuffer(new MemoryBufferAllocator(), Buffer::LINEAR);
+	depthBuffer.Allocate(settings.width, settings.height, Buffer::FLOAT32);
+
+	Texture frameBuffer(new MemoryBufferAllocator(), Buffer::LINEAR);
+	frameBuffer.Allocate(settings.width, settings.height, Buffer::FLOAT128);
+
+	RenderTarget renderTarget;
+	renderTarget.SetupBuffers(&frameBuffer, &depthBuffer);
+
+	Camera camera(cml::left_handed);
+	camera.SetPerspective(45.0f, ((float) settings.width) / settings.height, 0.1f, 5000.0f);
+	camera.SetViewport(0.0f, 0.0f, (float) settings.width, (float) settings.height);
+	camera.apertureSize = 0.0f;
+
+	LightData lightData;
+	lightData.numPixelLights = 8;
+	lightData.ambient = Color::BLACK;
+	lightData.shadowDistance = 1e4f;
+
+	LightData::Light& light = lightData.lights[0];
+	light.type = LightData::DIRECTIONAL;
+	light.direction = VectorUtil<3>::Normalize(Vector3(0.3f, -1.0f, -0.3f));
+	light.color = Color::WHITE;
+	light.intensity = 2.0f;
+	light.enabled = true;
+
+	RenderContext renderContext;
+	renderContext.accelerationStructure = structure;
+	renderContext.camera = &camera;
+	renderContext.renderTarget = &renderTarget;
+	renderContext.lightData = &lightData;
+
+	TextureFactory textureFactory;
+	textureFactory.scheduler = &scheduler;
+
+	ObjLoader objLoader(textureFactory);
+	objLoader.scheduler = &scheduler;
+
+	std::string skyboxRoot = settings.assetRoot + "/Skyboxes/sun25deg/";
+
+	SixSidedSkybox skybox;
+	skybox.right = textureFactory.GetTexture(skyboxRoot + "skyrender0001.png");
+	skybox.front = textureFactory.GetTexture(skyboxRoot + "skyrender0002.png");
+	skybox.top = textureFactory.GetTexture(skyboxRoot + "skyrender0003.png");
+	skybox.left = textureFactory.GetTexture(skyboxRoot + "skyrender0004.png");
+	skybox.back = textureFactory.GetTexture(skyboxRoot + "skyrender0005.png");
+	skybox.bottom = textureFactory.GetTexture(skyboxRoot + "skyrender0006.png");
+
+	renderContext.skybox = &skybox;
+
+	// Load the model
+	std::string fileName = settings.assetRoot + "/" + scene.fileName;
+
+	Model model;
+
+	Transformation transform;
+	transform.SetScale(Vector3(scene.scale, scene.scale, scene.scale));
+
+	timer.Tick();
+	objLoader.Load(fileName.c_str(), model);
+	result.loadTime = timer.Poll();
+
+	if (model.meshes.empty())
+	{
+		printf("[Benchmark]: Skipping scene \"%s\", no meshes loaded from \"%s\"\n", scene.name, fileName.c_str());
+		scheduler.Stop();
+
+		return false;
+	}
+
+	// Build the mesh trees and the scene tree
+	timer.Tick();
+
+	ModelEx* modelEx = new ModelEx(model, &scheduler, NULL, settings.perfectSplits, structure);
+
+	std::vector<Node*> nodes;
+	std::vector<Renderable*> renderables;
+
+	for (uint32_t meshIdx = 0; meshIdx < modelEx->meshes.size(); ++meshIdx)
+	{
+		Renderable* renderable = new Renderable();
+		renderable->shape = modelEx->meshes[meshIdx];
+		renderable->material = model.materials[meshIdx];
+
+		Node* node = new Node();
+		node->AddComponent(&transform);
+		node->AddComponent(renderable);
+
+		renderables.push_back(renderable);
+		nodes.push_back(node);
+	}
+
+	renderContext.nodes = nodes;
+	renderContext.Optimize(&scheduler);
+
+	result.buildTime = timer.Poll();
+
+	result.triangles = 0;
+	result.treeMemory = renderContext.GetTreeMemoryUsage();
+
+	for (auto it = modelEx->meshes.begin(); it != modelEx->meshes.end(); ++it)
+	{
+		result.triangles += (*it)->triangles.size();
+		result.treeMemory += (*it)->GetTreeMemoryUsage();
+	}
+
+	// Ray throughput of the acceleration structures
+	TraceRays(renderContext, camera, scene, result);
+	TraceRandomRays(renderContext, result);
+
+	// Full frames with the Monte Carlo integrator
+	result.samples = 0.0f;
+
+	if (settings.frames > 0)
+	{
+		RayTracer rayTracer(scheduler);
+		rayTracer.Initialize();
+
+		SetView(camera, renderContext.GetBounds(), scene, 0);
+
+		rayTracer.SetRenderContext(&renderContext);
+		rayTracer.currentIntegrator = &rayTracer.monteCarloIntegrator;
+		rayTracer.samplesPerPixel = settings.samplesPerPixel;
+		rayTracer.maxDepth = settings.maxDepth;
+		rayTracer.seed = SEED;
+
+		result.samples = RenderFrames(rayTracer);
+
+		// The same ray tracer is used for all layouts, every ray tracer starts its own worker threads
+		if (settings.compareTiles)
+		{
+			for (uint32_t tileOrder = 0; tileOrder < RayTracer::TILE_ORDER_COUNT; ++tileOrder)
+			{
+				for (uint32_t sizeIdx = 0; sizeIdx < TILE_SIZE_COUNT; ++sizeIdx)
+				{
+					printf("[Benchmark]: Rendering with %s tile order and %ux%u tiles...\n", RayTracer::TILE_ORDER_NAMES[tileOrder], TILE_SIZES[sizeIdx], TILE_SIZES[sizeIdx]);
+
+					rayTracer.SetTileLayout(TILE_SIZES[sizeIdx], (RayTracer::TileOrder) tileOrder);
+
+					TileResult tileResult;
+					tileResult.scene = scene.name;
+					tileResult.structure = structure;
+					tileResult.tileSize = TILE_SIZES[sizeIdx];
+					tileResult.tileOrder = tileOrder;
+					tileResult.samples = RenderFrames(rayTracer);
+
+					tileResults.push_back(tileResult);
+				}
+			}
+		}
+
+		rayTracer.Cleanup();
+	}
+
+	// Release the scene
+	for (uint32_t nodeIdx = 0; nodeIdx < nodes.size(); ++nodeIdx)
+	{
+		delete nodes[nodeIdx];
+		delete renderables[nodeIdx];
+	}
+
+	delete modelEx;
+
+	for (auto it = model.meshes.begin(); it != model.meshes.end(); ++it)
+		delete *it;
+
+	frameBuffer.Destroy();
+	depthBuffer.Destroy();
+
+	scheduler.Stop();
+
+	return true;
+}
+
+float Benchmark::RenderFrames(RayTracer& rayTracer)
+{
+	// Start from an empty frame, so that every layout renders the same samples
+	rayTracer.ResetFrame(false);
+
+	Timer timer(0.0f, FLT_MAX);
+	timer.Tick();
+
+	// Frames are waited on instead of polled, so the time doesn't include the sleeps of RayTracer::Render
+	for (uint32_t frame = 0; frame < settings.frames; ++frame)
+		rayTracer.RenderFrame();
+
+	float renderTime = timer.Poll();
+
+	return (settings.width * settings.height * (float) rayTracer.renderedSamples) / renderTime;
+}
+
+void Benchmark::SetView(Camera& camera, const AABB& bounds, const SceneDescription& scene, uint32_t view) const
+{
+	// Views are spread evenly over an ellipse around the center of the scene, at the height of the center
+	Vector3 center = (bounds.Min() + bounds.Max()) * 0.5f;
+	Vector3 extents = (bounds.Max() - bounds.Min()) * 0.5f;
+
+	float angle = (TWO_PI * view) / settings.views;
+
+	Vector3 position = center;
+	position[0] += cos(angle) * extents[0] * scene.cameraDistance;
+	position[2] += sin(angle) * extents[2] * scene.cameraDistance;
+
+	camera.SetLookAt(position, center, Vector3(0.0f, 1.0f, 0.0f));
+	camera.UpdateViewMtx();
+}
+
+void Benchmark::TraceRays(const RenderContext& renderContext, Camera& camera, const SceneDescription& scene, Result& result)
+{
+	const AABB& bounds = renderContext.GetBounds();
+	const Vector3 toLight = -renderContext.lightData->lights[0].direction;
+	const float epsilon = (bounds.Max() - bounds.Min()).length() * 1e-5f;
+
+	uint32_t pixelCount = settings.width * settings.height;
+
+	std::vector<Ray> rays(pixelCount);
+	std::vector<RaycastHit> hits(pixelCount);
+	std::vector<Ray> shadowRays;
+	shadowRays.reserve(pixelCount);
+
+	Timer timer(0.0f, FLT_MAX);
+	float primaryTime = 0.0f, shadowTime = 0.0f;
+	uint32_t primaryHits = 0, shadowRayCount = 0, shadowHits = 0;
+
+	for (uint32_t view = 0; view < settings.views; ++view)
+	{
+		SetView(camera, bounds, scene, view);
+
+		// Generate the rays up front, so that only the traversal is timed
+		for (uint32_t y = 0; y < settings.height; ++y)
+		{
+			for (uint32_t x = 0; x < settings.width; ++x)
+				camera.ViewportToRay(Vector2(x + 0.5f, y + 0.5f), rays[y * settings.width + x]);
+		}
+
+		timer.Tick();
+
+		for (uint32_t rayIdx = 0; rayIdx < pixelCount; ++rayIdx)
+		{
+			hits[rayIdx] = RaycastHit();
+
+			if (renderContext.IntersectRay(rays[rayIdx], hits[rayIdx]))
+				++primaryHits;
+		}
+
+		primaryTime += timer.Poll();
+
+		// Shadow rays towards the directional light from every primary hit
+		shadowRays.clear();
+
+		for (uint32_t rayIdx = 0; rayIdx < pixelCount; ++rayIdx)
+		{
+			const RaycastHit& hit = hits[rayIdx];
+
+			if (hit.element == NULL)
+				continue;
+
+			Vector3 normal = hit.normal;
+			if (cml::dot(normal, rays[rayIdx].direction) > 0.0f)
+				normal = -normal;
+
+			shadowRays.push_back(Ray(hit.point + normal * epsilon, toLight));
+		}
+
+		timer.Tick();
+
+		for (auto it = shadowRays.begin(); it != shadowRays.end(); ++it)
+		{
+			if (renderContext.Occluded(*it, FLT_MAX))
+				++shadowHits;
+		}
+
+		shadowTime += timer.Poll();
+		shadowRayCount += shadowRays.size();
+	}
+
+	uint32_t primaryRayCount = pixelCount * settings.views;
+
+	result.primaryRays = primaryRayCount / primaryTime;
+	result.primaryHitRate = primaryHits / (float) primaryRayCount;
+
+	result.shadowRays = shadowRayCount > 0 ? shadowRayCount / shadowTime : 0.0f;
+	result.shadowHitRate = shadowRayCount > 0 ? shadowHits / (float) shadowRayCount : 0.0f;
+}
+
+void Benchmark::TraceRandomRays(const RenderContext& renderContext, Result& result)
+{
+	const AABB& bounds = renderContext.GetBounds();
+	Vector3 size = bounds.Max() - bounds.Min();
+
+	// Incoherent rays from random points in the scene bounds in uniformly distributed directions
+	Random random(SEED);
+
+	std::vector<Ray> rays(settings.randomRays);
+
+	for (auto it = rays.begin(); it != rays.end(); ++it)
+	{
+		Vector3 origin = bounds.Min() + Vector3(random.NextFloat() * size[0], random.NextFloat() * size[1], random.NextFloat() * size[2]);
+
+		float z = 1.0f - 2.0f * random.NextFloat();
+		float r = sqrt(std::max(0.0f, 1.0f - z * z));
+		float phi = TWO_PI * random.NextFloat();
+
+		*it = Ray(origin, Vector3(r * cos(phi), r * sin(phi), z));
+	}
+
+	Timer timer(0.0f, FLT_MAX);
+	timer.Tick();
+
+	uint32_t hits = 0;
+
+	for (auto it = rays.begin(); it != rays.end(); ++it)
+	{
+		RaycastHit hitInfo;
+
+		if (renderContext.IntersectRay(*it, hitInfo))
+			++hits;
+	}
+
+	float time = timer.Poll();
+
+	result.randomRays = rays.empty() ? 0.0f : rays.size() / time;
+	result.randomHitRate = rays.empty() ? 0.0f : hits / (float) rays.size();
+}
+
+void Benchmark::PrintResults(const std::vector<Result>& results)
+{
+	printf("\n[Benchmark]: Results (rays per second on a single thread, samples per second on all threads)\n");
+	printf("%-16s %-9s %10s %10s %10s %10s %14s %14s %14s %14s\n",
+		"Scene", "Structure", "Triangles", "Load (ms)", "Build (ms)", "Tree (MB)", "Primary (M/s)", "Shadow (M/s)", "Random (M/s)", "Samples (M/s)");
+
+	for (auto it = results.begin(); it != results.end(); ++it)
+	{
+		const Result& result = *it;
+
+		printf("%-16s %-9s %10u %10.0f %10.0f %10.2f %14.3f %14.3f %14.3f %14.3f\n",
+			result.scene.c_str(), ACCELERATION_STRUCTURE_NAMES[result.structure], result.triangles, result.loadTime * 1000.0f, result.buildTime * 1000.0f, result.treeMemory / (1024.0f * 1024.0f),
+			result.primaryRays * 1e-6f, result.shadowRays * 1e-6f, result.randomRays * 1e-6f, result.samples * 1e-6f);
+	}
+
+	printf("\n%-16s %-9s %14s %14s %14s\n", "Scene", "Structure", "Primary hits", "Shadow hits", "Random hits");
+
+	for (auto it = results.begin(); it != results.end(); ++it)
+	{
+		const Result& result = *it;
+
+		printf("%-16s %-9s %13.2f%% %13.2f%% %13.2f%%\n",
+			result.scene.c_str(), ACCELERATION_STRUCTURE_NAMES[result.structure], result.primaryHitRate * 100.0f, result.shadowHitRate * 100.0f, result.randomHitRate * 100.0f);
+	}
+}
+
+void Benchmark::PrintTileResults(const std::vector<TileResult>& results)
+{
+	printf("\n[Benchmark]: Monte Carlo samples per second (M/s) per tile order and tile size\n");
+	printf("%-16s %-9s %-10s", "Scene", "Structure", "Order");
+
+	for (uint32_t sizeIdx = 0; sizeIdx < TILE_SIZE_COUNT; ++sizeIdx)
+	{
+		char header[16];
+		snprintf(header, sizeof(header), "%ux%u", TILE_SIZES[sizeIdx], TILE_SIZES[sizeIdx]);
+
+		printf(" %10s", header);
+	}
+
+	printf("\n");
+
+	// Results are stored per scene, structure and order, with one entry per tile size
+	for (uint32_t resultIdx = 0; resultIdx + TILE_SIZE_COUNT <= results.size(); resultIdx += TILE_SIZE_COUNT)
+	{
+		const TileResult& first = results[resultIdx];
+		printf("%-16s %-9s %-10s", first.scene.c_str(), ACCELERATION_STRUCTURE_NAMES[first.structure], RayTracer::TILE_ORDER_NAMES[first.tileOrder]);
+
+		for (uint32_t sizeIdx = 0; sizeIdx < TILE_SIZE_COUNT; ++sizeIdx)
+			printf(" %10.3f", results[resultIdx + sizeIdx].samples * 1e-6f);
+
+		printf("\n");
+	}
+}
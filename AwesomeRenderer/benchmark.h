@@ -0,0 +1,142 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include "awesomerenderer.h"
+#include "accelerationstructure.h"
+
+namespace AwesomeRenderer
+{
+	class AABB;
+	class Camera;
+	class RenderContext;
+
+	namespace RayTracing
+	{
+		class RayTracer;
+	}
+
+	// Measures the acceleration structures and the path tracer on a fixed set of scenes, with fixed seeds and camera paths so that
+	// the numbers of different builds can be compared. Started with "--benchmark" followed by the options listed by PrintUsage.
+	class Benchmark
+	{
+
+	public:
+		struct Settings
+		{
+			std::string assetRoot;
+
+			// Only run the scene with this name, runs all scenes if empty
+			std::string scene;
+
+			uint32_t width, height;
+
+			// Number of camera positions on the path around the scene, primary and shadow rays are traced for each of them
+			uint32_t views;
+			uint32_t randomRays;
+
+			uint32_t samplesPerPixel;
+			uint32_t frames;
+			uint32_t maxDepth;
+
+			// Also renders the Monte Carlo frames with every tile order and tile size
+			bool compareTiles;
+
+			// Builds the mesh trees with perfect splits
+			bool perfectSplits;
+
+			// Only use the acceleration structure with this name, runs every scene with all structures if empty
+			std::string structure;
+
+			Settings();
+		};
+
+		struct Result
+		{
+			std::string scene;
+			AccelerationStructure structure;
+
+			uint32_t triangles;
+
+			float loadTime;
+			float buildTime;
+			size_t treeMemory;
+
+			// Rays per second on a single thread
+			float primaryRays;
+			float shadowRays;
+			float randomRays;
+
+			// Fraction of the rays that hit something, to check that different builds trace the same scene
+			float primaryHitRate;
+			float shadowHitRate;
+			float randomHitRate;
+
+			// Samples per second of the Monte Carlo integrator, using all threads
+			float samples;
+		};
+
+		// Samples per second of the Monte Carlo integrator with a specific tile layout
+		struct TileResult
+		{
+			std::string scene;
+			AccelerationStructure structure;
+
+			uint32_t tileSize;
+			uint32_t tileOrder;
+
+			float samples;
+		};
+
+	private:
+		struct SceneDescription
+		{
+			const char* name;
+			const char* fileName;
+
+			float scale;
+
+			// Radius of the camera path relative to the scene bounds, values below one keep the camera inside the scene
+			float cameraDistance;
+		};
+
+		static const uint32_t SCENE_COUNT = 3;
+		static const SceneDescription SCENES[SCENE_COUNT];
+		static const uint64_t SEED;
+
+		static const uint32_t TILE_SIZE_COUNT = 4;
+		static const uint32_t TILE_SIZES[TILE_SIZE_COUNT];
+
+		Settings settings;
+
+		std::vector<TileResult> tileResults;
+
+	public:
+		Benchmark(const Settings& settings);
+
+		// Runs all scenes and prints the results, returns the process exit code
+		int Run();
+
+		// Parses the command line options and runs the benchmark. Returns the process exit code
+		static int Main(int argc, char** argv);
+
+		static bool ParseArguments(int argc, char** argv, Settings& settings);
+		static void PrintUsage();
+
+	private:
+		bool RunScene(const SceneDescription& scene, AccelerationStructure structure, Result& result);
+
+		void TraceRays(const RenderContext& renderContext, Camera& camera, const SceneDescription& scene, Result& result);
+		void TraceRandomRays(const RenderContext& renderContext, Result& result);
+
+		// Renders the Monte Carlo frames and returns the number of samples per second
+		float RenderFrames(RayTracing::RayTracer& rayTracer);
+
+		void SetView(Camera& camera, const AABB& bounds, const SceneDescription& scene, uint32_t view) const;
+
+		static void PrintResults(const std::vector<Result>& results);
+		static void PrintTileResults(const std::vector<TileResult>& results);
+	};
+
+}
+
+#endif
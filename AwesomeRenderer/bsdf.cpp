@@ -10,6 +10,7 @@
 #include "rendercontext.h"
 #include "rendertarget.h"
 #include "raycasthit.h"
+#include "statistics.h"
 
 using namespace AwesomeRenderer;
 using namespace AwesomeRenderer::RayTracing;
@@ -26,6 +27,8 @@ BSDF::BSDF(BxDF* diffuse, BxDF* specular) : diffuse(diffuse), specular(specular)
 
 Vector3 BSDF::Sample(const Vector3& wo, const Vector3& wi, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, const RenderContext& renderContext, BxDFTypes typeMask) const
 {
+	AR_COUNT(BSDF_EVALUATIONS, 1);
+
 	Vector3 diffuseReflection(0.0f, 0.0f, 0.0f), specularReflection(0.0f, 0.0f, 0.0f);
 
 	if (diffuse != NULL && (typeMask & BXDF_DIFFUSE) != 0)
@@ -40,7 +43,7 @@ Vector3 BSDF::Sample(const Vector3& wo, const Vector3& wi, const Vector3& normal
 			Color F0 = microfacetMaterial->specular;
 
 			if (microfacetMaterial->specularMap != NULL)
-				F0 *= microfacetMaterial->specularMap->SampleMipMaps(hitInfo.uv, hitInfo.distance, hitInfo.surfaceAreaToTextureRatio, renderContext.renderTarget->frameBuffer->GetResolution());
+				F0 *= microfacetMaterial->specularMap->SampleMipMaps(hitInfo.uv, hitInfo.textureLod);
 
 			Vector3 h = VectorUtil<3>::Normalize(wo + wi);
 			Vector3 fresnel = Vector3(1.0f, 1.0f, 1.0f) - RenderUtil::FresnelSchlick(VectorUtil<3>::Dot(wo, h), F0.subvector(3));
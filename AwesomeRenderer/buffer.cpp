@@ -4,6 +4,8 @@
 #include "awesomerenderer.h"
 #include "buffer.h"
 #include "bufferallocator.h"
+#include "memorybufferallocator.h"
+#include "pixelconverter.h"
 
 #include "inputmanager.h"
 
@@ -13,7 +15,9 @@
 
 using namespace AwesomeRenderer;
 
-Buffer::Buffer(BufferAllocator* allocator, ColorSpace colorSpace) : allocator(allocator), colorSpace(colorSpace), data(NULL)
+const float Buffer::DEFAULT_GAMMA = 2.2f;
+
+Buffer::Buffer(BufferAllocator* allocator, ColorSpace colorSpace) : allocator(allocator), colorSpace(colorSpace), layout(LAYOUT_LINEAR), data(NULL)
 {
 	
 }
@@ -44,8 +48,20 @@ void Buffer::AllocateAligned(uint32_t preferredWidth, uint32_t preferredHeight,
 	this->width = preferredWidth;
 	this->height = preferredHeight;
 
-	this->stride = CalculateStride(preferredWidth, bpp, alignment);
-	this->size = height * stride;
+	if (layout == LAYOUT_LINEAR)
+	{
+		this->stride = CalculateStride(preferredWidth, bpp, alignment);
+		this->size = height * stride;
+	}
+	else
+	{
+		// Tiles on the right and top edge are padded
+		uint32_t horizontalTiles = (preferredWidth + TILE_SIZE - 1) >> TILE_SHIFT;
+		uint32_t verticalTiles = (preferredHeight + TILE_SIZE - 1) >> TILE_SHIFT;
+
+		this->stride = horizontalTiles * TILE_SIZE * TILE_SIZE * pixelStride;
+		this->size = verticalTiles * stride;
+	}
 
 	data = allocator->Allocate(*this);
 }
@@ -66,50 +82,124 @@ void Buffer::Destroy()
 	}
 }
 
+void Buffer::SetLayout(Layout layout)
+{
+	if (layout == this->layout)
+		return;
+
+	if (data == NULL)
+	{
+		this->layout = layout;
+		return;
+	}
+
+	// Keep a copy of the pixels in the current layout while the buffer is reallocated
+	Buffer source(new MemoryBufferAllocator(), colorSpace);
+	source.layout = this->layout;
+	source.AllocateAligned(width, height, alignment, encoding);
+	memcpy(source.data, data, size);
+
+	Destroy();
+
+	this->layout = layout;
+	AllocateAligned(source.width, source.height, source.alignment, source.encoding);
+
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+			memcpy(GetBase(x, y), source.GetBase(x, y), pixelStride);
+	}
+}
+
 void Buffer::Clear(const Color& color)
 {
-	for (uint8_t y = 0; y < height; ++y)
-		for (uint8_t x = 0; x < width; ++x)
-			SetPixel(x, y, color);
+	// Tiled buffers are filled including the padding of the edge tiles
+	if (layout == LAYOUT_TILED)
+	{
+		PixelConverter::Fill(color, size / pixelStride, encoding, data);
+		return;
+	}
+
+	for (uint32_t y = 0; y < height; ++y)
+		PixelConverter::Fill(color, width, encoding, GetBase(0, y));
 }
 
 void Buffer::Blit(const Buffer& src)
 {
 	bool tonemap = IsHDR(src.encoding) && !IsHDR(encoding) && !InputManager::Instance().GetKey('T');
-	Color color;
+
+	std::vector<uchar> sourceStaging, destinationStaging;
+	uint32_t blitWidth = std::min(width, src.width);
 
 	for (uint32_t y = 0; y < std::min(height, src.height); ++y)
 	{
-		for (uint32_t x = 0; x < std::min(width, src.width); ++x)
-		{
-			src.GetPixel(x, y, color, ColorSpace::LINEAR);
+		uchar* row = MapRow(y, destinationStaging);
 
-			if (tonemap)
-				Tonemap(color, color);
+		// Pixels of the destination row that are not covered by the source are kept
+		if (layout == LAYOUT_TILED && blitWidth < width)
+			memcpy(row, ReadRow(y, sourceStaging), width * pixelStride);
 
-			SetPixel(x, y, color, ColorSpace::LINEAR);
-		}
+		PixelConverter::Convert(src.ReadRow(y, sourceStaging), src.encoding, src.colorSpace, row, encoding, colorSpace, blitWidth, tonemap);
+		WriteRow(y, row);
 	}
 }
 
 void Buffer::Blit(const Sampler& sampler)
 {
 	bool tonemap = IsHDR(sampler.texture->encoding) && !IsHDR(encoding) && !InputManager::Instance().GetKey('T');
-	Color color;
+
+	std::vector<Color> colors(width);
+	std::vector<uchar> staging;
 
 	for (uint32_t y = 0; y < height; ++y)
 	{
 		for (uint32_t x = 0; x < width; ++x)
 		{
 			Vector2 uv(x / (float)width, y / (float)height);
-			sampler.Sample(uv, color);
+			sampler.Sample(uv, colors[x]);
+		}
 
-			if (tonemap)
-				Tonemap(color, color);
+		uchar* row = MapRow(y, staging);
+		PixelConverter::Convert(reinterpret_cast<const uchar*>(&colors[0]), FLOAT128, LINEAR, row, encoding, colorSpace, width, tonemap);
+		WriteRow(y, row);
+	}
+}
 
-			SetPixel(x, y, color, ColorSpace::LINEAR);
-		}
+const uchar* Buffer::ReadRow(uint32_t y, std::vector<uchar>& staging) const
+{
+	if (layout == LAYOUT_LINEAR)
+		return GetBase(0, y);
+
+	staging.resize(width * pixelStride);
+
+	for (uint32_t x = 0; x < width; ++x)
+		memcpy(&staging[x * pixelStride], GetBase(x, y), pixelStride);
+
+	return &staging[0];
+}
+
+uchar* Buffer::MapRow(uint32_t y, std::vector<uchar>& staging)
+{
+	if (layout == LAYOUT_LINEAR)
+		return GetBase(0, y);
+
+	staging.resize(width * pixelStride);
+
+	return &staging[0];
+}
+
+void Buffer::WriteRow(uint32_t y, const uchar* pixels)
+{
+	if (layout == LAYOUT_LINEAR)
+	{
+		if (pixels != GetBase(0, y))
+			memcpy(GetBase(0, y), pixels, width * pixelStride);
+
+		return;
 	}
+
+	for (uint32_t x = 0; x < width; ++x)
+		memcpy(GetBase(x, y), pixels + x * pixelStride, pixelStride);
 }
 
 float Buffer::GetPixel(uint32_t x, uint32_t y) const
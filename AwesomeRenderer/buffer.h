@@ -14,7 +14,7 @@ namespace AwesomeRenderer
 	{
 
 	public:
-		const float DEFAULT_GAMMA = 2.2f;
+		static const float DEFAULT_GAMMA;
 
 		enum Encoding
 		{
@@ -27,11 +27,24 @@ namespace AwesomeRenderer
 			GAMMA
 		};
 
+		// Order of the pixels in memory. Tiled buffers group pixels in tiles of TILE_SIZE x TILE_SIZE, which are stored row by row.
+		// Inside a tile the pixels are in Morton order, so every aligned 2x2 block of pixels is contiguous.
+		enum Layout
+		{
+			LAYOUT_LINEAR,
+			LAYOUT_TILED
+		};
+
+		static const uint32_t TILE_SIZE = 4;
+		static const uint32_t TILE_SHIFT = 2;
+
+		// Bytes per row of pixels, or per row of tiles for tiled buffers
 		uint32_t width, height, stride, size;
 		uint8_t bpp, pixelStride, alignment;
 
 		Encoding encoding;
 		ColorSpace colorSpace;
+		Layout layout;
 
 		uchar* data;
 
@@ -50,6 +63,9 @@ namespace AwesomeRenderer
 
 		uint32_t CalculateStride(uint32_t width, uint8_t bitDepth, uint8_t alignment);
 		void Destroy();
+
+		// Moves the pixels to the given layout. The layout of an unallocated buffer is used by the next allocation
+		void SetLayout(Layout layout);
 		
 		AR_FORCE_INLINE void Clear() { memset(data, 0, size); }
 		void Clear(const Color& color);
@@ -57,6 +73,14 @@ namespace AwesomeRenderer
 		void Blit(const Buffer& src);
 		void Blit(const Sampler& sampler);
 
+		// Returns the pixels of a row from left to right. Rows of tiled buffers are gathered in the staging vector
+		const uchar* ReadRow(uint32_t y, std::vector<uchar>& staging) const;
+
+		// Returns the memory a row of pixels can be written to, which is the staging vector for tiled buffers.
+		// The pixels are only stored after the row is committed with WriteRow.
+		uchar* MapRow(uint32_t y, std::vector<uchar>& staging);
+		void WriteRow(uint32_t y, const uchar* pixels);
+
 		float GetPixel(uint32_t x, uint32_t y) const;
 		void GetPixel(uint32_t x, uint32_t y, Color& color) const;
 		void GetPixel(uint32_t x, uint32_t y, Color& color, ColorSpace colorSpace) const;
@@ -68,7 +92,13 @@ namespace AwesomeRenderer
 		
 		AR_FORCE_INLINE uchar* GetBase(uint32_t x, uint32_t y) const
 		{ 
-			return data + y * stride + x * pixelStride;
+			if (layout == LAYOUT_LINEAR)
+				return data + y * stride + x * pixelStride;
+
+			uint32_t tileOffset = (y >> TILE_SHIFT) * stride + (x >> TILE_SHIFT) * (TILE_SIZE * TILE_SIZE * pixelStride);
+			uint32_t pixelIdx = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+
+			return data + tileOffset + pixelIdx * pixelStride;
 		}
 
 		AR_FORCE_INLINE float GetResolution() const
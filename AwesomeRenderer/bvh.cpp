@@ -0,0 +1,1089 @@
+#include "awesomerenderer.h"
+#include "bvh.h"
+
+#include "timer.h"
+#include "scheduler.h"
+#include "raypacket.h"
+#include "triangleblock.h"
+#include "statistics.h"
+
+using namespace AwesomeRenderer;
+
+template <typename ElementType>
+const float BVH<ElementType>::TRAVERSAL_COST = 1.0f;
+
+template <typename ElementType>
+const float BVH<ElementType>::INTERSECTION_COST = 0.5f;
+
+template <typename ElementType>
+const float BVH<ElementType>::REBUILD_THRESHOLD = 1.3f;
+
+template <typename ElementType>
+const uint32_t BVH<ElementType>::LEAF_ALIGNMENT = 1;
+
+
+template <typename ElementType>
+BVH<ElementType>::BVH() : elements(), wideNodes(false), nodes(NULL), nodeCount(0), wideNodeBuffer(NULL), wideNodeCount(0), elementBuffer(NULL), elementBufferSize(0), triangleBlocks(NULL), buildTime(0.0f), optimizedCost(0.0f), currentCost(0.0f), elementArea(0.0f)
+{
+
+}
+
+template <typename ElementType>
+BVH<ElementType>::~BVH()
+{
+	Release();
+}
+
+template <typename ElementType>
+void BVH<ElementType>::Release()
+{
+	if (nodes != NULL)
+		FreeAligned(nodes);
+
+	if (wideNodeBuffer != NULL)
+		FreeAligned(wideNodeBuffer);
+
+	if (elementBuffer != NULL)
+		FreeAligned(elementBuffer);
+
+	if (triangleBlocks != NULL)
+		FreeAligned(triangleBlocks);
+
+	nodes = NULL;
+	wideNodeBuffer = NULL;
+	elementBuffer = NULL;
+	triangleBlocks = NULL;
+
+	nodeCount = 0;
+	wideNodeCount = 0;
+	elementBufferSize = 0;
+}
+
+template <typename ElementType>
+void BVH<ElementType>::Optimize(const AABB& bounds, Scheduler* scheduler)
+{
+	Timer buildTimer(0.0f, FLT_MAX);
+	buildTimer.Tick();
+
+	Release();
+
+	this->bounds = bounds;
+
+	uint32_t elementCount = elements.size();
+
+	if (elementCount == 0)
+	{
+		buildTime = buildTimer.Poll();
+		return;
+	}
+
+	BuildContext context(scheduler);
+	context.elementInfo.resize(elementCount);
+	context.order.resize(elementCount);
+
+	uint32_t threads = std::thread::hardware_concurrency();
+	if (!threads)
+		threads = 4;
+
+	context.jobSize = std::max(elementCount / (threads * JOBS_PER_THREAD), PARALLEL_BUILD_THRESHOLD);
+
+	elementArea = 0.0f;
+
+	// Calculate the bounds and centroids of all elements once, the nodes only reorder the element indices
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		AABB objectBounds;
+		elements[elementIdx]->GetPrimitive().CalculateBounds(objectBounds);
+
+		ElementInfo& info = context.elementInfo[elementIdx];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			info.bounds.lower[axis] = objectBounds.Min()[axis];
+			info.bounds.upper[axis] = objectBounds.Max()[axis];
+			info.centroid[axis] = (info.bounds.lower[axis] + info.bounds.upper[axis]) * 0.5f;
+		}
+
+		elementArea += info.bounds.Area();
+
+		context.order[elementIdx] = elementIdx;
+	}
+
+	// Recursively build the hierarchy. Large subtrees are handed to the scheduler
+	bool allowJobs = scheduler != NULL && elementCount > PARALLEL_BUILD_THRESHOLD;
+
+	std::vector<BuildNode> buildNodes;
+	buildNodes.push_back(BuildNode(0, elementCount));
+
+	CreateNode(context, buildNodes, 0, 0, allowJobs);
+
+	context.jobs.WaitForCompletion();
+
+	// Convert the build nodes to a depth first node array
+	std::vector<Node> flatNodes;
+	std::vector<uint32_t> elementIndices;
+
+	FlattenNode(context, buildNodes, 0, flatNodes, elementIndices);
+
+	nodeCount = flatNodes.size();
+	nodes = AllocateAligned<Node>(CACHE_LINE_SIZE, nodeCount);
+	memcpy(nodes, &flatNodes[0], nodeCount * sizeof(Node));
+
+	elementBufferSize = elementIndices.size();
+	elementBuffer = AllocateAligned<uint32_t>(CACHE_LINE_SIZE, elementBufferSize);
+	memcpy(elementBuffer, &elementIndices[0], elementBufferSize * sizeof(uint32_t));
+
+	PackLeaves();
+
+	context.jobs.Clear();
+
+	if (wideNodes)
+	{
+		// The binary nodes are only needed to collapse them, the leaves keep their place in the element buffer
+		std::vector<WideNode> flatWideNodes;
+		CollapseNode(0, flatWideNodes);
+
+		wideNodeCount = flatWideNodes.size();
+		wideNodeBuffer = AllocateAligned<WideNode>(CACHE_LINE_SIZE, wideNodeCount);
+		memcpy(wideNodeBuffer, &flatWideNodes[0], wideNodeCount * sizeof(WideNode));
+
+		FreeAligned(nodes);
+		nodes = NULL;
+		nodeCount = 0;
+	}
+
+	optimizedCost = CalculateCost();
+	currentCost = optimizedCost;
+
+	buildTime = buildTimer.Poll();
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::Refit(const AABB& bounds, Scheduler* scheduler)
+{
+	if (nodes == NULL && wideNodeBuffer == NULL)
+	{
+		Optimize(bounds, scheduler);
+		return true;
+	}
+
+	this->bounds = bounds;
+
+	std::vector<Bounds> elementBounds(elements.size());
+	elementArea = 0.0f;
+
+	for (uint32_t elementIdx = 0; elementIdx < elements.size(); ++elementIdx)
+	{
+		AABB objectBounds;
+		elements[elementIdx]->GetPrimitive().CalculateBounds(objectBounds);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			elementBounds[elementIdx].lower[axis] = objectBounds.Min()[axis];
+			elementBounds[elementIdx].upper[axis] = objectBounds.Max()[axis];
+		}
+
+		elementArea += elementBounds[elementIdx].Area();
+	}
+
+	// Children are always stored behind their parent, so a reverse pass visits them before the parent
+	if (wideNodeBuffer != NULL)
+	{
+		for (uint32_t wideNodeIdx = wideNodeCount; wideNodeIdx > 0; --wideNodeIdx)
+		{
+			WideNode& node = wideNodeBuffer[wideNodeIdx - 1];
+
+			for (uint32_t childIdx = 0; childIdx < WIDE_NODE_SIZE; ++childIdx)
+			{
+				if (node.bounds[0][0][childIdx] > node.bounds[1][0][childIdx])
+					continue;
+
+				Bounds childBounds;
+				childBounds.Reset();
+
+				if (node.elementCounts[childIdx] > 0)
+					CalculateLeafBounds(node.children[childIdx], node.elementCounts[childIdx], elementBounds, childBounds);
+				else
+				{
+					const WideNode& child = wideNodeBuffer[node.children[childIdx]];
+
+					for (uint32_t grandchildIdx = 0; grandchildIdx < WIDE_NODE_SIZE; ++grandchildIdx)
+					{
+						for (int axis = 0; axis < 3; ++axis)
+						{
+							childBounds.lower[axis] = std::min(childBounds.lower[axis], child.bounds[0][axis][grandchildIdx]);
+							childBounds.upper[axis] = std::max(childBounds.upper[axis], child.bounds[1][axis][grandchildIdx]);
+						}
+					}
+				}
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					node.bounds[0][axis][childIdx] = childBounds.lower[axis];
+					node.bounds[1][axis][childIdx] = childBounds.upper[axis];
+				}
+			}
+		}
+	}
+	else
+	{
+		for (uint32_t nodeIdx = nodeCount; nodeIdx > 0; --nodeIdx)
+		{
+			Node& node = nodes[nodeIdx - 1];
+
+			Bounds nodeBounds;
+			nodeBounds.Reset();
+
+			if (node.IsLeaf())
+				CalculateLeafBounds(node.offset, node.GetElementCount(), elementBounds, nodeBounds);
+			else
+			{
+				const Node* children[] = { &node + 1, nodes + node.offset };
+
+				for (uint32_t childIdx = 0; childIdx < 2; ++childIdx)
+				{
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						nodeBounds.lower[axis] = std::min(nodeBounds.lower[axis], children[childIdx]->lower[axis]);
+						nodeBounds.upper[axis] = std::max(nodeBounds.upper[axis], children[childIdx]->upper[axis]);
+					}
+				}
+			}
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				node.lower[axis] = nodeBounds.lower[axis];
+				node.upper[axis] = nodeBounds.upper[axis];
+			}
+		}
+	}
+
+	currentCost = CalculateCost();
+
+	// Elements that moved apart leave large overlapping nodes behind, build a new hierarchy once these cost too much
+	if (currentCost > optimizedCost * REBUILD_THRESHOLD)
+	{
+		printf("[BVH]: Refitted cost %.2f exceeds the optimized cost %.2f, rebuilding...\n", currentCost, optimizedCost);
+
+		Optimize(bounds, scheduler);
+		return true;
+	}
+
+	return false;
+}
+
+template <typename ElementType>
+void BVH<ElementType>::CalculateLeafBounds(uint32_t elementOffset, uint32_t elementCount, const std::vector<Bounds>& elementBounds, Bounds& bounds) const
+{
+	const uint32_t* leafElements = elementBuffer + elementOffset;
+
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+		bounds.Extend(elementBounds[leafElements[elementIdx]]);
+}
+
+template <typename ElementType>
+float BVH<ElementType>::CalculateCost() const
+{
+	float cost = 0.0f;
+
+	if (wideNodeBuffer != NULL)
+	{
+		for (uint32_t wideNodeIdx = 0; wideNodeIdx < wideNodeCount; ++wideNodeIdx)
+		{
+			const WideNode& node = wideNodeBuffer[wideNodeIdx];
+
+			Bounds nodeBounds;
+			nodeBounds.Reset();
+
+			for (uint32_t childIdx = 0; childIdx < WIDE_NODE_SIZE; ++childIdx)
+			{
+				if (node.bounds[0][0][childIdx] > node.bounds[1][0][childIdx])
+					continue;
+
+				Bounds childBounds;
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					childBounds.lower[axis] = node.bounds[0][axis][childIdx];
+					childBounds.upper[axis] = node.bounds[1][axis][childIdx];
+				}
+
+				nodeBounds.Extend(childBounds);
+
+				if (node.elementCounts[childIdx] > 0)
+					cost += INTERSECTION_COST * node.elementCounts[childIdx] * childBounds.Area();
+			}
+
+			cost += TRAVERSAL_COST * nodeBounds.Area();
+		}
+	}
+	else
+	{
+		for (uint32_t nodeIdx = 0; nodeIdx < nodeCount; ++nodeIdx)
+		{
+			const Node& node = nodes[nodeIdx];
+
+			Bounds nodeBounds;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				nodeBounds.lower[axis] = node.lower[axis];
+				nodeBounds.upper[axis] = node.upper[axis];
+			}
+
+			if (node.IsLeaf())
+				cost += INTERSECTION_COST * node.GetElementCount() * nodeBounds.Area();
+			else
+				cost += TRAVERSAL_COST * nodeBounds.Area();
+		}
+	}
+
+	return elementArea > 0.0f ? cost / elementArea : 0.0f;
+}
+
+template <typename ElementType>
+void BVH<ElementType>::Analyze() const
+{
+	uint32_t leaves = 0;
+	uint32_t maxDepth = 0;
+	uint32_t largestLeafSize = 0;
+	uint32_t totalElements = 0;
+	uint32_t usedChildren = 0;
+
+	struct ScheduledNode
+	{
+		uint32_t node;
+		uint32_t depth;
+	};
+
+	std::vector<ScheduledNode> nodesLeft;
+
+	ScheduledNode node;
+	node.node = 0;
+	node.depth = 0;
+
+	if (nodeCount > 0 || wideNodeCount > 0)
+		nodesLeft.push_back(node);
+
+	while (!nodesLeft.empty())
+	{
+		node = nodesLeft.back();
+		nodesLeft.pop_back();
+
+		// Leaves of wide nodes are stored in their parent, so they are counted without scheduling them
+		if (wideNodeBuffer != NULL)
+		{
+			const WideNode& wideNode = wideNodeBuffer[node.node];
+
+			for (uint32_t childIdx = 0; childIdx < WIDE_NODE_SIZE; ++childIdx)
+			{
+				if (wideNode.bounds[0][0][childIdx] > wideNode.bounds[1][0][childIdx])
+					continue;
+
+				++usedChildren;
+
+				uint32_t elementCount = wideNode.elementCounts[childIdx];
+
+				if (elementCount > 0)
+				{
+					++leaves;
+
+					totalElements += elementCount;
+					largestLeafSize = std::max(largestLeafSize, elementCount);
+					maxDepth = std::max(maxDepth, node.depth + 1);
+				}
+				else
+				{
+					ScheduledNode child;
+					child.node = wideNode.children[childIdx];
+					child.depth = node.depth + 1;
+
+					nodesLeft.push_back(child);
+				}
+			}
+		}
+		else if (nodes[node.node].IsLeaf())
+		{
+			++leaves;
+
+			uint32_t elementCount = nodes[node.node].GetElementCount();
+
+			totalElements += elementCount;
+			largestLeafSize = std::max(largestLeafSize, elementCount);
+			maxDepth = std::max(maxDepth, node.depth);
+		}
+		else
+		{
+			uint32_t secondChild = nodes[node.node].offset;
+
+			++node.depth;
+
+			++node.node;
+			nodesLeft.push_back(node);
+
+			node.node = secondChild;
+			nodesLeft.push_back(node);
+		}
+	}
+
+	printf("[BVH]: Optimized with %u leaves; Largest leaf: %u/%u; Max depth: %u; SAH cost: %.2f; Build time: %.0fms\n",
+		leaves, largestLeafSize, totalElements, maxDepth, currentCost, buildTime * 1000);
+
+	if (wideNodeBuffer != NULL)
+	{
+		printf("[BVH]: Memory usage: %.1fKB; %u wide nodes with %.2f children on average; %u element indices\n",
+			GetMemoryUsage() / 1024.0f, wideNodeCount, usedChildren / (float) std::max(wideNodeCount, 1U), elementBufferSize);
+	}
+	else
+	{
+		printf("[BVH]: Memory usage: %.1fKB; %u nodes; %u element indices\n",
+			GetMemoryUsage() / 1024.0f, nodeCount, elementBufferSize);
+	}
+}
+
+template <typename ElementType>
+size_t BVH<ElementType>::GetMemoryUsage() const
+{
+	size_t memoryUsage = nodeCount * sizeof(Node) + wideNodeCount * sizeof(WideNode) + elementBufferSize * sizeof(uint32_t);
+
+	if (triangleBlocks != NULL)
+		memoryUsage += (elementBufferSize / LEAF_ALIGNMENT) * sizeof(TriangleBlock);
+
+	return memoryUsage;
+}
+
+template <typename ElementType>
+void BVH<ElementType>::CreateNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, uint32_t depth, bool allowJobs)
+{
+	uint32_t begin = buildNodes[nodeIdx].begin;
+	uint32_t end = buildNodes[nodeIdx].end;
+	uint32_t elementCount = end - begin;
+
+	// Fit the node to its elements
+	Bounds nodeBounds, centroidBounds;
+	nodeBounds.Reset();
+	centroidBounds.Reset();
+
+	for (uint32_t orderIdx = begin; orderIdx < end; ++orderIdx)
+	{
+		const ElementInfo& info = context.elementInfo[context.order[orderIdx]];
+
+		nodeBounds.Extend(info.bounds);
+		centroidBounds.Extend(info.centroid);
+	}
+
+	buildNodes[nodeIdx].bounds = nodeBounds;
+
+	// If we are at the maximum depth, this will always be a leaf node
+	if (elementCount <= 1 || depth >= MAX_DEPTH - 1)
+		return;
+
+	uint32_t axis;
+	uint32_t middle = SplitSAH(context, buildNodes[nodeIdx], centroidBounds, axis);
+
+	if (middle == end)
+	{
+		if (elementCount <= MAX_LEAF_SIZE)
+			return;
+
+		// A leaf would be cheaper, but it would hold too many elements. Split at the median of the longest axis instead
+		axis = 0;
+
+		for (int candidateAxis = 1; candidateAxis < 3; ++candidateAxis)
+		{
+			if (centroidBounds.upper[candidateAxis] - centroidBounds.lower[candidateAxis] > centroidBounds.upper[axis] - centroidBounds.lower[axis])
+				axis = candidateAxis;
+		}
+
+		middle = begin + elementCount / 2;
+
+		// Order equal centroids by element, so that the build doesn't depend on the selection algorithm
+		const std::vector<ElementInfo>& elementInfo = context.elementInfo;
+		std::nth_element(context.order.begin() + begin, context.order.begin() + middle, context.order.begin() + end,
+			[&elementInfo, axis](uint32_t a, uint32_t b)
+		{
+			float centroidA = elementInfo[a].centroid[axis];
+			float centroidB = elementInfo[b].centroid[axis];
+
+			return centroidA < centroidB || (centroidA == centroidB && a < b);
+		});
+	}
+
+	uint32_t firstChild = buildNodes.size();
+	buildNodes.push_back(BuildNode(begin, middle));
+	buildNodes.push_back(BuildNode(middle, end));
+
+	BuildNode& node = buildNodes[nodeIdx];
+	node.axis = axis;
+	node.firstChild = firstChild;
+
+	CreateChildNode(context, buildNodes, firstChild, depth + 1, allowJobs);
+	CreateChildNode(context, buildNodes, firstChild + 1, depth + 1, allowJobs);
+}
+
+template <typename ElementType>
+void BVH<ElementType>::CreateChildNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, uint32_t depth, bool allowJobs)
+{
+	uint32_t elementCount = buildNodes[nodeIdx].end - buildNodes[nodeIdx].begin;
+
+	// Small subtrees are not worth the scheduling overhead
+	if (!allowJobs || elementCount < PARALLEL_BUILD_THRESHOLD)
+	{
+		CreateNode(context, buildNodes, nodeIdx, depth, false);
+		return;
+	}
+
+	// Keep splitting on this thread until the subtree is small enough to be built by a single job
+	if (elementCount > context.jobSize)
+	{
+		CreateNode(context, buildNodes, nodeIdx, depth, true);
+		return;
+	}
+
+	// Jobs reorder their own range of the element order, so they don't need to synchronize
+	BuildJob* job = new BuildJob(*this, context, buildNodes[nodeIdx].begin, buildNodes[nodeIdx].end, depth);
+	buildNodes[nodeIdx].job = job;
+
+	context.jobs.Schedule(job);
+}
+
+template <typename ElementType>
+uint32_t BVH<ElementType>::SplitSAH(BuildContext& context, const BuildNode& node, const Bounds& centroidBounds, uint32_t& axis) const
+{
+	struct Bin
+	{
+		Bounds bounds;
+		uint32_t count;
+	};
+
+	uint32_t begin = node.begin;
+	uint32_t end = node.end;
+	uint32_t elementCount = end - begin;
+
+	// Costs are relative to the surface area of the node, but aren't divided by it
+	float nodeArea = node.bounds.Area();
+	float lowestCost = INTERSECTION_COST * elementCount * nodeArea;
+
+	int bestAxis = -1;
+	uint32_t bestBin = 0;
+
+	for (int candidateAxis = 0; candidateAxis < 3; ++candidateAxis)
+	{
+		float lower = centroidBounds.lower[candidateAxis];
+		float extent = centroidBounds.upper[candidateAxis] - lower;
+
+		// All centroids are at the same position on this axis
+		if (extent <= 0.0f)
+			continue;
+
+		float scale = BIN_COUNT / extent;
+
+		Bin bins[BIN_COUNT];
+
+		for (uint32_t binIdx = 0; binIdx < BIN_COUNT; ++binIdx)
+		{
+			bins[binIdx].bounds.Reset();
+			bins[binIdx].count = 0;
+		}
+
+		for (uint32_t orderIdx = begin; orderIdx < end; ++orderIdx)
+		{
+			const ElementInfo& info = context.elementInfo[context.order[orderIdx]];
+			uint32_t binIdx = std::min((uint32_t) ((info.centroid[candidateAxis] - lower) * scale), BIN_COUNT - 1);
+
+			bins[binIdx].bounds.Extend(info.bounds);
+			++bins[binIdx].count;
+		}
+
+		// Sweep from the upper end to find the cost of everything above each split, then from the lower end to evaluate the splits
+		float upperAreas[BIN_COUNT];
+		uint32_t upperCounts[BIN_COUNT];
+
+		Bounds sweepBounds;
+		sweepBounds.Reset();
+		uint32_t sweepCount = 0;
+
+		for (uint32_t binIdx = BIN_COUNT - 1; binIdx > 0; --binIdx)
+		{
+			sweepBounds.Extend(bins[binIdx].bounds);
+			sweepCount += bins[binIdx].count;
+
+			upperAreas[binIdx] = sweepCount > 0 ? sweepBounds.Area() : 0.0f;
+			upperCounts[binIdx] = sweepCount;
+		}
+
+		sweepBounds.Reset();
+		sweepCount = 0;
+
+		for (uint32_t binIdx = 1; binIdx < BIN_COUNT; ++binIdx)
+		{
+			sweepBounds.Extend(bins[binIdx - 1].bounds);
+			sweepCount += bins[binIdx - 1].count;
+
+			if (sweepCount == 0 || upperCounts[binIdx] == 0)
+				continue;
+
+			float cost = TRAVERSAL_COST * nodeArea + INTERSECTION_COST * (sweepCount * sweepBounds.Area() + upperCounts[binIdx] * upperAreas[binIdx]);
+
+			if (cost < lowestCost)
+			{
+				lowestCost = cost;
+				bestAxis = candidateAxis;
+				bestBin = binIdx;
+			}
+		}
+	}
+
+	if (bestAxis < 0)
+		return end;
+
+	axis = bestAxis;
+
+	// Move the elements in the bins below the split to the front of the range
+	const std::vector<ElementInfo>& elementInfo = context.elementInfo;
+	float lower = centroidBounds.lower[axis];
+	float scale = BIN_COUNT / (centroidBounds.upper[axis] - lower);
+
+	auto middle = std::partition(context.order.begin() + begin, context.order.begin() + end, [&elementInfo, axis, lower, scale, bestBin](uint32_t element)
+	{
+		return std::min((uint32_t) ((elementInfo[element].centroid[axis] - lower) * scale), BIN_COUNT - 1) < bestBin;
+	});
+
+	return middle - context.order.begin();
+}
+
+template <typename ElementType>
+void BVH<ElementType>::FlattenNode(const BuildContext& context, const std::vector<BuildNode>& buildNodes, uint32_t buildNodeIdx, std::vector<Node>& flatNodes, std::vector<uint32_t>& elementIndices) const
+{
+	// Continue with the root node of subtrees that were built by a job
+	const std::vector<BuildNode>* nodeList = &buildNodes;
+
+	while ((*nodeList)[buildNodeIdx].job != NULL)
+	{
+		nodeList = &(*nodeList)[buildNodeIdx].job->nodes;
+		buildNodeIdx = 0;
+	}
+
+	const BuildNode& buildNode = (*nodeList)[buildNodeIdx];
+
+	uint32_t nodeIdx = flatNodes.size();
+	flatNodes.push_back(Node());
+
+	Node& node = flatNodes[nodeIdx];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		node.lower[axis] = buildNode.bounds.lower[axis];
+		node.upper[axis] = buildNode.bounds.upper[axis];
+	}
+
+	if (buildNode.firstChild == 0)
+	{
+		uint32_t elementCount = buildNode.end - buildNode.begin;
+
+		node.offset = elementIndices.size();
+		node.data = elementCount << 2;
+
+		elementIndices.insert(elementIndices.end(), context.order.begin() + buildNode.begin, context.order.begin() + buildNode.end);
+		elementIndices.resize(((elementIndices.size() + LEAF_ALIGNMENT - 1) / LEAF_ALIGNMENT) * LEAF_ALIGNMENT, UINT32_MAX);
+
+		return;
+	}
+
+	node.data = buildNode.axis;
+
+	// The first child is placed directly behind this node
+	FlattenNode(context, *nodeList, buildNode.firstChild, flatNodes, elementIndices);
+
+	flatNodes[nodeIdx].offset = flatNodes.size();
+	FlattenNode(context, *nodeList, buildNode.firstChild + 1, flatNodes, elementIndices);
+}
+
+template <typename ElementType>
+uint32_t BVH<ElementType>::CollapseNode(uint32_t nodeIdx, std::vector<WideNode>& flatWideNodes) const
+{
+	uint32_t wideNodeIdx = flatWideNodes.size();
+	flatWideNodes.push_back(WideNode());
+
+	// Replace the inner child with the largest surface area by its children, until the node is full
+	uint32_t children[WIDE_NODE_SIZE];
+	uint32_t childCount = 1;
+
+	children[0] = nodeIdx;
+
+	while (childCount < WIDE_NODE_SIZE)
+	{
+		int largestChild = -1;
+		float largestArea = -1.0f;
+
+		for (uint32_t childIdx = 0; childIdx < childCount; ++childIdx)
+		{
+			const Node& child = nodes[children[childIdx]];
+
+			if (child.IsLeaf())
+				continue;
+
+			float width = child.upper[0] - child.lower[0];
+			float height = child.upper[1] - child.lower[1];
+			float depth = child.upper[2] - child.lower[2];
+			float area = width * height + height * depth + depth * width;
+
+			if (area > largestArea)
+			{
+				largestChild = childIdx;
+				largestArea = area;
+			}
+		}
+
+		if (largestChild < 0)
+			break;
+
+		uint32_t openedNode = children[largestChild];
+		children[largestChild] = openedNode + 1;
+		children[childCount++] = nodes[openedNode].offset;
+	}
+
+	WideNode wideNode;
+
+	for (uint32_t childIdx = 0; childIdx < WIDE_NODE_SIZE; ++childIdx)
+	{
+		if (childIdx >= childCount)
+		{
+			// Inverted bounds are missed by every ray
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				wideNode.bounds[0][axis][childIdx] = FLT_MAX;
+				wideNode.bounds[1][axis][childIdx] = -FLT_MAX;
+			}
+
+			wideNode.children[childIdx] = 0;
+			wideNode.elementCounts[childIdx] = 0;
+
+			continue;
+		}
+
+		const Node& child = nodes[children[childIdx]];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			wideNode.bounds[0][axis][childIdx] = child.lower[axis];
+			wideNode.bounds[1][axis][childIdx] = child.upper[axis];
+		}
+
+		if (child.IsLeaf())
+		{
+			wideNode.children[childIdx] = child.offset;
+			wideNode.elementCounts[childIdx] = child.GetElementCount();
+		}
+		else
+		{
+			wideNode.children[childIdx] = CollapseNode(children[childIdx], flatWideNodes);
+			wideNode.elementCounts[childIdx] = 0;
+		}
+	}
+
+	flatWideNodes[wideNodeIdx] = wideNode;
+
+	return wideNodeIdx;
+}
+
+template <typename ElementType>
+void BVH<ElementType>::PackLeaves()
+{
+	// Only hierarchies of mesh triangles have a packed layout
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	if (wideNodeBuffer != NULL)
+		return IntersectWide(ray, hitInfo, maxDistance, false);
+
+	if (nodes != NULL)
+		return IntersectBinary(ray, hitInfo, maxDistance, false);
+
+	return false;
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::Occluded(const Ray& ray, float maxDistance) const
+{
+	RaycastHit hitInfo;
+
+	if (wideNodeBuffer != NULL)
+		return IntersectWide(ray, hitInfo, maxDistance, true);
+
+	if (nodes != NULL)
+		return IntersectBinary(ray, hitInfo, maxDistance, true);
+
+	return false;
+}
+
+template <typename ElementType>
+uint32_t BVH<ElementType>::IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const
+{
+	float maxDistances[RayPacket::SIZE];
+	_mm_storeu_ps(maxDistances, maxDistance);
+
+	uint32_t hits = 0;
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((mask & (1 << rayIdx)) != 0 && IntersectRay(packet.rays[rayIdx], hitInfo[rayIdx], maxDistances[rayIdx]))
+			hits |= 1 << rayIdx;
+	}
+
+	return hits;
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::IntersectBinary(const Ray& ray, RaycastHit& hitInfo, float maxDistance, bool anyHit) const
+{
+	// The slab of each axis is entered at the lower bound for positive directions, and at the upper bound otherwise
+	int nearSide[3];
+	for (int axis = 0; axis < 3; ++axis)
+		nearSide[axis] = ray.invDirection[axis] < 0.0f;
+
+	uint32_t stack[MAX_DEPTH];
+	uint32_t stackSize = 0;
+
+	uint32_t nodeIdx = 0;
+	bool hit = false;
+
+	while (true)
+	{
+		const Node& node = nodes[nodeIdx];
+
+		AR_COUNT(NODES_VISITED, 1);
+
+		// Comparisons with NaN fail, so axes where the ray lies in a bounding plane don't limit the interval
+		float tMin = 0.0f, tMax = maxDistance;
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float tNear = ((nearSide[axis] ? node.upper : node.lower)[axis] - ray.origin[axis]) * ray.invDirection[axis];
+			float tFar = ((nearSide[axis] ? node.lower : node.upper)[axis] - ray.origin[axis]) * ray.invDirection[axis];
+
+			tMin = tNear > tMin ? tNear : tMin;
+			tMax = tFar < tMax ? tFar : tMax;
+		}
+
+		if (tMin <= tMax)
+		{
+			if (!node.IsLeaf())
+			{
+				// Visit the child on the side the ray comes from first
+				uint32_t nearNode = nodeIdx + 1;
+				uint32_t farNode = node.offset;
+
+				if (nearSide[node.GetAxis()])
+					std::swap(nearNode, farNode);
+
+				assert(stackSize < MAX_DEPTH);
+				stack[stackSize++] = farNode;
+
+				nodeIdx = nearNode;
+				continue;
+			}
+
+			AR_COUNT(LEAVES_VISITED, 1);
+
+			if (anyHit)
+			{
+				if (OccludedLeaf(node.offset, node.GetElementCount(), ray, maxDistance))
+					return true;
+			}
+			else if (IntersectLeaf(node.offset, node.GetElementCount(), ray, hitInfo, maxDistance))
+			{
+				maxDistance = hitInfo.distance;
+				hit = true;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	return hit;
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::IntersectWide(const Ray& ray, RaycastHit& hitInfo, float maxDistance, bool anyHit) const
+{
+	__m128 origin[3], invDirection[3];
+	int nearSide[3];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		origin[axis] = _mm_set1_ps(ray.origin[axis]);
+		invDirection[axis] = _mm_set1_ps(ray.invDirection[axis]);
+		nearSide[axis] = ray.invDirection[axis] < 0.0f;
+	}
+
+	// Every visited node leaves at most three of its children on the stack
+	WideStackNode stack[MAX_DEPTH * (WIDE_NODE_SIZE - 1) + 1];
+	uint32_t stackSize = 0;
+
+	stack[stackSize].node = 0;
+	stack[stackSize].tMin = 0.0f;
+	++stackSize;
+
+	bool hit = false;
+
+	while (stackSize > 0)
+	{
+		const WideStackNode& stackNode = stack[--stackSize];
+
+		// The nearest hit could have been found since this node was pushed
+		if (stackNode.tMin > maxDistance)
+			continue;
+
+		const WideNode& node = wideNodeBuffer[stackNode.node];
+
+		AR_COUNT(NODES_VISITED, 1);
+
+		// Test the ray against the bounds of all four children at once. The slab distance is passed as the first operand to
+		// min and max, which return the second operand if either is NaN
+		__m128 tMin = _mm_setzero_ps();
+		__m128 tMax = _mm_set1_ps(maxDistance);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			__m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearSide[axis]][axis]), origin[axis]), invDirection[axis]);
+			__m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1 - nearSide[axis]][axis]), origin[axis]), invDirection[axis]);
+
+			tMin = _mm_max_ps(tNear, tMin);
+			tMax = _mm_min_ps(tFar, tMax);
+		}
+
+		uint32_t hitMask = _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+
+		if (hitMask == 0)
+			continue;
+
+		float distances[WIDE_NODE_SIZE];
+		_mm_storeu_ps(distances, tMin);
+
+		// Sort the children that are hit from near to far
+		uint32_t order[WIDE_NODE_SIZE];
+		uint32_t hitCount = 0;
+
+		for (uint32_t childIdx = 0; childIdx < WIDE_NODE_SIZE; ++childIdx)
+		{
+			if ((hitMask & (1 << childIdx)) == 0)
+				continue;
+
+			uint32_t insertIdx = hitCount++;
+
+			for (; insertIdx > 0 && distances[order[insertIdx - 1]] > distances[childIdx]; --insertIdx)
+				order[insertIdx] = order[insertIdx - 1];
+
+			order[insertIdx] = childIdx;
+		}
+
+		// Leaves are tested right away, the nearest first so that the others can be culled by its hit
+		for (uint32_t orderIdx = 0; orderIdx < hitCount; ++orderIdx)
+		{
+			uint32_t childIdx = order[orderIdx];
+			uint32_t elementCount = node.elementCounts[childIdx];
+
+			if (elementCount == 0 || distances[childIdx] > maxDistance)
+				continue;
+
+			AR_COUNT(LEAVES_VISITED, 1);
+
+			if (anyHit)
+			{
+				if (OccludedLeaf(node.children[childIdx], elementCount, ray, maxDistance))
+					return true;
+			}
+			else if (IntersectLeaf(node.children[childIdx], elementCount, ray, hitInfo, maxDistance))
+			{
+				maxDistance = hitInfo.distance;
+				hit = true;
+			}
+		}
+
+		// Push the inner children from far to near, so that the nearest one is visited next
+		for (uint32_t orderIdx = hitCount; orderIdx > 0; --orderIdx)
+		{
+			uint32_t childIdx = order[orderIdx - 1];
+
+			if (node.elementCounts[childIdx] > 0 || distances[childIdx] > maxDistance)
+				continue;
+
+			assert(stackSize < sizeof(stack) / sizeof(stack[0]));
+
+			WideStackNode& child = stack[stackSize++];
+			child.node = node.children[childIdx];
+			child.tMin = distances[childIdx];
+		}
+	}
+
+	return hit;
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::OccludedLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, float maxDistance) const
+{
+	const uint32_t* leafElements = elementBuffer + elementOffset;
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		if (elements[leafElements[elementIdx]]->GetShape().Occluded(ray, maxDistance))
+			return true;
+	}
+
+	return false;
+}
+
+template <typename ElementType>
+bool BVH<ElementType>::IntersectLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	float closestDistance = maxDistance;
+	bool hit = false;
+
+	const uint32_t* leafElements = elementBuffer + elementOffset;
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		const ElementType* element = elements[leafElements[elementIdx]];
+
+		if (element->GetShape().IntersectRay(ray, hitInfo, closestDistance))
+		{
+			hitInfo.element = element;
+
+			closestDistance = hitInfo.distance;
+			hit = true;
+		}
+	}
+
+	return hit;
+}
+
+#include "renderable.h"
+template BVH<Renderable>;
+
+#include "meshtriangle.h"
+
+template<>
+const uint32_t BVH<MeshTriangle>::LEAF_ALIGNMENT = TriangleBlock::SIZE;
+
+template<>
+void BVH<MeshTriangle>::PackLeaves()
+{
+	triangleBlocks = TriangleBlock::PackLeaves(elements, elementBuffer, elementBufferSize);
+}
+
+template<>
+bool BVH<MeshTriangle>::IntersectLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	return TriangleBlock::IntersectLeaf(triangleBlocks, elementOffset, elementCount, ray, hitInfo, maxDistance);
+}
+
+template<>
+bool BVH<MeshTriangle>::OccludedLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, float maxDistance) const
+{
+	return TriangleBlock::OccludedLeaf(triangleBlocks, elementOffset, elementCount, ray, maxDistance);
+}
+
+template BVH<MeshTriangle>;
\ No newline at end of file
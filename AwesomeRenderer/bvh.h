@@ -0,0 +1,279 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "awesomerenderer.h"
+#include "aabb.h"
+
+#include "threading.h"
+#include "workerjob.h"
+#include "jobbatch.h"
+
+namespace AwesomeRenderer
+{
+	class Scheduler;
+	class RayPacket;
+	class TriangleBlock;
+
+	// Bounding volume hierarchy built with a binned SAH. The nodes are stored depth first, optionally collapsed to nodes with four
+	// children whose bounds are tested at once with SSE. Supports the same elements and queries as KDTree
+	template <typename ElementType>
+	class BVH
+	{
+	public:
+		static const uint32_t BIN_COUNT = 16;
+		static const uint32_t MAX_LEAF_SIZE = 8;
+		static const uint32_t MAX_DEPTH = 64;
+		static const float TRAVERSAL_COST;
+		static const float INTERSECTION_COST;
+
+		// Refitted hierarchies are rebuilt once their SAH cost exceeds the cost after the last build by this factor
+		static const float REBUILD_THRESHOLD;
+
+		// Subtrees with less elements than this are always built on the thread that created their parent
+		static const uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+		static const uint32_t JOBS_PER_THREAD = 8;
+
+		// The element list of every leaf starts at a multiple of this in the element buffer
+		static const uint32_t LEAF_ALIGNMENT;
+
+		static const uint32_t WIDE_NODE_SIZE = 4;
+		static const uint32_t CACHE_LINE_SIZE = 64;
+
+		std::vector<ElementType*> elements;
+
+		// Collapse the binary hierarchy to nodes with four children after it is built
+		bool wideNodes;
+
+	private:
+		struct Bounds
+		{
+			float lower[3], upper[3];
+
+			void Reset()
+			{
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					lower[axis] = FLT_MAX;
+					upper[axis] = -FLT_MAX;
+				}
+			}
+
+			void Extend(const Bounds& other)
+			{
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					lower[axis] = std::min(lower[axis], other.lower[axis]);
+					upper[axis] = std::max(upper[axis], other.upper[axis]);
+				}
+			}
+
+			void Extend(const float point[3])
+			{
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					lower[axis] = std::min(lower[axis], point[axis]);
+					upper[axis] = std::max(upper[axis], point[axis]);
+				}
+			}
+
+			float Area() const
+			{
+				float width = upper[0] - lower[0];
+				float height = upper[1] - lower[1];
+				float depth = upper[2] - lower[2];
+
+				return 2.0f * (width * height + height * depth + depth * width);
+			}
+		};
+
+		// Node of the binary hierarchy, the first child of an inner node is stored directly behind it
+		struct Node
+		{
+			float lower[3];
+
+			// Inner nodes: index of the second child. Leaves: offset of the first element in the element buffer
+			uint32_t offset;
+
+			float upper[3];
+
+			// The lowest two bits are the split axis, which decides the child that is visited first. The upper bits are the number of
+			// elements, zero for inner nodes
+			uint32_t data;
+
+			AR_FORCE_INLINE bool IsLeaf() const { return (data >> 2) != 0; }
+			AR_FORCE_INLINE uint32_t GetElementCount() const { return data >> 2; }
+			AR_FORCE_INLINE int GetAxis() const { return (int)(data & 0x03); }
+		};
+
+		// Node with four children. The bounds of the children are stored per axis, lower bounds first, so that they can be tested at once.
+		// Unused children have inverted bounds, which are never hit. Must be allocated with 16 byte alignment
+		struct WideNode
+		{
+			float bounds[2][3][WIDE_NODE_SIZE];
+
+			// Index of the child node, or the offset of the first element in the element buffer for leaves
+			uint32_t children[WIDE_NODE_SIZE];
+
+			// Number of elements of leaf children, zero for inner children
+			uint32_t elementCounts[WIDE_NODE_SIZE];
+		};
+
+		struct ElementInfo
+		{
+			Bounds bounds;
+			float centroid[3];
+		};
+
+		class BuildJob;
+
+		// Intermediate node representation used while building. These are flattened to the final node layout once all subtrees are finished
+		struct BuildNode
+		{
+			Bounds bounds;
+
+			// Range of the node in the element order of the build context
+			uint32_t begin, end;
+
+			uint32_t axis;
+
+			// Index of the first child in the same node list, the second child is always allocated directly behind it. Zero for leaves
+			uint32_t firstChild;
+
+			// If set, this node is the root node of the subtree built by this job
+			BuildJob* job;
+
+			BuildNode(uint32_t begin, uint32_t end) : begin(begin), end(end), axis(0), firstChild(0), job(NULL)
+			{
+
+			}
+		};
+
+		struct BuildContext
+		{
+			std::vector<ElementInfo> elementInfo;
+
+			// Element indices, every node reorders the range of its elements so that the elements of its children are consecutive
+			std::vector<uint32_t> order;
+
+			// Jobs that build subtrees, they are kept until their nodes are flattened
+			JobBatch jobs;
+
+			uint32_t jobSize;
+
+			BuildContext(Scheduler* scheduler) : jobs(scheduler)
+			{
+
+			}
+		};
+
+		class BuildJob : public WorkerJob
+		{
+		public:
+			BVH<ElementType>& bvh;
+			BuildContext& context;
+
+			uint32_t depth;
+
+			std::vector<BuildNode> nodes;
+
+		public:
+			BuildJob(BVH<ElementType>& bvh, BuildContext& context, uint32_t begin, uint32_t end, uint32_t depth) :
+				bvh(bvh), context(context), depth(depth)
+			{
+				nodes.push_back(BuildNode(begin, end));
+			}
+
+		protected:
+			void Run()
+			{
+				bvh.CreateNode(context, nodes, 0, depth, false);
+			}
+		};
+
+		// Child of a wide node that still has to be visited, with the distance at which the ray enters it
+		struct WideStackNode
+		{
+			uint32_t node;
+			float tMin;
+		};
+
+		AABB bounds;
+
+		Node* nodes;
+		uint32_t nodeCount;
+
+		WideNode* wideNodeBuffer;
+		uint32_t wideNodeCount;
+
+		// Index of every element in the leaves. Leaves refer to their first entry by offset, padding of aligned leaves is UINT32_MAX
+		uint32_t* elementBuffer;
+		uint32_t elementBufferSize;
+
+		// Packed copies of the leaf elements, only used by hierarchies that support it. Block i holds the elements at i * LEAF_ALIGNMENT in the element buffer
+		TriangleBlock* triangleBlocks;
+
+		float buildTime;
+
+		// SAH cost of the hierarchy right after it was built, and after the last refit
+		float optimizedCost;
+		float currentCost;
+
+		// Sum of the surface areas of the element bounds, which the cost is relative to
+		float elementArea;
+
+	public:
+		BVH();
+		~BVH();
+
+		// The bounds are reported by GetBounds, the nodes are fitted to the bounds of their elements
+		void Optimize(const AABB& bounds, Scheduler* scheduler = NULL);
+		void Analyze() const;
+
+		// Fits the nodes to the current bounds of their elements without changing the hierarchy, for elements that moved.
+		// Rebuilds the hierarchy instead if refitting degraded it too much. Returns whether it was rebuilt
+		bool Refit(const AABB& bounds, Scheduler* scheduler = NULL);
+
+		// Number of bytes used by the nodes, the element buffer and the packed leaves
+		size_t GetMemoryUsage() const;
+
+		const AABB& GetBounds() const { return bounds; }
+		float GetBuildTime() const { return buildTime; }
+
+		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance = FLT_MAX) const;
+
+		// Returns whether any element is hit within maxDistance. Stops at the first hit instead of searching the nearest one
+		bool Occluded(const Ray& ray, float maxDistance) const;
+
+		// Intersects all rays in the mask with the hierarchy, returns a mask of the rays that hit an element. The rays are traversed one by one
+		uint32_t IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const;
+
+	private:
+		void Release();
+
+		void CreateNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, uint32_t depth, bool allowJobs);
+		void CreateChildNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, uint32_t depth, bool allowJobs);
+
+		// Finds the cheapest split between the bins of the element centroids, and reorders the elements of the node to it.
+		// Returns the first element of the upper child, or the end of the node if a leaf is cheaper
+		uint32_t SplitSAH(BuildContext& context, const BuildNode& node, const Bounds& centroidBounds, uint32_t& axis) const;
+
+		void FlattenNode(const BuildContext& context, const std::vector<BuildNode>& buildNodes, uint32_t buildNodeIdx, std::vector<Node>& flatNodes, std::vector<uint32_t>& elementIndices) const;
+		uint32_t CollapseNode(uint32_t nodeIdx, std::vector<WideNode>& flatWideNodes) const;
+		void PackLeaves();
+
+		// Expected cost of tracing a ray through the hierarchy. This is relative to the area of the elements instead of the root,
+		// since moving a single element far away grows the root, which would make a degraded hierarchy look cheaper
+		float CalculateCost() const;
+
+		void CalculateLeafBounds(uint32_t elementOffset, uint32_t elementCount, const std::vector<Bounds>& elementBounds, Bounds& bounds) const;
+
+		bool IntersectBinary(const Ray& ray, RaycastHit& hitInfo, float maxDistance, bool anyHit) const;
+		bool IntersectWide(const Ray& ray, RaycastHit& hitInfo, float maxDistance, bool anyHit) const;
+
+		bool IntersectLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool OccludedLeaf(uint32_t elementOffset, uint32_t elementCount, const Ray& ray, float maxDistance) const;
+	};
+
+}
+
+#endif
\ No newline at end of file
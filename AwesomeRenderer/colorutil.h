@@ -14,6 +14,12 @@ namespace AwesomeRenderer
 				out[channel] = (src[channel] * src[3]) + (dst[channel] * (1.0f - src[3]));
 
 		}
+
+		// Relative luminance of a linear RGB color (Rec. 709)
+		static float Luminance(const Vector3& color)
+		{
+			return color[0] * 0.2126f + color[1] * 0.7152f + color[2] * 0.0722f;
+		}
 	};
 }
 
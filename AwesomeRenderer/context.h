@@ -1,6 +1,8 @@
 #ifndef _CONTEXT_H_
 #define _CONTEXT_H_
 
+#include "accelerationstructure.h"
+
 namespace AwesomeRenderer
 {
 	class LightData;
@@ -9,6 +11,7 @@ namespace AwesomeRenderer
 	class TextureFactory;
 	class Camera;
 	class Window;
+	class Scheduler;
 
 	class Context
 	{
@@ -25,6 +28,22 @@ namespace AwesomeRenderer
 		ObjLoader* objLoader;
 		TextureFactory* textureFactory;
 
+		Scheduler* scheduler;
+
+		// Directory where optimized mesh trees are cached, NULL to always build them
+		const char* treeCacheDirectory;
+
+		// Whether mesh trees are built with perfect splits, see KDTree::perfectSplits
+		bool perfectSplits;
+
+		// Acceleration structure that meshes are built with
+		AccelerationStructure accelerationStructure;
+
+		Context() : window(NULL), mainContext(NULL), hudContext(NULL), mainCamera(NULL), hudCamera(NULL),
+			objLoader(NULL), textureFactory(NULL), scheduler(NULL), treeCacheDirectory(NULL), perfectSplits(false), accelerationStructure(ACCELERATION_KDTREE)
+		{
+
+		}
 
 	};
 
@@ -27,7 +27,7 @@ DebugIntegrator::DebugIntegrator(RayTracer& rayTracer) : SurfaceIntegrator(rayTr
 }
 
 
-Vector3 DebugIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth)
+Vector3 DebugIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth)
 {
 	PhongMaterial* phongMaterial = material.As<PhongMaterial>();
 
@@ -40,14 +40,15 @@ Vector3 DebugIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Mat
 			if (InputManager::Instance().GetKey('M'))
 				color *= phongMaterial->diffuseMap->Sample(hitInfo.uv, 0U);
 			else
-				color *= phongMaterial->diffuseMap->SampleMipMaps(hitInfo.uv, hitInfo.distance, hitInfo.surfaceAreaToTextureRatio, context.renderTarget->frameBuffer->GetResolution());
+				color *= phongMaterial->diffuseMap->SampleMipMaps(hitInfo.uv, hitInfo.textureLod);
 		}
 
 		if (material.translucent)
 		{
 			Ray refractionRay(hitInfo.point + ray.direction *1e-3f, ray.direction);
+			refractionRay.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
 			ShadingInfo refractionShading;
-			rayTracer.CalculateShading(refractionRay, refractionShading, depth);
+			rayTracer.CalculateShading(refractionRay, refractionShading, random, depth);
 
 			ColorUtil::Blend(color, refractionShading.color, color);
 		}
@@ -15,7 +15,7 @@ namespace AwesomeRenderer
 		public:
 			DebugIntegrator(RayTracer& rayTracer);
 
-			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth);
+			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth);
 
 		};
 	}
@@ -106,7 +106,7 @@ namespace AwesomeRenderer
 						return false;
 					}
 
-					PostProcessAsset(*instance);
+					PostProcessAsset(fileName, *instance);
 
 					CacheAsset(fileName, *instance);
 
@@ -123,7 +123,7 @@ namespace AwesomeRenderer
 
 		virtual bool Instantiate(AssetType** instance) const = 0;
 
-		virtual void PostProcessAsset(AssetType* instance) { };
+		virtual void PostProcessAsset(const std::string& fileName, AssetType* instance) { };
 
 		void CacheAsset(const std::string& fileName, AssetType* instance)
 		{
@@ -0,0 +1,39 @@
+#include "awesomerenderer.h"
+
+#include "jobbatch.h"
+#include "scheduler.h"
+#include "workerjob.h"
+
+using namespace AwesomeRenderer;
+
+JobBatch::JobBatch(Scheduler* scheduler) : scheduler(scheduler)
+{
+
+}
+
+JobBatch::~JobBatch()
+{
+	Clear();
+}
+
+void JobBatch::Schedule(WorkerJob* job)
+{
+	jobs.push_back(job);
+	scheduler->ScheduleJob(job);
+}
+
+void JobBatch::WaitForCompletion()
+{
+	for (auto it = jobs.begin(); it != jobs.end(); ++it)
+		(*it)->WaitUntilCompleted();
+}
+
+void JobBatch::Clear()
+{
+	WaitForCompletion();
+
+	for (auto it = jobs.begin(); it != jobs.end(); ++it)
+		delete *it;
+
+	jobs.clear();
+}
\ No newline at end of file
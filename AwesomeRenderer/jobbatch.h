@@ -0,0 +1,36 @@
+#ifndef _JOB_BATCH_H_
+#define _JOB_BATCH_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+
+	class Scheduler;
+	class WorkerJob;
+
+	// Jobs that are scheduled one at a time and waited on together. The batch owns the jobs and deletes them once it is
+	// cleared or destroyed. Jobs have to be scheduled from the thread that waits on the batch.
+	class JobBatch
+	{
+	private:
+		Scheduler* scheduler;
+
+		std::vector<WorkerJob*> jobs;
+
+	public:
+		JobBatch(Scheduler* scheduler);
+		~JobBatch();
+
+		void Schedule(WorkerJob* job);
+
+		// Waits until all scheduled jobs completed, including jobs that were still queued
+		void WaitForCompletion();
+
+		// Waits for all scheduled jobs and deletes them
+		void Clear();
+	};
+
+}
+
+#endif
\ No newline at end of file
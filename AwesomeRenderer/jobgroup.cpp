@@ -1,34 +1,139 @@
-
 #include "jobgroup.h"
 
 using namespace AwesomeRenderer;
 
+const uint32_t JobGroup::SPIN_COUNT = 64;
+const uint32_t JobGroup::MAX_TRANSFER_SIZE = 32;
+
+namespace
+{
+	// The group and queue index of the worker running on this thread
+	thread_local const JobGroup* currentGroup = NULL;
+	thread_local int32_t currentWorker = -1;
+}
 
-JobGroup::JobGroup() : jobSignal(0, UINT32_MAX), jobQueue()
+JobGroup::JobGroup() : jobQueue(), queuedJobs(0), wakeEpoch(0), parkedWorkers(0), shuttingDown(false)
 {
 
 }
 
+JobGroup::~JobGroup()
+{
+	for (auto it = workerQueues.begin(); it != workerQueues.end(); ++it)
+		delete *it;
+
+	workerQueues.clear();
+}
+
+uint32_t JobGroup::AddWorker()
+{
+	workerQueues.push_back(new WorkStealingQueue<WorkerJob>());
+
+	return workerQueues.size() - 1;
+}
+
+void JobGroup::BindWorker(uint32_t workerIdx)
+{
+	currentGroup = this;
+	currentWorker = workerIdx;
+}
+
+int32_t JobGroup::GetCurrentWorker() const
+{
+	return currentGroup == this ? currentWorker : -1;
+}
+
 void JobGroup::EnqueueJob(WorkerJob* job)
 {
-	jobQueue.Lock();
-	
-	jobQueue->push_back(job);
+	int32_t workerIdx = GetCurrentWorker();
 
-	jobQueue.Unlock();
+	if (workerIdx >= 0)
+	{
+		// Jobs created by a worker go to its own queue, where idle workers can steal them
+		workerQueues[workerIdx]->Push(job);
+	}
+	else
+	{
+		jobQueue.Lock();
+
+		jobQueue->push_back(job);
+		++queuedJobs;
+
+		jobQueue.Unlock();
+	}
 
-	jobSignal.Signal();
+	WakeWorker();
 }
 
 WorkerJob* JobGroup::DequeueJob()
 {
+	return FindJob(GetCurrentWorker());
+}
+
+WorkerJob* JobGroup::FindJob(int32_t workerIdx)
+{
+	WorkerJob* job = NULL;
+
+	// Newest job of the own queue first, its data is most likely still in the cache
+	if (workerIdx >= 0)
+	{
+		job = workerQueues[workerIdx]->Pop();
+
+		if (job != NULL)
+			return job;
+	}
+
+	job = TakeQueuedJobs(workerIdx);
+
+	if (job != NULL)
+		return job;
+
+	// Steal the oldest job from other workers, starting with the next worker so that thieves spread over the queues
+	uint32_t workerCount = workerQueues.size();
+
+	for (uint32_t offset = 1; offset <= workerCount; ++offset)
+	{
+		uint32_t victimIdx = (workerIdx + offset) % workerCount;
+
+		if ((int32_t) victimIdx == workerIdx)
+			continue;
+
+		job = workerQueues[victimIdx]->Steal();
+
+		if (job != NULL)
+			return job;
+	}
+
+	return NULL;
+}
+
+WorkerJob* JobGroup::TakeQueuedJobs(int32_t workerIdx)
+{
+	if (queuedJobs.load() == 0)
+		return NULL;
+
 	jobQueue.Lock();
 
 	WorkerJob* job = NULL;
+
 	if (!jobQueue->empty())
 	{
 		job = jobQueue->front();
 		jobQueue->pop_front();
+		--queuedJobs;
+
+		// Move a share of the remaining jobs to the own queue, so that other workers steal them from there instead of contending for the lock
+		if (workerIdx >= 0)
+		{
+			uint32_t transferSize = std::min((uint32_t) jobQueue->size() / (uint32_t) workerQueues.size(), MAX_TRANSFER_SIZE);
+
+			for (uint32_t jobIdx = 0; jobIdx < transferSize; ++jobIdx)
+			{
+				workerQueues[workerIdx]->Push(jobQueue->front());
+				jobQueue->pop_front();
+				--queuedJobs;
+			}
+		}
 	}
 
 	jobQueue.Unlock();
@@ -36,17 +141,86 @@ WorkerJob* JobGroup::DequeueJob()
 	return job;
 }
 
+WorkerJob* JobGroup::WaitForJob(uint32_t workerIdx)
+{
+	// Spin for a while before parking, new jobs often follow shortly after a worker runs out
+	for (uint32_t spin = 0; spin < SPIN_COUNT; ++spin)
+	{
+		WorkerJob* job = FindJob(workerIdx);
+
+		if (job != NULL)
+			return job;
+
+		std::this_thread::yield();
+	}
+
+	// Register as parked before checking the queues one last time. A job enqueued after that check changes the epoch, so the wake up can't be missed
+	uint64_t epoch = wakeEpoch.load();
+	++parkedWorkers;
+
+	WorkerJob* job = FindJob(workerIdx);
+
+	if (job == NULL)
+	{
+		std::unique_lock<std::mutex> lock(parkMutex);
+
+		while (wakeEpoch.load() == epoch && !shuttingDown.load())
+			parkSignal.wait(lock);
+	}
+
+	--parkedWorkers;
+
+	return job;
+}
+
+void JobGroup::WakeWorker()
+{
+	++wakeEpoch;
+
+	if (parkedWorkers.load() == 0)
+		return;
+
+	// Taking the lock makes sure a worker that is about to park has started waiting
+	parkMutex.lock();
+	parkMutex.unlock();
+
+	parkSignal.notify_one();
+}
+
+void JobGroup::Shutdown()
+{
+	shuttingDown = true;
+	++wakeEpoch;
+
+	parkMutex.lock();
+	parkMutex.unlock();
+
+	parkSignal.notify_all();
+}
 
 void JobGroup::ClearQueue()
 {
 	jobQueue.Lock();
 	
 	jobQueue->clear();
+	queuedJobs = 0;
 
 	jobQueue.Unlock();
+
+	// Other workers may still be working on their queues, so remove the jobs as a thief would
+	for (auto it = workerQueues.begin(); it != workerQueues.end(); ++it)
+	{
+		while (!(*it)->IsEmpty())
+			(*it)->Steal();
+	}
 }
 
 uint32_t JobGroup::JobsLeft() const
 {
-	return jobQueue->size();
+	uint32_t jobsLeft = queuedJobs.load();
+
+	for (auto it = workerQueues.begin(); it != workerQueues.end(); ++it)
+		jobsLeft += (*it)->Size();
+
+	return jobsLeft;
 }
\ No newline at end of file
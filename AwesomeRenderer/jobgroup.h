@@ -4,28 +4,65 @@
 #include "awesomerenderer.h"
 
 #include "threading.h"
+#include "workstealingqueue.h"
 
 namespace AwesomeRenderer
 {
 
 	class WorkerJob;
 
+	// A set of jobs executed by a set of worker threads. Every worker has its own queue, and steals jobs from the
+	// other workers when it runs out. Jobs enqueued from threads outside of the group are handed out in batches.
 	class JobGroup
 	{
-	public:
-		Semaphore jobSignal;
-
 	private:
+		static const uint32_t SPIN_COUNT;
+		static const uint32_t MAX_TRANSFER_SIZE;
+
+		std::vector<WorkStealingQueue<WorkerJob>*> workerQueues;
+
+		// Jobs enqueued by threads that aren't workers of this group
 		LockedVariable<std::deque<WorkerJob*>> jobQueue;
+		std::atomic<uint32_t> queuedJobs;
+
+		// Idle workers are parked until the wake epoch changes
+		std::mutex parkMutex;
+		std::condition_variable parkSignal;
+
+		std::atomic<uint64_t> wakeEpoch;
+		std::atomic<uint32_t> parkedWorkers;
+
+		std::atomic<bool> shuttingDown;
 
 	public:
 		JobGroup();
+		~JobGroup();
 
 		void EnqueueJob(WorkerJob* job);
 		WorkerJob* DequeueJob();
 
 		void ClearQueue();
 		uint32_t JobsLeft() const;
+
+		// Creates the queue for a new worker and returns its index. All workers have to be added before any of them is started
+		uint32_t AddWorker();
+
+		// Binds the calling thread to the queue of a worker
+		void BindWorker(uint32_t workerIdx);
+
+		// Returns the next job for a worker, or NULL if the worker was woken without a job being available
+		WorkerJob* WaitForJob(uint32_t workerIdx);
+
+		// Wakes all parked workers and keeps them from parking again, so that stopped workers can exit
+		void Shutdown();
+
+	private:
+		WorkerJob* FindJob(int32_t workerIdx);
+		WorkerJob* TakeQueuedJobs(int32_t workerIdx);
+
+		void WakeWorker();
+
+		int32_t GetCurrentWorker() const;
 	};
 
 }
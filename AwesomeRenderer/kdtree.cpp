@@ -3,6 +3,13 @@
 #include "kdtree.h"
 #include "kdtreenode.h"
 
+#include "timer.h"
+#include "scheduler.h"
+#include "raypacket.h"
+#include "triangleblock.h"
+#include "statistics.h"
+#include "mappedfile.h"
+
 using namespace AwesomeRenderer;
 
 template <typename ElementType>
@@ -17,9 +24,12 @@ const float KDTree<ElementType>::EMPTY_BONUS = 0.0f;
 template <typename ElementType>
 const float KDTree<ElementType>::POSITION_EPSILON = 1e-5f;
 
+template <typename ElementType>
+const uint32_t KDTree<ElementType>::LEAF_ALIGNMENT = 1;
+
 
 template <typename ElementType>
-KDTree<ElementType>::KDTree(uint32_t maxDepth) : maxDepth(maxDepth), elements(), nodes(NULL), lastNode(0), availableNodes(0), elementBuffer(NULL)
+KDTree<ElementType>::KDTree(uint32_t maxDepth) : maxDepth(maxDepth), elements(), perfectSplits(false), nodes(NULL), availableNodes(0), elementBuffer(NULL), elementBufferSize(0), triangleBlocks(NULL), nodeFile(NULL), buildTime(0.0f)
 {
 
 }
@@ -27,25 +37,110 @@ KDTree<ElementType>::KDTree(uint32_t maxDepth) : maxDepth(maxDepth), elements(),
 template <typename ElementType>
 KDTree<ElementType>::~KDTree()
 {
-	if (nodes != NULL)
-		FreeAligned(nodes);
+	Release();
+}
+
+template <typename ElementType>
+void KDTree<ElementType>::Release()
+{
+	if (nodeFile != NULL)
+	{
+		delete nodeFile;
+		nodeFile = NULL;
+	}
+	else
+	{
+		if (nodes != NULL)
+			FreeAligned(nodes);
+
+		if (elementBuffer != NULL)
+			FreeAligned(elementBuffer);
+	}
+
+	if (triangleBlocks != NULL)
+		FreeAligned(triangleBlocks);
+
+	nodes = NULL;
+	elementBuffer = NULL;
+	triangleBlocks = NULL;
 
-	if (elementBuffer != NULL)
-		FreeAligned(elementBuffer);
+	availableNodes = 0;
+	elementBufferSize = 0;
 }
 
 template <typename ElementType>
-void KDTree<ElementType>::Optimize(const AABB& bounds)
+void KDTree<ElementType>::Optimize(const AABB& bounds, Scheduler* scheduler)
 {
+	Timer buildTimer(0.0f, FLT_MAX);
+	buildTimer.Tick();
+
+	Release();
+
 	this->bounds = bounds;
+
+	uint32_t elementCount = elements.size();
+
+	BuildContext context(scheduler);
+	context.elementBounds.resize(elementCount);
+
+	uint32_t threads = std::thread::hardware_concurrency();
+	if (!threads)
+		threads = 4;
+
+	context.jobSize = std::max(elementCount / (threads * JOBS_PER_THREAD), PARALLEL_BUILD_THRESHOLD);
+
+	// Calculate the bounds of all elements once, and create a sorted list of split positions for every axis
+	BuildInput input;
+	input.elements.resize(elementCount);
+
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		AABB objectBounds;
+		elements[elementIdx]->GetPrimitive().CalculateBounds(objectBounds);
+
+		ElementBounds& elementBounds = context.elementBounds[elementIdx];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			elementBounds.lower[axis] = objectBounds.Min()[axis] - KDTree<ElementType>::POSITION_EPSILON;
+			elementBounds.upper[axis] = objectBounds.Max()[axis] + KDTree<ElementType>::POSITION_EPSILON;
+		}
+
+		input.elements[elementIdx] = elementIdx;
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		std::vector<SplitPosition>& splitPositions = input.splitPositions[axis];
+		splitPositions.reserve(elementCount * 2);
+
+		for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+			AddSplitPositions(context.elementBounds[elementIdx], axis, elementIdx, splitPositions);
+
+		// This is the only sort during the build, child nodes filter the sorted list of their parent
+		std::sort(splitPositions.begin(), splitPositions.end(), SortSplitPosition);
+	}
+
+	if (perfectSplits)
+		input.bounds = context.elementBounds;
 	
-	// Create the index buffer which holds a list of element indices in all nodes
-	elementBufferSize = elements.size() * maxDepth * 2;
-	elementBufferOffset = 0;
-	elementBuffer = AllocateAligned<ElementType*>(4, elementBufferSize);
-	
-	// Create the root node and recursively build the tree
-	CreateNode(0, bounds, elements);
+	// Recursively build the tree. Large subtrees are handed to the scheduler
+	bool allowJobs = scheduler != NULL && elementCount > PARALLEL_BUILD_THRESHOLD;
+
+	std::vector<BuildNode> buildNodes;
+	buildNodes.push_back(BuildNode());
+
+	CreateNode(context, buildNodes, 0, bounds, input, 0, allowJobs);
+
+	context.jobs.WaitForCompletion();
+
+	// Convert the build nodes to the final node layout
+	FlattenTree(buildNodes);
+	PackLeaves();
+
+	context.jobs.Clear();
+
+	buildTime = buildTimer.Poll();
 }
 
 template <typename ElementType>
@@ -56,6 +151,7 @@ void KDTree<ElementType>::Analyze() const
 	uint32_t maxDepth = 0;
 	uint32_t largestLeafSize = 0;
 	uint32_t totalElements = 0;
+	uint32_t usedNodes = 0;
 
 	struct ScheduledNode
 	{
@@ -77,6 +173,8 @@ void KDTree<ElementType>::Analyze() const
 		node = nodesLeft.back();
 		nodesLeft.pop_back();
 
+		++usedNodes;
+
 		if (node.ptr->IsLeaf())
 		{
 			++leaves;
@@ -103,36 +201,204 @@ void KDTree<ElementType>::Analyze() const
 		}
 	}
 
-	printf("[KDTree]: Optimized with %u leaves, %u empty; Largest leaf: %u/%u; Max depth: %u\n",
-		leaves, emptyLeaves, largestLeafSize, totalElements, maxDepth);
+	printf("[KDTree]: Optimized with %u leaves, %u empty; Largest leaf: %u/%u; Max depth: %u; Build time: %.0fms\n",
+		leaves, emptyLeaves, largestLeafSize, totalElements, maxDepth, buildTime * 1000);
+
+	// Compare with the layout of a depth first node array and an element pointer buffer reserved for the deepest possible tree.
+	// Those nodes stored a pointer next to their flags, which pads them to pointer alignment
+	const size_t unpackedNodeSize = ((sizeof(uint32_t) + sizeof(void*) + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+
+	size_t memoryUsage = GetMemoryUsage();
+	size_t unpackedMemoryUsage = memoryUsage - availableNodes * sizeof(KDTreeNode<ElementType>) - elementBufferSize * sizeof(uint32_t) +
+		usedNodes * unpackedNodeSize + elements.size() * this->maxDepth * 2 * sizeof(ElementType*);
+
+	printf("[KDTree]: Memory usage: %.1fKB; %u nodes in %u cache lines, %u padding; %u element indices; Unpacked layout: %.1fKB\n",
+		memoryUsage / 1024.0f, availableNodes, (availableNodes + TREELET_SIZE - 1) / TREELET_SIZE, availableNodes - usedNodes, elementBufferSize,
+		unpackedMemoryUsage / 1024.0f);
+}
+
+template <typename ElementType>
+size_t KDTree<ElementType>::GetMemoryUsage() const
+{
+	size_t memoryUsage = availableNodes * sizeof(KDTreeNode<ElementType>) + elementBufferSize * sizeof(uint32_t);
+
+	if (triangleBlocks != NULL)
+		memoryUsage += (elementBufferSize / LEAF_ALIGNMENT) * sizeof(TriangleBlock);
+
+	return memoryUsage;
+}
+
+template <typename ElementType>
+bool KDTree<ElementType>::Save(const char* fileName, uint64_t contentHash) const
+{
+	assert(nodes != NULL);
+
+	FILE* filePtr;
+	errno_t result = fopen_s(&filePtr, fileName, "wb");
+
+	if (result != 0)
+	{
+		printf("[KDTree]: Failed to open file \"%s\". Error code: %d\n", fileName, result);
+		return false;
+	}
+
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.contentHash = contentHash;
+	header.elementCount = elements.size();
+	header.maxDepth = maxDepth;
+	header.leafAlignment = LEAF_ALIGNMENT;
+	header.perfectSplits = perfectSplits;
+	header.traversalCost = TRAVERSAL_COST;
+	header.intersectionCost = INTERSECTION_COST;
+	header.emptyBonus = EMPTY_BONUS;
+	header.positionEpsilon = POSITION_EPSILON;
+	header.nodeSize = sizeof(KDTreeNode<ElementType>);
+	header.nodeCount = availableNodes;
+	header.elementBufferSize = elementBufferSize;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		header.boundsMin[axis] = bounds.Min()[axis];
+		header.boundsMax[axis] = bounds.Max()[axis];
+	}
+
+	// The nodes are aligned to cache lines in the file, so that the treelets stay intact when used from the mapped file
+	header.nodeOffset = (sizeof(header) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	header.elementOffset = header.nodeOffset + (uint64_t) header.nodeCount * header.nodeSize;
+
+	fwrite(&header, sizeof(header), 1, filePtr);
+
+	const uchar padding[CACHE_LINE_SIZE] = { 0 };
+	fwrite(padding, 1, (size_t) (header.nodeOffset - sizeof(header)), filePtr);
+
+	fwrite(nodes, header.nodeSize, header.nodeCount, filePtr);
+
+	if (elementBufferSize > 0)
+		fwrite(elementBuffer, sizeof(uint32_t), elementBufferSize, filePtr);
+
+	bool success = ferror(filePtr) == 0;
+	fclose(filePtr);
+
+	if (!success)
+	{
+		printf("[KDTree]: Failed to write file \"%s\"\n", fileName);
+		remove(fileName);
+	}
+
+	return success;
 }
 
 template <typename ElementType>
-void KDTree<ElementType>::CreateNode(uint32_t nodeIdx, const AABB& bounds, const std::vector<ElementType*>& elements, int depth)
+bool KDTree<ElementType>::Load(const char* fileName, uint64_t contentHash)
 {
-	if (nodeIdx >= availableNodes)
+	Timer loadTimer(0.0f, FLT_MAX);
+	loadTimer.Tick();
+
+	MappedFile* file = new MappedFile();
+
+	if (!file->Open(fileName) || file->GetSize() < sizeof(FileHeader))
+	{
+		delete file;
+		return false;
+	}
+
+	const uchar* data = file->GetData();
+	const FileHeader& header = *reinterpret_cast<const FileHeader*>(data);
+
+	bool valid = header.magic == FILE_MAGIC && header.version == FILE_VERSION &&
+				 header.contentHash == contentHash && header.elementCount == elements.size() &&
+				 header.maxDepth == maxDepth && header.leafAlignment == LEAF_ALIGNMENT && header.perfectSplits == (uint32_t) perfectSplits &&
+				 header.traversalCost == TRAVERSAL_COST && header.intersectionCost == INTERSECTION_COST &&
+				 header.emptyBonus == EMPTY_BONUS && header.positionEpsilon == POSITION_EPSILON &&
+				 header.nodeSize == sizeof(KDTreeNode<ElementType>) && header.nodeCount > 0 &&
+				 header.elementOffset == header.nodeOffset + (uint64_t) header.nodeCount * header.nodeSize &&
+				 file->GetSize() >= header.elementOffset + (uint64_t) header.elementBufferSize * sizeof(uint32_t);
+
+	if (!valid)
 	{
-		uint32_t desiredNodes = std::max(2 * availableNodes, 512U);
-		KDTreeNode<ElementType>* newNodes = AllocateAligned<KDTreeNode<ElementType>>(8, desiredNodes);
-		if (availableNodes > 0)
+		printf("[KDTree]: Tree file \"%s\" doesn't match the elements or build parameters\n", fileName);
+
+		delete file;
+		return false;
+	}
+
+	Release();
+
+	nodeFile = file;
+
+	nodes = const_cast<KDTreeNode<ElementType>*>(reinterpret_cast<const KDTreeNode<ElementType>*>(data + header.nodeOffset));
+	availableNodes = header.nodeCount;
+
+	// The element buffer is stored in the same format, but is only used after checking that all indices are valid
+	elementBuffer = const_cast<uint32_t*>(reinterpret_cast<const uint32_t*>(data + header.elementOffset));
+	elementBufferSize = header.elementBufferSize;
+
+	for (uint32_t bufferIdx = 0; bufferIdx < elementBufferSize; ++bufferIdx)
+	{
+		uint32_t elementIdx = elementBuffer[bufferIdx];
+
+		if (elementIdx != UINT32_MAX && elementIdx >= elements.size())
 		{
-			memcpy(newNodes, nodes, availableNodes * sizeof(KDTreeNode<ElementType>));
-			FreeAligned(nodes);
+			printf("[KDTree]: Tree file \"%s\" has an invalid element index\n", fileName);
+
+			Release();
+			return false;
 		}
+	}
+
+	// Children are always placed behind their parent, so this also rules out cycles. Leaves have to start at a new triangle block.
+	// Since parents are visited first, the depth of a node is final once it is reached. Deeper trees would overflow the traversal stacks
+	std::vector<uint32_t> depths(availableNodes, 0);
+	uint32_t depthLimit = maxDepth < MAX_DEPTH ? maxDepth : MAX_DEPTH;
+
+	for (uint32_t nodeIdx = 0; nodeIdx < availableNodes; ++nodeIdx)
+	{
+		const KDTreeNode<ElementType>& node = nodes[nodeIdx];
+
+		bool validNode;
 
-		nodes = newNodes;
-		availableNodes = desiredNodes;
+		if (node.IsLeaf())
+			validNode = (uint64_t) node.GetElementOffset() + node.GetElementCount() <= elementBufferSize && node.GetElementOffset() % LEAF_ALIGNMENT == 0;
+		else
+		{
+			validNode = node.GetUpperNode() > nodeIdx && node.GetUpperNode() + 1 < availableNodes && depths[nodeIdx] < depthLimit;
+
+			if (validNode)
+			{
+				depths[node.GetUpperNode()] = std::max(depths[node.GetUpperNode()], depths[nodeIdx] + 1);
+				depths[node.GetUpperNode() + 1] = std::max(depths[node.GetUpperNode() + 1], depths[nodeIdx] + 1);
+			}
+		}
+
+		if (!validNode)
+		{
+			printf("[KDTree]: Tree file \"%s\" has an invalid node\n", fileName);
+
+			Release();
+			return false;
+		}
 	}
-	
-	KDTreeNode<ElementType>* node = nodes + nodeIdx;
 
-	if (nodeIdx > lastNode)
-		lastNode = nodeIdx;
+	bounds = AABB(Vector3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]), Vector3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]));
+
+	PackLeaves();
 
+	buildTime = loadTimer.Poll();
+
+	return true;
+}
+
+template <typename ElementType>
+void KDTree<ElementType>::CreateNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, const AABB& bounds, BuildInput& input, uint32_t depth, bool allowJobs)
+{
 	// If we are at the maximum tree depth, this will always be a leaf node
 	if (depth >= maxDepth)
 	{
-		InitialiseLeaf(node, elements);
+		buildNodes[nodeIdx].elements.swap(input.elements);
 		return;
 	}
 
@@ -140,145 +406,319 @@ void KDTree<ElementType>::CreateNode(uint32_t nodeIdx, const AABB& bounds, const
 	float volume = bounds.Width() * bounds.Height() * bounds.Depth();
 	if (volume < 1e-3f)
 	{
-		InitialiseLeaf(node, elements);
+		buildNodes[nodeIdx].elements.swap(input.elements);
 		return;
 	}
 		
 	// If the splitting algorithm can't find a split point which whill improve the tree, create a leaf
 	int axis = depth % 3;
 	float splitPoint, splitCost;
-	//if (!SplitFast(elements, bounds, axis, splitPoint))
-	if (!SplitSAH(axis, elements, bounds, splitPoint, splitCost))
-	//if (!SplitSAH(elements, bounds, axis, splitPoint)) // Choose best axis to split this node
+	bool split;
+
+	if (perfectSplits)
+	{
+		// Choose the axis with the cheapest split
+		split = false;
+		splitCost = FLT_MAX;
+
+		for (int candidateAxis = 0; candidateAxis < 3; ++candidateAxis)
+		{
+			float candidatePoint, candidateCost;
+
+			if (SplitClippedSAH(candidateAxis, input, bounds, candidatePoint, candidateCost) && candidateCost < splitCost)
+			{
+				axis = candidateAxis;
+				splitPoint = candidatePoint;
+				splitCost = candidateCost;
+				split = true;
+			}
+		}
+	}
+	else
+		split = SplitSAH(axis, context, input, bounds, splitPoint, splitCost);
+
+	if (!split)
 	{
-		InitialiseLeaf(node, elements);
+		buildNodes[nodeIdx].elements.swap(input.elements);
 		return;
 	}
 
-	std::vector<ElementType*> upperElements;
-	std::vector<ElementType*> lowerElements;
+	AABB upperBounds, lowerBounds;
+	CalculateBounds(bounds, axis, splitPoint, upperBounds, lowerBounds);
+
+	BuildInput upperInput;
+	BuildInput lowerInput;
 
 	// Relocate all objects in this leaf to the child nodes they intersect
-	uint32_t elementCount = elements.size();
+	uint32_t elementCount = input.elements.size();
+
+	std::vector<uint32_t> upperIndices(elementCount);
+	std::vector<uint32_t> lowerIndices(elementCount);
+	std::vector<int> sides(elementCount);
+
+	// Elements on both sides of the plane are clipped to the child nodes when building with perfect splits
+	std::vector<uint32_t> upperClipped, lowerClipped;
+
 	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
 	{
-		const Primitive& primitive = elements[elementIdx]->GetPrimitive();
+		uint32_t element = input.elements[elementIdx];
 
 		// Determine which side of the plane this object is
-		int side = primitive.SideOfAAPlane(axis, splitPoint);
+		int side;
+
+		if (perfectSplits)
+		{
+			const ElementBounds& elementBounds = input.bounds[elementIdx];
+			side = elementBounds.upper[axis] <= splitPoint ? -1 : (elementBounds.lower[axis] >= splitPoint ? 1 : 0);
+		}
+		else
+			side = elements[element]->GetPrimitive().SideOfAAPlane(axis, splitPoint);
+
+		sides[elementIdx] = side;
 
 		if (side >= 0)
-			upperElements.push_back(elements[elementIdx]);
+		{
+			upperIndices[elementIdx] = upperInput.elements.size();
+			upperInput.elements.push_back(element);
+
+			if (perfectSplits)
+			{
+				if (side == 0)
+				{
+					upperClipped.push_back(upperIndices[elementIdx]);
+					upperInput.bounds.push_back(ClipElement(element, input.bounds[elementIdx], upperBounds));
+				}
+				else
+					upperInput.bounds.push_back(input.bounds[elementIdx]);
+			}
+		}
 
 		if (side <= 0)
-			lowerElements.push_back(elements[elementIdx]);
+		{
+			lowerIndices[elementIdx] = lowerInput.elements.size();
+			lowerInput.elements.push_back(element);
+
+			if (perfectSplits)
+			{
+				if (side == 0)
+				{
+					lowerClipped.push_back(lowerIndices[elementIdx]);
+					lowerInput.bounds.push_back(ClipElement(element, input.bounds[elementIdx], lowerBounds));
+				}
+				else
+					lowerInput.bounds.push_back(input.bounds[elementIdx]);
+			}
+		}
 	}
+
+	// Distribute the split positions over the child nodes. This keeps them sorted
+	for (int splitAxis = 0; splitAxis < 3; ++splitAxis)
+	{
+		const std::vector<SplitPosition>& splitPositions = input.splitPositions[splitAxis];
+
+		std::vector<SplitPosition>& upperPositions = upperInput.splitPositions[splitAxis];
+		std::vector<SplitPosition>& lowerPositions = lowerInput.splitPositions[splitAxis];
+
+		for (auto it = splitPositions.begin(); it != splitPositions.end(); ++it)
+		{
+			SplitPosition splitPosition = *it;
+			int side = sides[splitPosition.element];
+
+			// The split positions of clipped elements are generated again
+			if (perfectSplits && side == 0)
+				continue;
+
+			if (side >= 0)
+			{
+				splitPosition.element = upperIndices[it->element];
+				upperPositions.push_back(splitPosition);
+			}
+
+			if (side <= 0)
+			{
+				splitPosition.element = lowerIndices[it->element];
+				lowerPositions.push_back(splitPosition);
+			}
+		}
+	}
+
+	if (perfectSplits)
+	{
+		MergeClippedSplitPositions(upperInput, upperClipped);
+		MergeClippedSplitPositions(lowerInput, lowerClipped);
+	}
+
+	// The input for this node is no longer needed, release it before building the subtrees
+	input = BuildInput();
 	
-	uint32_t upperNodeIdx = lastNode + 1;
-	lastNode += 2;
-	node->InitialiseNonLeaf(splitPoint, axis, upperNodeIdx);
+	uint32_t upperNodeIdx = buildNodes.size();
+	buildNodes.resize(buildNodes.size() + 2);
+
+	BuildNode& node = buildNodes[nodeIdx];
+	node.axis = axis;
+	node.splitPoint = splitPoint;
+	node.upperNode = upperNodeIdx;
 
 	// Try to optimize child nodes
-	AABB upperBounds, lowerBounds;
-	CalculateBounds(bounds, axis, splitPoint, upperBounds, lowerBounds);
-	
-	CreateNode(upperNodeIdx, upperBounds, upperElements, depth + 1);
-	CreateNode(upperNodeIdx + 1, lowerBounds, lowerElements, depth + 1);
+	CreateChildNode(context, buildNodes, upperNodeIdx, upperBounds, upperInput, depth + 1, allowJobs);
+	CreateChildNode(context, buildNodes, upperNodeIdx + 1, lowerBounds, lowerInput, depth + 1, allowJobs);
 }
 
 template <typename ElementType>
-void KDTree<ElementType>::InitialiseLeaf(KDTreeNode<ElementType>* node, const std::vector<ElementType*>& elements)
+void KDTree<ElementType>::CreateChildNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, const AABB& bounds, BuildInput& input, uint32_t depth, bool allowJobs)
 {
-	uint32_t elementCount = elements.size();
+	uint32_t elementCount = input.elements.size();
 
-	assert((elementBufferOffset + elementCount) < elementBufferSize);
+	// Small subtrees are not worth the scheduling overhead
+	if (!allowJobs || elementCount < PARALLEL_BUILD_THRESHOLD)
+	{
+		CreateNode(context, buildNodes, nodeIdx, bounds, input, depth, false);
+		return;
+	}
 
-	// Reserve space in the element index bufer for all indices
-	ElementType** nodeElements = elementBuffer + elementBufferOffset;
-	elementBufferOffset += elementCount;
+	// Keep splitting on this thread until the subtree is small enough to be built by a single job
+	if (elementCount > context.jobSize)
+	{
+		CreateNode(context, buildNodes, nodeIdx, bounds, input, depth, true);
+		return;
+	}
 
-	// Copy indices to the buffer for the node
-	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
-		nodeElements[elementIdx] = elements[elementIdx];
+	BuildJob* job = new BuildJob(*this, context, bounds, depth);
+	job->input.elements.swap(input.elements);
+
+	for (int axis = 0; axis < 3; ++axis)
+		job->input.splitPositions[axis].swap(input.splitPositions[axis]);
+
+	job->input.bounds.swap(input.bounds);
 
-	node->InitialiseLeaf(nodeElements, elementCount);
+	buildNodes[nodeIdx].job = job;
+
+	context.jobs.Schedule(job);
 }
 
 template <typename ElementType>
-bool KDTree<ElementType>::SplitSAH(const std::vector<ElementType*>& elements, const AABB& bounds, int& bestAxis, float& bestSplitPosition)
+void KDTree<ElementType>::FlattenTree(const std::vector<BuildNode>& buildNodes)
 {
-	bool willSplit = false;
-	float lowestCost = FLT_MAX;
+	// Unused slots at the end of a cache line are filled with empty leaves, these are never visited
+	KDTreeNode<ElementType> paddingNode;
+	paddingNode.InitialiseLeaf(0, 0);
 
-	const Vector3& min = bounds.Min();
-	const Vector3& max = bounds.Max();
+	std::vector<KDTreeNode<ElementType>> flatNodes(1, paddingNode);
+	std::vector<FlattenEntry> leaves;
 
-	// Find the best axis to split along by calculating the split cost for each axis
-	for (int axis = 0; axis < 3; ++axis)
+	// Inner nodes that have been placed, but whose children still have to be placed in a treelet
+	std::vector<FlattenEntry> treeletRoots;
+	std::vector<FlattenEntry> treeletNodes;
+
+	FlattenEntry root = FlattenEntry::Resolve(buildNodes, 0, 0);
+
+	if (root.buildNode->axis == 3)
+		leaves.push_back(root);
+	else
+		treeletRoots.push_back(root);
+
+	while (!treeletRoots.empty())
 	{
-		float splitPosition, cost;
-		if (SplitSAH(axis, elements, bounds, splitPosition, cost))
+		treeletNodes.clear();
+		treeletNodes.push_back(treeletRoots.back());
+		treeletRoots.pop_back();
+
+		// Start at a new cache line if less than two pairs of children fit in the current one
+		uint32_t freeNodes = TREELET_SIZE - flatNodes.size() % TREELET_SIZE;
+
+		if (freeNodes < 4)
 		{
-			willSplit = true;
+			flatNodes.resize(flatNodes.size() + freeNodes, paddingNode);
+			freeNodes = TREELET_SIZE;
+		}
 
-			if (cost < lowestCost)
+		// Place pairs of children in breadth first order, until the cache line is full
+		uint32_t entryIdx = 0;
+
+		for (; entryIdx < treeletNodes.size() && freeNodes >= 2; ++entryIdx)
+		{
+			FlattenEntry entry = treeletNodes[entryIdx];
+
+			uint32_t upperNodeIdx = flatNodes.size();
+			flatNodes.resize(upperNodeIdx + 2, paddingNode);
+			freeNodes -= 2;
+
+			flatNodes[entry.nodeIdx].InitialiseNonLeaf(entry.buildNode->splitPoint, entry.buildNode->axis, upperNodeIdx);
+
+			for (uint32_t childIdx = 0; childIdx < 2; ++childIdx)
 			{
-				lowestCost = cost;
-				bestAxis = axis;
-				bestSplitPosition = splitPosition;
+				FlattenEntry child = FlattenEntry::Resolve(*entry.buildNodes, entry.buildNode->upperNode + childIdx, upperNodeIdx + childIdx);
+
+				if (child.buildNode->axis == 3)
+					leaves.push_back(child);
+				else
+					treeletNodes.push_back(child);
 			}
 		}
+
+		// The nodes that didn't fit become the roots of the next treelets, which are placed in depth first order
+		for (uint32_t remainingIdx = treeletNodes.size(); remainingIdx > entryIdx; --remainingIdx)
+			treeletRoots.push_back(treeletNodes[remainingIdx - 1]);
 	}
-	
-	return willSplit;
-}
 
+	availableNodes = flatNodes.size();
+	nodes = AllocateAligned<KDTreeNode<ElementType>>(CACHE_LINE_SIZE, availableNodes);
+	memcpy(nodes, &flatNodes[0], availableNodes * sizeof(KDTreeNode<ElementType>));
+
+	// The size of all leaves is known now, so the element buffer doesn't have to be reserved for the worst case
+	elementBufferSize = 0;
+
+	for (auto it = leaves.begin(); it != leaves.end(); ++it)
+		elementBufferSize += ((it->buildNode->elements.size() + LEAF_ALIGNMENT - 1) / LEAF_ALIGNMENT) * LEAF_ALIGNMENT;
+
+	elementBuffer = AllocateAligned<uint32_t>(CACHE_LINE_SIZE, std::max(elementBufferSize, 1U));
+
+	uint32_t elementOffset = 0;
+
+	for (auto it = leaves.begin(); it != leaves.end(); ++it)
+		InitialiseLeaf(nodes + it->nodeIdx, it->buildNode->elements, elementOffset);
+
+	assert(elementOffset == elementBufferSize);
+}
 
 template <typename ElementType>
-bool KDTree<ElementType>::SplitSAH(int axis, const std::vector<ElementType*>& elements, const AABB& bounds, float& bestSplitPosition, float& lowestCost)
+void KDTree<ElementType>::InitialiseLeaf(KDTreeNode<ElementType>* node, const std::vector<uint32_t>& elementIndices, uint32_t& elementOffset)
 {
-	const Vector3& max = bounds.Max();
-	const Vector3& min = bounds.Min();
+	uint32_t elementCount = elementIndices.size();
+	uint32_t reservedCount = ((elementCount + LEAF_ALIGNMENT - 1) / LEAF_ALIGNMENT) * LEAF_ALIGNMENT;
 
-	uint32_t elementCount = elements.size();
-	float dontSplitCost = KDTree<ElementType>::INTERSECTION_COST * elementCount;
+	assert((elementOffset + reservedCount) <= elementBufferSize);
+
+	// Copy indices to the buffer for the node
+	uint32_t* nodeElements = elementBuffer + elementOffset;
 
-	// Initialize a potentional position list with two positions per object
-	splitPositions.clear();
-	splitPositions.reserve(elementCount * 2);
-	
-	// Iterate through all objects in this leaf
 	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
-	{
-		// Calculate axis aligned boundaries for this shape
-		AABB objectBounds;
-		elements[elementIdx]->GetPrimitive().CalculateBounds(objectBounds);
+		nodeElements[elementIdx] = elementIndices[elementIdx];
 
-		// Save the minimum and maximum position for the bounds
-		SplitPosition splitPosition;
+	for (uint32_t elementIdx = elementCount; elementIdx < reservedCount; ++elementIdx)
+		nodeElements[elementIdx] = UINT32_MAX;
 
-		float oMin = objectBounds.Min()[axis] - KDTree<ElementType>::POSITION_EPSILON;
-		float oMax = objectBounds.Max()[axis] + KDTree<ElementType>::POSITION_EPSILON;
+	node->InitialiseLeaf(elementOffset, elementCount);
+	elementOffset += reservedCount;
+}
 
-		// If the primitive intersects the outer bounds, skip it
-		if (oMin <= min[axis] || oMax >= max[axis])
-			continue;
+template <typename ElementType>
+void KDTree<ElementType>::PackLeaves()
+{
+	// Only trees of mesh triangles have a packed layout
+}
 
-		// If the primitive has zero length on this axis, skip it
-		if (fabs(oMin - oMax) < KDTree<ElementType>::POSITION_EPSILON)
-			continue;
+template <typename ElementType>
+bool KDTree<ElementType>::SplitSAH(int axis, const BuildContext& context, const BuildInput& input, const AABB& bounds, float& bestSplitPosition, float& lowestCost) const
+{
+	const Vector3& max = bounds.Max();
+	const Vector3& min = bounds.Min();
 
-		splitPosition.position = oMin;
-		splitPosition.event = SplitPosition::PRIMITIVE_START;
-		splitPositions.push_back(splitPosition);
-		
-		splitPosition.position = oMax;
-		splitPosition.event = SplitPosition::PRIMITIVE_END;
-		splitPositions.push_back(splitPosition);
-	}
+	uint32_t elementCount = input.elements.size();
+	float dontSplitCost = KDTree<ElementType>::INTERSECTION_COST * elementCount;
 
-	// Sort split positions on the axis
-	std::sort(splitPositions.begin(), splitPositions.end(), SortSplitPosition);
+	// The split positions for this axis are already sorted
+	const std::vector<SplitPosition>& splitPositions = input.splitPositions[axis];
 
 	// Calculate the length of this node
 	float rootLength = max[axis] - min[axis];
@@ -302,6 +742,11 @@ bool KDTree<ElementType>::SplitSAH(int axis, const std::vector<ElementType*>& el
 	for (uint32_t pointIdx = 0, pointCount = splitPositions.size(); pointIdx < pointCount; ++pointIdx)
 	{
 		const SplitPosition& splitPosition = splitPositions[pointIdx];
+		const ElementBounds& elementBounds = context.elementBounds[input.elements[splitPosition.element]];
+
+		// If the primitive intersects the outer bounds, skip it
+		if (elementBounds.lower[axis] <= min[axis] || elementBounds.upper[axis] >= max[axis])
+			continue;
 
 		if (addToLower)
 			++lowerObjectCount;
@@ -346,44 +791,149 @@ bool KDTree<ElementType>::SplitSAH(int axis, const std::vector<ElementType*>& el
 }
 
 template <typename ElementType>
-bool KDTree<ElementType>::SplitFast(const std::vector<ElementType*>& elements, const AABB& bounds, int& bestAxis, float& bestSplitPosition)
+bool KDTree<ElementType>::SplitClippedSAH(int axis, const BuildInput& input, const AABB& bounds, float& bestSplitPosition, float& lowestCost) const
 {
-	if (elements.size() < 25)
-		return false;
-
-	const Vector3& min = bounds.Min();
 	const Vector3& max = bounds.Max();
+	const Vector3& min = bounds.Min();
+
+	uint32_t elementCount = input.elements.size();
+	float dontSplitCost = KDTree<ElementType>::INTERSECTION_COST * elementCount;
+
+	const std::vector<SplitPosition>& splitPositions = input.splitPositions[axis];
+
+	// Calculate the surface of this node
+	int upperAxis = (axis + 1) % 3;
+	int lowerAxis = (axis + 2) % 3;
+	float width = max[upperAxis] - min[upperAxis];
+	float height = max[lowerAxis] - min[lowerAxis];
+	float rootArea = bounds.Area();
+
+	// Elements go to the lower node if they start before the split position, and to the upper node if they end after it
+	uint32_t lowerObjectCount = 0;
+	uint32_t upperObjectCount = elementCount;
 
-	// Find the longest axis and use that as split axis
-	float dx = max[0] - min[0];
-	float dy = max[1] - min[1];
-	float dz = max[2] - min[2];
+	lowestCost = FLT_MAX;
 
-	int axis;
-	if (dx > dz)
+	for (uint32_t pointIdx = 0, pointCount = splitPositions.size(); pointIdx < pointCount; )
 	{
-		if (dx > dy)
-			axis = 0;
-		else
-			axis = 1;
+		float position = splitPositions[pointIdx].position;
+
+		// Handle all events at the same position at once
+		uint32_t starts = 0, ends = 0;
+
+		for (; pointIdx < pointCount && splitPositions[pointIdx].position == position; ++pointIdx)
+		{
+			if (splitPositions[pointIdx].event == SplitPosition::PRIMITIVE_START)
+				++starts;
+			else
+				++ends;
+		}
+
+		upperObjectCount -= ends;
+
+		// Positions on or outside the node bounds would create an empty child node
+		if (position > min[axis] && position < max[axis])
+		{
+			float upperLength = max[axis] - position;
+			float lowerLength = position - min[axis];
+
+			float upperArea = 2 * (width * height + height * upperLength + width * upperLength);
+			float lowerArea = 2 * (width * height + height * lowerLength + width * lowerLength);
+			float emptyBonus = (lowerObjectCount == 0 || upperObjectCount == 0) ? KDTree<ElementType>::EMPTY_BONUS : 0.0f;
+
+			float cost = KDTree<ElementType>::TRAVERSAL_COST + KDTree<ElementType>::INTERSECTION_COST * (1.0f - emptyBonus) *
+													((upperArea / rootArea) * upperObjectCount + (lowerArea / rootArea) * lowerObjectCount);
+
+			if (cost < lowestCost)
+			{
+				lowestCost = cost;
+				bestSplitPosition = position;
+			}
+		}
+
+		lowerObjectCount += starts;
 	}
-	else
+
+	return lowestCost < dontSplitCost;
+}
+
+template <typename ElementType>
+typename KDTree<ElementType>::ElementBounds KDTree<ElementType>::ClipElement(uint32_t element, const ElementBounds& elementBounds, const AABB& bounds) const
+{
+	ElementBounds clippedBounds = elementBounds;
+
+	AABB primitiveBounds;
+	const Vector3* lower = &bounds.Min();
+	const Vector3* upper = &bounds.Max();
+
+	// Rounding can make an element that straddles the split plane miss the child node, it is kept with its bounds limited to the node then
+	if (elements[element]->GetPrimitive().CalculateClippedBounds(bounds, primitiveBounds))
 	{
-		if (dz > dy)
-			axis = 2;
-		else
-			axis = 1;
+		lower = &primitiveBounds.Min();
+		upper = &primitiveBounds.Max();
 	}
 
-	// The split point is halfway this axis
-	bestAxis = axis;
-	bestSplitPosition = (min[axis] + max[axis]) / 2.0f;
+	// The clipped bounds never grow, so that the element stays on the same side of the planes of its ancestors
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		clippedBounds.lower[axis] = std::max(elementBounds.lower[axis], (*lower)[axis] - KDTree<ElementType>::POSITION_EPSILON);
+		clippedBounds.upper[axis] = std::min(elementBounds.upper[axis], (*upper)[axis] + KDTree<ElementType>::POSITION_EPSILON);
+	}
 
-	return true;
+	return clippedBounds;
 }
 
 template <typename ElementType>
-void KDTree<ElementType>::CalculateBounds(const AABB& bounds, int axis, float splitPoint, AABB& upper, AABB& lower)
+void KDTree<ElementType>::MergeClippedSplitPositions(BuildInput& input, const std::vector<uint32_t>& clippedElements) const
+{
+	if (clippedElements.empty())
+		return;
+
+	std::vector<SplitPosition> clippedPositions, mergedPositions;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		clippedPositions.clear();
+
+		for (auto it = clippedElements.begin(); it != clippedElements.end(); ++it)
+			AddSplitPositions(input.bounds[*it], axis, *it, clippedPositions);
+
+		// Only the clipped elements have to be sorted, the other positions are still sorted
+		std::sort(clippedPositions.begin(), clippedPositions.end(), SortSplitPosition);
+
+		std::vector<SplitPosition>& splitPositions = input.splitPositions[axis];
+
+		mergedPositions.resize(splitPositions.size() + clippedPositions.size());
+		std::merge(splitPositions.begin(), splitPositions.end(), clippedPositions.begin(), clippedPositions.end(), mergedPositions.begin(), SortSplitPosition);
+
+		splitPositions.swap(mergedPositions);
+	}
+}
+
+template <typename ElementType>
+void KDTree<ElementType>::AddSplitPositions(const ElementBounds& elementBounds, int axis, uint32_t element, std::vector<SplitPosition>& splitPositions)
+{
+	float oMin = elementBounds.lower[axis];
+	float oMax = elementBounds.upper[axis];
+
+	// If the primitive has zero length on this axis, skip it
+	if (fabs(oMin - oMax) < KDTree<ElementType>::POSITION_EPSILON)
+		return;
+
+	SplitPosition splitPosition;
+	splitPosition.element = element;
+
+	splitPosition.position = oMin;
+	splitPosition.event = SplitPosition::PRIMITIVE_START;
+	splitPositions.push_back(splitPosition);
+
+	splitPosition.position = oMax;
+	splitPosition.event = SplitPosition::PRIMITIVE_END;
+	splitPositions.push_back(splitPosition);
+}
+
+template <typename ElementType>
+void KDTree<ElementType>::CalculateBounds(const AABB& bounds, int axis, float splitPoint, AABB& upper, AABB& lower) const
 {
 	const Vector3& min = bounds.Min();
 	const Vector3& max = bounds.Max();
@@ -410,10 +960,24 @@ bool KDTree<ElementType>::IntersectRay(const Ray& ray, RaycastHit& hitInfo, floa
 
 	// Somehow, if we use std::min(maxDistance, tMax) as max distance, this sometimes misses intersection.
 	// TODO: Test why this is.
-	return IntersectRaySec(ray, hitInfo, std::max(0.0f, tMin), maxDistance);
+	return IntersectRaySec(nodes, ray, hitInfo, std::max(0.0f, tMin), maxDistance);
 	//return IntersectRayRec(&nodes[0], ray, hitInfo, std::max(0.0f, tMin), maxDistance);
 }
 
+template <typename ElementType>
+bool KDTree<ElementType>::Occluded(const Ray& ray, float maxDistance) const
+{
+	float tMax, tMin;
+	if (!bounds.IntersectRay(ray, tMin, tMax))
+		return false;
+
+	if (tMin > maxDistance)
+		return false;
+
+	// Like IntersectRay, the box exit distance isn't used to limit the traversal
+	return OccludedSec(ray, std::max(0.0f, tMin), maxDistance);
+}
+
 template <typename ElementType>
 bool KDTree<ElementType>::IntersectRayRec(KDTreeNode<ElementType>* node, const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const
 {
@@ -423,10 +987,11 @@ bool KDTree<ElementType>::IntersectRayRec(KDTreeNode<ElementType>* node, const R
 		float closestDistance = tMax;
 		bool hit = false;
 
-		ElementType** elements = node->GetElements();
+		const uint32_t* leafElements = GetLeafElements(node);
 		for (uint32_t elementIdx = 0, elementCount = node->GetElementCount(); elementIdx < elementCount; ++elementIdx)
 		{
-			const Shape& shape = elements[elementIdx]->GetShape();
+			ElementType* element = elements[leafElements[elementIdx]];
+			const Shape& shape = element->GetShape();
 
 			// Perform the ray-triangle intersection
 			RaycastHit shapeHitInfo;
@@ -436,7 +1001,7 @@ bool KDTree<ElementType>::IntersectRayRec(KDTreeNode<ElementType>* node, const R
 			closestDistance = shapeHitInfo.distance;
 
 			hitInfo = shapeHitInfo;
-			hitInfo.element = elements[elementIdx];
+			hitInfo.element = element;
 
 			hit = true;
 		}
@@ -498,10 +1063,10 @@ bool KDTree<ElementType>::IntersectRayRec(KDTreeNode<ElementType>* node, const R
 }
 
 template <typename ElementType>
-bool KDTree<ElementType>::IntersectRaySec(const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const
+bool KDTree<ElementType>::IntersectRaySec(const KDTreeNode<ElementType>* root, const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const
 {
 	TraversalStack stack;
-	stack.Push(nodes, tMin, tMax);
+	stack.Push(root, tMin, tMax);
 
 	while (!stack.IsEmpty())
 	{
@@ -513,6 +1078,8 @@ bool KDTree<ElementType>::IntersectRaySec(const Ray& ray, RaycastHit& hitInfo, f
 
 		while (!node->IsLeaf())
 		{
+			AR_COUNT(NODES_VISITED, 1);
+
 			int axis = node->GetAxis();
 			float splitPoint = node->GetSplitPoint();
 			
@@ -545,59 +1112,42 @@ bool KDTree<ElementType>::IntersectRaySec(const Ray& ray, RaycastHit& hitInfo, f
 			}
 		}
 
-		// The current node is a leaf node, this means we can check its contents
-		float closestDistance = tMax;
-		bool hit = false;
-
-		uint32_t elementCount = node->GetElementCount();
-		ElementType** elements = node->GetElements();
-		for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
-		{
-			const ElementType* element = elements[elementIdx];
-
-			// Perform the ray-triangle intersection
-			if (element->GetShape().IntersectRay(ray, hitInfo, closestDistance))
-			{
-				hitInfo.element = element;
-
-				closestDistance = hitInfo.distance;
-				hit = true;
-			}
-		}
+		AR_COUNT(LEAVES_VISITED, 1);
 
-		if (hit)
+		// The current node is a leaf node, this means we can check its contents
+		if (IntersectLeaf(node, ray, hitInfo, tMax))
 			return true;
 	}
 
 	return false;
 }
 
-#include "renderable.h"
-template KDTree<Renderable>;
-
-#include "meshtriangle.h"
-
-template<>
-bool KDTree<MeshTriangle>::IntersectRaySec(const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const
+template <typename ElementType>
+bool KDTree<ElementType>::OccludedSec(const Ray& ray, float tMin, float tMax) const
 {
+	// Any hit within the range of the ray counts, even if it's outside the current node
+	float maxDistance = tMax;
+
 	TraversalStack stack;
 	stack.Push(nodes, tMin, tMax);
 
 	while (!stack.IsEmpty())
 	{
 		const StackNode& stackNode = stack.Pop();
-		const KDTreeNode<MeshTriangle>* node = stackNode.node;
+		const KDTreeNode<ElementType>* node = stackNode.node;
 
 		tMin = stackNode.tMin;
 		tMax = stackNode.tMax;
 
 		while (!node->IsLeaf())
 		{
+			AR_COUNT(NODES_VISITED, 1);
+
 			int axis = node->GetAxis();
 			float splitPoint = node->GetSplitPoint();
-
-			const KDTreeNode<MeshTriangle>* nearNode;
-			const KDTreeNode<MeshTriangle>* farNode;
+			
+			const KDTreeNode<ElementType>* nearNode;
+			const KDTreeNode<ElementType>* farNode;
 
 			if (ray.origin[axis] < splitPoint)
 			{
@@ -625,31 +1175,276 @@ bool KDTree<MeshTriangle>::IntersectRaySec(const Ray& ray, RaycastHit& hitInfo,
 			}
 		}
 
-		// The current node is a leaf node, this means we can check its contents
-		hitInfo.distance = tMax;
-		bool hit = false;
+		AR_COUNT(LEAVES_VISITED, 1);
 
-		uint32_t elementCount = node->GetElementCount();
-		MeshTriangle** elements = node->GetElements();
-		for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+		if (OccludedLeaf(node, ray, maxDistance))
+			return true;
+	}
+
+	return false;
+}
+
+template <typename ElementType>
+bool KDTree<ElementType>::OccludedLeaf(const KDTreeNode<ElementType>* node, const Ray& ray, float maxDistance) const
+{
+	uint32_t elementCount = node->GetElementCount();
+	const uint32_t* leafElements = GetLeafElements(node);
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		if (elements[leafElements[elementIdx]]->GetShape().Occluded(ray, maxDistance))
+			return true;
+	}
+
+	return false;
+}
+
+template <typename ElementType>
+bool KDTree<ElementType>::IntersectLeaf(const KDTreeNode<ElementType>* node, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	float closestDistance = maxDistance;
+	bool hit = false;
+
+	uint32_t elementCount = node->GetElementCount();
+	const uint32_t* leafElements = GetLeafElements(node);
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		const ElementType* element = elements[leafElements[elementIdx]];
+
+		// Perform the ray-triangle intersection
+		if (element->GetShape().IntersectRay(ray, hitInfo, closestDistance))
 		{
-			const MeshTriangle* element = elements[elementIdx];
+			hitInfo.element = element;
 
-			// Perform the ray-triangle intersection
-			if (element->IntersectRay(ray, hitInfo, hitInfo.distance))
+			closestDistance = hitInfo.distance;
+			hit = true;
+		}
+	}
+
+	return hit;
+}
+
+template <typename ElementType>
+uint32_t KDTree<ElementType>::IntersectLeafPacket(const KDTreeNode<ElementType>* node, const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, float* maxDistance) const
+{
+	uint32_t hits = 0;
+
+	uint32_t elementCount = node->GetElementCount();
+	const uint32_t* leafElements = GetLeafElements(node);
+	for (uint32_t elementIdx = 0; elementIdx < elementCount; ++elementIdx)
+	{
+		const ElementType* element = elements[leafElements[elementIdx]];
+
+		uint32_t elementHits = element->GetShape().IntersectRayPacket(packet, hitInfo, mask, _mm_loadu_ps(maxDistance));
+
+		for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+		{
+			if ((elementHits & (1 << rayIdx)) == 0)
+				continue;
+
+			hitInfo[rayIdx].element = element;
+			maxDistance[rayIdx] = hitInfo[rayIdx].distance;
+		}
+
+		hits |= elementHits;
+	}
+
+	return hits;
+}
+
+template <typename ElementType>
+uint32_t KDTree<ElementType>::IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const
+{
+	float maxDistances[RayPacket::SIZE];
+	_mm_storeu_ps(maxDistances, maxDistance);
+
+	// Rays that don't share direction signs can't be traversed in the same order, trace them seperately
+	if (!packet.IsCoherent(mask))
+	{
+		uint32_t hits = 0;
+		for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+		{
+			if ((mask & (1 << rayIdx)) != 0 && IntersectRay(packet.rays[rayIdx], hitInfo[rayIdx], maxDistances[rayIdx]))
+				hits |= 1 << rayIdx;
+		}
+
+		return hits;
+	}
+
+	float tMins[RayPacket::SIZE];
+	
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		tMins[rayIdx] = 0.0f;
+
+		if ((mask & (1 << rayIdx)) == 0)
+			continue;
+
+		float tMin, tMax;
+		if (!bounds.IntersectRay(packet.rays[rayIdx], tMin, tMax) || tMin > maxDistances[rayIdx])
+			mask &= ~(1 << rayIdx);
+		else
+			tMins[rayIdx] = std::max(0.0f, tMin);
+	}
+
+	if (mask == 0)
+		return 0;
+
+	// Same as the single ray version, the box exit distance isn't used to limit the traversal
+	return IntersectRayPacketSec(packet, hitInfo, mask, _mm_loadu_ps(tMins), maxDistance);
+}
+
+template <typename ElementType>
+uint32_t KDTree<ElementType>::IntersectRayPacketSec(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& tMin, const __m128& tMax) const
+{
+	PacketTraversalStack stack;
+	stack.Push(nodes, mask, tMin, tMax);
+
+	uint32_t hits = 0;
+
+	// Rays that hit an element are finished and don't need to visit the nodes that are still on the stack
+	uint32_t finished = 0;
+
+	while (!stack.IsEmpty())
+	{
+		const PacketStackNode& stackNode = stack.Pop();
+		const KDTreeNode<ElementType>* node = stackNode.node;
+
+		uint32_t activeMask = stackNode.mask & ~finished;
+		__m128 nodeMin = stackNode.tMin;
+		__m128 nodeMax = stackNode.tMax;
+
+		while (activeMask != 0 && !node->IsLeaf())
+		{
+			AR_COUNT(NODES_VISITED, 1);
+
+			int axis = node->GetAxis();
+
+			// All rays in the packet have the same direction sign, so they all visit the children in the same order
+			const KDTreeNode<ElementType>* upperNode = &nodes[node->GetUpperNode()];
+			const KDTreeNode<ElementType>* lowerNode = upperNode + 1;
+
+			const KDTreeNode<ElementType>* firstNode;
+			const KDTreeNode<ElementType>* secondNode;
+
+			if ((_mm_movemask_ps(packet.direction[axis]) & activeMask) == 0)
+			{
+				firstNode = lowerNode;
+				secondNode = upperNode;
+			}
+			else
 			{
-				hitInfo.element = element;
+				firstNode = upperNode;
+				secondNode = lowerNode;
+			}
+
+			__m128 tSplit = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node->GetSplitPoint()), packet.origin[axis]), packet.invDirection[axis]);
+
+			// Comparisons are negated so that rays with a NaN split distance visit both children
+			uint32_t firstMask = _mm_movemask_ps(_mm_cmpnlt_ps(tSplit, nodeMin)) & activeMask;
+			uint32_t secondMask = _mm_movemask_ps(_mm_cmpngt_ps(tSplit, nodeMax)) & activeMask;
 
-				//closestDistance = hitInfo.distance;
-				hit = true;
+			if (firstMask == 0)
+			{
+				node = secondNode;
+				activeMask = secondMask;
+				nodeMin = _mm_max_ps(tSplit, nodeMin);
+			}
+			else if (secondMask == 0)
+			{
+				node = firstNode;
+				activeMask = firstMask;
+				nodeMax = _mm_min_ps(tSplit, nodeMax);
+			}
+			else
+			{
+				stack.Push(secondNode, secondMask, _mm_max_ps(tSplit, nodeMin), nodeMax);
+
+				node = firstNode;
+				activeMask = firstMask;
+				nodeMax = _mm_min_ps(tSplit, nodeMax);
+			}
+
+			// Packet traversal has no benefit for a single ray, continue with the regular traversal
+			if ((activeMask & (activeMask - 1)) == 0 && activeMask != 0 && !node->IsLeaf())
+			{
+				float tMins[RayPacket::SIZE], tMaxs[RayPacket::SIZE];
+				_mm_storeu_ps(tMins, nodeMin);
+				_mm_storeu_ps(tMaxs, nodeMax);
+
+				uint32_t rayIdx = 0;
+				while ((activeMask & (1 << rayIdx)) == 0)
+					++rayIdx;
+
+				if (IntersectRaySec(node, packet.rays[rayIdx], hitInfo[rayIdx], tMins[rayIdx], tMaxs[rayIdx]))
+				{
+					hits |= activeMask;
+					finished |= activeMask;
+				}
+
+				activeMask = 0;
 			}
 		}
 
-		if (hit)
-			return true;
+		if (activeMask == 0)
+			continue;
+
+		AR_COUNT(LEAVES_VISITED, 1);
+
+		// The current node is a leaf node, this means we can check its contents
+		float closestDistance[RayPacket::SIZE];
+		_mm_storeu_ps(closestDistance, nodeMax);
+
+		uint32_t leafHits = IntersectLeafPacket(node, packet, hitInfo, activeMask, closestDistance);
+
+		hits |= leafHits;
+		finished |= leafHits;
 	}
 
-	return false;
+	return hits;
+}
+
+#include "renderable.h"
+template KDTree<Renderable>;
+
+#include "meshtriangle.h"
+
+template<>
+const uint32_t KDTree<MeshTriangle>::LEAF_ALIGNMENT = TriangleBlock::SIZE;
+
+template<>
+void KDTree<MeshTriangle>::PackLeaves()
+{
+	triangleBlocks = TriangleBlock::PackLeaves(elements, elementBuffer, elementBufferSize);
+}
+
+template<>
+bool KDTree<MeshTriangle>::IntersectLeaf(const KDTreeNode<MeshTriangle>* node, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	return TriangleBlock::IntersectLeaf(triangleBlocks, node->GetElementOffset(), node->GetElementCount(), ray, hitInfo, maxDistance);
+}
+
+template<>
+bool KDTree<MeshTriangle>::OccludedLeaf(const KDTreeNode<MeshTriangle>* node, const Ray& ray, float maxDistance) const
+{
+	return TriangleBlock::OccludedLeaf(triangleBlocks, node->GetElementOffset(), node->GetElementCount(), ray, maxDistance);
+}
+
+template<>
+uint32_t KDTree<MeshTriangle>::IntersectLeafPacket(const KDTreeNode<MeshTriangle>* node, const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, float* maxDistance) const
+{
+	// Each ray is tested against a block of triangles at once instead of a triangle against all rays
+	uint32_t hits = 0;
+
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((mask & (1 << rayIdx)) != 0 && IntersectLeaf(node, packet.rays[rayIdx], hitInfo[rayIdx], maxDistance[rayIdx]))
+		{
+			maxDistance[rayIdx] = hitInfo[rayIdx].distance;
+			hits |= 1 << rayIdx;
+		}
+	}
+
+	return hits;
 }
 
 template KDTree<MeshTriangle>;
\ No newline at end of file
@@ -4,11 +4,20 @@
 #include "awesomerenderer.h"
 #include "aabb.h"
 
+#include "threading.h"
+#include "workerjob.h"
+#include "jobbatch.h"
+
 namespace AwesomeRenderer
 {
 	template<typename ElementType>
 	class KDTreeNode;
 
+	class Scheduler;
+	class RayPacket;
+	class TriangleBlock;
+	class MappedFile;
+
 	template <typename ElementType>
 	class KDTree
 	{
@@ -19,9 +28,54 @@ namespace AwesomeRenderer
 		static const float EMPTY_BONUS;
 		static const float POSITION_EPSILON;
 
+		// Subtrees with less elements than this are always built on the thread that created their parent
+		static const uint32_t PARALLEL_BUILD_THRESHOLD = 1024;
+		static const uint32_t JOBS_PER_THREAD = 8;
+
+		// The element list of every leaf starts at a multiple of this in the element buffer
+		static const uint32_t LEAF_ALIGNMENT;
+
+		// Nodes are stored in treelets of this many nodes, the size of a cache line. Every treelet holds the children of a small
+		// subtree in breadth first order, so that the first levels below a node are fetched together
+		static const uint32_t TREELET_SIZE = 8;
+		static const uint32_t CACHE_LINE_SIZE = 64;
+
+		static const uint32_t FILE_MAGIC = 0x444B5241; // "ARKD"
+		static const uint32_t FILE_VERSION = 3;
+
 		std::vector<ElementType*> elements;
 
+		// Build with perfect splits: elements are clipped to the bounds of every node before their split positions are generated,
+		// and all three axes are considered for every split. Slower to build, but large elements are shared by less leaves
+		bool perfectSplits;
+
 	private:
+		// Saved trees start with this header, followed by the node array and the element index of every entry in the element buffer
+		struct FileHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+
+			// Identifies the elements the tree was built for
+			uint64_t contentHash;
+			uint32_t elementCount;
+
+			// Build parameters, trees built with different parameters are rebuilt
+			uint32_t maxDepth;
+			uint32_t leafAlignment;
+			uint32_t perfectSplits;
+			float traversalCost, intersectionCost, emptyBonus, positionEpsilon;
+
+			uint32_t nodeSize;
+			uint32_t nodeCount;
+			uint32_t elementBufferSize;
+
+			float boundsMin[3], boundsMax[3];
+
+			uint64_t nodeOffset;
+			uint64_t elementOffset;
+		};
+
 		struct SplitPosition
 		{
 			enum Event
@@ -32,6 +86,117 @@ namespace AwesomeRenderer
 
 			float position;
 			Event event;
+
+			// Index of the element in the element list of the node being split
+			uint32_t element;
+		};
+
+		// Primitive bounds on each axis, including the position epsilon
+		struct ElementBounds
+		{
+			float lower[3];
+			float upper[3];
+		};
+
+		// Elements in a node that still has to be built, along with their split positions sorted on each axis
+		struct BuildInput
+		{
+			std::vector<uint32_t> elements;
+			std::vector<SplitPosition> splitPositions[3];
+
+			// Bounds of the elements clipped to the node, only used for perfect splits
+			std::vector<ElementBounds> bounds;
+		};
+
+		class BuildJob;
+
+		// Intermediate node representation used while building. These are flattened to the final node layout once all subtrees are finished
+		struct BuildNode
+		{
+			uint32_t axis;
+			float splitPoint;
+
+			// Index of the upper child in the same node list, the lower child is always allocated directly behind it
+			uint32_t upperNode;
+
+			// If set, this node is the root node of the subtree built by this job
+			BuildJob* job;
+
+			std::vector<uint32_t> elements;
+
+			BuildNode() : axis(3), splitPoint(0.0f), upperNode(0), job(NULL)
+			{
+
+			}
+		};
+
+		// Build node that has been given an index in the final node array, but whose children still have to be placed
+		struct FlattenEntry
+		{
+			const BuildNode* buildNode;
+			const std::vector<BuildNode>* buildNodes;
+			uint32_t nodeIdx;
+
+			// Continues with the root node of subtrees that were built by a job
+			static FlattenEntry Resolve(const std::vector<BuildNode>& buildNodes, uint32_t buildNodeIdx, uint32_t nodeIdx)
+			{
+				const std::vector<BuildNode>* nodes = &buildNodes;
+
+				while ((*nodes)[buildNodeIdx].job != NULL)
+				{
+					nodes = &(*nodes)[buildNodeIdx].job->nodes;
+					buildNodeIdx = 0;
+				}
+
+				FlattenEntry entry;
+				entry.buildNode = &(*nodes)[buildNodeIdx];
+				entry.buildNodes = nodes;
+				entry.nodeIdx = nodeIdx;
+
+				return entry;
+			}
+		};
+
+		struct BuildContext
+		{
+			std::vector<ElementBounds> elementBounds;
+
+			// Jobs that build subtrees, they are kept until their nodes are flattened
+			JobBatch jobs;
+
+			uint32_t jobSize;
+
+			BuildContext(Scheduler* scheduler) : jobs(scheduler)
+			{
+
+			}
+		};
+
+		class BuildJob : public WorkerJob
+		{
+		public:
+			KDTree<ElementType>& tree;
+			BuildContext& context;
+
+			AABB bounds;
+			BuildInput input;
+			uint32_t depth;
+
+			std::vector<BuildNode> nodes;
+
+		public:
+			BuildJob(KDTree<ElementType>& tree, BuildContext& context, const AABB& bounds, uint32_t depth) :
+				tree(tree), context(context), bounds(bounds), depth(depth)
+			{
+
+			}
+
+		protected:
+			void Run()
+			{
+				nodes.push_back(BuildNode());
+				tree.CreateNode(context, nodes, 0, bounds, input, depth, false);
+			}
 		};
 
 		struct StackNode
@@ -77,46 +242,142 @@ namespace AwesomeRenderer
 			bool IsEmpty() const { return count == 0; }
 		};
 
+		struct PacketStackNode
+		{
+			__m128 tMin, tMax;
+			const KDTreeNode<ElementType>* node;
+			uint32_t mask;
+		};
+
+		class PacketTraversalStack
+		{
+		public:
+			PacketStackNode stack[MAX_DEPTH];
+
+			uint32_t count;
+
+		public:
+			PacketTraversalStack() : count(0)
+			{
+
+			}
+
+			void Push(const KDTreeNode<ElementType>* node, uint32_t mask, const __m128& tMin, const __m128& tMax)
+			{
+				assert(count < MAX_DEPTH);
+
+				PacketStackNode& stackNode = stack[count];
+				stackNode.node = node;
+				stackNode.mask = mask;
+				stackNode.tMin = tMin;
+				stackNode.tMax = tMax;
+
+				++count;
+			}
+
+			const PacketStackNode& Pop()
+			{
+				assert(count > 0);
+
+				--count;
+
+				return stack[count];
+			}
+
+			bool IsEmpty() const { return count == 0; }
+		};
+
 		AABB bounds;
 		uint32_t maxDepth;
 
-		std::vector<SplitPosition> splitPositions;
-
 		KDTreeNode<ElementType>* nodes;
-		uint32_t lastNode;
 		uint32_t availableNodes;
 
-		ElementType** elementBuffer;
+		// Index in the element list of every element in the leaves. Leaves refer to their first entry by offset, padding of aligned leaves is UINT32_MAX
+		uint32_t* elementBuffer;
 		uint32_t elementBufferSize;
-		uint32_t elementBufferOffset;
-		
+
+		// Packed copies of the leaf elements, only used by trees that support it. Block i holds the elements at i * LEAF_ALIGNMENT in the element buffer
+		TriangleBlock* triangleBlocks;
+
+		// File that the nodes and element buffer are mapped from if the tree was loaded, these aren't allocated in that case
+		MappedFile* nodeFile;
+
+		float buildTime;
 	
 	public:
 		KDTree(uint32_t maxDepth);
 		~KDTree();
 
-		void Optimize(const AABB& bounds);
+		void Optimize(const AABB& bounds, Scheduler* scheduler = NULL);
 		void Analyze() const;
 
+		// Writes the optimized tree to a file. The content hash should identify the elements, in the order of the element list
+		bool Save(const char* fileName, uint64_t contentHash) const;
+
+		// Restores a tree saved for the same elements and build parameters, instead of optimizing it.
+		// The nodes are used directly from the mapped file, only the element buffer is rebuilt from the stored indices
+		bool Load(const char* fileName, uint64_t contentHash);
+
+		// Number of bytes used by the nodes, the element buffer and the packed leaves
+		size_t GetMemoryUsage() const;
+
+		const AABB& GetBounds() const { return bounds; }
+		float GetBuildTime() const { return buildTime; }
+
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance = FLT_MAX) const;
 
+		// Returns whether any element is hit within maxDistance. Stops at the first hit instead of searching the nearest one
+		bool Occluded(const Ray& ray, float maxDistance) const;
+
+		// Intersects all rays in the mask with the tree, returns a mask of the rays that hit an element
+		uint32_t IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const;
+
 	private:
-		void CreateNode(uint32_t nodeIdx, const AABB& bounds, const std::vector<ElementType*>& elements, int depth = 0);
-		void InitialiseLeaf(KDTreeNode<ElementType>* node, const std::vector<ElementType*>& elements);
+		void Release();
+
+		AR_FORCE_INLINE const uint32_t* GetLeafElements(const KDTreeNode<ElementType>* node) const { return elementBuffer + node->GetElementOffset(); }
+
+		void CreateNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, const AABB& bounds, BuildInput& input, uint32_t depth, bool allowJobs);
+		void CreateChildNode(BuildContext& context, std::vector<BuildNode>& buildNodes, uint32_t nodeIdx, const AABB& bounds, BuildInput& input, uint32_t depth, bool allowJobs);
+		void InitialiseLeaf(KDTreeNode<ElementType>* node, const std::vector<uint32_t>& elementIndices, uint32_t& elementOffset);
+
+		// Places the build nodes in the final node array as cache line sized treelets and fills the element buffer
+		void FlattenTree(const std::vector<BuildNode>& buildNodes);
+		void PackLeaves();
 
 		bool IntersectRayRec(KDTreeNode<ElementType>* node, const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const;
-		bool IntersectRaySec(const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const;
+		bool IntersectRaySec(const KDTreeNode<ElementType>* root, const Ray& ray, RaycastHit& hitInfo, float tMin, float tMax) const;
+		uint32_t IntersectRayPacketSec(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& tMin, const __m128& tMax) const;
+
+		bool OccludedSec(const Ray& ray, float tMin, float tMax) const;
+
+		bool IntersectLeaf(const KDTreeNode<ElementType>* node, const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool OccludedLeaf(const KDTreeNode<ElementType>* node, const Ray& ray, float maxDistance) const;
+		uint32_t IntersectLeafPacket(const KDTreeNode<ElementType>* node, const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, float* maxDistance) const;
+
+		bool SplitSAH(int axis, const BuildContext& context, const BuildInput& input, const AABB& bounds, float& bestSplitPosition, float& lowestCost) const;
+		bool SplitClippedSAH(int axis, const BuildInput& input, const AABB& bounds, float& bestSplitPosition, float& lowestCost) const;
 
-		bool SplitSAH(const std::vector<ElementType*>& elements, const AABB& bounds, int& bestAxis, float& bestSplitPosition);
-		bool SplitSAH(int axis, const std::vector<ElementType*>& elements, const AABB& bounds, float& bestSplitPosition, float& lowestCost);
+		ElementBounds ClipElement(uint32_t element, const ElementBounds& elementBounds, const AABB& bounds) const;
 
-		bool SplitFast(const std::vector<ElementType*>& elements, const AABB& bounds, int& bestAxis, float& bestSplitPosition);
+		// Generates the split positions of elements that were clipped to a child node and merges them with the other split positions
+		void MergeClippedSplitPositions(BuildInput& input, const std::vector<uint32_t>& clippedElements) const;
 
-		void CalculateBounds(const AABB& bounds, int axis, float splitPoint, AABB& upper, AABB& lower);
+		static void AddSplitPositions(const ElementBounds& elementBounds, int axis, uint32_t element, std::vector<SplitPosition>& splitPositions);
+
+		void CalculateBounds(const AABB& bounds, int axis, float splitPoint, AABB& upper, AABB& lower) const;
 
 		static bool SortSplitPosition(const SplitPosition& a, const SplitPosition& b)
 		{
-			return a.position < b.position;
+			// Order equal positions by event and element as well, so that the build doesn't depend on the sorting algorithm
+			if (a.position != b.position)
+				return a.position < b.position;
+
+			if (a.event != b.event)
+				return a.event < b.event;
+
+			return a.element < b.element;
 		}
 	};
 
@@ -14,10 +14,11 @@ namespace AwesomeRenderer
 		// For non-leaf nodes: Tthe upper bytes are the index of the upper element, the lower element is always allocated directly behind it
 		uint32_t data;
 
+		// Leaf nodes refer to their elements by offset in the element buffer of the tree, so that nodes can be stored on disk
 		union
 		{
 			float splitPoint;
-			ElementType** elementList;
+			uint32_t elementOffset;
 		};
 
 	public:
@@ -31,10 +32,10 @@ namespace AwesomeRenderer
 
 		}
 
-		void InitialiseLeaf(ElementType** elements, uint32_t elementCount)
+		void InitialiseLeaf(uint32_t elementOffset, uint32_t elementCount)
 		{
 			data = (elementCount << 2) | 0x03;
-			elementList = elements;
+			this->elementOffset = elementOffset;
 		}
 
 		void InitialiseNonLeaf(float splitPoint, uint32_t axis, uint32_t upperNode)
@@ -52,7 +53,7 @@ namespace AwesomeRenderer
 
 		AR_FORCE_INLINE uint32_t GetUpperNode() const { return (data >> 2); }
 		
-		ElementType** GetElements() const { return elementList; }
+		uint32_t GetElementOffset() const { return elementOffset; }
 		uint32_t GetElementCount() const { return (data >> 2); }
 		
 	private:
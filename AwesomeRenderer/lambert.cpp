@@ -62,7 +62,7 @@ Color Lambert::SampleAlbedo(const RaycastHit& hitInfo, const Material& material,
 	}
 
 	if (albedoMap != NULL)
-		albedo *= albedoMap->SampleMipMaps(hitInfo.uv, hitInfo.distance, hitInfo.surfaceAreaToTextureRatio, renderContext.renderTarget->frameBuffer->GetResolution());
+		albedo *= albedoMap->SampleMipMaps(hitInfo.uv, hitInfo.textureLod);
 
 	return albedo;
 }
\ No newline at end of file
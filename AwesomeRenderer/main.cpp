@@ -123,6 +123,8 @@
 
 #include "context.h"
 #include "setup.h"
+#include "batchrenderer.h"
+#include "benchmark.h"
 
 // Debug
 #include "debugdisplay.h"
@@ -130,8 +132,15 @@
 using namespace AwesomeRenderer;
 using namespace AwesomeRenderer::RayTracing;
 
-int main() 
+int main(int argc, char** argv) 
 {
+	// Offline rendering without a window
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+		return BatchRenderer::Main(argc - 2, argv + 2);
+
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+		return Benchmark::Main(argc - 2, argv + 2);
+
 	return WinMain(GetModuleHandle(NULL), NULL, GetCommandLine(), SW_SHOW);
 }
 
@@ -157,7 +166,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
 	// Job scheduler
 	printf("[AwesomeRenderer]: Setting up scheduler...\n");
-	Scheduler scheduler(0);
+	uint32_t cores = std::thread::hardware_concurrency();
+	if (!cores)
+		cores = 4;
+
+	Scheduler scheduler(cores);
 	scheduler.Start();
 
 	// Setup frame and depth buffers
@@ -213,6 +226,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	mainContext.camera = &camera;
 	mainContext.renderTarget = &renderTarget;
 
+	// Objects can be moved at runtime, which a hierarchy refits while a KD-tree has to be rebuilt every frame
+	mainContext.accelerationStructure = ACCELERATION_BVH;
+
 	/**/
 	Camera cameraHud(cml::left_handed);
 	cameraHud.viewMtx.identity();
@@ -262,9 +278,13 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
 	Vector3 zero(0.0f, 0.0f, 0.0f);
 
-	// Assets factories
+	// Assets factories, mip levels are only built when they are used so that large scenes start quicker
 	TextureFactory textureFactory;
+	textureFactory.mipmapMode = TextureFactory::MIPMAPS_LAZY;
+	textureFactory.scheduler = &scheduler;
+
 	ObjLoader objLoader(textureFactory);
+	objLoader.scheduler = &scheduler;
 	
 	// Game loop timer
 	Timer timer(0.00001f, 100.0f);
@@ -282,6 +302,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 	context.objLoader = &objLoader;
 	context.textureFactory = &textureFactory;
 
+	context.scheduler = &scheduler;
+	context.treeCacheDirectory = "../Cache";
+
 	Setup setup(context, GENERATE_EXTENDED_MESH_DATA);
 	setup.SetupLighting();
 	setup.SetupScene();
@@ -364,7 +387,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 #if GENERATE_EXTENDED_MESH_DATA
 	printf("[AwesomeRenderer]: Optimizing main KD tree!\n");
 
-	mainContext.Optimize();
+	mainContext.Optimize(&scheduler);
 #endif
 
 	window.Show(nCmdShow);
@@ -428,7 +451,18 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
 		rayTracerDebug.Update(timingInfo.elapsedSeconds);
 
+#if GENERATE_EXTENDED_MESH_DATA
+		// The ray tracer has to stop tracing the scene before moved renderables are transformed and the structure is refit
+		if (mainRenderer == &rayTracer && mainContext.HasMovedRenderables())
+			rayTracer.ResetFrame(false);
+#endif
+
 		mainContext.Update();
+
+#if GENERATE_EXTENDED_MESH_DATA
+		mainContext.Refit(&scheduler);
+#endif
+
 		mainRenderer->SetRenderContext(&mainContext);
 		mainRenderer->Render();
 
@@ -0,0 +1,98 @@
+#include "awesomerenderer.h"
+#include "mappedfile.h"
+#include "util.h"
+
+using namespace AwesomeRenderer;
+
+MappedFile::MappedFile() : file(INVALID_HANDLE_VALUE), mapping(NULL), data(NULL), size(0)
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* fileName)
+{
+	Close();
+
+	file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+
+	// Empty files can't be mapped
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (mapping == NULL)
+	{
+		printf("[MappedFile]: Failed to create file mapping for \"%s\"\n", fileName);
+
+		Close();
+		return false;
+	}
+
+	data = static_cast<const uchar*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (data == NULL)
+	{
+		printf("[MappedFile]: Failed to map view of \"%s\"\n", fileName);
+
+		Close();
+		return false;
+	}
+
+	size = fileSize.QuadPart;
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != NULL)
+		UnmapViewOfFile(data);
+
+	if (mapping != NULL)
+		CloseHandle(mapping);
+
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+	data = NULL;
+	size = 0;
+}
+
+bool MappedFile::GetFileInfo(const char* fileName, uint64_t& size, uint64_t& lastWriteTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (!GetFileAttributesExA(fileName, GetFileExInfoStandard, &attributes))
+		return false;
+
+	size = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	lastWriteTime = ((uint64_t) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+
+	return true;
+}
+
+uint64_t MappedFile::HashFile(const char* fileName)
+{
+	MappedFile file;
+
+	if (!file.Open(fileName))
+		return 0;
+
+	return Util::Hash(file.GetData(), file.GetSize());
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+
+	// Read-only view of a complete file, mapped into memory by the operating system. Pages are loaded on first access.
+	class MappedFile
+	{
+
+	private:
+		HANDLE file;
+		HANDLE mapping;
+
+		const uchar* data;
+		uint64_t size;
+
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool Open(const char* fileName);
+		void Close();
+
+		AR_FORCE_INLINE bool IsOpen() const { return data != NULL; }
+
+		AR_FORCE_INLINE const uchar* GetData() const { return data; }
+		AR_FORCE_INLINE uint64_t GetSize() const { return size; }
+
+		// Retrieves the size and last write time of a file without opening it
+		static bool GetFileInfo(const char* fileName, uint64_t& size, uint64_t& lastWriteTime);
+
+		// Hash of the contents of a file, zero if the file can't be opened
+		static uint64_t HashFile(const char* fileName);
+	};
+
+}
+
+#endif
\ No newline at end of file
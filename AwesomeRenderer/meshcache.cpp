@@ -0,0 +1,221 @@
+#include "awesomerenderer.h"
+
+#include "meshcache.h"
+#include "mappedfile.h"
+#include "mesh.h"
+
+using namespace AwesomeRenderer;
+
+const char* MeshCache::FILE_EXTENSION = ".meshcache";
+
+bool MeshCache::Write(const std::string& fileName, const std::string& sourceFileName, const Contents& contents)
+{
+	assert(contents.meshes.size() == contents.materials.size());
+
+	Header header;
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.meshCount = contents.meshes.size();
+	header.materialLibCount = contents.materialLibs.size();
+
+	if (!MappedFile::GetFileInfo(sourceFileName.c_str(), header.sourceSize, header.sourceTime))
+		return false;
+
+	header.sourceHash = MappedFile::HashFile(sourceFileName.c_str());
+
+	FILE* filePtr;
+	errno_t result = fopen_s(&filePtr, fileName.c_str(), "wb");
+
+	if (result != 0)
+	{
+		printf("[MeshCache]: Failed to open file \"%s\". Error code: %d\n", fileName.c_str(), result);
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, filePtr);
+
+	for (auto it = contents.materialLibs.begin(); it != contents.materialLibs.end(); ++it)
+		WriteString(filePtr, *it);
+
+	for (uint32_t meshIdx = 0; meshIdx < contents.meshes.size(); ++meshIdx)
+	{
+		const Mesh& mesh = *contents.meshes[meshIdx];
+		const MaterialReference& material = contents.materials[meshIdx];
+
+		MeshHeader meshHeader;
+		meshHeader.attributes = mesh.attributes;
+		meshHeader.materialLib = material.materialLib;
+		meshHeader.vertexCount = mesh.vertices.size();
+		meshHeader.colorCount = mesh.colors.size();
+		meshHeader.texcoordCount = mesh.texcoords.size();
+		meshHeader.normalCount = mesh.normals.size();
+		meshHeader.tangentCount = mesh.tangents.size();
+		meshHeader.bitangentCount = mesh.bitangents.size();
+		meshHeader.indexCount = mesh.indices.size();
+
+		fwrite(&meshHeader, sizeof(meshHeader), 1, filePtr);
+		WriteString(filePtr, material.name);
+
+		WriteArray(filePtr, mesh.vertices);
+		WriteArray(filePtr, mesh.colors);
+		WriteArray(filePtr, mesh.texcoords);
+		WriteArray(filePtr, mesh.normals);
+		WriteArray(filePtr, mesh.tangents);
+		WriteArray(filePtr, mesh.bitangents);
+		WriteArray(filePtr, mesh.indices);
+	}
+
+	bool success = ferror(filePtr) == 0;
+	fclose(filePtr);
+
+	if (!success)
+	{
+		printf("[MeshCache]: Failed to write file \"%s\"\n", fileName.c_str());
+		remove(fileName.c_str());
+	}
+
+	return success;
+}
+
+bool MeshCache::Read(const std::string& fileName, const std::string& sourceFileName, Contents& contents)
+{
+	uint64_t sourceSize, sourceTime;
+
+	if (!MappedFile::GetFileInfo(sourceFileName.c_str(), sourceSize, sourceTime))
+		return false;
+
+	MappedFile file;
+
+	if (!file.Open(fileName.c_str()))
+		return false;
+
+	const uchar* cursor = file.GetData();
+	const uchar* end = cursor + file.GetSize();
+
+	if (file.GetSize() < sizeof(Header))
+	{
+		printf("[MeshCache]: Invalid mesh cache file \"%s\"\n", fileName.c_str());
+		return false;
+	}
+
+	Header header;
+	memcpy(&header, cursor, sizeof(Header));
+	cursor += sizeof(Header);
+
+	if (header.magic != FILE_MAGIC || header.version != FILE_VERSION)
+	{
+		printf("[MeshCache]: Invalid mesh cache file \"%s\"\n", fileName.c_str());
+		return false;
+	}
+
+	// The timestamp also changes when a file is copied or checked out, in that case the hash decides whether the contents changed
+	if (header.sourceSize != sourceSize || (header.sourceTime != sourceTime && header.sourceHash != MappedFile::HashFile(sourceFileName.c_str())))
+	{
+		printf("[MeshCache]: Mesh cache \"%s\" is outdated\n", fileName.c_str());
+		return false;
+	}
+
+	contents.materialLibs.resize(header.materialLibCount);
+	contents.materials.resize(header.meshCount);
+	contents.meshes.clear();
+
+	bool valid = true;
+
+	for (uint32_t libIdx = 0; libIdx < header.materialLibCount && valid; ++libIdx)
+		valid = ReadString(cursor, end, contents.materialLibs[libIdx]);
+
+	for (uint32_t meshIdx = 0; meshIdx < header.meshCount && valid; ++meshIdx)
+	{
+		if ((uint64_t) (end - cursor) < sizeof(MeshHeader))
+		{
+			valid = false;
+			break;
+		}
+
+		MeshHeader meshHeader;
+		memcpy(&meshHeader, cursor, sizeof(MeshHeader));
+		cursor += sizeof(MeshHeader);
+
+		MaterialReference& material = contents.materials[meshIdx];
+		material.materialLib = meshHeader.materialLib;
+
+		Mesh* mesh = new Mesh((Mesh::VertexAttributes) meshHeader.attributes);
+		contents.meshes.push_back(mesh);
+
+		valid = meshHeader.materialLib < (int32_t) header.materialLibCount &&
+				ReadString(cursor, end, material.name) &&
+				ReadArray(cursor, end, meshHeader.vertexCount, mesh->vertices) &&
+				ReadArray(cursor, end, meshHeader.colorCount, mesh->colors) &&
+				ReadArray(cursor, end, meshHeader.texcoordCount, mesh->texcoords) &&
+				ReadArray(cursor, end, meshHeader.normalCount, mesh->normals) &&
+				ReadArray(cursor, end, meshHeader.tangentCount, mesh->tangents) &&
+				ReadArray(cursor, end, meshHeader.bitangentCount, mesh->bitangents) &&
+				ReadArray(cursor, end, meshHeader.indexCount, mesh->indices);
+	}
+
+	if (!valid)
+	{
+		printf("[MeshCache]: Mesh cache file \"%s\" is truncated\n", fileName.c_str());
+
+		for (auto it = contents.meshes.begin(); it != contents.meshes.end(); ++it)
+			delete *it;
+
+		contents.meshes.clear();
+
+		return false;
+	}
+
+	if (header.sourceTime != sourceTime)
+	{
+		// The mapping keeps the file from being opened for writing
+		file.Close();
+		UpdateSourceTime(fileName, header, sourceTime);
+	}
+
+	return true;
+}
+
+void MeshCache::UpdateSourceTime(const std::string& fileName, Header& header, uint64_t sourceTime)
+{
+	// Only the timestamp of the source changed, storing it saves hashing the source again on the next run
+	FILE* filePtr;
+
+	if (fopen_s(&filePtr, fileName.c_str(), "r+b") != 0)
+		return;
+
+	header.sourceTime = sourceTime;
+
+	fwrite(&header, sizeof(header), 1, filePtr);
+	fclose(filePtr);
+}
+
+void MeshCache::WriteString(FILE* filePtr, const std::string& string)
+{
+	uint32_t length = string.length();
+	fwrite(&length, sizeof(length), 1, filePtr);
+	fwrite(string.c_str(), 1, length, filePtr);
+
+	// Pad the string so that the arrays after it stay aligned
+	const uchar padding[4] = { 0, 0, 0, 0 };
+	fwrite(padding, 1, (4 - length % 4) % 4, filePtr);
+}
+
+bool MeshCache::ReadString(const uchar*& cursor, const uchar* end, std::string& string)
+{
+	if ((uint64_t) (end - cursor) < sizeof(uint32_t))
+		return false;
+
+	uint32_t length;
+	memcpy(&length, cursor, sizeof(length));
+	cursor += sizeof(length);
+
+	uint32_t paddedLength = (length + 3) & ~3;
+
+	if ((uint64_t) (end - cursor) < paddedLength)
+		return false;
+
+	string.assign(reinterpret_cast<const char*>(cursor), length);
+	cursor += paddedLength;
+
+	return true;
+}
\ No newline at end of file
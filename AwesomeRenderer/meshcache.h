@@ -0,0 +1,104 @@
+#ifndef _MESH_CACHE_H_
+#define _MESH_CACHE_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+	class Mesh;
+
+	// Binary copy of the meshes loaded from a model file. The vertex and index arrays are stored exactly as they are laid out
+	// in memory, so that loading them is a copy out of the mapped file instead of parsing.
+	// Materials are stored by name, together with the material libraries that define them.
+	class MeshCache
+	{
+	public:
+		static const uint32_t FILE_MAGIC = 0x434D5241; // "ARMC"
+		static const uint32_t FILE_VERSION = 1;
+
+		// Extension appended to the file name of the source model
+		static const char* FILE_EXTENSION;
+
+		// Material of a submesh, by its name in one of the material libraries. An empty name means the default material.
+		struct MaterialReference
+		{
+			int32_t materialLib;
+			std::string name;
+
+			MaterialReference() : materialLib(-1)
+			{
+
+			}
+		};
+
+		struct Contents
+		{
+			std::vector<std::string> materialLibs;
+
+			std::vector<Mesh*> meshes;
+			std::vector<MaterialReference> materials;
+		};
+
+	private:
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+
+			uint32_t meshCount;
+			uint32_t materialLibCount;
+
+			// Identifies the source file that the cache was created from
+			uint64_t sourceSize;
+			uint64_t sourceTime;
+			uint64_t sourceHash;
+		};
+
+		struct MeshHeader
+		{
+			uint32_t attributes;
+			int32_t materialLib;
+
+			uint32_t vertexCount, colorCount, texcoordCount, normalCount;
+			uint32_t tangentCount, bitangentCount;
+			uint32_t indexCount;
+		};
+
+	public:
+		static bool Write(const std::string& fileName, const std::string& sourceFileName, const Contents& contents);
+
+		// Reads the meshes from a cache file, fails if the file is invalid or if the source file changed after the cache was written.
+		// The meshes in the contents are allocated by this function.
+		static bool Read(const std::string& fileName, const std::string& sourceFileName, Contents& contents);
+
+	private:
+		static void UpdateSourceTime(const std::string& fileName, Header& header, uint64_t sourceTime);
+
+		static void WriteString(FILE* filePtr, const std::string& string);
+
+		template<typename T>
+		static void WriteArray(FILE* filePtr, const std::vector<T>& array)
+		{
+			if (!array.empty())
+				fwrite(&array[0], sizeof(T), array.size(), filePtr);
+		}
+
+		static bool ReadString(const uchar*& cursor, const uchar* end, std::string& string);
+
+		template<typename T>
+		static bool ReadArray(const uchar*& cursor, const uchar* end, uint32_t count, std::vector<T>& array)
+		{
+			if ((uint64_t) (end - cursor) < (uint64_t) count * sizeof(T))
+				return false;
+
+			const T* elements = reinterpret_cast<const T*>(cursor);
+			array.assign(elements, elements + count);
+
+			cursor += count * sizeof(T);
+
+			return true;
+		}
+	};
+}
+
+#endif
\ No newline at end of file
@@ -4,12 +4,14 @@
 #include "mesh.h"
 #include "meshtriangle.h"
 #include "kdtreenode.h"
+#include "raypacket.h"
+#include "util.h"
 
 using namespace AwesomeRenderer;
 
 template class KDTree<MeshTriangle>;
 
-MeshEx::MeshEx(Mesh& mesh) : Extension(mesh), tree(20), worldMtx(), world2object()
+MeshEx::MeshEx(Mesh& mesh) : Extension(mesh), accelerationStructure(ACCELERATION_KDTREE), tree(20), worldMtx(), world2object(), texelDensityOffset(0.0f)
 {
 	triangles.reserve(mesh.indices.size() / 3);
 
@@ -31,6 +33,15 @@ MeshEx::MeshEx(Mesh& mesh) : Extension(mesh), tree(20), worldMtx(), world2object
 		if (triangle.IsLine())
 			continue;
 
+		// The texel density only depends on the triangle, so it's calculated once instead of for every hit
+		if (mesh.HasAttribute(Mesh::VERTEX_TEXCOORD))
+		{
+			float texels = Triangle<Vector2>::Area(mesh.texcoords[vIdx0], mesh.texcoords[vIdx1], mesh.texcoords[vIdx2]);
+
+			if (texels > 0.0f)
+				triangle.texelDensity = 0.5f * log2(texels / triangle.Area());
+		}
+
 		triangles.push_back(triangle);
 		
 		// TODO: These references break if the vector decides to resize. Use simple array?
@@ -43,7 +54,7 @@ MeshEx::~MeshEx()
 	triangles.clear();
 }
 
-void MeshEx::OptimizeTree()
+void MeshEx::OptimizeTree(Scheduler* scheduler, const char* cacheDirectory)
 {
 	// Optimize the tree with the local bounds, since it works with triangles in local coordinates
 	Matrix44 mtx;
@@ -52,10 +63,72 @@ void MeshEx::OptimizeTree()
 	AABB localBounds = provider.bounds;
 	localBounds.Transform(mtx);
 
-	tree.Optimize(localBounds);
+	if (accelerationStructure != ACCELERATION_KDTREE)
+	{
+		// Hierarchies are fast enough to build that they aren't cached
+		bvh.elements = tree.elements;
+		bvh.wideNodes = accelerationStructure == ACCELERATION_BVH4;
+		bvh.Optimize(localBounds, scheduler);
+
+		printf("[MeshEx]: Mesh %s optimized, analyzing...\n", ACCELERATION_STRUCTURE_NAMES[accelerationStructure]);
+		bvh.Analyze();
+
+		return;
+	}
+
+	std::string treeFileName;
+	uint64_t contentHash = 0;
+
+	if (cacheDirectory != NULL)
+	{
+		contentHash = CalculateContentHash(localBounds);
+
+		char hashString[17];
+		sprintf(hashString, "%016llx", (unsigned long long) contentHash);
+
+		treeFileName = std::string(cacheDirectory) + "/" + hashString + ".kdtree";
+
+		if (tree.Load(treeFileName.c_str(), contentHash))
+		{
+			printf("[MeshEx]: Mesh tree loaded from \"%s\", analyzing...\n", treeFileName.c_str());
+			tree.Analyze();
+			return;
+		}
+	}
+
+	tree.Optimize(localBounds, scheduler);
 
 	printf("[MeshEx]: Mesh tree optimized, analyzing...\n");
 	tree.Analyze();
+
+	if (cacheDirectory != NULL)
+	{
+		CreateDirectoryA(cacheDirectory, NULL);
+		tree.Save(treeFileName.c_str(), contentHash);
+	}
+}
+
+size_t MeshEx::GetTreeMemoryUsage() const
+{
+	return accelerationStructure == ACCELERATION_KDTREE ? tree.GetMemoryUsage() : bvh.GetMemoryUsage();
+}
+
+float MeshEx::GetTreeBuildTime() const
+{
+	return accelerationStructure == ACCELERATION_KDTREE ? tree.GetBuildTime() : bvh.GetBuildTime();
+}
+
+uint64_t MeshEx::CalculateContentHash(const AABB& bounds) const
+{
+	// The tree only depends on the bounds it is built in, the build mode and the positions of the triangles, in order
+	uint64_t hash = Util::Hash(&bounds.Min()[0], sizeof(Vector3));
+	hash = Util::Hash(&bounds.Max()[0], sizeof(Vector3), hash);
+	hash = Util::Hash(&tree.perfectSplits, sizeof(tree.perfectSplits), hash);
+
+	for (auto it = triangles.begin(); it != triangles.end(); ++it)
+		hash = Util::Hash(it->v, sizeof(it->v), hash);
+
+	return hash;
 }
 
 void MeshEx::Transform(const Matrix44& mtx)
@@ -65,6 +138,14 @@ void MeshEx::Transform(const Matrix44& mtx)
 	// Create an inversed transformation matrix to transform to object space
 	world2object = worldMtx;
 	world2object.inverse();
+
+	// Surface areas scale quadratically, so the square root of the density scales inversely to distances.
+	// The scale is the average length of the transformed axes, which rotations don't change
+	float scale = (cml::transform_vector(worldMtx, Vector3(1.0f, 0.0f, 0.0f)).length() +
+				   cml::transform_vector(worldMtx, Vector3(0.0f, 1.0f, 0.0f)).length() +
+				   cml::transform_vector(worldMtx, Vector3(0.0f, 0.0f, 1.0f)).length()) / 3.0f;
+
+	texelDensityOffset = -log2(scale);
 }
 
 bool MeshEx::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
@@ -73,84 +154,130 @@ bool MeshEx::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance
 	Ray objectSpaceRay(cml::transform_point(world2object, ray.origin), cml::transform_vector(world2object, ray.direction));
 
 	// Transform maxDistance to object space
-	Vector3 scale = cml::transform_vector(world2object, Vector3(1.0f, 1.0f, 1.0f));
-	maxDistance *= std::max(scale[0], std::max(scale[1], scale[2]));
+	maxDistance *= ObjectSpaceDistanceScale();
 
-	// Perform intersection on the KD-tree
-	if (tree.IntersectRay(objectSpaceRay, hitInfo, maxDistance))
+	// Perform intersection on the acceleration structure
+	bool hit = accelerationStructure == ACCELERATION_KDTREE ? tree.IntersectRay(objectSpaceRay, hitInfo, maxDistance) : bvh.IntersectRay(objectSpaceRay, hitInfo, maxDistance);
+
+	if (hit)
 	{
-		// Interpolate vertex attributes of the hit triangle
-		const MeshTriangle* tri = dynamic_cast<const MeshTriangle*>(hitInfo.element);
+		InterpolateHit(ray, hitInfo);
+		return true;
+	}
 
-		// Retrieve the vertex indices of this triangle
-		int vIdx0 = provider.indices[tri->faceIdx * 3];
-		int vIdx1 = provider.indices[tri->faceIdx * 3 + 1];
-		int vIdx2 = provider.indices[tri->faceIdx * 3 + 2];
+	return false;
+}
 
-		if (provider.HasAttribute(Mesh::VERTEX_NORMAL))
-		{
-			VectorUtil<3>::Interpolate(
-				provider.normals[vIdx0],
-				provider.normals[vIdx1],
-				provider.normals[vIdx2],
-				hitInfo.barycentricCoords, hitInfo.normal);
-		}
-		else
-			hitInfo.normal = tri->normal;
+bool MeshEx::Occluded(const Ray& ray, float maxDistance) const
+{
+	// Only the acceleration structure is needed, there are no vertex attributes to interpolate
+	Ray objectSpaceRay(cml::transform_point(world2object, ray.origin), cml::transform_vector(world2object, ray.direction));
 
-		if (provider.HasAttribute(Mesh::VERTEX_TEXCOORD))
-		{
-			Vector2 uv0 = provider.texcoords[vIdx0];
-			Vector2 uv1 = provider.texcoords[vIdx1];
-			Vector2 uv2 = provider.texcoords[vIdx2];
+	if (accelerationStructure == ACCELERATION_KDTREE)
+		return tree.Occluded(objectSpaceRay, maxDistance * ObjectSpaceDistanceScale());
 
-			VectorUtil<2>::Interpolate(uv0, uv1, uv2, hitInfo.barycentricCoords, hitInfo.uv);
+	return bvh.Occluded(objectSpaceRay, maxDistance * ObjectSpaceDistanceScale());
+}
 
-			float surfaceArea = Triangle<Vector3>::Area(cml::transform_point(worldMtx, tri->v[0]),
-														cml::transform_point(worldMtx, tri->v[1]),
-														cml::transform_point(worldMtx, tri->v[2]));
-			float texels = Triangle<Vector2>::Area(uv0, uv1, uv2);
-			
-			assert(surfaceArea > 0.0f);
+uint32_t MeshEx::IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const
+{
+	// Transform rays to object space to use for intersection
+	Ray objectSpaceRays[RayPacket::SIZE];
 
-			if (texels > 0.0f)
-				hitInfo.surfaceAreaToTextureRatio = surfaceArea / texels;
-		}
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((mask & (1 << rayIdx)) == 0)
+			continue;
 
-		if (provider.HasAttribute(Mesh::VERTEX_TANGENTS))
-		{
-			VectorUtil<3>::Interpolate(
-				provider.tangents[vIdx0],
-				provider.tangents[vIdx1],
-				provider.tangents[vIdx2],
-				hitInfo.barycentricCoords, hitInfo.tangent);
-
-			hitInfo.tangent = cml::transform_vector(worldMtx, hitInfo.tangent);
-			hitInfo.tangent.normalize();
-		}
+		const Ray& ray = packet.rays[rayIdx];
+		objectSpaceRays[rayIdx] = Ray(cml::transform_point(world2object, ray.origin), cml::transform_vector(world2object, ray.direction));
+	}
 
+	RayPacket objectSpacePacket(objectSpaceRays);
 
-		if (provider.HasAttribute(Mesh::VERTEX_BITANGENTS))
-		{
-			VectorUtil<3>::Interpolate(
-				provider.bitangents[vIdx0],
-				provider.bitangents[vIdx1],
-				provider.bitangents[vIdx2],
-				hitInfo.barycentricCoords, hitInfo.bitangent);
-			
-			hitInfo.bitangent = cml::transform_vector(worldMtx, hitInfo.bitangent);
-			hitInfo.bitangent.normalize();
-		}
+	// Transform maxDistance to object space
+	__m128 objectSpaceMaxDistance = _mm_mul_ps(maxDistance, _mm_set1_ps(ObjectSpaceDistanceScale()));
 
-		hitInfo.point = cml::transform_point(worldMtx, hitInfo.point);
-		hitInfo.normal = cml::transform_vector(worldMtx, hitInfo.normal);
-		hitInfo.normal.normalize();
-		
-		// TODO: transform provided distance back to world space instead of recalculating?
-		hitInfo.distance = (hitInfo.point - ray.origin).length();
+	// Perform intersection on the acceleration structure
+	uint32_t hits = accelerationStructure == ACCELERATION_KDTREE ? tree.IntersectRayPacket(objectSpacePacket, hitInfo, mask, objectSpaceMaxDistance) :
+																   bvh.IntersectRayPacket(objectSpacePacket, hitInfo, mask, objectSpaceMaxDistance);
+
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((hits & (1 << rayIdx)) != 0)
+			InterpolateHit(packet.rays[rayIdx], hitInfo[rayIdx]);
+	}
+
+	return hits;
+}
+
+float MeshEx::ObjectSpaceDistanceScale() const
+{
+	Vector3 scale = cml::transform_vector(world2object, Vector3(1.0f, 1.0f, 1.0f));
+	return std::max(scale[0], std::max(scale[1], scale[2]));
+}
+
+void MeshEx::InterpolateHit(const Ray& ray, RaycastHit& hitInfo) const
+{
+	// Interpolate vertex attributes of the hit triangle
+	const MeshTriangle* tri = dynamic_cast<const MeshTriangle*>(hitInfo.element);
+
+	// Retrieve the vertex indices of this triangle
+	int vIdx0 = provider.indices[tri->faceIdx * 3];
+	int vIdx1 = provider.indices[tri->faceIdx * 3 + 1];
+	int vIdx2 = provider.indices[tri->faceIdx * 3 + 2];
+
+	if (provider.HasAttribute(Mesh::VERTEX_NORMAL))
+	{
+		VectorUtil<3>::Interpolate(
+			provider.normals[vIdx0],
+			provider.normals[vIdx1],
+			provider.normals[vIdx2],
+			hitInfo.barycentricCoords, hitInfo.normal);
+	}
+	else
+		hitInfo.normal = tri->normal;
+
+	if (provider.HasAttribute(Mesh::VERTEX_TEXCOORD))
+	{
+		Vector2 uv0 = provider.texcoords[vIdx0];
+		Vector2 uv1 = provider.texcoords[vIdx1];
+		Vector2 uv2 = provider.texcoords[vIdx2];
+
+		VectorUtil<2>::Interpolate(uv0, uv1, uv2, hitInfo.barycentricCoords, hitInfo.uv);
+	}
+
+	hitInfo.texelDensity = tri->texelDensity + texelDensityOffset;
+
+	if (provider.HasAttribute(Mesh::VERTEX_TANGENTS))
+	{
+		VectorUtil<3>::Interpolate(
+			provider.tangents[vIdx0],
+			provider.tangents[vIdx1],
+			provider.tangents[vIdx2],
+			hitInfo.barycentricCoords, hitInfo.tangent);
+
+		hitInfo.tangent = cml::transform_vector(worldMtx, hitInfo.tangent);
+		hitInfo.tangent.normalize();
+	}
+
+
+	if (provider.HasAttribute(Mesh::VERTEX_BITANGENTS))
+	{
+		VectorUtil<3>::Interpolate(
+			provider.bitangents[vIdx0],
+			provider.bitangents[vIdx1],
+			provider.bitangents[vIdx2],
+			hitInfo.barycentricCoords, hitInfo.bitangent);
 		
-		return true;
+		hitInfo.bitangent = cml::transform_vector(worldMtx, hitInfo.bitangent);
+		hitInfo.bitangent.normalize();
 	}
 
-	return false;
+	hitInfo.point = cml::transform_point(worldMtx, hitInfo.point);
+	hitInfo.normal = cml::transform_vector(worldMtx, hitInfo.normal);
+	hitInfo.normal.normalize();
+	
+	// TODO: transform provided distance back to world space instead of recalculating?
+	hitInfo.distance = (hitInfo.point - ray.origin).length();
 }
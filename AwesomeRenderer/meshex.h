@@ -4,11 +4,14 @@
 #include "awesomerenderer.h"
 #include "component.h"
 #include "kdtree.h"
+#include "bvh.h"
+#include "accelerationstructure.h"
 #include "mesh.h"
 
 namespace AwesomeRenderer
 {
 	class MeshTriangle;
+	class Scheduler;
 	
 	class MeshEx : public Shape, public Extension<Mesh, MeshEx>
 	{
@@ -17,24 +20,44 @@ namespace AwesomeRenderer
 
 		std::vector<MeshTriangle> triangles;
 
+		// Structure that is built by OptimizeTree and used for intersections. Only the selected structure holds nodes
+		AccelerationStructure accelerationStructure;
+
 		KDTree<MeshTriangle> tree;
+		BVH<MeshTriangle> bvh;
 
 		Matrix44 worldMtx;
 		Matrix44 world2object;
 
+		// Converts the object space texel densities of the triangles to world space, follows from the scale of the world matrix
+		float texelDensityOffset;
+
 	public:
 		MeshEx(Mesh& mesh);
 		~MeshEx();
 
-		void OptimizeTree();
+		// KD-trees are loaded from and saved to the cache directory if one is given, keyed by the content of the mesh
+		void OptimizeTree(Scheduler* scheduler = NULL, const char* cacheDirectory = NULL);
+
+		// Number of bytes used by the nodes and leaves of the selected acceleration structure
+		size_t GetTreeMemoryUsage() const;
+		float GetTreeBuildTime() const;
 
 		void Transform(const Matrix44& mtx);
 
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		uint32_t IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		const Primitive& GetPrimitive() const { return provider.bounds; }
 
 		static uint32_t ExtensionID() { return Mesh::MESH_EX; }
+
+	private:
+		uint64_t CalculateContentHash(const AABB& bounds) const;
+
+		void InterpolateHit(const Ray& ray, RaycastHit& hitInfo) const;
+		float ObjectSpaceDistanceScale() const;
 	};
 }
 
@@ -10,7 +10,7 @@
 
 using namespace AwesomeRenderer;
 
-MeshTriangle::MeshTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, uint32_t faceIdx) : Triangle(v0, v1, v2), Primitive(), faceIdx(faceIdx)
+MeshTriangle::MeshTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, uint32_t faceIdx) : Triangle(v0, v1, v2), Primitive(), faceIdx(faceIdx), texelDensity(0.0f)
 {
 	CalculateNormal();
 	PreCalculateBarycentric();
@@ -19,7 +19,7 @@ MeshTriangle::MeshTriangle(const Vector3& v0, const Vector3& v1, const Vector3&
 MeshTriangle::MeshTriangle(const MeshTriangle& other) :
 	MeshTriangle(other.v[0], other.v[1], other.v[2], other.faceIdx)
 {
-
+	texelDensity = other.texelDensity;
 }
 
 const Vector3& MeshTriangle::CalculateNormal()
@@ -45,6 +45,30 @@ void MeshTriangle::Transform(const Matrix44& mtx)
 }
 
 bool MeshTriangle::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	float t;
+	Vector3 barycentricCoords;
+
+	if (!CalculateIntersection(ray, maxDistance, t, barycentricCoords))
+		return false;
+
+	// Fill the hit info struct with gathered data
+	hitInfo.point = ray.origin + t * ray.direction;
+	hitInfo.distance = t;
+	hitInfo.barycentricCoords = barycentricCoords;
+
+	return true;
+}
+
+bool MeshTriangle::Occluded(const Ray& ray, float maxDistance) const
+{
+	float t;
+	Vector3 barycentricCoords;
+
+	return CalculateIntersection(ray, maxDistance, t, barycentricCoords);
+}
+
+bool MeshTriangle::CalculateIntersection(const Ray& ray, float maxDistance, float& t, Vector3& barycentricCoords) const
 {
 	float dot = VectorUtil<3>::Dot(normal, ray.direction);
 
@@ -59,7 +83,7 @@ bool MeshTriangle::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDi
 	if (distanceToPlane < 0.0f)
 		return false;
 
-	float t = distanceToPlane / -dot;
+	t = distanceToPlane / -dot;
 
 	if (t > maxDistance)
 		return false;
@@ -80,11 +104,8 @@ bool MeshTriangle::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDi
 	if (u < 0.0f || v < 0.0f || u + v > 1.0f)
 		return false;
 		
-	// Fill the hit info struct with gathered data
-	hitInfo.point = pointOnPlane;
-	hitInfo.distance = t;
-	hitInfo.barycentricCoords.set(1.0f - u - v, u, v);
-		
+	barycentricCoords.set(1.0f - u - v, u, v);
+
 	return true;
 }
 
@@ -118,9 +139,18 @@ void MeshTriangle::CalculateBounds(AABB& bounds) const
 	bounds.Initialize(lower, upper);
 }
 
-float MeshTriangle::Area() const
+bool MeshTriangle::CalculateClippedBounds(const AABB& box, AABB& bounds) const
 {
-	Vector3 p = v[0] + (dot01 * VectorUtil<3>::Normalize(v1));
+	Vector3 lower, upper;
+	if (!CalculateClippedBounds(box.Min(), box.Max(), lower, upper))
+		return false;
 
-	return 0.5f * v1.length() * (v[1] - p).length();
+	bounds.Initialize(lower, upper);
+
+	return true;
+}
+
+float MeshTriangle::Area() const
+{
+	return 0.5f * cml::cross(v[1] - v[0], v[2] - v[0]).length();
 }
\ No newline at end of file
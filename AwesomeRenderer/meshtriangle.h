@@ -16,12 +16,17 @@ namespace AwesomeRenderer
 	{
 		using Triangle<Vector3>::CalculateBounds;
 		using Primitive::CalculateBounds;
+		using Triangle<Vector3>::CalculateClippedBounds;
+		using Primitive::CalculateClippedBounds;
 
 	public:
 		// Normal vector for this triangle (world space)
 		Vector3 normal;
 
 		uint32_t faceIdx;
+
+		// Log2 of the square root of the texture coordinate area per unit of object space surface area, zero without texture coordinates
+		float texelDensity;
 	
 	public:
 		MeshTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, uint32_t faceIdx);
@@ -32,13 +37,18 @@ namespace AwesomeRenderer
 		void Transform(const Matrix44& mtx);
 
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		int SideOfPlane(const Plane& plane) const;
 		int SideOfAAPlane(int axis, float position) const;
 
 		void CalculateBounds(AABB& bounds) const;
+		bool CalculateClippedBounds(const AABB& box, AABB& bounds) const;
 		float Area() const;
 
+
+	private:
+		bool CalculateIntersection(const Ray& ray, float maxDistance, float& t, Vector3& barycentricCoords) const;
 	};
 }
 
@@ -0,0 +1,18 @@
+#include "awesomerenderer.h"
+
+#include "mipmapjob.h"
+#include "texture.h"
+
+using namespace AwesomeRenderer;
+
+MipMapJob::MipMapJob(const Buffer& previousLevel, Buffer& mipLevel, uint32_t y, uint32_t height) :
+	previousLevel(previousLevel), mipLevel(mipLevel), y(y), height(height)
+{
+
+}
+
+void MipMapJob::Run()
+{
+	if (!IsInterrupted())
+		Texture::FilterMipLevel(previousLevel, mipLevel, y, y + height);
+}
\ No newline at end of file
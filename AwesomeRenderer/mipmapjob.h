@@ -0,0 +1,31 @@
+#ifndef _MIPMAP_JOB_H_
+#define _MIPMAP_JOB_H_
+
+#include "awesomerenderer.h"
+
+#include "workerjob.h"
+
+namespace AwesomeRenderer
+{
+	class Buffer;
+
+	// Filters a band of rows of a mip level from the previous level
+	class MipMapJob : public WorkerJob
+	{
+
+	private:
+		const Buffer& previousLevel;
+		Buffer& mipLevel;
+
+		uint32_t y, height;
+
+	public:
+		MipMapJob(const Buffer& previousLevel, Buffer& mipLevel, uint32_t y, uint32_t height);
+
+	protected:
+		void Run();
+
+	};
+}
+
+#endif
\ No newline at end of file
@@ -9,14 +9,16 @@
 
 using namespace AwesomeRenderer;
 
-ModelEx::ModelEx(Model& model) : Extension(model)
+ModelEx::ModelEx(Model& model, Scheduler* scheduler, const char* treeCacheDirectory, bool perfectSplits, AccelerationStructure accelerationStructure) : Extension(model)
 {
 	std::vector<Mesh*>::const_iterator it;
 
 	for (it = model.meshes.begin(); it != model.meshes.end(); ++it)
 	{
 		MeshEx* mesh = new MeshEx(**it);
-		mesh->OptimizeTree();
+		mesh->accelerationStructure = accelerationStructure;
+		mesh->tree.perfectSplits = perfectSplits;
+		mesh->OptimizeTree(scheduler, treeCacheDirectory);
 		meshes.push_back(mesh);
 	}
 }
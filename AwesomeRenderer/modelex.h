@@ -4,10 +4,12 @@
 #include "awesomerenderer.h"
 
 #include "model.h"
+#include "accelerationstructure.h"
 
 namespace AwesomeRenderer
 {
 	class MeshEx;
+	class Scheduler;
 
 	class ModelEx : public Extension<Model, ModelEx>
 	{
@@ -16,7 +18,8 @@ namespace AwesomeRenderer
 		std::vector<MeshEx*> meshes;
 
 	public:
-		ModelEx(Model& model);
+		ModelEx(Model& model, Scheduler* scheduler = NULL, const char* treeCacheDirectory = NULL, bool perfectSplits = false,
+			AccelerationStructure accelerationStructure = ACCELERATION_KDTREE);
 		~ModelEx();
 
 		static uint32_t ExtensionID() { return Model::MODEL_EX; }
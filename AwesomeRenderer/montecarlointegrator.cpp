@@ -22,12 +22,12 @@
 using namespace AwesomeRenderer;
 using namespace AwesomeRenderer::RayTracing;
 
-MonteCarloIntegrator::MonteCarloIntegrator(RayTracer& rayTracer) : SurfaceIntegrator(rayTracer), random(Random::instance)
+MonteCarloIntegrator::MonteCarloIntegrator(RayTracer& rayTracer) : SurfaceIntegrator(rayTracer)
 {
 
 }
 
-Vector3 MonteCarloIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth)
+Vector3 MonteCarloIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth)
 {
 	const RenderContext& renderContext = rayTracer.GetRenderContext();
 	Vector3 radiance = material.emission.subvector(3) * material.emissionIntensity;
@@ -42,12 +42,12 @@ Vector3 MonteCarloIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, cons
 			for (uint32_t lightIdx = 0; lightIdx < renderContext.lightData->areaLights.size(); ++lightIdx)
 			{
 				const AreaLight* light = renderContext.lightData->areaLights[lightIdx];
-				radiance += SampleAreaLight(*light, hitInfo.point, -ray.direction, hitInfo.normal, hitInfo, material);
+				radiance += SampleAreaLight(*light, hitInfo.point, -ray.direction, hitInfo.normal, hitInfo, material, random);
 			}
 		}
 
 		if (depth < rayTracer.maxDepth)
-			radiance += Sample(hitInfo.point, -ray.direction, hitInfo.normal, hitInfo, material, depth);
+			radiance += Sample(hitInfo.point, -ray.direction, hitInfo.normal, hitInfo, material, random, depth);
 	}
 
 	if (material.translucent)
@@ -58,8 +58,10 @@ Vector3 MonteCarloIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, cons
 		// Create a 'refraction' ray, which actually just passes through the surface
 		// Note: this is quite a bit epsilon value to add to the origin. This is to prevent infinitely hitting the same surface
 		Ray refractionRay(hitInfo.point + ray.direction * 0.05f, ray.direction);
+		refractionRay.type = Ray::TRANSMISSION;
+		refractionRay.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
 		ShadingInfo refractionShading;
-		rayTracer.CalculateShading(refractionRay, refractionShading, depth);
+		rayTracer.CalculateShading(refractionRay, refractionShading, random, depth);
 
 		// Blend radiance for this surface with the refracted radiance
 		Color color = Color(radiance, albedo[3]);
@@ -71,48 +73,76 @@ Vector3 MonteCarloIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, cons
 	return radiance;
 }
 
-Vector3 MonteCarloIntegrator::Sample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, int depth)
+Vector3 MonteCarloIntegrator::Sample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, int depth)
 {
-	// Sample BSDF
-	Vector2 r(random.NextFloat(), random.NextFloat());
+	Ray reflectionRay;
+	Vector3 weight;
 
-	Vector3 sampleVector;
-	material.bsdf->GenerateSampleVector(r, wo, normal, material, sampleVector);
-		
-	float pdf = material.bsdf->CalculatePDF(wo, sampleVector, normal, material);
+	if (!GenerateBSDFSample(p, wo, normal, hitInfo, material, random, reflectionRay, weight))
+		return Vector3(0.0f, 0.0f, 0.0f);
 
- 	return Sample(p, wo, sampleVector, normal, hitInfo, material, depth, pdf);
+	// Calculate incoming light along this sample vector
+	ShadingInfo reflectionShading;
+	rayTracer.CalculateShading(reflectionRay, reflectionShading, random, depth + 1);
+
+	Vector3 radiance = reflectionShading.color.subvector(3);
+
+	return weight * radiance;
 }
 
-Vector3 MonteCarloIntegrator::Sample(const Vector3& p, const Vector3& wo, const Vector3& wi, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, int depth, float pdf)
+bool MonteCarloIntegrator::GenerateBSDFSample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, Ray& sampleRay, Vector3& weight)
 {
+	// Sample BSDF
+	Vector2 r(random.NextFloat(), random.NextFloat());
+
+	Vector3 wi;
+	material.bsdf->GenerateSampleVector(r, wo, normal, material, wi);
+		
+	float pdf = material.bsdf->CalculatePDF(wo, wi, normal, material);
+
 	if (pdf < 1e-5f)
-		return Vector3(0.0f, 0.0f, 0.0f);
+		return false;
 
 	float NoL = VectorUtil<3>::Dot(normal, wi);
 
 	if (NoL <= 0.0f)
-		return Vector3(0.0f, 0.0f, 0.0f);
+		return false;
 	
 	Vector3 reflectance = material.bsdf->Sample(wo, wi, normal, hitInfo, material, rayTracer.GetRenderContext());
 	
 	if (reflectance.length_squared() < 1e-5f)
-		return Vector3(0.0f, 0.0f, 0.0f);
+		return false;
 
-	// Calculate incoming light along this sample vector
-	Ray reflectionRay(p + wi * 1e-5f, wi);
+	sampleRay = Ray(p + wi * 1e-5f, wi);
+	sampleRay.type = Ray::REFLECTION;
+	sampleRay.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
+	weight = reflectance * NoL / pdf;
 
-	ShadingInfo reflectionShading;
-	rayTracer.CalculateShading(reflectionRay, reflectionShading, depth + 1);
+	return true;
+}
 
-	Vector3 radiance = reflectionShading.color.subvector(3);
+Vector3 MonteCarloIntegrator::SampleAreaLight(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random)
+{
+	Vector3 radiance(0.0f, 0.0f, 0.0f);
+
+	LightSample samples[2];
+	uint32_t sampleCount = GenerateAreaLightSamples(light, p, wo, normal, hitInfo, material, random, samples);
+
+	for (uint32_t sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+	{
+		const LightSample& sample = samples[sampleIdx];
 
-	return reflectance * radiance * NoL / pdf;
+		// Shadow test
+		if (!rayTracer.Occluded(sample.shadowRay, sample.distance))
+			radiance += sample.radiance;
+	}
+
+	return radiance;
 }
 
-Vector3 MonteCarloIntegrator::SampleAreaLight(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material)
+uint32_t MonteCarloIntegrator::GenerateAreaLightSamples(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, LightSample* samples)
 {
-	Vector3 radiance(0.0f, 0.0f, 0.0f);
+	uint32_t sampleCount = 0;
 
 	Vector3 lightRadiance = light.material->emission.subvector(3) * light.material->emissionIntensity;
 
@@ -126,23 +156,14 @@ Vector3 MonteCarloIntegrator::SampleAreaLight(const AreaLight& light, const Vect
 	float lightPDF = light.primitive->CalculatePDF(p, lightSampleVector);
 	float bsdfPDF = material.bsdf->CalculatePDF(wo, lightSampleVector, normal, material);
 
-	// Shadow test
-	RaycastHit lightHit;
 	if (lightPDF > 0)
 	{
-		bool obstructed = rayTracer.RayCast(Ray(p + lightSampleVector * 1e-5f, lightSampleVector), lightHit, distanceToLight - 1e-5f);
-
-		if (obstructed)
-		{
-			const AreaLight* hitElement = dynamic_cast<const AreaLight*>(lightHit.element);
-			obstructed = hitElement != &light;
-		}
+		LightSample& sample = samples[sampleCount++];
+		sample.shadowRay = Ray(p + lightSampleVector * 1e-5f, lightSampleVector);
+		sample.distance = distanceToLight - 1e-5f;
 
-		if (!obstructed)
-		{
-			Vector3 reflectance = material.bsdf->Sample(wo, lightSampleVector, normal, hitInfo, material, rayTracer.GetRenderContext());
-			radiance += lightRadiance * reflectance * (VectorUtil<3>::Dot(normal, lightSampleVector) * PowerHeuristic(1, lightPDF, 1, bsdfPDF) / lightPDF);
-		}
+		Vector3 reflectance = material.bsdf->Sample(wo, lightSampleVector, normal, hitInfo, material, rayTracer.GetRenderContext());
+		sample.radiance = lightRadiance * reflectance * (VectorUtil<3>::Dot(normal, lightSampleVector) * PowerHeuristic(1, lightPDF, 1, bsdfPDF) / lightPDF);
 	}
 
 	// Sample BSDF
@@ -155,24 +176,18 @@ Vector3 MonteCarloIntegrator::SampleAreaLight(const AreaLight& light, const Vect
 	{
 		Ray bsdfRay(p + bsdfSampleVector * 1e-5f, bsdfSampleVector);
 
+		RaycastHit lightHit;
 		if (light.primitive->IntersectRay(bsdfRay, lightHit))
 		{
-			// Shadow test
-			bool obstructed = rayTracer.RayCast(bsdfRay, lightHit, lightHit.distance);
+			// Stop the shadow test just before the light so that it doesn't occlude itself
+			LightSample& sample = samples[sampleCount++];
+			sample.shadowRay = bsdfRay;
+			sample.distance = lightHit.distance - 1e-5f;
 
-			if (obstructed)
-			{
-				const AreaLight* hitElement = dynamic_cast<const AreaLight*>(lightHit.element);
-				obstructed = hitElement != &light;
-			}
-			
-			if (!obstructed)
-			{
-				Vector3 reflectance = material.bsdf->Sample(wo, bsdfSampleVector, normal, hitInfo, material, rayTracer.GetRenderContext());
-				radiance += lightRadiance * reflectance * (VectorUtil<3>::Dot(normal, bsdfSampleVector) * PowerHeuristic(1, bsdfPDF, 1, lightPDF) / bsdfPDF);
-			}
+			Vector3 reflectance = material.bsdf->Sample(wo, bsdfSampleVector, normal, hitInfo, material, rayTracer.GetRenderContext());
+			sample.radiance = lightRadiance * reflectance * (VectorUtil<3>::Dot(normal, bsdfSampleVector) * PowerHeuristic(1, bsdfPDF, 1, lightPDF) / bsdfPDF);
 		}
 	}
 
-	return radiance;
-}
\ No newline at end of file
+	return sampleCount;
+}
@@ -14,19 +14,22 @@ namespace AwesomeRenderer
 
 		class MonteCarloIntegrator : public SurfaceIntegrator
 		{
-		private:
-			Random& random;
-
 		public:
 			MonteCarloIntegrator(RayTracer& rayTracer);
 
-			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& renderContext, int depth);
+			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& renderContext, Random& random, int depth);
+
+		protected:
+			// Generates a continuation ray according to the BSDF. The weight is the reflectance divided by the sample probability
+			bool GenerateBSDFSample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, Ray& sampleRay, Vector3& weight);
+
+			// Generates the light and BSDF samples for an area light, weighted by multiple importance sampling. Returns the number of samples written
+			uint32_t GenerateAreaLightSamples(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, LightSample* samples);
 
 		private:
-			Vector3 Sample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, int depth);
-			Vector3 Sample(const Vector3& p, const Vector3& wo, const Vector3& wi, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, int depth, float pdf);
+			Vector3 Sample(const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random, int depth);
 			
-			Vector3 SampleAreaLight(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material);
+			Vector3 SampleAreaLight(const AreaLight& light, const Vector3& p, const Vector3& wo, const Vector3& normal, const RaycastHit& hitInfo, const Material& material, Random& random);
 
 			AR_INLINE float BalanceHeuristic(int nF, float pdfF, int nG, float pdfG)
 			{
@@ -10,12 +10,18 @@
 #include "phongshader.h"
 #include "sampler.h"
 #include "blinndistribution.h"
+#include "meshcache.h"
+#include "mappedfile.h"
+#include "objparser.h"
+#include "objparsejob.h"
+#include "jobbatch.h"
 
 using namespace AwesomeRenderer;
 
 const float ObjLoader::HEIGHT_MAP_NORMAL_STRENGTH = 2.0f;
+const uint32_t ObjLoader::PARSE_CHUNK_SIZE = 1 << 20;
 
-ObjLoader::ObjLoader(TextureFactory& textureFactory) : textureFactory(textureFactory)
+ObjLoader::ObjLoader(TextureFactory& textureFactory) : textureFactory(textureFactory), scheduler(NULL), useMeshCache(true)
 {
 	defaultShader = new PhongShader();
 
@@ -27,216 +33,233 @@ ObjLoader::ObjLoader(TextureFactory& textureFactory) : textureFactory(textureFac
 
 void ObjLoader::Load(const char* fileName, Model& model)
 {
-	FileReader reader;
+	if (useMeshCache && LoadMeshCache(fileName, model))
+		return;
+
+	MappedFile file;
 	
-	if (!reader.Open(fileName))
+	if (!file.Open(fileName))
 	{
 		printf("[ObjLoader]: Failed to load file \"%s\"\n", fileName);
 		return;
 	}
 
-	Mesh::VertexAttributes defaultAttributes = (Mesh::VertexAttributes) 0;
+	const char* data = reinterpret_cast<const char*>(file.GetData());
 
-	// Buffers that hold the vertex lists
-	std::vector<Vector3> vertexBuffer;
-	std::vector<Vector3> normalBuffer;
-	std::vector<Vector2> texcoordBuffer;
+	std::vector<ObjParser::Chunk> chunks;
+	ObjParser::SplitChunks(data, data + file.GetSize(), PARSE_CHUNK_SIZE, chunks);
 
-	Mesh* mesh = NULL;
-	Material* material = NULL;
-	
-	while (char* lineBuffer = reader.ReadLine())
-	{		
-		std::string line(lineBuffer);
-
-		uint32_t charIdx = 0;
-		
-		// Skip whitespace at the start of the line
-		for (charIdx = 0; charIdx < line.length(); ++charIdx)
-		{
-			char c = line[charIdx];
-			if (c != ' ' || c != '\t')
-				break;
-
-		}
-
-		if (charIdx == line.length())
-			continue;
+	ParseChunks(chunks);
 
-		lineBuffer += charIdx;
-		line = line.substr(charIdx);
-		charIdx = 0;
+	// All parsed data is copied out of the file
+	file.Close();
 
-		switch (line[charIdx])
-		{
-			case '\0':
-			case '\r':	
-			case '\n':
-			case '#':
-				// Empty line or comment, skip it
-				break;
+	// Merge the vertex lists of all chunks, relative indices in a chunk are offset by the elements defined before it
+	std::vector<Vector3> vertexBuffer;
+	std::vector<Vector3> normalBuffer;
+	std::vector<Vector2> texcoordBuffer;
 
-			case 'g':
-			{
-				// New submesh
-				// TODO: Manage memory registered by factory
-				mesh = new Mesh(defaultAttributes);
-				material = NULL;
-				
-				model.AddMesh(mesh, defaultMaterial);
-				
-				break;
-			}
+	std::vector<int32_t> vertexBase, normalBase, texcoordBase;
 
-			case 'v':
-			{
-				float v[3];
+	for (auto it = chunks.begin(); it != chunks.end(); ++it)
+	{
+		vertexBase.push_back(vertexBuffer.size());
+		normalBase.push_back(normalBuffer.size());
+		texcoordBase.push_back(texcoordBuffer.size());
 
-				do
-				{
-					// Vertex
-					if (sscanf_s(lineBuffer, "v %f %f %f", &v[0], &v[1], &v[2]) > 0)
-					{
-						vertexBuffer.push_back(Vector3(v[0], v[1], v[2]));
-						break;
-					}
+		vertexBuffer.insert(vertexBuffer.end(), it->vertices.begin(), it->vertices.end());
+		normalBuffer.insert(normalBuffer.end(), it->normals.begin(), it->normals.end());
+		texcoordBuffer.insert(texcoordBuffer.end(), it->texcoords.begin(), it->texcoords.end());
+	}
 
-					// Texture coordinate
-					if (sscanf_s(lineBuffer, "vt %f %f", &v[0], &v[1]) > 0)
-					{
-						texcoordBuffer.push_back(Vector2(v[0], v[1]));
-						break;
-					}
+	Mesh::VertexAttributes defaultAttributes = (Mesh::VertexAttributes) 0;
 
-					// Normal
-					if (sscanf_s(lineBuffer, "vn %f %f %f", &v[0], &v[1], &v[2]) > 0)
-					{
-						Vector3 normal(v[0], v[1], v[2]);
-						normal.normalize();
-						normalBuffer.push_back(normal);
-						break;
-					}
+	Mesh* mesh = NULL;
+	Material* material = NULL;
 
-					printf("[ObjLoader]: Invalid vertex definition in OBJ \"%s\"\n", lineBuffer);
+	// Material libraries and material names referenced by the submeshes, stored in the mesh cache
+	MeshCache::Contents cacheContents;
 
-				} while (false);
+	// Statements are executed in file order
+	for (uint32_t chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx)
+	{
+		const ObjParser::Chunk& chunk = chunks[chunkIdx];
 
-				break;
-			}
+		for (auto it = chunk.statements.begin(); it != chunk.statements.end(); ++it)
+		{
+			const ObjParser::Statement& statement = *it;
 
-			case 'f':
+			switch (statement.type)
 			{
-				assert(mesh != NULL && "Face definition found before group definition!");
-
-				IndexReader reader;
-				uint32_t vertices = reader.Parse(lineBuffer, 2, line.length() - 2);
-
-				assert(vertices == 3 || vertices == 4);
-
-				for (uint32_t vertexIdx = 0; vertexIdx < vertices; ++vertexIdx)
+				case ObjParser::STATEMENT_GROUP:
 				{
-					IndexReader::VertexIndices& vi = reader.vertexIndices[vertexIdx];
-
-					// Negative indices are relative to the buffer arrays
-					// Others are index in the buffer array + 1
+					// New submesh
+					// TODO: Manage memory registered by factory
+					mesh = new Mesh(defaultAttributes);
+					material = NULL;
 
-					if (vi.vertexIdx < 0)
-						vi.vertexIdx = vertexBuffer.size() + vi.vertexIdx;
-					else
-						--vi.vertexIdx;
-
-					if (vi.normalIdx < 0)
-						vi.normalIdx = normalBuffer.size() + vi.normalIdx;
-					else
-						--vi.normalIdx;
+					model.AddMesh(mesh, defaultMaterial);
+					cacheContents.materials.push_back(MeshCache::MaterialReference());
 
-					if (vi.texcoordIdx < 0)
-						vi.texcoordIdx = texcoordBuffer.size() + vi.texcoordIdx;
-					else
-						--vi.texcoordIdx;
+					break;
 				}
 
-				// Triangle indices
-				const uint32_t triangles[] =
+				case ObjParser::STATEMENT_FACE:
 				{
-					0, 1, 2,
-					0, 2, 3
-				};
+					assert(mesh != NULL && "Face definition found before group definition!");
 
-				// Iterate through all vertices of the face
-				for (uint32_t triIdx = 0; triIdx < (vertices - 2); ++triIdx)
-				{
-					//for (uint32_t vertexIdx = 0; vertexIdx < 3; ++vertexIdx)
-					for (int32_t vertexIdx = 2; vertexIdx >= 0; --vertexIdx)
-					{
-						IndexReader::VertexIndices& vi = reader.vertexIndices[triangles[triIdx * 3 + vertexIdx]];
-							
-						if (vi.vertexIdx >= 0)
-						{
-							mesh->vertices.push_back(vertexBuffer[vi.vertexIdx]);
-							mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_POSITION);
-						}
+					const ObjParser::FaceVertex* faceVertices = &chunk.faceVertices[statement.first];
 
-						if (vi.texcoordIdx >= 0)
-						{
-							mesh->texcoords.push_back(texcoordBuffer[vi.texcoordIdx]);
-							mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_TEXCOORD);
-						}
+					// Faces are triangulated as a fan, with the winding order of the vertices reversed
+					for (uint32_t triIdx = 0; triIdx < statement.count - 2; ++triIdx)
+					{
+						const uint32_t corners[] = { triIdx + 2, triIdx + 1, 0 };
 
-						if (vi.normalIdx >= 0)
+						for (uint32_t cornerIdx = 0; cornerIdx < 3; ++cornerIdx)
 						{
-							mesh->normals.push_back(normalBuffer[vi.normalIdx]);
-							mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_NORMAL);
+							const ObjParser::FaceVertex& vertex = faceVertices[corners[cornerIdx]];
+
+							int32_t vertexIdx = vertex.vertexIdx + ((vertex.relative & ObjParser::RELATIVE_VERTEX) ? vertexBase[chunkIdx] : 0);
+							int32_t texcoordIdx = vertex.texcoordIdx + ((vertex.relative & ObjParser::RELATIVE_TEXCOORD) ? texcoordBase[chunkIdx] : 0);
+							int32_t normalIdx = vertex.normalIdx + ((vertex.relative & ObjParser::RELATIVE_NORMAL) ? normalBase[chunkIdx] : 0);
+
+							if (vertexIdx >= 0 && vertexIdx < (int32_t) vertexBuffer.size())
+							{
+								mesh->vertices.push_back(vertexBuffer[vertexIdx]);
+								mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_POSITION);
+							}
+
+							if (texcoordIdx >= 0 && texcoordIdx < (int32_t) texcoordBuffer.size())
+							{
+								mesh->texcoords.push_back(texcoordBuffer[texcoordIdx]);
+								mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_TEXCOORD);
+							}
+
+							if (normalIdx >= 0 && normalIdx < (int32_t) normalBuffer.size())
+							{
+								mesh->normals.push_back(normalBuffer[normalIdx]);
+								mesh->attributes = (Mesh::VertexAttributes) (mesh->attributes | Mesh::VERTEX_NORMAL);
+							}
+
+							mesh->indices.push_back(mesh->vertices.size() - 1);
 						}
-							
-						mesh->indices.push_back(mesh->vertices.size() - 1);
 					}
-				}
-
 
-				break;
-			}
+					break;
+				}
 
-			default:
-				// Material library directive
-				if (line.compare(0, 6, "mtllib") == 0)
+				case ObjParser::STATEMENT_MATERIAL_LIB:
 				{
-					std::string mtlLib = GetRelativeFileName(line.substr(7), fileName);					
+					// Material library directive
+					std::string mtlLib = GetRelativeFileName(chunk.names[statement.first], fileName);
 					LoadMaterialLib(mtlLib.c_str());
+
+					cacheContents.materialLibs.push_back(mtlLib);
 					break;
 				}
 
-				// Material reference directive
-				if (line.compare(0, 6, "usemtl") == 0)
+				case ObjParser::STATEMENT_USE_MATERIAL:
 				{
-					std::string name = line.substr(7);
+					// Material reference directive
+					const std::string& name = chunk.names[statement.first];
 
 					Material* linkedMaterial = materialLib[name];
-					
+
+					MeshCache::MaterialReference reference;
+					reference.materialLib = cacheContents.materialLibs.size() - 1;
+					reference.name = name;
+
 					if (material != NULL)
 					{
 						// If the mesh already has a material, create a new submesh
 						mesh = new Mesh(defaultAttributes);
 						model.AddMesh(mesh, linkedMaterial);
+						cacheContents.materials.push_back(reference);
 					}
 					else
 					{
 						// Assign this material to the last created submesh
 						model.materials[model.materials.size() - 1] = linkedMaterial;
+						cacheContents.materials[cacheContents.materials.size() - 1] = reference;
 					}
 
 					material = linkedMaterial;
 
 					break;
 				}
-
-				//printf("[ObjLoader]: Invalid line in OBJ \"%s\"\n", lineBuffer);
-				break;
+			}
 		}
 	}
-	
-	reader.Close();
-	
+
+	FinalizeModel(fileName, model);
+
+	if (useMeshCache)
+	{
+		cacheContents.meshes = model.meshes;
+
+		std::string cacheFileName = std::string(fileName) + MeshCache::FILE_EXTENSION;
+
+		if (MeshCache::Write(cacheFileName, fileName, cacheContents))
+			printf("[ObjLoader]: Wrote mesh cache \"%s\"\n", cacheFileName.c_str());
+	}
+}
+
+void ObjLoader::ParseChunks(std::vector<ObjParser::Chunk>& chunks)
+{
+	if (scheduler == NULL || chunks.size() == 1)
+	{
+		for (auto it = chunks.begin(); it != chunks.end(); ++it)
+			ObjParser::ParseChunk(*it);
+
+		return;
+	}
+
+	JobBatch jobs(scheduler);
+
+	for (auto it = chunks.begin(); it != chunks.end(); ++it)
+		jobs.Schedule(new ObjParseJob(*it));
+
+	jobs.Clear();
+}
+
+bool ObjLoader::LoadMeshCache(const char* fileName, Model& model)
+{
+	std::string cacheFileName = std::string(fileName) + MeshCache::FILE_EXTENSION;
+
+	MeshCache::Contents contents;
+
+	if (!MeshCache::Read(cacheFileName, fileName, contents))
+		return false;
+
+	// Loading a library replaces the current one, so the materials of each library are kept separately
+	std::vector<std::map<std::string, Material*>> materialLibs;
+
+	for (auto it = contents.materialLibs.begin(); it != contents.materialLibs.end(); ++it)
+	{
+		LoadMaterialLib(it->c_str());
+		materialLibs.push_back(materialLib);
+	}
+
+	for (uint32_t meshIdx = 0; meshIdx < contents.meshes.size(); ++meshIdx)
+	{
+		const MeshCache::MaterialReference& reference = contents.materials[meshIdx];
+		Material* material = defaultMaterial;
+
+		if (!reference.name.empty())
+			material = reference.materialLib >= 0 ? materialLibs[reference.materialLib][reference.name] : NULL;
+
+		model.AddMesh(contents.meshes[meshIdx], material);
+	}
+
+	printf("[ObjLoader]: Loaded mesh cache \"%s\"\n", cacheFileName.c_str());
+
+	FinalizeModel(fileName, model);
+
+	return true;
+}
+
+void ObjLoader::FinalizeModel(const char* fileName, Model& model)
+{
 	// Count total number of vertices/triangles
 	int verts = 0, tris = 0;
 
@@ -250,23 +273,17 @@ void ObjLoader::Load(const char* fileName, Model& model)
 
 		mesh.CalculateBounds();
 
-		// If the mesh's material has a normal map, calculate tangent space basis vectors
+		// If the mesh's material has a normal map, calculate tangent space basis vectors. Meshes from the cache already have them
 		Material* material = model.materials[cMesh];
-		if (material != NULL && material->normalMap != NULL)
+		if (material != NULL && material->normalMap != NULL && !mesh.HasAttribute(Mesh::VERTEX_TANGENTS))
 			mesh.CalculateTangentBasis();
 	}
 
 	model.CalculateBounds();
 
-	// Release buffers
-	vertexBuffer.clear();
-	normalBuffer.clear();
-	texcoordBuffer.clear();
-
 	printf("[ObjLoader]: Loaded \"%s\" with %d vertices and %d triangles in %d meshes.\n", fileName, verts, tris, meshes.size());
 }
 
-
 void ObjLoader::LoadMaterialLib(const char* fileName)
 {
 	materialLib.clear();
@@ -518,7 +535,7 @@ void ObjLoader::LoadMaterialLib(const char* fileName)
 						}
 
 						if (diffuseMap->texture->HasMipmaps())
-							mergedTexture->GenerateMipMaps();
+							textureFactory.GenerateMipMaps(mergedTexture);
 
 						diffuseMap->texture = mergedTexture;
 						material->translucent = TRUE;
@@ -567,103 +584,4 @@ void ObjLoader::ParseColor(const char* input, Color& color)
 		base = next;
 		++channel;
 	}
-}
-
-uint32_t ObjLoader::IndexReader::Parse(const char* buffer, uint32_t offset, uint32_t amount)
-{
-	vertexIdx = -1;
-	NextVertex();
-
-	ResetIndex();
-
-	for (uint32_t charIdx = offset; charIdx < offset + amount + 1; ++charIdx)
-	{
-		const char c = buffer[charIdx];
-
-		switch (c)
-		{
-		case '\0':
-		case ' ':
-			// Extra whitespace without an index, ignore it
-			if (currentIdx == 0)
-				break;
-
-			// We finished the last index in a vertex, save it and move to the next one 
-			SaveCurrentIdx();
-			NextVertex();
-
-			break;
-
-		case '/':
-			// Save the index, even if it is zero
-			SaveCurrentIdx();
-			break;
-
-		case '#':
-			// Comment incoming, skip rest of line
-			charIdx = offset + amount;
-			break;
-
-		case '-':
-			// Unary operator should be before any digits
-			if (currentIdx != 0)
-			{
-				printf("[ObjLoader]: Unexpected character '-' in face definition.\n");
-				break;
-			}
-
-			// Flip sign (yeah we support --10 == 10 as an index)
-			sign *= -1;
-			break;
-
-		default:
-			// Check if character is a digit
-			if (c >= '0' && c <= '9')
-			{
-				// Add digit to current total index
-				currentIdx = (currentIdx * 10) + ((c - '0') * sign);
-				break;
-			}
-
-			printf("[ObjLoader]: Unkown character '%c' in face definition.\n", c);
-			break;
-		}
-	}
-	
-	return vertexIdx;
-}
-
-ObjLoader::IndexReader::IndexReader()
-{
-
-}
-
-void ObjLoader::IndexReader::SaveCurrentIdx()
-{
-	// Retrieve pointer to the VertexIndices element we want to save the index to
-	int32_t* base = reinterpret_cast<int32_t*>(&vertexIndices[vertexIdx]);
-
-	// Save index in the correct attribute
-	*(base + attributeIdx) = currentIdx;
-
-	// Reset index and move to the next attribute
-	++attributeIdx;
-
-	ResetIndex();
-}
-
-void ObjLoader::IndexReader::NextVertex()
-{
-	// Clear the next vertex indices struct
-	++vertexIdx;
-	attributeIdx = 0;
-
-	if (vertexIdx < MAX_VERTICES)
-		vertexIndices[vertexIdx] = VertexIndices();
-}
-
-void ObjLoader::IndexReader::ResetIndex()
-{
-	sign = 1;
-	currentIdx = 0;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define _OBJ_LOADER_H_
 
 #include "awesomerenderer.h"
+#include "objparser.h"
 
 namespace AwesomeRenderer
 {
@@ -12,46 +13,17 @@ namespace AwesomeRenderer
 	class PhongMaterial;
 	class Shader;
 	class TextureFactory;
+	class Scheduler;
 
 	class ObjLoader
 	{
 		
-	public:
-
-		class IndexReader
-		{
-		public:
-			static const uint32_t MAX_VERTICES = 10;
-
-			struct VertexIndices
-			{
-				int32_t vertexIdx, texcoordIdx, normalIdx;
-
-				VertexIndices() : vertexIdx(0), texcoordIdx(0), normalIdx(0)
-				{
-
-				}
-			};
-
-			VertexIndices vertexIndices[MAX_VERTICES];
-		private:
-			int32_t vertexIdx;
-			int32_t attributeIdx;
-			int32_t sign;
-			int32_t currentIdx;
-
-		public:
-			IndexReader();
-			uint32_t Parse(const char* buffer, uint32_t offset, uint32_t amount);
-
-		private:
-			void SaveCurrentIdx();
-			void NextVertex();
-			void ResetIndex();
-		};
 	private:
 		static const float HEIGHT_MAP_NORMAL_STRENGTH;
 
+		// Files are split in chunks of this many bytes that are parsed in parallel
+		static const uint32_t PARSE_CHUNK_SIZE;
+
 		std::map<std::string, Material*> materialLib;
 
 		TextureFactory& textureFactory;
@@ -61,6 +33,12 @@ namespace AwesomeRenderer
 
 		Shader* defaultShader;
 
+	public:
+		// Parses large files on multiple threads if set
+		Scheduler* scheduler;
+
+		// Whether parsed models are stored in a mesh cache file next to the source, which is loaded instead on the next run
+		bool useMeshCache;
 
 	public:
 		ObjLoader(TextureFactory& textureFactory);
@@ -69,6 +47,10 @@ namespace AwesomeRenderer
 		void LoadMaterialLib(const char* fileName);
 
 	private:
+		void ParseChunks(std::vector<ObjParser::Chunk>& chunks);
+		bool LoadMeshCache(const char* fileName, Model& model);
+		void FinalizeModel(const char* fileName, Model& model);
+
 		std::string GetRelativeFileName(std::string fileName, const char* basePath);
 		void ParseColor(const char* input, Color& color);
 	};
@@ -0,0 +1,16 @@
+#include "awesomerenderer.h"
+
+#include "objparsejob.h"
+
+using namespace AwesomeRenderer;
+
+ObjParseJob::ObjParseJob(ObjParser::Chunk& chunk) : chunk(chunk)
+{
+
+}
+
+void ObjParseJob::Run()
+{
+	if (!IsInterrupted())
+		ObjParser::ParseChunk(chunk);
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef _OBJ_PARSE_JOB_H_
+#define _OBJ_PARSE_JOB_H_
+
+#include "awesomerenderer.h"
+
+#include "threading.h"
+#include "workerjob.h"
+#include "objparser.h"
+
+namespace AwesomeRenderer
+{
+
+	// Parses a chunk of an OBJ file
+	class ObjParseJob : public WorkerJob
+	{
+
+	private:
+		ObjParser::Chunk& chunk;
+
+	public:
+		ObjParseJob(ObjParser::Chunk& chunk);
+
+	protected:
+		void Run();
+
+	};
+}
+
+#endif
\ No newline at end of file
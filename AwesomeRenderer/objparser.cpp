@@ -0,0 +1,410 @@
+#include "awesomerenderer.h"
+
+#include "objparser.h"
+
+using namespace AwesomeRenderer;
+
+namespace
+{
+	// Powers of ten that are exactly representable as a float
+	const float POWERS_OF_TEN[] =
+	{
+		1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+	};
+
+	const int32_t MAX_EXACT_EXPONENT = 10;
+	const uint64_t MAX_EXACT_MANTISSA = 1ULL << 24;
+
+	// Digits beyond this amount could overflow the 64-bit mantissa
+	const uint32_t MAX_MANTISSA_DIGITS = 19;
+}
+
+void ObjParser::ParseChunk(Chunk& chunk)
+{
+	const char* c = chunk.begin;
+
+	while (c < chunk.end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(c, '\n', chunk.end - c));
+
+		if (lineEnd == NULL)
+			lineEnd = chunk.end;
+
+		const char* next = lineEnd < chunk.end ? lineEnd + 1 : lineEnd;
+
+		// Strip the carriage return of Windows line endings
+		while (lineEnd > c && lineEnd[-1] == '\r')
+			--lineEnd;
+
+		ParseLine(chunk, c, lineEnd);
+
+		c = next;
+	}
+}
+
+void ObjParser::SplitChunks(const char* begin, const char* end, uint32_t chunkSize, std::vector<Chunk>& chunks)
+{
+	chunks.clear();
+
+	const char* c = begin;
+
+	while (c < end)
+	{
+		const char* chunkEnd = end;
+
+		// Extend the chunk up to and including the next line break
+		if ((uint64_t) (end - c) > chunkSize)
+		{
+			const char* newline = static_cast<const char*>(memchr(c + chunkSize, '\n', end - (c + chunkSize)));
+			chunkEnd = newline != NULL ? newline + 1 : end;
+		}
+
+		chunks.emplace_back();
+		chunks.back().begin = c;
+		chunks.back().end = chunkEnd;
+
+		c = chunkEnd;
+	}
+}
+
+void ObjParser::ParseLine(Chunk& chunk, const char* c, const char* end)
+{
+	SkipWhitespace(c, end);
+
+	if (c == end)
+		return;
+
+	switch (*c)
+	{
+		case '#':
+			// Comment, skip it
+			break;
+
+		case 'v':
+		{
+			float v[3] = { 0.0f, 0.0f, 0.0f };
+
+			++c;
+
+			// Texture coordinate
+			if (c < end && *c == 't')
+			{
+				++c;
+
+				if (ParseVector(c, end, v, 2) > 0)
+				{
+					chunk.texcoords.push_back(Vector2(v[0], v[1]));
+					break;
+				}
+			}
+
+			// Normal
+			else if (c < end && *c == 'n')
+			{
+				++c;
+
+				if (ParseVector(c, end, v, 3) > 0)
+				{
+					Vector3 normal(v[0], v[1], v[2]);
+					normal.normalize();
+					chunk.normals.push_back(normal);
+					break;
+				}
+			}
+
+			// Vertex
+			else if (ParseVector(c, end, v, 3) > 0)
+			{
+				chunk.vertices.push_back(Vector3(v[0], v[1], v[2]));
+				break;
+			}
+
+			printf("[ObjParser]: Invalid vertex definition in OBJ\n");
+			break;
+		}
+
+		case 'f':
+			ParseFace(chunk, c + 1, end);
+			break;
+
+		case 'g':
+		{
+			// New submesh
+			Statement statement = { STATEMENT_GROUP, 0, 0 };
+			chunk.statements.push_back(statement);
+			break;
+		}
+
+		default:
+		{
+			StatementType type;
+
+			// Material library and material reference directives, their argument is the rest of the line
+			if (end - c > 7 && strncmp(c, "mtllib", 6) == 0)
+				type = STATEMENT_MATERIAL_LIB;
+			else if (end - c > 7 && strncmp(c, "usemtl", 6) == 0)
+				type = STATEMENT_USE_MATERIAL;
+			else
+				break;
+
+			Statement statement = { type, (uint32_t) chunk.names.size(), 1 };
+			chunk.statements.push_back(statement);
+			chunk.names.push_back(std::string(c + 7, end));
+			break;
+		}
+	}
+}
+
+void ObjParser::ParseFace(Chunk& chunk, const char* c, const char* end)
+{
+	FaceVertex vertices[MAX_FACE_VERTICES];
+	uint32_t vertexCount = 0;
+
+	while (true)
+	{
+		SkipWhitespace(c, end);
+
+		// Stop at the end of the line or a comment
+		if (c == end || *c == '#')
+			break;
+
+		if (vertexCount == MAX_FACE_VERTICES)
+		{
+			printf("[ObjParser]: Face definition with more than %u vertices.\n", MAX_FACE_VERTICES);
+			return;
+		}
+
+		FaceVertex& vertex = vertices[vertexCount];
+		vertex.relative = 0;
+		vertex.texcoordIdx = -1;
+		vertex.normalIdx = -1;
+
+		int32_t index;
+
+		if (!ParseInt(c, end, index))
+		{
+			printf("[ObjParser]: Unknown character '%c' in face definition.\n", *c);
+			return;
+		}
+
+		vertex.vertexIdx = ResolveIndex(index, chunk.vertices.size(), vertex.relative, RELATIVE_VERTEX);
+
+		// Texture coordinate and normal indices are optional, as in "v//vn"
+		if (c < end && *c == '/')
+		{
+			++c;
+
+			if (ParseInt(c, end, index))
+				vertex.texcoordIdx = ResolveIndex(index, chunk.texcoords.size(), vertex.relative, RELATIVE_TEXCOORD);
+
+			if (c < end && *c == '/')
+			{
+				++c;
+
+				if (ParseInt(c, end, index))
+					vertex.normalIdx = ResolveIndex(index, chunk.normals.size(), vertex.relative, RELATIVE_NORMAL);
+			}
+		}
+
+		if (c < end && !IsWhitespace(*c) && *c != '#')
+		{
+			printf("[ObjParser]: Unknown character '%c' in face definition.\n", *c);
+			return;
+		}
+
+		++vertexCount;
+	}
+
+	if (vertexCount < 3)
+	{
+		printf("[ObjParser]: Face definition with less than 3 vertices.\n");
+		return;
+	}
+
+	Statement statement = { STATEMENT_FACE, (uint32_t) chunk.faceVertices.size(), vertexCount };
+	chunk.statements.push_back(statement);
+	chunk.faceVertices.insert(chunk.faceVertices.end(), vertices, vertices + vertexCount);
+}
+
+uint32_t ObjParser::ParseVector(const char*& c, const char* end, float* components, uint32_t count)
+{
+	uint32_t parsed = 0;
+
+	while (parsed < count)
+	{
+		SkipWhitespace(c, end);
+
+		if (!ParseFloat(c, end, components[parsed]))
+			break;
+
+		++parsed;
+	}
+
+	return parsed;
+}
+
+int32_t ObjParser::ResolveIndex(int32_t index, uint32_t definedElements, uint32_t& relative, RelativeIndex flag)
+{
+	// Positive indices start at one, negative indices count back from the last defined element
+	if (index > 0)
+		return index - 1;
+
+	if (index < 0)
+	{
+		relative |= flag;
+		return (int32_t) definedElements + index;
+	}
+
+	// An index of zero means the attribute is missing
+	return -1;
+}
+
+bool ObjParser::ParseFloat(const char*& c, const char* end, float& value)
+{
+	const char* start = c;
+
+	bool negative = false;
+
+	if (c < end && (*c == '-' || *c == '+'))
+	{
+		negative = *c == '-';
+		++c;
+	}
+
+	uint64_t mantissa = 0;
+	int32_t exponent = 0;
+
+	uint32_t mantissaDigits = 0;
+	bool hasDigits = false;
+
+	// Integer part
+	for (; c < end && *c >= '0' && *c <= '9'; ++c)
+	{
+		hasDigits = true;
+
+		if (mantissaDigits < MAX_MANTISSA_DIGITS)
+		{
+			mantissa = mantissa * 10 + (*c - '0');
+
+			// Leading zeros don't count as digits
+			if (mantissa > 0)
+				++mantissaDigits;
+		}
+		else
+			++exponent;
+	}
+
+	// Fractional part
+	if (c < end && *c == '.')
+	{
+		++c;
+
+		for (; c < end && *c >= '0' && *c <= '9'; ++c)
+		{
+			hasDigits = true;
+
+			if (mantissaDigits < MAX_MANTISSA_DIGITS)
+			{
+				mantissa = mantissa * 10 + (*c - '0');
+				--exponent;
+
+				if (mantissa > 0)
+					++mantissaDigits;
+			}
+		}
+	}
+
+	if (!hasDigits)
+	{
+		c = start;
+		return false;
+	}
+
+	// Exponent, only consumed if it contains digits
+	if (c < end && (*c == 'e' || *c == 'E'))
+	{
+		const char* e = c + 1;
+		bool negativeExponent = false;
+
+		if (e < end && (*e == '-' || *e == '+'))
+		{
+			negativeExponent = *e == '-';
+			++e;
+		}
+
+		if (e < end && *e >= '0' && *e <= '9')
+		{
+			int32_t exponentValue = 0;
+
+			for (; e < end && *e >= '0' && *e <= '9'; ++e)
+			{
+				if (exponentValue < 10000)
+					exponentValue = exponentValue * 10 + (*e - '0');
+			}
+
+			exponent += negativeExponent ? -exponentValue : exponentValue;
+			c = e;
+		}
+	}
+
+	// Both the mantissa and the power of ten are exact floats, so a single float multiplication or division rounds correctly.
+	// This covers the usual seven significant digits, rounding through a double could differ from strtof in the last bit
+	if (mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_EXPONENT && exponent <= MAX_EXACT_EXPONENT)
+	{
+		float result = (float) mantissa;
+		result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+
+		value = negative ? -result : result;
+		return true;
+	}
+
+	// Numbers with many digits or large exponents are left to the C library, which needs a terminated copy of the token
+	size_t length = c - start;
+	char buffer[64];
+
+	if (length < sizeof(buffer))
+	{
+		memcpy(buffer, start, length);
+		buffer[length] = '\0';
+
+		value = strtof(buffer, NULL);
+	}
+	else
+		value = strtof(std::string(start, length).c_str(), NULL);
+
+	return true;
+}
+
+bool ObjParser::ParseInt(const char*& c, const char* end, int32_t& value)
+{
+	const char* start = c;
+
+	int32_t sign = 1;
+
+	if (c < end && (*c == '-' || *c == '+'))
+	{
+		sign = *c == '-' ? -1 : 1;
+		++c;
+	}
+
+	if (c == end || *c < '0' || *c > '9')
+	{
+		c = start;
+		return false;
+	}
+
+	int32_t result = 0;
+
+	for (; c < end && *c >= '0' && *c <= '9'; ++c)
+		result = result * 10 + (*c - '0');
+
+	value = sign * result;
+
+	return true;
+}
+
+void ObjParser::SkipWhitespace(const char*& c, const char* end)
+{
+	while (c < end && IsWhitespace(*c))
+		++c;
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef _OBJ_PARSER_H_
+#define _OBJ_PARSER_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+
+	// Parses a range of lines of an OBJ file. Files are split in chunks at line boundaries that are parsed independently,
+	// the results are merged in file order by the ObjLoader.
+	class ObjParser
+	{
+
+	public:
+		static const uint32_t MAX_FACE_VERTICES = 16;
+
+		enum StatementType
+		{
+			STATEMENT_GROUP,
+			STATEMENT_FACE,
+			STATEMENT_MATERIAL_LIB,
+			STATEMENT_USE_MATERIAL,
+		};
+
+		enum RelativeIndex
+		{
+			RELATIVE_VERTEX		= 1,
+			RELATIVE_TEXCOORD	= 2,
+			RELATIVE_NORMAL		= 4,
+		};
+
+		// Zero based indices of the attributes of a face vertex, negative if the attribute is missing.
+		// Indices that are relative in the file are stored relative to the first element defined in the chunk.
+		struct FaceVertex
+		{
+			int32_t vertexIdx, texcoordIdx, normalIdx;
+			uint32_t relative;
+		};
+
+		// Faces refer to their vertices in the face vertex list, other statements to their argument in the name list
+		struct Statement
+		{
+			StatementType type;
+			uint32_t first, count;
+		};
+
+		struct Chunk
+		{
+			const char* begin;
+			const char* end;
+
+			std::vector<Vector3> vertices;
+			std::vector<Vector3> normals;
+			std::vector<Vector2> texcoords;
+
+			std::vector<FaceVertex> faceVertices;
+			std::vector<Statement> statements;
+			std::vector<std::string> names;
+		};
+
+	public:
+		static void ParseChunk(Chunk& chunk);
+
+		// Splits a file in chunks of roughly the given size, that end on a line boundary
+		static void SplitChunks(const char* begin, const char* end, uint32_t chunkSize, std::vector<Chunk>& chunks);
+
+		static bool ParseFloat(const char*& c, const char* end, float& value);
+		static bool ParseInt(const char*& c, const char* end, int32_t& value);
+
+	private:
+		static void ParseLine(Chunk& chunk, const char* line, const char* end);
+		static void ParseFace(Chunk& chunk, const char* c, const char* end);
+
+		static uint32_t ParseVector(const char*& c, const char* end, float* components, uint32_t count);
+		static int32_t ResolveIndex(int32_t index, uint32_t definedElements, uint32_t& relative, RelativeIndex flag);
+
+		static void SkipWhitespace(const char*& c, const char* end);
+		static bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
+	};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include "awesomerenderer.h"
+
+#include "pixelconverter.h"
+
+using namespace AwesomeRenderer;
+
+static_assert(sizeof(Color) == 4 * sizeof(float), "Colors are loaded and stored as SSE vectors");
+
+namespace
+{
+	// Swaps the red and blue channel of a color
+	AR_FORCE_INLINE __m128 SwapRedBlue(__m128 color)
+	{
+		return _mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 0, 1, 2));
+	}
+
+	AR_FORCE_INLINE __m128 Saturate(__m128 color)
+	{
+		return _mm_min_ps(_mm_max_ps(color, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	}
+
+	// Converts four colors to four 8-bit RGBA pixels, truncating like Buffer::EncodeColor
+	AR_FORCE_INLINE __m128i PackColors(__m128 c0, __m128 c1, __m128 c2, __m128 c3)
+	{
+		const __m128 scale = _mm_set1_ps(255.0f);
+
+		__m128i i0 = _mm_cvttps_epi32(_mm_mul_ps(Saturate(c0), scale));
+		__m128i i1 = _mm_cvttps_epi32(_mm_mul_ps(Saturate(c1), scale));
+		__m128i i2 = _mm_cvttps_epi32(_mm_mul_ps(Saturate(c2), scale));
+		__m128i i3 = _mm_cvttps_epi32(_mm_mul_ps(Saturate(c3), scale));
+
+		return _mm_packus_epi16(_mm_packs_epi32(i0, i1), _mm_packs_epi32(i2, i3));
+	}
+
+	AR_FORCE_INLINE __m128 UnpackPixel(__m128i pixels)
+	{
+		return _mm_div_ps(_mm_cvtepi32_ps(pixels), _mm_set1_ps(255.0f));
+	}
+}
+
+PixelConverter::GammaTables::GammaTables()
+{
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		decode[Buffer::LINEAR][value] = value / 255.0f;
+		decode[Buffer::GAMMA][value] = pow(value / 255.0f, Buffer::DEFAULT_GAMMA);
+	}
+
+	for (uint32_t idx = 0; idx < GAMMA_TABLE_SIZE; ++idx)
+		encode[idx] = (uint8_t) (pow(idx / (float) (GAMMA_TABLE_SIZE - 1), 1.0f / Buffer::DEFAULT_GAMMA) * 255.0f);
+}
+
+const PixelConverter::GammaTables& PixelConverter::GetGammaTables()
+{
+	static const GammaTables tables;
+	return tables;
+}
+
+bool PixelConverter::IsByteEncoding(Buffer::Encoding encoding)
+{
+	return encoding == Buffer::RGB24 || encoding == Buffer::RGBA32 || encoding == Buffer::BGR24 || encoding == Buffer::BGRA32;
+}
+
+void PixelConverter::Convert(const uchar* source, Buffer::Encoding sourceEncoding, Buffer::ColorSpace sourceColorSpace,
+	uchar* destination, Buffer::Encoding destinationEncoding, Buffer::ColorSpace destinationColorSpace, uint32_t count, bool tonemap)
+{
+	// Tonemapping is done on linear colors
+	bool linearize = sourceColorSpace == Buffer::GAMMA && (destinationColorSpace == Buffer::LINEAR || tonemap);
+	bool delinearize = destinationColorSpace == Buffer::GAMMA && (sourceColorSpace == Buffer::LINEAR || tonemap);
+
+	uint32_t sourcePixelStride = Buffer::GetEncodingDepth(sourceEncoding) / 8;
+	uint32_t destinationPixelStride = Buffer::GetEncodingDepth(destinationEncoding) / 8;
+
+	if (sourceEncoding == destinationEncoding && !linearize && !delinearize && !tonemap)
+	{
+		memcpy(destination, source, count * sourcePixelStride);
+		return;
+	}
+
+	Color colors[CHUNK_SIZE];
+
+	for (uint32_t offset = 0; offset < count; offset += CHUNK_SIZE)
+	{
+		uint32_t chunkSize = std::min(CHUNK_SIZE, count - offset);
+
+		if (linearize && IsByteEncoding(sourceEncoding))
+			DecodeGamma(source + offset * sourcePixelStride, sourceEncoding, chunkSize, colors);
+		else
+		{
+			Decode(source + offset * sourcePixelStride, sourceEncoding, chunkSize, colors);
+
+			if (linearize)
+				Linearize(colors, chunkSize);
+		}
+
+		if (tonemap)
+			Tonemap(colors, chunkSize);
+
+		if (delinearize && IsByteEncoding(destinationEncoding))
+			EncodeGamma(colors, chunkSize, destinationEncoding, destination + offset * destinationPixelStride);
+		else
+		{
+			if (delinearize)
+				Delinearize(colors, chunkSize);
+
+			Encode(colors, chunkSize, destinationEncoding, destination + offset * destinationPixelStride);
+		}
+	}
+}
+
+void PixelConverter::Decode(const uchar* source, Buffer::Encoding encoding, uint32_t count, Color* colors)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	uint32_t pixelIdx = 0;
+
+	switch (encoding)
+	{
+	case Buffer::RGBA32:
+	case Buffer::BGRA32:
+	{
+		bool swap = encoding == Buffer::BGRA32;
+
+		// Widen four pixels at once from bytes to 32-bit integers
+		for (; pixelIdx + 4 <= count; pixelIdx += 4)
+		{
+			__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + pixelIdx * 4));
+			__m128i low = _mm_unpacklo_epi8(pixels, zero);
+			__m128i high = _mm_unpackhi_epi8(pixels, zero);
+
+			__m128 decoded[4] =
+			{
+				UnpackPixel(_mm_unpacklo_epi16(low, zero)),
+				UnpackPixel(_mm_unpackhi_epi16(low, zero)),
+				UnpackPixel(_mm_unpacklo_epi16(high, zero)),
+				UnpackPixel(_mm_unpackhi_epi16(high, zero)),
+			};
+
+			for (uint32_t idx = 0; idx < 4; ++idx)
+				_mm_storeu_ps(colors[pixelIdx + idx].data(), swap ? SwapRedBlue(decoded[idx]) : decoded[idx]);
+		}
+
+		for (; pixelIdx < count; ++pixelIdx)
+		{
+			const uchar* pixel = source + pixelIdx * 4;
+			__m128 decoded = UnpackPixel(_mm_setr_epi32(pixel[0], pixel[1], pixel[2], pixel[3]));
+
+			_mm_storeu_ps(colors[pixelIdx].data(), swap ? SwapRedBlue(decoded) : decoded);
+		}
+
+		break;
+	}
+
+	case Buffer::RGB24:
+	case Buffer::BGR24:
+	{
+		bool swap = encoding == Buffer::BGR24;
+
+		for (; pixelIdx < count; ++pixelIdx)
+		{
+			const uchar* pixel = source + pixelIdx * 3;
+			__m128 decoded = UnpackPixel(_mm_setr_epi32(pixel[0], pixel[1], pixel[2], 255));
+
+			_mm_storeu_ps(colors[pixelIdx].data(), swap ? SwapRedBlue(decoded) : decoded);
+		}
+
+		break;
+	}
+
+	case Buffer::FLOAT96:
+	{
+		const float* floats = reinterpret_cast<const float*>(source);
+
+		for (; pixelIdx < count; ++pixelIdx, floats += 3)
+			_mm_storeu_ps(colors[pixelIdx].data(), _mm_setr_ps(floats[0], floats[1], floats[2], 1.0f));
+
+		break;
+	}
+
+	case Buffer::FLOAT128:
+		memcpy(colors, source, count * sizeof(Color));
+		break;
+
+	default:
+		assert(false && "Encoding does not support color reading.");
+		break;
+	}
+}
+
+void PixelConverter::Encode(const Color* colors, uint32_t count, Buffer::Encoding encoding, uchar* destination)
+{
+	uint32_t pixelIdx = 0;
+
+	switch (encoding)
+	{
+	case Buffer::RGBA32:
+	case Buffer::BGRA32:
+	case Buffer::RGB24:
+	case Buffer::BGR24:
+	{
+		bool swap = encoding == Buffer::BGRA32 || encoding == Buffer::BGR24;
+		bool alpha = encoding == Buffer::RGBA32 || encoding == Buffer::BGRA32;
+
+		uint32_t pixelStride = alpha ? 4 : 3;
+		uchar pixels[16];
+
+		for (; pixelIdx < count; pixelIdx += 4)
+		{
+			__m128 c[4];
+			uint32_t batchSize = std::min(count - pixelIdx, 4U);
+
+			for (uint32_t idx = 0; idx < 4; ++idx)
+			{
+				c[idx] = idx < batchSize ? _mm_loadu_ps(colors[pixelIdx + idx].data()) : _mm_setzero_ps();
+
+				if (swap)
+					c[idx] = SwapRedBlue(c[idx]);
+			}
+
+			__m128i packed = PackColors(c[0], c[1], c[2], c[3]);
+
+			if (alpha && batchSize == 4)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + pixelIdx * 4), packed);
+				continue;
+			}
+
+			// Pixels without alpha, or the last pixels of the span, are copied separately
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), packed);
+
+			for (uint32_t idx = 0; idx < batchSize; ++idx)
+				memcpy(destination + (pixelIdx + idx) * pixelStride, pixels + idx * 4, pixelStride);
+		}
+
+		break;
+	}
+
+	case Buffer::FLOAT96:
+	{
+		float* floats = reinterpret_cast<float*>(destination);
+
+		for (; pixelIdx < count; ++pixelIdx, floats += 3)
+			memcpy(floats, colors[pixelIdx].data(), 3 * sizeof(float));
+
+		break;
+	}
+
+	case Buffer::FLOAT128:
+		memcpy(destination, colors, count * sizeof(Color));
+		break;
+
+	default:
+		assert(false && "Encoding does not support color writing.");
+		break;
+	}
+}
+
+void PixelConverter::Fill(const Color& color, uint32_t count, Buffer::Encoding encoding, uchar* destination)
+{
+	uint32_t pixelStride = Buffer::GetEncodingDepth(encoding) / 8;
+
+	uchar pixel[16];
+	Encode(&color, 1, encoding, pixel);
+
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+		memcpy(destination + pixelIdx * pixelStride, pixel, pixelStride);
+}
+
+void PixelConverter::Tonemap(Color* colors, uint32_t count)
+{
+	// Coefficients of the filmic tonemapping curve, see Buffer::Tonemap
+	const __m128 a = _mm_set1_ps(2.51f);
+	const __m128 b = _mm_set1_ps(0.03f);
+	const __m128 c = _mm_set1_ps(2.43f);
+	const __m128 d = _mm_set1_ps(0.59f);
+	const __m128 e = _mm_set1_ps(0.14f);
+
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+	{
+		__m128 x = _mm_loadu_ps(colors[pixelIdx].data());
+		x = Saturate(_mm_div_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(a, x), b)), _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(c, x), d)), e)));
+
+		_mm_storeu_ps(colors[pixelIdx].data(), x);
+		colors[pixelIdx][3] = 1.0f;
+	}
+}
+
+void PixelConverter::Linearize(Color* colors, uint32_t count)
+{
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+		Buffer::AdjustGamma(colors[pixelIdx], Buffer::DEFAULT_GAMMA);
+}
+
+void PixelConverter::Delinearize(Color* colors, uint32_t count)
+{
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+		Buffer::AdjustGamma(colors[pixelIdx], 1.0f / Buffer::DEFAULT_GAMMA);
+}
+
+void PixelConverter::DecodeGamma(const uchar* source, Buffer::Encoding encoding, uint32_t count, Color* colors)
+{
+	const GammaTables& tables = GetGammaTables();
+
+	bool swap = encoding == Buffer::BGRA32 || encoding == Buffer::BGR24;
+	bool alpha = encoding == Buffer::RGBA32 || encoding == Buffer::BGRA32;
+
+	uint32_t pixelStride = alpha ? 4 : 3;
+	uint32_t red = swap ? 2 : 0;
+	uint32_t blue = 2 - red;
+
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+	{
+		const uchar* pixel = source + pixelIdx * pixelStride;
+
+		_mm_storeu_ps(colors[pixelIdx].data(), _mm_setr_ps(tables.decode[Buffer::GAMMA][pixel[red]], tables.decode[Buffer::GAMMA][pixel[1]],
+			tables.decode[Buffer::GAMMA][pixel[blue]], alpha ? tables.decode[Buffer::LINEAR][pixel[3]] : 1.0f));
+	}
+}
+
+void PixelConverter::EncodeGamma(const Color* colors, uint32_t count, Buffer::Encoding encoding, uchar* destination)
+{
+	const GammaTables& tables = GetGammaTables();
+
+	bool swap = encoding == Buffer::BGRA32 || encoding == Buffer::BGR24;
+	bool alpha = encoding == Buffer::RGBA32 || encoding == Buffer::BGRA32;
+
+	uint32_t pixelStride = alpha ? 4 : 3;
+	uint32_t red = swap ? 2 : 0;
+	uint32_t blue = 2 - red;
+
+	// The color channels are rounded to the nearest table entry, alpha is encoded linearly
+	const __m128 scale = _mm_setr_ps((float) (GAMMA_TABLE_SIZE - 1), (float) (GAMMA_TABLE_SIZE - 1), (float) (GAMMA_TABLE_SIZE - 1), 255.0f);
+	const __m128 offset = _mm_setr_ps(0.5f, 0.5f, 0.5f, 0.0f);
+
+	int32_t indices[4];
+
+	for (uint32_t pixelIdx = 0; pixelIdx < count; ++pixelIdx)
+	{
+		__m128 color = Saturate(_mm_loadu_ps(colors[pixelIdx].data()));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(color, scale), offset)));
+
+		uchar* pixel = destination + pixelIdx * pixelStride;
+		pixel[red] = tables.encode[indices[0]];
+		pixel[1] = tables.encode[indices[1]];
+		pixel[blue] = tables.encode[indices[2]];
+
+		if (alpha)
+			pixel[3] = (uchar) indices[3];
+	}
+}
\ No newline at end of file
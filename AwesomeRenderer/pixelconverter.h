@@ -0,0 +1,63 @@
+#ifndef _PIXEL_CONVERTER_H_
+#define _PIXEL_CONVERTER_H_
+
+#include "awesomerenderer.h"
+#include "buffer.h"
+
+namespace AwesomeRenderer
+{
+	// Converts spans of pixels between buffer encodings. Pixels are decoded to floating point colors in chunks, converted to the
+	// destination color space and optionally tonemapped, and then encoded again. The decoding and encoding kernels use SSE2.
+	class PixelConverter
+	{
+	private:
+		static const uint32_t CHUNK_SIZE = 64;
+		static const uint32_t GAMMA_TABLE_SIZE = 1 << 14;
+
+		struct GammaTables
+		{
+			// Gamma corrected 8-bit channels to linear values, indexed by color space
+			float decode[2][256];
+
+			// Linear values in [0, 1] to gamma corrected 8-bit channels
+			uint8_t encode[GAMMA_TABLE_SIZE];
+
+			GammaTables();
+		};
+
+	public:
+		// Converts a span of pixels. Colors are converted between the color spaces, and tonemapped before they are written if
+		// tonemap is set. Spans with the same encoding that don't need any conversion are copied.
+		static void Convert(const uchar* source, Buffer::Encoding sourceEncoding, Buffer::ColorSpace sourceColorSpace,
+			uchar* destination, Buffer::Encoding destinationEncoding, Buffer::ColorSpace destinationColorSpace, uint32_t count, bool tonemap = false);
+
+		// Decodes pixels without color space conversion. Encodings without alpha channel decode to an alpha of one
+		static void Decode(const uchar* source, Buffer::Encoding encoding, uint32_t count, Color* colors);
+
+		// Encodes colors without color space conversion, 8-bit encodings clamp the channels to [0, 1]
+		static void Encode(const Color* colors, uint32_t count, Buffer::Encoding encoding, uchar* destination);
+
+		// Encodes a single color to a span of pixels
+		static void Fill(const Color& color, uint32_t count, Buffer::Encoding encoding, uchar* destination);
+
+		static void Tonemap(Color* colors, uint32_t count);
+
+		// Converts colors from the gamma corrected to the linear color space and back
+		static void Linearize(Color* colors, uint32_t count);
+		static void Delinearize(Color* colors, uint32_t count);
+
+		// Returns the table that converts 8-bit channels of the given color space to linear values
+		static const float* GetDecodeTable(Buffer::ColorSpace colorSpace) { return GetGammaTables().decode[colorSpace]; }
+
+	private:
+		static const GammaTables& GetGammaTables();
+
+		static bool IsByteEncoding(Buffer::Encoding encoding);
+
+		// 8-bit conversions that combine the gamma conversion with decoding or encoding through lookup tables
+		static void DecodeGamma(const uchar* source, Buffer::Encoding encoding, uint32_t count, Color* colors);
+		static void EncodeGamma(const Color* colors, uint32_t count, Buffer::Encoding encoding, uchar* destination);
+	};
+}
+
+#endif
\ No newline at end of file
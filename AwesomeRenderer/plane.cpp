@@ -43,6 +43,19 @@ bool Plane::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance)
 	return true;
 }
 
+bool Plane::Occluded(const Ray& ray, float maxDistance) const
+{
+	float dot = -VectorUtil<3>::Dot(normalTransformed, ray.direction);
+
+	// Ray is parallel to plane
+	if (dot == 0.0f)
+		return false;
+
+	float t = Distance(ray.origin) / dot;
+
+	return t >= 0.0f && t <= maxDistance;
+}
+
 int Plane::SideOfPlane(const Vector3& point) const
 {
 	return (int) Util::Sign(VectorUtil<3>::Dot(point - PointOnPlane(), normal));
@@ -22,6 +22,7 @@ namespace AwesomeRenderer
 		void Transform(const Matrix44& mtx);
 
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		int SideOfPlane(const Plane& plane) const;
 		int SideOfPlane(const Vector3& point) const;
@@ -3,6 +3,7 @@
 
 #include "primitive.h"
 #include "plane.h"
+#include "aabb.h"
 
 using namespace AwesomeRenderer;
 
@@ -19,4 +20,25 @@ int Primitive::SideOfAAPlane(int axis, float position) const
 
 	Plane plane(position, normal);
 	return SideOfPlane(plane);
+}
+
+bool Primitive::CalculateClippedBounds(const AABB& box, AABB& bounds) const
+{
+	AABB primitiveBounds;
+	CalculateBounds(primitiveBounds);
+
+	Vector3 lower, upper;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		lower[axis] = std::max(primitiveBounds.Min()[axis], box.Min()[axis]);
+		upper[axis] = std::min(primitiveBounds.Max()[axis], box.Max()[axis]);
+
+		if (lower[axis] > upper[axis])
+			return false;
+	}
+
+	bounds.Initialize(lower, upper);
+
+	return true;
 }
\ No newline at end of file
@@ -27,6 +27,10 @@ namespace AwesomeRenderer
 		virtual int SideOfAAPlane(int axis, float position) const;
 
 		virtual void CalculateBounds(AABB& bounds) const = 0;
+
+		// Bounds of the part of the primitive inside the box, returns false if it doesn't overlap the box.
+		// By default this is the overlap of the bounds of the primitive with the box
+		virtual bool CalculateClippedBounds(const AABB& box, AABB& bounds) const;
 		virtual float Area() const = 0;
 
 		virtual Vector3 Sample(const Vector2& r, Vector3& normal) const
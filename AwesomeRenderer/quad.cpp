@@ -29,6 +29,11 @@ bool Quad::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance)
 	return lower.IntersectRay(ray, hitInfo, maxDistance);
 }
 
+bool Quad::Occluded(const Ray& ray, float maxDistance) const
+{
+	return upper.Occluded(ray, maxDistance) || lower.Occluded(ray, maxDistance);
+}
+
 int Quad::SideOfPlane(const Plane& plane) const
 {
 	int upperSide = upper.SideOfPlane(plane);
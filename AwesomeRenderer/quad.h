@@ -18,6 +18,7 @@ namespace AwesomeRenderer
 		void Transform(const Matrix44& mtx);
 
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		int SideOfPlane(const Plane& plane) const;
 
@@ -1,7 +0,0 @@
-
-#include "random.h"
-
-using namespace AwesomeRenderer;
-
-
-Random Random::instance;
\ No newline at end of file
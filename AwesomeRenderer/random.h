@@ -2,39 +2,81 @@
 #define _RANDOM_H_
 
 #include <cstdlib>
+#include <cstdint>
 #include "debug.h"
 
 namespace AwesomeRenderer
 {
 
+	// PCG32 random number generator. Every instance has its own state, so each render thread should use its own instance.
 	class Random
 	{
 
-	public:
-		static Random instance;
+	private:
+		static const uint64_t MULTIPLIER = 6364136223846793005ULL;
+
+		uint64_t state;
+		uint64_t increment;
 
 	public:
 		Random()
 		{
+			Seed(0, 0);
+		}
+
+		Random(uint64_t seed, uint64_t stream = 0)
+		{
+			Seed(seed, stream);
+		}
+
+		// Resets the generator, different streams with the same seed produce independent sequences
+		void Seed(uint64_t seed, uint64_t stream = 0)
+		{
+			state = 0;
+			increment = (Mix(stream) << 1) | 1;
 
+			NextUInt();
+			state += Mix(seed);
+			NextUInt();
 		}
 
-		float NextFloat() 
+		uint32_t NextUInt()
 		{
-			float scale = ((float)RAND_MAX) + 1;
-			float base = rand() / scale;
-			float fine = rand() / scale;
+			uint64_t oldState = state;
+			state = oldState * MULTIPLIER + increment;
 
-			return base + fine / scale;
+			uint32_t xorShifted = (uint32_t) (((oldState >> 18) ^ oldState) >> 27);
+			uint32_t rotation = (uint32_t) (oldState >> 59);
+
+			return (xorShifted >> rotation) | (xorShifted << ((0 - rotation) & 31));
+		}
+
+		float NextFloat()
+		{
+			// Use the upper 24 bits, so that the result is exactly representable and always smaller than one
+			return (NextUInt() >> 8) * (1.0f / 16777216.0f);
 		}
 
-		int NextInt(int min, int max) 
+		int NextInt(int min, int max)
 		{
 			assert(max >= min);
-			return min + (int) floor((NextFloat() - 1e-5f) * (max - min)); 
+			return min + (int) floor((NextFloat() - 1e-5f) * (max - min));
+		}
+
+	private:
+		// Scrambles seeds so that neighbouring pixels and sample indices don't produce correlated sequences
+		static uint64_t Mix(uint64_t x)
+		{
+			x ^= x >> 30;
+			x *= 0xbf58476d1ce4e5b9ULL;
+			x ^= x >> 27;
+			x *= 0x94d049bb133111ebULL;
+			x ^= x >> 31;
+
+			return x;
 		}
 	};
 
 }
 
-#endif
\ No newline at end of file
+#endif
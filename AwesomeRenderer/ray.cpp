@@ -5,13 +5,13 @@
 
 using namespace AwesomeRenderer;
 
-Ray::Ray()
+Ray::Ray() : coneWidth(0.0f), coneSpread(0.0f)
 {
 
 }
 
 Ray::Ray(const Vector3& origin, const Vector3& direction) : 
-	origin(origin), direction(cml::normalize(direction)), type(UNKOWN)
+	origin(origin), direction(cml::normalize(direction)), coneWidth(0.0f), coneSpread(0.0f), type(UNKOWN)
 {
 	invDirection.set(
 		1.0f / this->direction[0],
@@ -21,11 +21,17 @@ namespace AwesomeRenderer
 		Vector3 direction;
 		Vector3 invDirection;
 
+		// Ray cone used to select texture mip levels. The cone has the given width at the origin and widens by the spread angle per unit of distance
+		float coneWidth;
+		float coneSpread;
+
 		Type type;
 	public:
 		Ray();
 		Ray(const Vector3& origin, const Vector3& direction);
 
+		void SetCone(float width, float spread) { coneWidth = width; coneSpread = spread; }
+
 	};
 
 }
@@ -13,21 +13,29 @@ namespace AwesomeRenderer
 		Vector3 bitangent;
 
 		float distance;
-		double surfaceAreaToTextureRatio;
+
+		// Log2 of the square root of the texture coordinate area per unit of world surface area of the hit triangle
+		float texelDensity;
+
+		// Ray cone at the hit point, and the mip level it selects before the size of the sampled texture is taken into account
+		float coneWidth;
+		float coneSpread;
+		float textureLod;
 
 		Vector3 barycentricCoords;
 		Vector2 uv;
 
 		const TreeElement* element;
 
-		RaycastHit() : distance(FLT_MAX), surfaceAreaToTextureRatio(1.0), element(NULL)
+		RaycastHit() : distance(FLT_MAX), texelDensity(0.0f), coneWidth(0.0f), coneSpread(0.0f), textureLod(0.0f), element(NULL)
 		{
 
 		}
 
 		RaycastHit(const RaycastHit& other) :
 			point(other.point), normal(other.normal), tangent(other.tangent), bitangent(other.bitangent),
-			distance(other.distance), surfaceAreaToTextureRatio(other.surfaceAreaToTextureRatio),
+			distance(other.distance), texelDensity(other.texelDensity),
+			coneWidth(other.coneWidth), coneSpread(other.coneSpread), textureLod(other.textureLod),
 			barycentricCoords(other.barycentricCoords), uv(other.uv),
 			element(other.element)
 		{
@@ -0,0 +1,32 @@
+
+#include "awesomerenderer.h"
+
+#include "raypacket.h"
+
+using namespace AwesomeRenderer;
+
+RayPacket::RayPacket(const Ray* rays)
+{
+	for (uint32_t rayIdx = 0; rayIdx < SIZE; ++rayIdx)
+		this->rays[rayIdx] = rays[rayIdx];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		origin[axis] = _mm_setr_ps(rays[0].origin[axis], rays[1].origin[axis], rays[2].origin[axis], rays[3].origin[axis]);
+		direction[axis] = _mm_setr_ps(rays[0].direction[axis], rays[1].direction[axis], rays[2].direction[axis], rays[3].direction[axis]);
+		invDirection[axis] = _mm_setr_ps(rays[0].invDirection[axis], rays[1].invDirection[axis], rays[2].invDirection[axis], rays[3].invDirection[axis]);
+	}
+}
+
+bool RayPacket::IsCoherent(uint32_t mask) const
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		uint32_t negative = _mm_movemask_ps(direction[axis]) & mask;
+
+		if (negative != 0 && negative != mask)
+			return false;
+	}
+
+	return true;
+}
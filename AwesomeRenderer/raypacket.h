@@ -0,0 +1,32 @@
+#ifndef _RAY_PACKET_H_
+#define _RAY_PACKET_H_
+
+#include "awesomerenderer.h"
+#include "ray.h"
+
+namespace AwesomeRenderer
+{
+
+	// A group of rays that are traced together. Each ray component is stored in an SSE register with one lane per ray
+	class RayPacket
+	{
+	public:
+		static const uint32_t SIZE = 4;
+		static const uint32_t FULL_MASK = (1 << SIZE) - 1;
+
+		__m128 origin[3];
+		__m128 direction[3];
+		__m128 invDirection[3];
+
+		Ray rays[SIZE];
+
+	public:
+		RayPacket(const Ray* rays);
+
+		// Returns whether the direction of all rays in the mask has the same sign on every axis
+		bool IsCoherent(uint32_t mask) const;
+	};
+
+}
+
+#endif
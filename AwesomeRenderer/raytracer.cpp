@@ -2,9 +2,11 @@
 #include "node.h"
 #include "raytracer.h"
 #include "ray.h"
+#include "raypacket.h"
 #include "raycasthit.h"
 #include "buffer.h"
 #include "texture.h"
+#include "pixelconverter.h"
 #include "camera.h"
 #include "gdibufferallocator.h"
 #include "window.h"
@@ -19,9 +21,11 @@
 #include "random.h"
 #include "shadinginfo.h"
 #include "renderjob.h"
+#include "resolvejob.h"
 #include "scheduler.h"
 #include "jobgroup.h"
 #include "sampler.h"
+#include "statistics.h"
 
 #include "inputmanager.h"
 
@@ -29,12 +33,15 @@ using namespace AwesomeRenderer;
 using namespace AwesomeRenderer::RayTracing;
 
 const uint32_t RayTracer::MAX_FRAME_TIME = 50;
-const uint32_t RayTracer::TILE_SIZE = 16;
+const uint32_t RayTracer::DEFAULT_TILE_SIZE = 16;
 const uint32_t RayTracer::SUBPIXEL_STRATIFICATION_SIZE = 32;
+const uint32_t RayTracer::RESOLVE_JOB_ROWS = 16;
+
+const char* RayTracer::TILE_ORDER_NAMES[] = { "random", "scanline", "morton", "hilbert", "spiral" };
 
 RayTracer::RayTracer(Scheduler& scheduler) : Renderer(), 
-	debugIntegrator(*this), whittedIntegrator(*this), monteCarloIntegrator(*this), renderingFrame(false), random(Random::instance),
-	maxDepth(0), samplesPerPixel(1), renderedSamples(0), frameTimer(0.0f, FLT_MAX), debugPixel(-1, -1)
+	debugIntegrator(*this), whittedIntegrator(*this), monteCarloIntegrator(*this), wavefrontIntegrator(*this), renderingFrame(false), pixelSpreadAngle(0.0f), tileSize(DEFAULT_TILE_SIZE), tileOrder(TILE_ORDER_HILBERT), seed(0),
+	maxDepth(0), samplesPerPixel(1), renderedSamples(0), renderedFrames(0), adaptiveThreshold(0.0f), adaptiveMinSamples(16), frameTimer(0.0f, FLT_MAX), debugPixel(-1, -1)
 {
 	currentIntegrator = &debugIntegrator;
 	
@@ -57,45 +64,204 @@ void RayTracer::SetRenderContext(const RenderContext* context)
 	if (context == renderContext)
 		return;
 
-	assert(renderContext == NULL && "RayTracer can't switch render contexts!"); // TODO: Handle this more gracefully
+	// The tiles and buffers depend on the frame buffer of the context, stop the current frame and create them again
+	if (renderContext != NULL)
+	{
+		ResetFrame(false);
+		Cleanup();
+	}
 
 	Renderer::SetRenderContext(context);
 
 	Texture* frameBuffer = context->renderTarget->frameBuffer;
+
+	pixelStatistics.assign(frameBuffer->width * frameBuffer->height, PixelStatistics());
+	accumulationBuffer.assign(frameBuffer->width * frameBuffer->height, Color(0.0f, 0.0f, 0.0f, 0.0f));
+
+	for (uint32_t y = 0; y < frameBuffer->height; y += RESOLVE_JOB_ROWS)
+		resolveJobs.push_back(new ResolveJob(*this, resolveJobsLeft, y, std::min(RESOLVE_JOB_ROWS, frameBuffer->height - y)));
 	
-	uint32_t horizontalTiles = (uint32_t) ceil(frameBuffer->width / (float)TILE_SIZE);
-	uint32_t verticalTiles = (uint32_t) ceil(frameBuffer->height / (float)TILE_SIZE);
+	CreateRenderJobs();
+}
+
+void RayTracer::SetTileLayout(uint32_t tileSize, TileOrder tileOrder)
+{
+	assert(tileSize > 0 && tileOrder < TILE_ORDER_COUNT);
+
+	if (tileSize == this->tileSize && tileOrder == this->tileOrder)
+		return;
+
+	this->tileSize = tileSize;
+	this->tileOrder = tileOrder;
+
+	// Tiles are created when the render context is set
+	if (renderContext == NULL)
+		return;
+
+	if (renderingFrame)
+		PostRender();
+
+	DestroyRenderJobs();
+	CreateRenderJobs();
+}
+
+void RayTracer::CreateRenderJobs()
+{
+	Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+
+	uint32_t horizontalTiles = (frameBuffer->width + tileSize - 1) / tileSize;
+	uint32_t verticalTiles = (frameBuffer->height + tileSize - 1) / tileSize;
+
+	std::vector<std::pair<uint64_t, RenderJob*>> tiles;
 
 	for (uint32_t verticalTile = 0; verticalTile < verticalTiles; ++verticalTile)
 	{
-		uint32_t y = verticalTile * TILE_SIZE;
+		uint32_t y = verticalTile * tileSize;
 
 		for (uint32_t horizontalTile = 0; horizontalTile < horizontalTiles; ++horizontalTile)
 		{
-			uint32_t x = horizontalTile * TILE_SIZE;
+			uint32_t x = horizontalTile * tileSize;
 
-			RenderJob* job = new RenderJob(*this, x, y, std::min(TILE_SIZE, frameBuffer->width - x), std::min(TILE_SIZE, frameBuffer->height - y));
-			renderJobs.push_back(job);
+			RenderJob* job = new RenderJob(*this, x, y, std::min(tileSize, frameBuffer->width - x), std::min(tileSize, frameBuffer->height - y));
+			tiles.push_back(std::make_pair(GetTileKey(tileOrder, horizontalTile, verticalTile, horizontalTiles, verticalTiles), job));
 		}
 	}
 	
-	std::random_shuffle(renderJobs.begin(), renderJobs.end());
+	std::stable_sort(tiles.begin(), tiles.end(), [](const std::pair<uint64_t, RenderJob*>& a, const std::pair<uint64_t, RenderJob*>& b) { return a.first < b.first; });
+
+	for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		renderJobs.push_back(it->second);
+
+	if (tileOrder == TILE_ORDER_RANDOM)
+		std::random_shuffle(renderJobs.begin(), renderJobs.end());
+}
+
+void RayTracer::DestroyRenderJobs()
+{
+	for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
+	{
+		RenderJob* job = *it;
+		job->Interrupt();
+		job->WaitForCompletion();
+
+		delete job;
+	}
+
+	renderJobs.clear();
+	scheduledJobs.clear();
+}
+
+uint64_t RayTracer::GetTileKey(TileOrder order, uint32_t x, uint32_t y, uint32_t horizontalTiles, uint32_t verticalTiles)
+{
+	switch (order)
+	{
+	case TILE_ORDER_MORTON:
+	{
+		// Interleave the bits of both coordinates
+		uint64_t key = 0;
+
+		for (uint32_t bit = 0; bit < 32; ++bit)
+			key |= ((uint64_t) ((x >> bit) & 1) << (2 * bit)) | ((uint64_t) ((y >> bit) & 1) << (2 * bit + 1));
+
+		return key;
+	}
+
+	case TILE_ORDER_HILBERT:
+	{
+		// Position on the Hilbert curve that covers the smallest power of two grid around all tiles
+		uint32_t gridSize = 1;
+		while (gridSize < std::max(horizontalTiles, verticalTiles))
+			gridSize <<= 1;
+
+		uint64_t key = 0;
+
+		for (uint32_t quadrantSize = gridSize / 2; quadrantSize > 0; quadrantSize /= 2)
+		{
+			uint32_t quadrantX = (x & quadrantSize) > 0 ? 1 : 0;
+			uint32_t quadrantY = (y & quadrantSize) > 0 ? 1 : 0;
+
+			key += quadrantSize * (uint64_t) quadrantSize * ((3 * quadrantX) ^ quadrantY);
+
+			// Rotate the quadrant so that the curve inside it starts and ends at the right corners
+			if (quadrantY == 0)
+			{
+				if (quadrantX == 1)
+				{
+					x = gridSize - 1 - x;
+					y = gridSize - 1 - y;
+				}
+
+				std::swap(x, y);
+			}
+		}
+
+		return key;
+	}
+
+	case TILE_ORDER_SPIRAL:
+	{
+		// Sort by the square ring around the center first, and by the angle within the ring
+		float dx = x + 0.5f - horizontalTiles * 0.5f;
+		float dy = y + 0.5f - verticalTiles * 0.5f;
+
+		uint64_t ring = (uint64_t) std::max(fabs(dx), fabs(dy));
+		uint64_t angle = (uint64_t) ((atan2(dy, dx) + PI) / (double) TWO_PI * UINT32_MAX);
+
+		return (ring << 32) | angle;
+	}
+
+	default:
+		// Scanline order, the random order is shuffled afterwards
+		return y * (uint64_t) horizontalTiles + x;
+	}
 }
 
 void RayTracer::PreRender()
 {
 	frameTimer.Tick();
 
-	// Schedule all render jobs
-	for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
-		jobGroup->EnqueueJob(*it);
+#if AR_STATISTICS
+	Statistics::Collect(frameStartStatistics);
+#endif
+
+	// The camera can only change between frames, so the spread of the primary rays is measured once per frame
+	const Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	Vector2 center(frameBuffer->width * 0.5f, frameBuffer->height * 0.5f);
+
+	Ray centerRay, neighbourRay;
+	renderContext->camera->ViewportToRay(center, centerRay);
+	renderContext->camera->ViewportToRay(center + Vector2(0.0f, 1.0f), neighbourRay);
+
+	pixelSpreadAngle = atan2(cml::cross(centerRay.direction, neighbourRay.direction).length(), VectorUtil<3>::Dot(centerRay.direction, neighbourRay.direction));
+
+	// The wavefront integrator renders the whole frame at once instead of per tile
+	if (currentIntegrator == &wavefrontIntegrator)
+		renderingFrame = wavefrontIntegrator.StartFrame(jobGroup);
+	else
+	{
+		scheduledJobs.clear();
+
+		// Schedule all tiles that still have pixels which need more samples
+		for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
+		{
+			if ((*it)->IsConverged())
+				continue;
+
+			scheduledJobs.push_back(*it);
+			jobGroup->EnqueueJob(*it);
+		}
 
-	renderingFrame = true;
+		renderingFrame = !scheduledJobs.empty();
+	}
 }
 
 void RayTracer::PostRender()
 {
 	float time = frameTimer.Poll();
+	bool frameRendered = renderingFrame;
+
+	// Stop the wavefront frame before clearing the queue, it waits for the phase jobs it has queued
+	wavefrontIntegrator.EndFrame();
 	
 	// Prevent new jobs from starting
 	jobGroup->ClearQueue();
@@ -110,23 +276,57 @@ void RayTracer::PostRender()
 	renderingFrame = false;
 	renderedSamples += samplesPerPixel;
 
+	if (frameRendered)
+	{
+		++renderedFrames;
+
+		// The frame buffer is only updated once the frame is done, not for every sample
+		ResolveFrameBuffer();
+	}
+
+#if AR_STATISTICS
+	// All jobs have stopped, so the counters of the frame are complete
+	if (frameRendered)
+	{
+		Statistics::Snapshot totals;
+		Statistics::Collect(totals);
+
+		frameStatistics = totals - frameStartStatistics;
+
+		if (!statisticsFile.empty())
+			Statistics::Export(statisticsFile, renderedFrames, renderedSamples, time, frameStatistics);
+	}
+#endif
+
 	printf("[RayTracer]: Rendered frame in %.0fms, total samples rendered: %u.\n", time * 1000, renderedSamples);
 }
 
 void RayTracer::Render()
 {
 	if (!renderingFrame)
+	{
 		PreRender();
 
+		// Nothing is left to render once all pixels have converged
+		if (!renderingFrame)
+			return;
+	}
+
 	Sleep(MAX_FRAME_TIME);
 
 	bool allCompleted = true;
-	for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
+
+	if (currentIntegrator == &wavefrontIntegrator)
+		allCompleted = wavefrontIntegrator.IsFrameCompleted();
+	else
 	{
-		if (!(*it)->IsCompleted())
+		for (auto it = scheduledJobs.begin(); it != scheduledJobs.end(); ++it)
 		{
-			allCompleted = false;
-			break;
+			if (!(*it)->IsCompleted())
+			{
+				allCompleted = false;
+				break;
+			}
 		}
 	}
 
@@ -134,6 +334,26 @@ void RayTracer::Render()
 		PostRender();
 }
 
+void RayTracer::RenderFrame()
+{
+	assert(!renderingFrame);
+
+	PreRender();
+
+	if (!renderingFrame)
+		return;
+
+	if (currentIntegrator == &wavefrontIntegrator)
+		wavefrontIntegrator.WaitForFrame();
+	else
+	{
+		for (auto it = scheduledJobs.begin(); it != scheduledJobs.end(); ++it)
+			(*it)->WaitUntilCompleted();
+	}
+
+	PostRender();
+}
+
 void RayTracer::Present(Window& window)
 {
 	Buffer* buffer = renderContext->renderTarget->frameBuffer;
@@ -145,16 +365,14 @@ void RayTracer::Present(Window& window)
 
 void RayTracer::Cleanup()
 {
-	for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
-	{
-		RenderJob* job = *it;
-		job->Interrupt();
-		job->WaitForCompletion();
+	wavefrontIntegrator.EndFrame();
 
-		delete job;
-	}
+	DestroyRenderJobs();
 
-	renderJobs.clear();
+	for (auto it = resolveJobs.begin(); it != resolveJobs.end(); ++it)
+		delete *it;
+
+	resolveJobs.clear();
 }
 
 void RayTracer::ResetFrame(bool startNewFrame)
@@ -162,67 +380,249 @@ void RayTracer::ResetFrame(bool startNewFrame)
 	PostRender();
 
 	renderedSamples = 0;
+	pixelStatistics.assign(pixelStatistics.size(), PixelStatistics());
+	accumulationBuffer.assign(accumulationBuffer.size(), Color(0.0f, 0.0f, 0.0f, 0.0f));
+
 	renderContext->renderTarget->Clear(Color::BLACK, renderContext->clearFlags);
 
 	if (startNewFrame)
 		PreRender();
 }
 
-float RayTracer::GetProgress() const
+bool RayTracer::IsConverged(const Point2& pixel) const
+{
+	if (adaptiveThreshold <= 0.0f)
+		return false;
+
+	const Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	const PixelStatistics& statistics = pixelStatistics[pixel[1] * frameBuffer->width + pixel[0]];
+
+	if (statistics.sampleCount < std::max(adaptiveMinSamples, 2U))
+		return false;
+
+	float sampleCount = (float) statistics.sampleCount;
+	float mean = statistics.luminanceSum / sampleCount;
+	float variance = std::max(statistics.luminanceSquaredSum - statistics.luminanceSum * mean, 0.0f) / (sampleCount - 1.0f);
+
+	// Standard error of the mean, relative to the pixel brightness. Very dark pixels use a minimum brightness so that they can converge
+	float error = sqrt(variance / sampleCount) / std::max(mean, 1e-2f);
+
+	return error <= adaptiveThreshold;
+}
+
+float RayTracer::GetProgress(ProgressMode mode) const
 {
+	if (mode == PROGRESS_CONVERGENCE)
+	{
+		if (adaptiveThreshold <= 0.0f || pixelStatistics.empty())
+			return 0.0f;
+
+		const Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+		uint32_t convergedPixels = 0;
+
+		for (uint32_t y = 0; y < frameBuffer->height; ++y)
+		{
+			for (uint32_t x = 0; x < frameBuffer->width; ++x)
+			{
+				if (IsConverged(Point2(x, y)))
+					++convergedPixels;
+			}
+		}
+
+		return convergedPixels / (float) pixelStatistics.size();
+	}
+
+	if (currentIntegrator == &wavefrontIntegrator)
+		return wavefrontIntegrator.GetProgress();
+
+	if (scheduledJobs.empty())
+		return renderingFrame ? 0.0f : 1.0f;
+
 	float progress = 0.0f;
 
-	for (auto it = renderJobs.begin(); it != renderJobs.end(); ++it)
+	for (auto it = scheduledJobs.begin(); it != scheduledJobs.end(); ++it)
 		progress += (*it)->GetProgress();
 
-	return progress / renderJobs.size();
+	return progress / scheduledJobs.size();
 }
 
 void RayTracer::Render(const Point2& pixel)
 {
 	BreakOnDebugPixel(pixel);
 
-	Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	Color color(0.0f, 0.0f, 0.0f, 0.0f);
+	float luminanceSum = 0.0f, luminanceSquaredSum = 0.0f;
+
+	for (uint32_t sample = 0; sample < samplesPerPixel; ++sample)
+	{
+		Random random;
+		SeedRandom(pixel, sample, random);
+
+		Ray ray;
+		GeneratePrimaryRay(pixel, sample, random, ray);
+
+		ShadingInfo shadingInfo;
+		CalculateShading(ray, shadingInfo, random);
+
+		color += shadingInfo.color;
 
-	Color color;
-	frameBuffer->GetPixel(pixel[0], pixel[1], color);
+		float luminance = ColorUtil::Luminance(shadingInfo.color.subvector(3));
+		luminanceSum += luminance;
+		luminanceSquaredSum += luminance * luminance;
+	}
 
-	color *= (float) renderedSamples;
+	AccumulatePixel(pixel, color, luminanceSum, luminanceSquaredSum, samplesPerPixel);
+}
+
+void RayTracer::RenderQuad(const Point2& pixel)
+{
+	Point2 pixels[RayPacket::SIZE];
+	Color colors[RayPacket::SIZE];
+	float luminanceSums[RayPacket::SIZE], luminanceSquaredSums[RayPacket::SIZE];
+
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		pixels[rayIdx] = Point2(pixel[0] + (rayIdx & 1), pixel[1] + (rayIdx >> 1));
+
+		BreakOnDebugPixel(pixels[rayIdx]);
+
+		colors[rayIdx] = Color(0.0f, 0.0f, 0.0f, 0.0f);
+		luminanceSums[rayIdx] = 0.0f;
+		luminanceSquaredSums[rayIdx] = 0.0f;
+	}
 
 	for (uint32_t sample = 0; sample < samplesPerPixel; ++sample)
 	{
-		uint32_t stratificationIndex = (renderedSamples + sample) % SUBPIXEL_STRATIFICATION_SIZE;
+		Random random[RayPacket::SIZE];
+		Ray rays[RayPacket::SIZE];
+
+		for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+		{
+			SeedRandom(pixels[rayIdx], sample, random[rayIdx]);
+			GeneratePrimaryRay(pixels[rayIdx], sample, random[rayIdx], rays[rayIdx]);
+		}
 
-		Vector2 subPixel = pixel;
-		subPixel[0] += -0.5f + SampleUtil::StratifiedSample(stratificationIndex, SUBPIXEL_STRATIFICATION_SIZE, random);
-		subPixel[1] += -0.5f + SampleUtil::StratifiedSample(stratificationIndex, SUBPIXEL_STRATIFICATION_SIZE, random);
+		// Primary rays of neighbouring pixels are coherent, so they can share the traversal of the scene
+		RayPacket packet(rays);
 
-		// Create a ray from the camera near plane through this pixel
-		Ray ray;
-		renderContext->camera->ViewportToRay(pixel, ray);
+		ShadingInfo shadingInfo[RayPacket::SIZE];
+		RaycastHit hitInfo[RayPacket::SIZE];
+		
+		uint32_t hits = RayCast(packet, hitInfo, RayPacket::FULL_MASK);
 
-		if (!InputManager::Instance().GetKey('B'))
+		for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
 		{
-			Vector3 focalPoint = ray.origin + ray.direction * renderContext->camera->focalDistance;
+			shadingInfo[rayIdx].hitInfo = hitInfo[rayIdx];
+			Shade(rays[rayIdx], shadingInfo[rayIdx], (hits & (1 << rayIdx)) != 0, random[rayIdx]);
 
-			Vector2 apertureOffset;
-			SampleUtil::UniformSampleDisc(Vector2(random.NextFloat(), random.NextFloat()), apertureOffset);
+			colors[rayIdx] += shadingInfo[rayIdx].color;
 
-			Vector3 rayOrigin = cml::transform_point(cml::inverse(renderContext->camera->viewMtx), Vector3(apertureOffset[0], apertureOffset[1], 0.0f) * renderContext->camera->apertureSize);
-			ray = Ray(rayOrigin, (focalPoint - rayOrigin).normalize());
+			float luminance = ColorUtil::Luminance(shadingInfo[rayIdx].color.subvector(3));
+			luminanceSums[rayIdx] += luminance;
+			luminanceSquaredSums[rayIdx] += luminance * luminance;
 		}
+	}
 
-		ShadingInfo shadingInfo;
-		CalculateShading(ray, shadingInfo);
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+		AccumulatePixel(pixels[rayIdx], colors[rayIdx], luminanceSums[rayIdx], luminanceSquaredSums[rayIdx], samplesPerPixel);
+}
 
-		color += shadingInfo.color;
+void RayTracer::AccumulatePixel(const Point2& pixel, const Color& colorSum, float luminanceSum, float luminanceSquaredSum, uint32_t sampleCount)
+{
+	Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	uint32_t pixelIdx = pixel[1] * frameBuffer->width + pixel[0];
+
+	// With adaptive sampling the sample count differs per pixel, the average is only calculated when resolving
+	accumulationBuffer[pixelIdx] += colorSum;
+
+	PixelStatistics& statistics = pixelStatistics[pixelIdx];
+	statistics.sampleCount += sampleCount;
+	statistics.luminanceSum += luminanceSum;
+	statistics.luminanceSquaredSum += luminanceSquaredSum;
+}
+
+void RayTracer::ResolveFrameBuffer()
+{
+	resolveJobsLeft.Configure(resolveJobs.size(), resolveJobs.size());
+
+	for (auto it = resolveJobs.begin(); it != resolveJobs.end(); ++it)
+	{
+		(*it)->Reset();
+		jobGroup->EnqueueJob(*it);
 	}
 
-	color *= (1.0f / (renderedSamples + samplesPerPixel));
-	color[3] = 1.0f;
+	// Help with resolving instead of only waiting for the workers
+	WorkerJob* job;
+	while ((job = jobGroup->DequeueJob()) != NULL)
+		job->Execute();
 
-	// Write to color buffer
-	frameBuffer->SetPixel(pixel[0], pixel[1], color);
+	resolveJobsLeft.WaitZero();
+}
+
+void RayTracer::Resolve(uint32_t beginRow, uint32_t endRow)
+{
+	Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	bool hdr = frameBuffer->IsHDR(frameBuffer->encoding);
+
+	std::vector<Color> colors(frameBuffer->width);
+	std::vector<uchar> staging;
+
+	for (uint32_t y = beginRow; y < endRow; ++y)
+	{
+		const Color* accumulation = &accumulationBuffer[y * frameBuffer->width];
+		const PixelStatistics* statistics = &pixelStatistics[y * frameBuffer->width];
+
+		for (uint32_t x = 0; x < frameBuffer->width; ++x)
+		{
+			// Every lane holds one color channel
+			uint32_t sampleCount = statistics[x].sampleCount;
+			__m128 color = _mm_mul_ps(_mm_loadu_ps(accumulation[x].data()), _mm_set1_ps(sampleCount > 0 ? 1.0f / sampleCount : 0.0f));
+
+			_mm_storeu_ps(colors[x].data(), color);
+			colors[x][3] = 1.0f;
+		}
+
+		// LDR frame buffers are tonemapped before they are converted to the color space of the frame buffer
+		uchar* row = frameBuffer->MapRow(y, staging);
+		PixelConverter::Convert(reinterpret_cast<const uchar*>(&colors[0]), Buffer::FLOAT128, Buffer::LINEAR,
+			row, frameBuffer->encoding, frameBuffer->colorSpace, frameBuffer->width, !hdr);
+		frameBuffer->WriteRow(y, row);
+	}
+}
+
+void RayTracer::SeedRandom(const Point2& pixel, uint32_t sample, Random& random) const
+{
+	// Every sample of every pixel has its own stream, so the result doesn't depend on which thread renders it
+	Texture* frameBuffer = renderContext->renderTarget->frameBuffer;
+	uint64_t pixelIdx = pixel[1] * (uint64_t) frameBuffer->width + pixel[0];
+
+	random.Seed(seed + renderedSamples + sample, pixelIdx);
+}
+
+void RayTracer::GeneratePrimaryRay(const Point2& pixel, uint32_t sample, Random& random, Ray& ray) const
+{
+	uint32_t stratificationIndex = (renderedSamples + sample) % SUBPIXEL_STRATIFICATION_SIZE;
+
+	Vector2 subPixel = pixel;
+	subPixel[0] += -0.5f + SampleUtil::StratifiedSample(stratificationIndex, SUBPIXEL_STRATIFICATION_SIZE, random);
+	subPixel[1] += -0.5f + SampleUtil::StratifiedSample(stratificationIndex, SUBPIXEL_STRATIFICATION_SIZE, random);
+
+	// Create a ray from the camera near plane through this pixel
+	renderContext->camera->ViewportToRay(pixel, ray);
+
+	if (!InputManager::Instance().GetKey('B'))
+	{
+		Vector3 focalPoint = ray.origin + ray.direction * renderContext->camera->focalDistance;
+
+		Vector2 apertureOffset;
+		SampleUtil::UniformSampleDisc(Vector2(random.NextFloat(), random.NextFloat()), apertureOffset);
+
+		Vector3 rayOrigin = cml::transform_point(cml::inverse(renderContext->camera->viewMtx), Vector3(apertureOffset[0], apertureOffset[1], 0.0f) * renderContext->camera->apertureSize);
+		ray = Ray(rayOrigin, (focalPoint - rayOrigin).normalize());
+	}
+
+	ray.type = Ray::HIT_TEST;
+	ray.SetCone(0.0f, pixelSpreadAngle);
 }
 
 void RayTracer::BreakOnDebugPixel(const Point2& pixel)
@@ -235,12 +635,17 @@ void RayTracer::BreakOnDebugPixel(const Point2& pixel)
 
 }
 
-bool RayTracer::CalculateShading(const Ray& ray, ShadingInfo& shadingInfo, int depth) const
+bool RayTracer::CalculateShading(const Ray& ray, ShadingInfo& shadingInfo, Random& random, int depth) const
 {
-	const LightData& lightData = *renderContext->lightData;
-
 	// Perform the raycast to find out which node we've hit
-	if (!RayCast(ray, shadingInfo.hitInfo))
+	bool hit = RayCast(ray, shadingInfo.hitInfo);
+
+	return Shade(ray, shadingInfo, hit, random, depth);
+}
+
+bool RayTracer::Shade(const Ray& ray, ShadingInfo& shadingInfo, bool hit, Random& random, int depth) const
+{
+	if (!hit)
 	{
 		if (renderContext->skybox != NULL)
 			renderContext->skybox->Sample(ray.direction, shadingInfo.color);
@@ -251,33 +656,72 @@ bool RayTracer::CalculateShading(const Ray& ray, ShadingInfo& shadingInfo, int d
 	const Renderable* renderable = dynamic_cast<const Renderable*>(shadingInfo.hitInfo.element);
 	const Material* material = renderable->material;
 	
-	if (material->normalMap != NULL && !InputManager::Instance().GetKey('N'))
-	{
-		const Vector3& t = shadingInfo.hitInfo.tangent;
-		const Vector3& n = shadingInfo.hitInfo.normal;
-		const Vector3& b = shadingInfo.hitInfo.bitangent;
+	CalculateTextureLod(ray, shadingInfo.hitInfo);
+	ApplyNormalMap(*material, shadingInfo.hitInfo);
+
+	shadingInfo.color = Color(currentIntegrator->Li(ray, shadingInfo.hitInfo, *material, *renderContext, random, depth), 1.0);
+	return TRUE;
+}
+
+void RayTracer::CalculateTextureLod(const Ray& ray, RaycastHit& hitInfo) const
+{
+	hitInfo.coneWidth = ray.coneWidth + ray.coneSpread * hitInfo.distance;
+	hitInfo.coneSpread = ray.coneSpread;
+
+	// The footprint of the cone is stretched along surfaces at grazing angles
+	float cosine = std::max(fabs(VectorUtil<3>::Dot(hitInfo.normal, ray.direction)), 1e-2f);
+
+	hitInfo.textureLod = hitInfo.texelDensity + log2(hitInfo.coneWidth / cosine);
+}
+
+void RayTracer::ApplyNormalMap(const Material& material, RaycastHit& hitInfo) const
+{
+	if (material.normalMap == NULL || InputManager::Instance().GetKey('N'))
+		return;
+
+	const Vector3& t = hitInfo.tangent;
+	const Vector3& n = hitInfo.normal;
+	const Vector3& b = hitInfo.bitangent;
 
-		Matrix33 tbn(	t[0], t[1], t[2], 
-						b[0], b[1], b[2],
-						n[0], n[1], n[2]);
+	Matrix33 tbn(	t[0], t[1], t[2], 
+					b[0], b[1], b[2],
+					n[0], n[1], n[2]);
 
-		Color normalSample;
-		material->normalMap->Sample(shadingInfo.hitInfo.uv, normalSample);
+	Color normalSample;
+	material.normalMap->Sample(hitInfo.uv, normalSample);
 		
-		Vector3 normal = normalSample.subvector(3) * 2.0f - Vector3(1.0f, 1.0f, 1.0f);
+	Vector3 normal = normalSample.subvector(3) * 2.0f - Vector3(1.0f, 1.0f, 1.0f);
+
+	normal = cml::transform_vector(tbn, normal);
+	normal.normalize();
+
+	hitInfo.normal = normal;
+	//hitInfo.normal = hitInfo.tangent * 0.5f + Vector3(0.5f, 0.5f, 0.5f);
+}
+
+bool RayTracer::RayCast(const Ray& ray, RaycastHit& nearestHit, float maxDistance) const 
+{
+	AR_COUNT(RAYS_UNKNOWN + ray.type, 1);
 
-		normal = cml::transform_vector(tbn, normal);
-		normal.normalize();
+	return renderContext->IntersectRay(ray, nearestHit, maxDistance);
+}
 
-		shadingInfo.hitInfo.normal = normal;
-		//shadingInfo.hitInfo.normal = shadingInfo.hitInfo.tangent * 0.5f + Vector3(0.5f, 0.5f, 0.5f);
+uint32_t RayTracer::RayCast(const RayPacket& packet, RaycastHit* nearestHit, uint32_t mask) const
+{
+#if AR_STATISTICS
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((mask & (1 << rayIdx)) != 0)
+			AR_COUNT(RAYS_UNKNOWN + packet.rays[rayIdx].type, 1);
 	}
+#endif
 
-	shadingInfo.color = Color(currentIntegrator->Li(ray, shadingInfo.hitInfo, *material, *renderContext, depth), 1.0);
-	return TRUE;
+	return renderContext->IntersectRayPacket(packet, nearestHit, mask, _mm_set1_ps(FLT_MAX));
 }
 
-bool RayTracer::RayCast(const Ray& ray, RaycastHit& nearestHit, float maxDistance) const 
+bool RayTracer::Occluded(const Ray& ray, float maxDistance) const
 {
-	return renderContext->tree.IntersectRay(ray, nearestHit, maxDistance);
+	AR_COUNT(RAYS_SHADOW, 1);
+
+	return renderContext->Occluded(ray, maxDistance);
 }
\ No newline at end of file
@@ -4,14 +4,17 @@
 #include "awesomerenderer.h"
 #include "renderer.h"
 #include "timer.h"
+#include "statistics.h"
 
 #include "debugintegrator.h"
 #include "whittedintegrator.h"
 #include "montecarlointegrator.h"
+#include "wavefrontintegrator.h"
 
 namespace AwesomeRenderer
 {
 	class Ray;
+	class RayPacket;
 	struct RaycastHit;
 
 	struct ShadingInfo;
@@ -25,44 +28,107 @@ namespace AwesomeRenderer
 	class Scheduler;
 	class JobGroup;
 
-	class Random;
-
 	namespace RayTracing
 	{
 		class RenderJob;
+		class ResolveJob;
 
 		class RayTracer : public Renderer
 		{
 			friend class RenderJob;
+			friend class ResolveJob;
+			friend class WavefrontIntegrator;
 
 		private:
 			static const uint32_t MAX_FRAME_TIME;
-			static const uint32_t TILE_SIZE;
+			static const uint32_t DEFAULT_TILE_SIZE;
 			static const uint32_t SUBPIXEL_STRATIFICATION_SIZE;
+			static const uint32_t RESOLVE_JOB_ROWS;
+
+		public:
+			enum ProgressMode
+			{
+				PROGRESS_FRAME,			// Fraction of the current frame that has been rendered
+				PROGRESS_CONVERGENCE,	// Fraction of the pixels that need no more samples
+			};
+
+			// Order in which the tiles of a frame are queued. The job group hands out queued jobs in batches, so with a
+			// coherent order every thread renders a contiguous region of the screen until it has to steal from another thread.
+			enum TileOrder
+			{
+				TILE_ORDER_RANDOM,		// Shuffled, neighbouring tiles are rendered by different threads
+				TILE_ORDER_SCANLINE,	// Row by row
+				TILE_ORDER_MORTON,		// Z-order curve
+				TILE_ORDER_HILBERT,		// Hilbert curve, unlike the Z-order curve consecutive tiles are always adjacent
+				TILE_ORDER_SPIRAL,		// Rings around the center of the screen, starting at the center
+
+				TILE_ORDER_COUNT
+			};
+
+			static const char* TILE_ORDER_NAMES[TILE_ORDER_COUNT];
+
+			// Running sums of all samples rendered for a pixel, used to estimate the error for adaptive sampling
+			struct PixelStatistics
+			{
+				uint32_t sampleCount;
+
+				float luminanceSum;
+				float luminanceSquaredSum;
+			};
 
+		private:
 			Timer frameTimer;
 
 			JobGroup* jobGroup;
 
 			std::vector<Point2> pixelList;
 			std::vector<RenderJob*> renderJobs;
+			std::vector<RenderJob*> scheduledJobs;
+
+			std::vector<ResolveJob*> resolveJobs;
+			Counter resolveJobsLeft;
+
+			std::vector<PixelStatistics> pixelStatistics;
+
+			// Sum of all samples of every pixel, the sample counts are kept in the pixel statistics
+			std::vector<Color> accumulationBuffer;
+
+			// Counter totals at the start of the frame, and the counters of the last completed frame
+			Statistics::Snapshot frameStartStatistics;
+			Statistics::Snapshot frameStatistics;
 
 			bool renderingFrame;
 
+			// Angle between the primary rays of neighbouring pixels, primary ray cones widen by this angle
+			float pixelSpreadAngle;
+
+			uint32_t tileSize;
+			TileOrder tileOrder;
+
 		public:
 
 			DebugIntegrator debugIntegrator;
 			WhittedIntegrator whittedIntegrator;
 			MonteCarloIntegrator monteCarloIntegrator;
+			WavefrontIntegrator wavefrontIntegrator;
 			SurfaceIntegrator* currentIntegrator;
 
 			uint32_t maxDepth;
 			uint32_t samplesPerPixel;
 			uint32_t renderedSamples;
+			uint32_t renderedFrames;
+
+			// If set, the statistics of every frame are appended to this file. Requires AR_STATISTICS
+			std::string statisticsFile;
+
+			// Pixels stop receiving samples once the relative standard error of their luminance is below this threshold. Zero disables adaptive sampling
+			float adaptiveThreshold;
+			uint32_t adaptiveMinSamples;
 
 			Point2 debugPixel;
 
-			Random& random;
+			// Base seed for the random streams of all pixels, renders with the same seed are reproducible
+			uint64_t seed;
 
 		public:
 
@@ -70,26 +136,72 @@ namespace AwesomeRenderer
 
 			void Initialize();
 			void Render();
+
+			// Renders a complete frame and blocks until it's done. Unlike polling Render, no time is spent sleeping between checks
+			void RenderFrame();
+
 			void Present(Window& window);
 			void Cleanup();
 			void ResetFrame(bool startNewFrame = true);
 
 			void SetRenderContext(const RenderContext* context);
 
+			// Changes the size and order of the tiles, interrupts the frame that is being rendered
+			void SetTileLayout(uint32_t tileSize, TileOrder tileOrder);
+
+			uint32_t GetTileSize() const { return tileSize; }
+			TileOrder GetTileOrder() const { return tileOrder; }
+
 			void BreakOnDebugPixel(const Point2& pixel);
 
 			void Render(const Point2& pixel);
-			bool CalculateShading(const Ray& ray, ShadingInfo& shadingInfo, int depth = 0) const;
+
+			// Renders the 2x2 block of pixels starting at the given pixel using ray packets for the primary rays
+			void RenderQuad(const Point2& pixel);
+
+			bool CalculateShading(const Ray& ray, ShadingInfo& shadingInfo, Random& random, int depth = 0) const;
+			bool Shade(const Ray& ray, ShadingInfo& shadingInfo, bool hit, Random& random, int depth = 0) const;
+
+			// Widens the cone of the ray up to the hit point and selects the texture level of detail of the hit from its footprint
+			void CalculateTextureLod(const Ray& ray, RaycastHit& hitInfo) const;
+
 			bool RayCast(const Ray& ray, RaycastHit& nearestHit, float maxDistance = FLT_MAX) const;
+			uint32_t RayCast(const RayPacket& packet, RaycastHit* nearestHit, uint32_t mask) const;
+
+			// Returns whether anything is hit within maxDistance, used for shadow rays
+			bool Occluded(const Ray& ray, float maxDistance) const;
+
+			bool IsConverged(const Point2& pixel) const;
 
-			float GetProgress() const;
+			float GetProgress(ProgressMode mode = PROGRESS_FRAME) const;
 			bool IsRenderingFrame() const { return renderingFrame; }
 			float FrameTime() const { return frameTimer.Poll(); }
+
+			const Statistics::Snapshot& GetFrameStatistics() const { return frameStatistics; }
 		private:
 
 			void PreRender();
 			void PostRender();
 
+			void CreateRenderJobs();
+			void DestroyRenderJobs();
+
+			// Returns the position of a tile in the given order, tiles are queued from low to high keys
+			static uint64_t GetTileKey(TileOrder order, uint32_t x, uint32_t y, uint32_t horizontalTiles, uint32_t verticalTiles);
+
+			void SeedRandom(const Point2& pixel, uint32_t sample, Random& random) const;
+			void GeneratePrimaryRay(const Point2& pixel, uint32_t sample, Random& random, Ray& ray) const;
+
+			void ApplyNormalMap(const Material& material, RaycastHit& hitInfo) const;
+
+			// Writes the average of the accumulated samples to the frame buffer, tonemapped if the frame buffer isn't HDR.
+			// Resolving uses the job group of the ray tracer, so this can only be done while no frame is being rendered
+			void ResolveFrameBuffer();
+			void Resolve(uint32_t beginRow, uint32_t endRow);
+
+			// Adds the sum of a number of new samples to the accumulation buffer
+			void AccumulatePixel(const Point2& pixel, const Color& colorSum, float luminanceSum, float luminanceSquaredSum, uint32_t sampleCount);
+
 		};
 
 	}
@@ -30,15 +30,17 @@ using namespace AwesomeRenderer::RayTracing;
 
 const std::string RayTracerDebug::RENDER_ROOT = "../Renders";
 const float RayTracerDebug::UPDATE_INTERVAL = 0.2f;
+const float RayTracerDebug::ADAPTIVE_THRESHOLDS[] = { 0.0f, 0.1f, 0.05f, 0.02f, 0.01f };
 
 
 RayTracerDebug::RayTracerDebug(Context& context, RayTracer& rayTracer) : 
 	context(context), rayTracer(rayTracer), inputManager(InputManager::Instance()),
-	currentIntegrator(0), textBuffer(NULL), exportMode(DISABLED)
+	currentIntegrator(0), currentAdaptiveThreshold(0), textBuffer(NULL), exportMode(DISABLED)
 {
 	integrators[0] = &rayTracer.debugIntegrator;
 	integrators[1] = &rayTracer.whittedIntegrator;
 	integrators[2] = &rayTracer.monteCarloIntegrator;
+	integrators[3] = &rayTracer.wavefrontIntegrator;
 }
 
 RayTracerDebug::~RayTracerDebug()
@@ -104,6 +106,17 @@ void RayTracerDebug::Update(float dt)
 		UpdateDebugDisplay();
 	}
 
+	if (inputManager.GetKeyDown('V'))
+	{
+		// Changing the threshold doesn't invalidate the samples rendered so far
+		currentAdaptiveThreshold = (currentAdaptiveThreshold + 1) % ADAPTIVE_THRESHOLD_COUNT;
+		rayTracer.adaptiveThreshold = ADAPTIVE_THRESHOLDS[currentAdaptiveThreshold];
+
+		printf("[AwesomeRenderer]: Settings raytracer adaptive sampling threshold to %.2f\n", rayTracer.adaptiveThreshold);
+
+		UpdateDebugDisplay();
+	}
+
 	if (inputManager.GetKeyDown('L'))
 	{
 		exportMode = (ExportMode) ((exportMode + 1) % EXPORT_MODE_COUNT);
@@ -121,7 +134,8 @@ void RayTracerDebug::Update(float dt)
 		rayTracer.Render(debugPixel);
 	}
 
-	if (!rayTracer.IsRenderingFrame())
+	// A converged frame isn't rendering anymore, but doesn't need to be exported continuously
+	if (!rayTracer.IsRenderingFrame() && (exportMode == ONCE || rayTracer.GetProgress(RayTracer::PROGRESS_CONVERGENCE) < 1.0f))
 	{
 		if (exportMode != DISABLED)
 		{
@@ -186,11 +200,19 @@ void RayTracerDebug::UpdateDebugDisplay()
 	else
 		timeLeft = "N/A";
 
+	char adaptiveText[64];
+
+	if (rayTracer.adaptiveThreshold > 0.0f)
+		sprintf(adaptiveText, "%.0f%% error, %.0f%% converged", rayTracer.adaptiveThreshold * 100, rayTracer.GetProgress(RayTracer::PROGRESS_CONVERGENCE) * 100);
+	else
+		sprintf(adaptiveText, "disabled");
+
 	sprintf(textBuffer,
-		"Bounces: %u; SPP: %u;\nEst. time left: %s\nProgress: %.0f%%\nExport: %s",
+		"Bounces: %u; SPP: %u;\nEst. time left: %s\nProgress: %.0f%%\nAdaptive: %s\nExport: %s",
 		rayTracer.maxDepth, rayTracer.samplesPerPixel,
 		timeLeft.c_str(),
 		progress * 100,
+		adaptiveText,
 		exportMode == CONTINUOUS ? "continuous" : (exportMode == ONCE ? "once" : "disabled")
 	);
 
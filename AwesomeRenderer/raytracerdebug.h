@@ -19,7 +19,9 @@ namespace AwesomeRenderer
 
 		private:
 			static const std::string RENDER_ROOT;
-			static const uint32_t INTEGRATOR_COUNT = 3;
+			static const uint32_t INTEGRATOR_COUNT = 4;
+			static const uint32_t ADAPTIVE_THRESHOLD_COUNT = 5;
+			static const float ADAPTIVE_THRESHOLDS[ADAPTIVE_THRESHOLD_COUNT];
 			static const uint32_t TEXT_BUFFER_SIZE = 1024;
 			static const float UPDATE_INTERVAL;
 
@@ -45,6 +47,8 @@ namespace AwesomeRenderer
 			SurfaceIntegrator* integrators[INTEGRATOR_COUNT];
 			uint32_t currentIntegrator;
 
+			uint32_t currentAdaptiveThreshold;
+
 			ExportMode exportMode;
 
 			float timeSinceUpdate;
@@ -16,52 +16,113 @@ using namespace AwesomeRenderer;
 
 RenderContext::RenderContext() : 
 	camera(NULL), renderTarget(NULL), lightData(NULL), skybox(NULL), 
-	clearFlags(RenderTarget::BUFFER_ALL), tree(20)
+	clearFlags(RenderTarget::BUFFER_ALL), accelerationStructure(ACCELERATION_KDTREE), tree(20), structureOutdated(false)
 {
 
 }
 
-void RenderContext::Optimize()
+void RenderContext::Optimize(Scheduler* scheduler)
 {
 	Update();
 
-	Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX);
-	Vector3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	tree.elements.clear();
 
 	for (auto it = nodes.begin(); it != nodes.end(); ++it)
 	{
 		Renderable* renderable = (*it)->GetComponent<Renderable>();
 
 		if (renderable != NULL)
-		{
-			AABB bounds;
-			renderable->GetPrimitive().CalculateBounds(bounds);
+			tree.elements.push_back(renderable);
+	}
 
-			Vector3 boundsMin = bounds.Min();
-			min[0] = std::min(min[0], boundsMin[0]);
-			min[1] = std::min(min[1], boundsMin[1]);
-			min[2] = std::min(min[2], boundsMin[2]);
+	AABB bounds = CalculateBounds();
 
-			Vector3 boundsMax = bounds.Max();
-			max[0] = std::max(max[0], boundsMax[0]);
-			max[1] = std::max(max[1], boundsMax[1]);
-			max[2] = std::max(max[2], boundsMax[2]);
+	if (accelerationStructure != ACCELERATION_KDTREE)
+	{
+		bvh.elements = tree.elements;
+		bvh.wideNodes = accelerationStructure == ACCELERATION_BVH4;
+		bvh.Optimize(bounds, scheduler);
 
-			tree.elements.push_back(renderable);
-		}
+		printf("[RenderContext]: Scene %s optimized, analyzing...\n", ACCELERATION_STRUCTURE_NAMES[accelerationStructure]);
+		bvh.Analyze();
+	}
+	else
+	{
+		tree.Optimize(bounds, scheduler);
+
+		printf("[RenderContext]: Scene tree optimized, analyzing...\n");
+		tree.Analyze();
+	}
+
+	structureOutdated = false;
+}
+
+void RenderContext::Refit(Scheduler* scheduler)
+{
+	if (!structureOutdated)
+		return;
+
+	AABB bounds = CalculateBounds();
+
+	if (accelerationStructure != ACCELERATION_KDTREE)
+	{
+		if (bvh.Refit(bounds, scheduler))
+			bvh.Analyze();
+	}
+	else
+		tree.Optimize(bounds, scheduler);
+
+	structureOutdated = false;
+}
+
+AABB RenderContext::CalculateBounds() const
+{
+	Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vector3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for (auto it = tree.elements.begin(); it != tree.elements.end(); ++it)
+	{
+		AABB bounds;
+		(*it)->GetPrimitive().CalculateBounds(bounds);
+
+		Vector3 boundsMin = bounds.Min();
+		min[0] = std::min(min[0], boundsMin[0]);
+		min[1] = std::min(min[1], boundsMin[1]);
+		min[2] = std::min(min[2], boundsMin[2]);
+
+		Vector3 boundsMax = bounds.Max();
+		max[0] = std::max(max[0], boundsMax[0]);
+		max[1] = std::max(max[1], boundsMax[1]);
+		max[2] = std::max(max[2], boundsMax[2]);
 	}
 	
 	Vector3 epsilon(0.1f, 0.1f, 0.1f);
 	min -= epsilon;
 	max += epsilon;
-	tree.Optimize(AABB(min, max));
 
-	printf("[RenderContext]: Scene tree optimized, analyzing...\n");
-	tree.Analyze();
+	return AABB(min, max);
+}
+
+bool RenderContext::HasMovedRenderables() const
+{
+	for (auto it = nodes.begin(); it != nodes.end(); ++it)
+	{
+		Node& node = **it;
+		Transformation* transform = node.GetComponent<Transformation>();
+
+		if (transform != NULL && transform->IsDirty() && node.GetComponent<Renderable>() != NULL)
+			return true;
+	}
+
+	return false;
 }
 
 void RenderContext::Update()
 {
+	// Check before recalculating, since nodes that share a transformation only see it change once
+	if (HasMovedRenderables())
+		structureOutdated = true;
+
 	// Prepare models in scene
 	for (auto it = nodes.begin(); it != nodes.end(); ++it)
 	{
@@ -83,11 +144,8 @@ void RenderContext::Update()
 		// Update renderable object
 		Renderable* renderable = node.GetComponent<Renderable>();
 
-		if (renderable != NULL)
-		{
-			if (renderable->shape != NULL)
-				renderable->shape->Transform(transform->WorldMtx());
-		}
+		if (renderable != NULL && renderable->shape != NULL)
+			renderable->shape->Transform(transform->WorldMtx());
 
 		// Update area lights
 		AreaLight* areaLight = node.GetComponent<AreaLight>();
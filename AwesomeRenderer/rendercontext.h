@@ -5,6 +5,8 @@
 #include "rendertarget.h"
 
 #include "kdtree.h"
+#include "bvh.h"
+#include "accelerationstructure.h"
 
 namespace AwesomeRenderer
 {
@@ -14,6 +16,7 @@ namespace AwesomeRenderer
 	class LightData;
 	class Skybox;
 	class Renderable;
+	class Scheduler;
 
 	class RenderContext
 	{
@@ -30,16 +33,70 @@ namespace AwesomeRenderer
 
 		// TODO: move this to a Scene class?
 		std::vector<Node*> nodes;
+
+		// Structure that Optimize builds over the renderables and that the queries below are answered with
+		AccelerationStructure accelerationStructure;
+
 		KDTree<Renderable> tree;
+		BVH<Renderable> bvh;
+
+	private:
+		// Set when renderables moved after the scene structure was built
+		bool structureOutdated;
 
 	public:
 
 		RenderContext();
 
-		void Optimize();
+		void Optimize(Scheduler* scheduler = NULL);
+
+		// Brings the scene structure up to date with renderables that moved since it was built. Hierarchies are refitted,
+		// and only rebuilt once refitting degraded them too much. KD-trees can't be refitted and are always rebuilt.
+		// Renderers should not trace rays while the structure is updated
+		void Refit(Scheduler* scheduler = NULL);
 
+		// Returns whether the next Update will move renderables, so renderers can stop tracing the scene first
+		bool HasMovedRenderables() const;
+
+		// Updates the transformations of all nodes, and marks the scene structure as outdated if renderables moved
 		void Update();
 
+		bool IsStructureOutdated() const { return structureOutdated; }
+
+		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance = FLT_MAX) const
+		{
+			if (accelerationStructure == ACCELERATION_KDTREE)
+				return tree.IntersectRay(ray, hitInfo, maxDistance);
+
+			return bvh.IntersectRay(ray, hitInfo, maxDistance);
+		}
+
+		bool Occluded(const Ray& ray, float maxDistance) const
+		{
+			if (accelerationStructure == ACCELERATION_KDTREE)
+				return tree.Occluded(ray, maxDistance);
+
+			return bvh.Occluded(ray, maxDistance);
+		}
+
+		uint32_t IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const
+		{
+			if (accelerationStructure == ACCELERATION_KDTREE)
+				return tree.IntersectRayPacket(packet, hitInfo, mask, maxDistance);
+
+			return bvh.IntersectRayPacket(packet, hitInfo, mask, maxDistance);
+		}
+
+		const AABB& GetBounds() const { return accelerationStructure == ACCELERATION_KDTREE ? tree.GetBounds() : bvh.GetBounds(); }
+
+		// Number of bytes used by the scene structure, the structures of the meshes aren't included
+		size_t GetTreeMemoryUsage() const { return accelerationStructure == ACCELERATION_KDTREE ? tree.GetMemoryUsage() : bvh.GetMemoryUsage(); }
+		float GetTreeBuildTime() const { return accelerationStructure == ACCELERATION_KDTREE ? tree.GetBuildTime() : bvh.GetBuildTime(); }
+
+	private:
+		// Bounds of all renderables, with some margin
+		AABB CalculateBounds() const;
+
 	};
 }
 
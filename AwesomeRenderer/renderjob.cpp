@@ -7,44 +7,66 @@
 #include "rendercontext.h"
 #include "shadinginfo.h"
 #include "texture.h"
+#include "statistics.h"
 
 using namespace AwesomeRenderer;
 using namespace AwesomeRenderer::RayTracing;
 
 
 RenderJob::RenderJob(RayTracer& rayTracer, uint32_t x, uint32_t y, uint32_t width, uint32_t height) : 
-	rayTracer(rayTracer), x(x), y(y), width(width), height(height), pixelIdx(0)
+	rayTracer(rayTracer), x(x), y(y), width(width), height(height), quadIdx(0)
 {
+	horizontalQuads = (width + 1) / 2;
+	verticalQuads = (height + 1) / 2;
 }
 
 void RenderJob::Run()
 {
-	const RenderContext& renderContext = rayTracer.GetRenderContext();
-	Buffer* frameBuffer = renderContext.renderTarget->frameBuffer;
+	AR_COUNT(RENDER_JOBS, 1);
+	AR_TIME_SCOPE(RENDER_JOB_TIME);
 
-	uint32_t pixels = width * height;
+	uint32_t quads = horizontalQuads * verticalQuads;
 
-	while (pixelIdx < pixels && !IsInterrupted())
+	// Pixels are rendered in 2x2 quads so that the primary rays can be traced as a packet
+	while (quadIdx < quads && !IsInterrupted())
 	{
-		Point2 pixel(x + (pixelIdx % width), y + (pixelIdx / width));
-
-		rayTracer.Render(pixel);
-
-		/*
-		rayTracer.BreakOnDebugPixel(pixel);
-
-		// Create a ray from the camera near plane through this pixel
-		Ray primaryRay;
-		renderContext.camera->ViewportToRay(pixel, primaryRay);
-
-		ShadingInfo shadingInfo;
-		rayTracer.CalculateShading(primaryRay, shadingInfo);
-
-		// Write to color buffer
-		frameBuffer->SetPixel(pixel[0], pixel[1], shadingInfo.color);
-		*/
-
-		++pixelIdx;
+		uint32_t quadX = (quadIdx % horizontalQuads) * 2;
+		uint32_t quadY = (quadIdx / horizontalQuads) * 2;
+
+		bool fullQuad = quadX + 1 < width && quadY + 1 < height;
+		bool converged = true;
+
+		for (uint32_t pixelY = quadY; pixelY < std::min(quadY + 2, height) && converged; ++pixelY)
+		{
+			for (uint32_t pixelX = quadX; pixelX < std::min(quadX + 2, width) && converged; ++pixelX)
+				converged = rayTracer.IsConverged(Point2(x + pixelX, y + pixelY));
+		}
+
+		// Converged pixels are skipped, a quad is still traced as a whole while one of its pixels needs more samples
+		if (converged)
+		{
+			++quadIdx;
+			continue;
+		}
+
+		if (fullQuad)
+			rayTracer.RenderQuad(Point2(x + quadX, y + quadY));
+		else
+		{
+			// Quads on the edge of an uneven tile are partially outside, render the remaining pixels individually
+			for (uint32_t pixelY = quadY; pixelY < std::min(quadY + 2, height); ++pixelY)
+			{
+				for (uint32_t pixelX = quadX; pixelX < std::min(quadX + 2, width); ++pixelX)
+				{
+					Point2 pixel(x + pixelX, y + pixelY);
+
+					if (!rayTracer.IsConverged(pixel))
+						rayTracer.Render(pixel);
+				}
+			}
+		}
+
+		++quadIdx;
 	}
 }
 
@@ -52,5 +74,19 @@ void RenderJob::Reset()
 {
 	WorkerJob::Reset();
 
-	pixelIdx = 0;
+	quadIdx = 0;
+}
+
+bool RenderJob::IsConverged() const
+{
+	for (uint32_t pixelY = 0; pixelY < height; ++pixelY)
+	{
+		for (uint32_t pixelX = 0; pixelX < width; ++pixelX)
+		{
+			if (!rayTracer.IsConverged(Point2(x + pixelX, y + pixelY)))
+				return false;
+		}
+	}
+
+	return true;
 }
\ No newline at end of file
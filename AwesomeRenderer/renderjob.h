@@ -18,15 +18,19 @@ namespace AwesomeRenderer
 		private:
 			RayTracer& rayTracer;
 
-			uint32_t pixelIdx;
+			uint32_t quadIdx;
 			uint32_t x, y, width, height;
+			uint32_t horizontalQuads, verticalQuads;
 
 		public:
 			RenderJob(RayTracer& rayTracer, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 			
 			void Reset();
 
-			float GetProgress() const { return pixelIdx / (float)(width * height); }
+			// Returns whether all pixels in this tile have converged, so that the tile doesn't need to be scheduled
+			bool IsConverged() const;
+
+			float GetProgress() const { return quadIdx / (float)(horizontalQuads * verticalQuads); }
 
 		protected:
 			void Run();
@@ -0,0 +1,20 @@
+#include "raytracer.h"
+#include "resolvejob.h"
+
+using namespace AwesomeRenderer;
+using namespace AwesomeRenderer::RayTracing;
+
+
+ResolveJob::ResolveJob(RayTracer& rayTracer, Counter& jobsLeft, uint32_t y, uint32_t height) :
+	rayTracer(rayTracer), jobsLeft(jobsLeft), y(y), height(height)
+{
+
+}
+
+void ResolveJob::Run()
+{
+	if (!IsInterrupted())
+		rayTracer.Resolve(y, y + height);
+
+	jobsLeft.Decrement();
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef _RESOLVE_JOB_H_
+#define _RESOLVE_JOB_H_
+
+#include "awesomerenderer.h"
+
+#include "threading.h"
+#include "workerjob.h"
+
+namespace AwesomeRenderer
+{
+	namespace RayTracing
+	{
+		class RayTracer;
+
+		// Converts a band of rows from the accumulation buffer of the ray tracer to the frame buffer
+		class ResolveJob : public WorkerJob
+		{
+
+		private:
+			RayTracer& rayTracer;
+			Counter& jobsLeft;
+
+			uint32_t y, height;
+
+		public:
+			ResolveJob(RayTracer& rayTracer, Counter& jobsLeft, uint32_t y, uint32_t height);
+
+		protected:
+			void Run();
+
+		};
+
+	}
+}
+
+#endif
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include "sampler.h"
 
 #include "texture.h"
+#include "statistics.h"
+#include "pixelconverter.h"
+#include "texturecache.h"
 
 using namespace AwesomeRenderer;
 
@@ -22,6 +25,8 @@ Color Sampler::Sample(const Vector2& uv, uint32_t mipLevel) const
 
 void Sampler::Sample(const Vector2& uv, Color& sample, uint32_t mipLevel) const
 {
+	AR_COUNT(TEXTURE_SAMPLES, 1);
+
 	Vector2 ts(uv);
 
 	// Normalize texture coordinates to 0 ... 1 range by using the wrap mode
@@ -45,12 +50,16 @@ void Sampler::Sample(const Vector2& uv, Color& sample, uint32_t mipLevel) const
 		break;
 	}
 
-	SampleBuffer(texture->GetMipLevel(mipLevel), ts, sampleMode, sample);
+	if (texture->IsCached())
+		SampleCache(texture, mipLevel, ts, sampleMode, sample);
+	else
+		SampleBuffer(texture->GetMipLevel(mipLevel), ts, sampleMode, sample);
 }
 
 Color Sampler::Sample(const Vector2& uv, float mipLevel) const
 {
-	if (!texture->HasMipmaps())
+	// Degenerate transformations or ray cones can produce a level of detail that isn't a number
+	if (!texture->HasMipmaps() || !_finite(mipLevel))
 		return Sample(uv, 0U);
 
 	Color sample;
@@ -79,18 +88,9 @@ Color Sampler::Sample(const Vector2& uv, float mipLevel) const
 	return sample;
 }
 
-Color Sampler::SampleMipMaps(const Vector2& uv, float distance, double surfaceAreaToTextureRatio, float screenResolution)
+Color Sampler::SampleMipMaps(const Vector2& uv, float textureLod) const
 {
-	float textureResolution = texture->GetResolution();
-
-	float textureToScreenRatio = textureResolution / screenResolution;
-
-	//float log2IdealDistance = 0.5f * log2(surfaceAreaToTextureRatio  / textureToScreenRatio);
-	float log2IdealDistance = (float) log2(surfaceAreaToTextureRatio / textureToScreenRatio);
-
-	float mipLevel = log2(distance) - log2IdealDistance;
-
-	return Sample(uv, mipLevel);
+	return Sample(uv, textureLod + texture->GetLog2Size());
 }
 
 void Sampler::SampleBuffer(const Buffer* buffer, const Vector2& uv, SampleMode sampleMode, Color& sample)
@@ -122,6 +122,12 @@ void Sampler::SampleBuffer(const Buffer* buffer, const Vector2& uv, SampleMode s
 			float fractX = ts[0] - intX;
 			float fractY = ts[1] - intY;
 
+			if (buffer->layout == Buffer::LAYOUT_TILED && (buffer->encoding == Buffer::RGBA32 || buffer->encoding == Buffer::BGRA32))
+			{
+				SampleFootprint(buffer, intX, intY, neighbourX, neighbourY, fractX, fractY, sample);
+				break;
+			}
+
 			Color samples[4];
 			buffer->GetPixel(intX,			intY,		samples[0], Buffer::LINEAR);
 			buffer->GetPixel(neighbourX,	intY,		samples[1], Buffer::LINEAR);
@@ -138,4 +144,86 @@ void Sampler::SampleBuffer(const Buffer* buffer, const Vector2& uv, SampleMode s
 			break;
 		}
 	}
+}
+
+void Sampler::SampleCache(const Texture* texture, uint32_t mipLevel, const Vector2& uv, SampleMode sampleMode, Color& sample)
+{
+	TiledTextureFile& tiledFile = *texture->GetTiledFile();
+	const TiledTextureFile::Level& level = tiledFile.levels[mipLevel];
+
+	Vector2 ts(uv);
+
+	// Convert UV coordinates to pixel coordinates
+	ts[0] *= (level.width - 1);
+	ts[1] *= (level.height - 1);
+
+	uint32_t intX = (uint32_t)ts[0];
+	uint32_t intY = (uint32_t)ts[1];
+
+	Color samples[4];
+
+	if (sampleMode == SM_POINT)
+	{
+		texture->GetCache()->GetFootprint(tiledFile, mipLevel, intX, intY, intX, intY, samples);
+		sample = samples[0];
+
+		return;
+	}
+
+	uint32_t neighbourX = std::min(intX + 1, level.width - 1);
+	uint32_t neighbourY = std::min(intY + 1, level.height - 1);
+
+	float fractX = ts[0] - intX;
+	float fractY = ts[1] - intY;
+
+	texture->GetCache()->GetFootprint(tiledFile, mipLevel, intX, intY, neighbourX, neighbourY, samples);
+
+	// Interpolate in X direction
+	samples[0] = (samples[0] * (1.0f - fractX)) + (samples[1] * fractX);
+	samples[1] = (samples[2] * (1.0f - fractX)) + (samples[3] * fractX);
+
+	// Interpolate in Y direction
+	sample = samples[0] * (1.0f - fractY) + samples[1] * fractY;
+}
+
+void Sampler::SampleFootprint(const Buffer* buffer, uint32_t x, uint32_t y, uint32_t neighbourX, uint32_t neighbourY, float fractX, float fractY, Color& sample)
+{
+	uint32_t texels[4];
+
+	// In a tiled buffer an aligned 2x2 block is contiguous and in the same order as the samples, so it's fetched with a single load
+	if ((x & 1) == 0 && (y & 1) == 0 && neighbourX == x + 1 && neighbourY == y + 1)
+		memcpy(texels, buffer->GetBase(x, y), sizeof(texels));
+	else
+	{
+		memcpy(&texels[0], buffer->GetBase(x, y), sizeof(uint32_t));
+		memcpy(&texels[1], buffer->GetBase(neighbourX, y), sizeof(uint32_t));
+		memcpy(&texels[2], buffer->GetBase(x, neighbourY), sizeof(uint32_t));
+		memcpy(&texels[3], buffer->GetBase(neighbourX, neighbourY), sizeof(uint32_t));
+	}
+
+	// Gamma corrected channels are converted the same way as Buffer::GetPixel does
+	const float* colorTable = PixelConverter::GetDecodeTable(buffer->colorSpace);
+	const float* alphaTable = PixelConverter::GetDecodeTable(Buffer::LINEAR);
+
+	uint32_t red = buffer->encoding == Buffer::BGRA32 ? 2 : 0;
+	uint32_t blue = 2 - red;
+
+	__m128 samples[4];
+
+	for (uint32_t texelIdx = 0; texelIdx < 4; ++texelIdx)
+	{
+		const uchar* channels = reinterpret_cast<const uchar*>(&texels[texelIdx]);
+		samples[texelIdx] = _mm_setr_ps(colorTable[channels[red]], colorTable[channels[1]], colorTable[channels[blue]], alphaTable[channels[3]]);
+	}
+
+	// Interpolate in X direction
+	__m128 weightX = _mm_set1_ps(fractX);
+	__m128 inverseWeightX = _mm_set1_ps(1.0f - fractX);
+
+	samples[0] = _mm_add_ps(_mm_mul_ps(samples[0], inverseWeightX), _mm_mul_ps(samples[1], weightX));
+	samples[1] = _mm_add_ps(_mm_mul_ps(samples[2], inverseWeightX), _mm_mul_ps(samples[3], weightX));
+
+	// Interpolate in Y direction
+	__m128 result = _mm_add_ps(_mm_mul_ps(samples[0], _mm_set1_ps(1.0f - fractY)), _mm_mul_ps(samples[1], _mm_set1_ps(fractY)));
+	_mm_storeu_ps(sample.data(), result);
 }
\ No newline at end of file
@@ -40,12 +40,20 @@ namespace AwesomeRenderer
 		void Sample(const Vector2& uv, Color& sample, uint32_t mipLevel = 0) const;
 
 		Color Sample(const Vector2& uv, float mipLevel) const;
-		Color SampleMipMaps(const Vector2& uv, float distance, double texelToSurfaceAreaRatio, float screenResolution);
+
+		// Samples the mip level for a texture independent level of detail, such as the texture LOD of a ray cone hit
+		Color SampleMipMaps(const Vector2& uv, float textureLod) const;
 
 
 	private:
 		static void SampleBuffer(const Buffer* buffer, const Vector2& uv, SampleMode sampleMode, Color& sample);
 
+		// Fetches the texels of textures that are streamed through the texture cache
+		static void SampleCache(const Texture* texture, uint32_t mipLevel, const Vector2& uv, SampleMode sampleMode, Color& sample);
+
+		// Bilinear filtering of a 2x2 footprint of a tiled 32-bit buffer, without decoding every texel through the buffer
+		static void SampleFootprint(const Buffer* buffer, uint32_t x, uint32_t y, uint32_t neighbourX, uint32_t neighbourY, float fractX, float fractY, Color& sample);
+
 	};
 
 }
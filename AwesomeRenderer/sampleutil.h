@@ -40,11 +40,6 @@ namespace AwesomeRenderer
 			return VectorUtil<3>::Dot(n, wi) * INV_PI;
 		}
 
-		static float StratifiedSample(uint32_t x, uint32_t n)
-		{
-			return StratifiedSample(x, n, Random::instance);
-		}
-
 		static float StratifiedSample(uint32_t x, uint32_t n, Random& random)
 		{
 			float step = 1.0f / n;
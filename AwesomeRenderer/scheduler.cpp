@@ -12,6 +12,9 @@ Scheduler::Scheduler(int sharedThreads) : running(false)
 
 Scheduler::~Scheduler()
 {
+	if (running)
+		Stop();
+
 	for (auto it = workers.begin(); it != workers.end(); ++it)
 		delete *it;
 
@@ -24,13 +27,16 @@ Scheduler::~Scheduler()
 
 void Scheduler::SetupWorkers(uint32_t threads, JobGroup* group)
 {
+	uint32_t firstWorker = workers.size();
+
+	// Create all workers before starting any, the queues of a group can't change while its workers are running
 	for (uint32_t threadIdx = 0; threadIdx < threads; ++threadIdx)
-	{
-		WorkerThread* worker = new WorkerThread(group);
-		workers.push_back(worker);
+		workers.push_back(new WorkerThread(group));
 
-		if (running)
-			worker->Start();
+	if (running)
+	{
+		for (uint32_t workerIdx = firstWorker; workerIdx < workers.size(); ++workerIdx)
+			workers[workerIdx]->Start();
 	}
 }
 
@@ -47,7 +53,14 @@ void Scheduler::Stop()
 	for (auto it = workers.begin(); it != workers.end(); ++it)
 		(*it)->Stop();
 
-	mainGroup.jobSignal.Signal(workers.size());
+	// Wake parked workers so that they notice they should stop
+	mainGroup.Shutdown();
+
+	for (auto it = jobGroups.begin(); it != jobGroups.end(); ++it)
+		(*it)->Shutdown();
+
+	for (auto it = workers.begin(); it != workers.end(); ++it)
+		(*it)->Join();
 
 	running = false;
 }
@@ -348,7 +348,7 @@ void Setup::SetupCornellBox()
 		model->CalculateBounds();
 		node->AddComponent(model);
 
-		ModelEx* modelEx = new ModelEx(*model);		
+		ModelEx* modelEx = new ModelEx(*model, context.scheduler, context.treeCacheDirectory, context.perfectSplits, context.accelerationStructure);		
 
 		Renderable* renderable = new Renderable();
 		renderable->shape = modelEx->meshes[0];
@@ -454,7 +454,7 @@ void Setup::SetupCornellBox()
 
 		node->AddComponent(model);
 
-		ModelEx* modelEx = new ModelEx(*model);
+		ModelEx* modelEx = new ModelEx(*model, context.scheduler, context.treeCacheDirectory, context.perfectSplits, context.accelerationStructure);
 
 		for (uint32_t meshIdx = 0; meshIdx < modelEx->meshes.size(); ++meshIdx)
 		{
@@ -664,7 +664,7 @@ void Setup::SetupSponza()
 
 		if (calculateExtendedMeshData)
 		{
-			ModelEx* modelEx = new ModelEx(*model);
+			ModelEx* modelEx = new ModelEx(*model, context.scheduler, context.treeCacheDirectory, context.perfectSplits, context.accelerationStructure);
 			for (uint32_t meshIdx = 0; meshIdx < modelEx->meshes.size(); ++meshIdx)
 			{
 				Node* meshNode = new Node();
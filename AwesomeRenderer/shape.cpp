@@ -0,0 +1,34 @@
+
+#include "awesomerenderer.h"
+
+#include "shape.h"
+#include "ray.h"
+#include "raypacket.h"
+#include "raycasthit.h"
+
+using namespace AwesomeRenderer;
+
+bool Shape::Occluded(const Ray& ray, float maxDistance) const
+{
+	RaycastHit hitInfo;
+	return IntersectRay(ray, hitInfo, maxDistance);
+}
+
+uint32_t Shape::IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const
+{
+	float maxDistances[RayPacket::SIZE];
+	_mm_storeu_ps(maxDistances, maxDistance);
+
+	// Shapes without a packet implementation intersect each ray seperately
+	uint32_t hits = 0;
+	for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+	{
+		if ((mask & (1 << rayIdx)) == 0)
+			continue;
+
+		if (IntersectRay(packet.rays[rayIdx], hitInfo[rayIdx], maxDistances[rayIdx]))
+			hits |= 1 << rayIdx;
+	}
+
+	return hits;
+}
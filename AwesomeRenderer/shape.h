@@ -7,6 +7,7 @@ namespace AwesomeRenderer
 {
 	class Primitive;
 	class Ray;
+	class RayPacket;
 
 	struct RaycastHit;
 
@@ -19,6 +20,12 @@ namespace AwesomeRenderer
 
 		virtual bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance = FLT_MAX) const = 0;
 
+		// Returns whether the ray hits this shape within maxDistance, without calculating any hit information
+		virtual bool Occluded(const Ray& ray, float maxDistance) const;
+
+		// Intersects all rays in the mask, returns a mask of the rays that hit this shape
+		virtual uint32_t IntersectRayPacket(const RayPacket& packet, RaycastHit* hitInfo, uint32_t mask, const __m128& maxDistance) const;
+
 		virtual const Primitive& GetPrimitive() const = 0;
 
 		const Shape& GetShape() const { return *this; }
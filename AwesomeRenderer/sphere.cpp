@@ -40,6 +40,26 @@ void Sphere::Transform(const Matrix44& mtx)
 }
 		
 bool Sphere::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	float t;
+	if (!CalculateIntersection(ray, maxDistance, t))
+		return false;
+
+	// Fill RaycastHit struct
+	hitInfo.distance = t;
+	hitInfo.point = ray.origin + ray.direction * t;
+	hitInfo.normal = VectorUtil<3>::Normalize(hitInfo.point - centerTransformed);
+	
+	return true;
+}
+
+bool Sphere::Occluded(const Ray& ray, float maxDistance) const
+{
+	float t;
+	return CalculateIntersection(ray, maxDistance, t);
+}
+
+bool Sphere::CalculateIntersection(const Ray& ray, float maxDistance, float& t) const
 {
 	Vector3 relativeOrigin = ray.origin - centerTransformed;
 
@@ -80,11 +100,8 @@ bool Sphere::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance
 	if (t0 < 0.0f || t0 > maxDistance)
 		return false;
 
-	// Fill RaycastHit struct
-	hitInfo.distance = t0;
-	hitInfo.point = ray.origin + ray.direction * t0;
-	hitInfo.normal = VectorUtil<3>::Normalize(hitInfo.point - centerTransformed);
-	
+	t = t0;
+
 	return true;
 }
 
@@ -31,6 +31,7 @@ namespace AwesomeRenderer
 		void Transform(const Matrix44& mtx);
 		
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance = FLT_MAX) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		int SideOfPlane(const Plane& plane) const;
 
@@ -52,6 +53,9 @@ namespace AwesomeRenderer
 
 		static Vector3 UniformSampleCone(const Vector2& r, float cosThetaMax);
 		static Vector3 UniformSampleCone(const Vector2& r, float cosThetaMax, const Vector3& x, const Vector3& y, const Vector3& z);
+
+	private:
+		bool CalculateIntersection(const Ray& ray, float maxDistance, float& t) const;
 	};
 }
 
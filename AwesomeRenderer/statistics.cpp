@@ -0,0 +1,122 @@
+#include "awesomerenderer.h"
+
+#include "statistics.h"
+
+using namespace AwesomeRenderer;
+
+const char* Statistics::NAMES[] =
+{
+	"rays_unknown",
+	"rays_hit_test",
+	"rays_reflection",
+	"rays_transmission",
+	"rays_shadow",
+
+	"nodes_visited",
+	"leaves_visited",
+	"triangles_tested",
+
+	"bsdf_evaluations",
+	"texture_samples",
+	"texture_cache_hits",
+	"texture_cache_misses",
+
+	"render_jobs",
+	"render_job_time_us",
+};
+
+std::atomic<Statistics::ThreadCounters*> Statistics::threadCounters(NULL);
+thread_local Statistics::ThreadCounters* Statistics::currentThreadCounters = NULL;
+
+Statistics::Snapshot::Snapshot()
+{
+	for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+		values[type] = 0;
+}
+
+Statistics::Snapshot Statistics::Snapshot::operator-(const Snapshot& other) const
+{
+	Snapshot difference;
+
+	for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+		difference.values[type] = values[type] - other.values[type];
+
+	return difference;
+}
+
+Statistics::ThreadCounters* Statistics::RegisterThread()
+{
+	ThreadCounters* counters = new ThreadCounters();
+
+	for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+		counters->values[type] = 0;
+
+	// Push the counters on the front of the list
+	counters->next = threadCounters.load();
+	while (!threadCounters.compare_exchange_weak(counters->next, counters));
+
+	return counters;
+}
+
+void Statistics::Collect(Snapshot& snapshot)
+{
+	snapshot = Snapshot();
+
+	for (ThreadCounters* counters = threadCounters.load(); counters != NULL; counters = counters->next)
+	{
+		for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+			snapshot.values[type] += counters->values[type].load(std::memory_order_relaxed);
+	}
+}
+
+bool Statistics::Export(const std::string& fileName, uint32_t pass, uint32_t samples, float frameTime, const Snapshot& snapshot)
+{
+	bool json = fileName.size() >= 5 && fileName.compare(fileName.size() - 5, 5, ".json") == 0;
+
+	FILE* filePtr;
+
+	// Open filename in append mode 
+	errno_t result = fopen_s(&filePtr, fileName.c_str(), "a");
+
+	if (result != 0)
+	{
+		printf("[Statistics]: Failed to open file \"%s\". Error code: %d\n", fileName.c_str(), result);
+		return false;
+	}
+
+	if (json)
+	{
+		fprintf(filePtr, "{\"pass\": %u, \"samples\": %u, \"frame_time_ms\": %.1f", pass, samples, frameTime * 1000.0f);
+
+		for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+			fprintf(filePtr, ", \"%s\": %llu", NAMES[type], (unsigned long long) snapshot.values[type]);
+
+		fprintf(filePtr, "}\n");
+	}
+	else
+	{
+		// Start a new file with the column names
+		fseek(filePtr, 0, SEEK_END);
+
+		if (ftell(filePtr) == 0)
+		{
+			fprintf(filePtr, "pass,samples,frame_time_ms");
+
+			for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+				fprintf(filePtr, ",%s", NAMES[type]);
+
+			fprintf(filePtr, "\n");
+		}
+
+		fprintf(filePtr, "%u,%u,%.1f", pass, samples, frameTime * 1000.0f);
+
+		for (uint32_t type = 0; type < TYPE_COUNT; ++type)
+			fprintf(filePtr, ",%llu", (unsigned long long) snapshot.values[type]);
+
+		fprintf(filePtr, "\n");
+	}
+
+	fclose(filePtr);
+
+	return true;
+}
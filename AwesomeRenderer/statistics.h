@@ -0,0 +1,117 @@
+#ifndef _STATISTICS_H_
+#define _STATISTICS_H_
+
+#include "awesomerenderer.h"
+
+// Set to 1 to collect render statistics. When disabled the counters compile away entirely
+#ifndef AR_STATISTICS
+#define AR_STATISTICS 0
+#endif
+
+namespace AwesomeRenderer
+{
+
+	// Counters for the hot paths of the ray tracer. Every thread increments its own set of counters, which are only summed when a snapshot is taken.
+	// Use the AR_COUNT and AR_TIME_SCOPE macros instead of calling Add directly, so that disabled statistics have no cost.
+	class Statistics
+	{
+	public:
+		enum Type
+		{
+			// Rays traced through the scene, by Ray::Type
+			RAYS_UNKNOWN,
+			RAYS_HIT_TEST,
+			RAYS_REFLECTION,
+			RAYS_TRANSMISSION,
+			RAYS_SHADOW,
+
+			NODES_VISITED,
+			LEAVES_VISITED,
+			TRIANGLES_TESTED,
+
+			BSDF_EVALUATIONS,
+			TEXTURE_SAMPLES,
+			TEXTURE_CACHE_HITS,
+			TEXTURE_CACHE_MISSES,
+
+			RENDER_JOBS,
+			RENDER_JOB_TIME,
+
+			TYPE_COUNT
+		};
+
+		static const char* NAMES[TYPE_COUNT];
+
+		struct Snapshot
+		{
+			uint64_t values[TYPE_COUNT];
+
+			Snapshot();
+
+			Snapshot operator-(const Snapshot& other) const;
+		};
+
+		// Measures the time until the end of its scope in microseconds
+		class ScopedTimer
+		{
+		private:
+			Type type;
+			std::chrono::steady_clock::time_point start;
+
+		public:
+			ScopedTimer(Type type) : type(type), start(std::chrono::steady_clock::now())
+			{
+
+			}
+
+			~ScopedTimer()
+			{
+				Add(type, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+		};
+
+	private:
+		struct ThreadCounters
+		{
+			// Only written by the owning thread, atomic so that snapshots can read them while the thread is running
+			std::atomic<uint64_t> values[TYPE_COUNT];
+
+			ThreadCounters* next;
+		};
+
+		// Lock-free list of the counters of all threads that have counted something. Counters are kept when their thread exits
+		static std::atomic<ThreadCounters*> threadCounters;
+		static thread_local ThreadCounters* currentThreadCounters;
+
+	public:
+		AR_FORCE_INLINE static void Add(Type type, uint64_t count)
+		{
+			if (currentThreadCounters == NULL)
+				currentThreadCounters = RegisterThread();
+
+			// A relaxed load and store instead of an atomic increment, since no other thread writes these counters
+			std::atomic<uint64_t>& value = currentThreadCounters->values[type];
+			value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+		}
+
+		// Sums the counters of all threads
+		static void Collect(Snapshot& snapshot);
+
+		// Appends a record for a render pass to a file. Files ending in ".json" get a JSON object per line, other files are written as CSV
+		static bool Export(const std::string& fileName, uint32_t pass, uint32_t samples, float frameTime, const Snapshot& snapshot);
+
+	private:
+		static ThreadCounters* RegisterThread();
+	};
+
+}
+
+#if AR_STATISTICS
+#define AR_COUNT(type, count) AwesomeRenderer::Statistics::Add((AwesomeRenderer::Statistics::Type) (AwesomeRenderer::Statistics::type), (count))
+#define AR_TIME_SCOPE(type) AwesomeRenderer::Statistics::ScopedTimer scopedTimer##type(AwesomeRenderer::Statistics::type)
+#else
+#define AR_COUNT(type, count)
+#define AR_TIME_SCOPE(type)
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 #include <list>
 #include <memory>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <stack>
 #include <queue>
@@ -16,8 +17,14 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <ctime>
 
+// SIMD intrinsics
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
 // Windows libraries
 #define NOMINMAX
 #include <Windows.h>
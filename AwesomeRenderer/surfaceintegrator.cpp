@@ -21,63 +21,74 @@ SurfaceIntegrator::SurfaceIntegrator(RayTracer& rayTracer) : rayTracer(rayTracer
 
 Vector3 SurfaceIntegrator::SampleDirectLight(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context)
 {
-	const Vector3 wo = -ray.direction;
-	const Vector3& normal = hitInfo.normal;
-	
 	Vector3 radiance(0.0f, 0.0f, 0.0f);
 		
 	// Iterate through all the lights
 	for (uint8_t i = 0; i < LightData::MAX_LIGHTS; ++i)
 	{
-		const LightData::Light& light = context.lightData->lights[i];
+		LightSample sample;
+		if (!GenerateDirectLightSample(i, ray, hitInfo, material, context, sample))
+			continue;
 
-		if (!light.enabled)
+		if (rayTracer.Occluded(sample.shadowRay, sample.distance))
 			continue;
+		
+		radiance += sample.radiance;
+	}
+	
+	return radiance;
+}
 
-		// Calculate light intensity
-		Vector3 wi;
-		float distanceToLight;
+bool SurfaceIntegrator::GenerateDirectLightSample(uint32_t lightIdx, const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, LightSample& sample)
+{
+	const LightData::Light& light = context.lightData->lights[lightIdx];
 
-		float intensity = light.intensity;
+	if (!light.enabled)
+		return false;
 
-		if (light.type != LightData::DIRECTIONAL)
-		{
-			wi = light.position - hitInfo.point;
+	const Vector3 wo = -ray.direction;
+	const Vector3& normal = hitInfo.normal;
 
-			distanceToLight = wi.length();
-			wi.normalize();
+	// Calculate light intensity
+	Vector3 wi;
+	float distanceToLight;
 
-			if (light.type == LightData::SPOT)
-			{
-				float angleTerm = VectorUtil<3>::Dot(light.direction, -wi);
-				float cosAngle = cos(light.angle);
+	float intensity = light.intensity;
 
-				if (angleTerm > cosAngle)
-					intensity *= (angleTerm - cosAngle) / (1.0f - cosAngle);
-				else
-					intensity = 0;
-			}
+	if (light.type != LightData::DIRECTIONAL)
+	{
+		wi = light.position - hitInfo.point;
 
-			intensity /= (light.constantAttenuation + light.lineairAttenuation * distanceToLight + light.quadricAttenuation * (distanceToLight * distanceToLight));
-		}
-		else
+		distanceToLight = wi.length();
+		wi.normalize();
+
+		if (light.type == LightData::SPOT)
 		{
-			wi = -light.direction;
-			distanceToLight = context.lightData->shadowDistance;
+			float angleTerm = VectorUtil<3>::Dot(light.direction, -wi);
+			float cosAngle = cos(light.angle);
+
+			if (angleTerm > cosAngle)
+				intensity *= (angleTerm - cosAngle) / (1.0f - cosAngle);
+			else
+				intensity = 0;
 		}
 
-		Ray shadowRay(hitInfo.point + hitInfo.normal * 1e-3f, wi);
+		intensity /= (light.constantAttenuation + light.lineairAttenuation * distanceToLight + light.quadricAttenuation * (distanceToLight * distanceToLight));
+	}
+	else
+	{
+		wi = -light.direction;
+		distanceToLight = context.lightData->shadowDistance;
+	}
 
-		RaycastHit shadowHitInfo;
-		if (rayTracer.RayCast(shadowRay, shadowHitInfo, distanceToLight))
-			continue;
+	sample.shadowRay = Ray(hitInfo.point + hitInfo.normal * 1e-3f, wi);
+	sample.distance = distanceToLight;
 		
-		float NoL = std::max(VectorUtil<3>::Dot(normal, wi), 0.0f);
-		Vector3 lightRadiance = light.color.subvector(3) * intensity;
+	float NoL = std::max(VectorUtil<3>::Dot(normal, wi), 0.0f);
+	Vector3 lightRadiance = light.color.subvector(3) * intensity;
 		
-		// TODO: This gets weird when the microfacet NDF returns a value > 1. Not sure how to handle this yet
-		radiance += material.bsdf->Sample(wo, wi, normal, hitInfo, material, rayTracer.GetRenderContext(), BSDF::BXDF_ALL) * lightRadiance * NoL;
-	}
-	
-	return radiance;
+	// TODO: This gets weird when the microfacet NDF returns a value > 1. Not sure how to handle this yet
+	sample.radiance = material.bsdf->Sample(wo, wi, normal, hitInfo, material, rayTracer.GetRenderContext(), BSDF::BXDF_ALL) * lightRadiance * NoL;
+
+	return true;
 }
@@ -2,6 +2,7 @@
 #define _SURFACE_INTEGRATOR_H_
 
 #include "awesomerenderer.h"
+#include "ray.h"
 
 namespace AwesomeRenderer
 {
@@ -14,10 +15,21 @@ namespace AwesomeRenderer
 
 	class RenderContext;
 
+	class Random;
+
 	namespace RayTracing
 	{
 		class RayTracer;
 
+		// Light arriving at a surface point, if the shadow ray isn't occluded
+		struct LightSample
+		{
+			Ray shadowRay;
+			float distance;
+
+			Vector3 radiance;
+		};
+
 		class SurfaceIntegrator
 		{
 
@@ -29,10 +41,11 @@ namespace AwesomeRenderer
 		public:
 			SurfaceIntegrator(RayTracer& rayTracer);
 			
-			virtual Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth) = 0;
+			virtual Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth) = 0;
 			
 		protected:
 			Vector3 SampleDirectLight(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context);
+			bool GenerateDirectLightSample(uint32_t lightIdx, const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, LightSample& sample);
 			Vector3 SampleAreaLight(const Renderable* light);
 			
 		};
@@ -4,68 +4,194 @@
 #include "texture.h"
 #include "bufferallocator.h"
 #include "memorybufferallocator.h"
+#include "pixelconverter.h"
+#include "mipmapjob.h"
+#include "jobbatch.h"
+#include "texturecache.h"
 
 using namespace AwesomeRenderer;
 
-Texture::Texture(BufferAllocator* allocator, ColorSpace colorSpace) : Buffer(allocator, colorSpace), mipmapLevels(DEFAULT_MIPMAP_LEVELS), mipChain(NULL)
+Texture::Texture(BufferAllocator* allocator, ColorSpace colorSpace) : Buffer(allocator, colorSpace), mipmapLevels(DEFAULT_MIPMAP_LEVELS), log2Size(0.0f), mipChain(NULL), cache(NULL), tiledFile(NULL)
 {
 
 }
 
 Texture::~Texture()
+{
+	DestroyMipChain();
+}
+
+void Texture::DestroyMipChain()
 {
 	if (mipChain != NULL)
 	{
 		for (uint32_t mipmapLevel = 0; mipmapLevel < mipmapLevels; ++mipmapLevel)
-			delete mipChain[mipmapLevel];
+			delete mipChain[mipmapLevel].load();
 
 		delete[] mipChain;
+		mipChain = NULL;
+	}
+}
+
+void Texture::GenerateMipMaps(Scheduler* scheduler)
+{
+	GenerateMipMapsLazy();
+
+	for (uint32_t mipmapLevel = 1; mipmapLevel <= mipmapLevels; ++mipmapLevel)
+	{
+		const Buffer& previousLevel = *GetMipLevel(mipmapLevel - 1);
+		Buffer* mipBuffer = AllocateMipLevel(mipmapLevel);
+
+		// Every level is filtered from the previous one, so only the rows of a single level are built in parallel
+		if (scheduler != NULL && mipBuffer->height > MIPMAP_JOB_ROWS)
+		{
+			JobBatch jobs(scheduler);
+
+			for (uint32_t y = 0; y < mipBuffer->height; y += MIPMAP_JOB_ROWS)
+				jobs.Schedule(new MipMapJob(previousLevel, *mipBuffer, y, std::min(MIPMAP_JOB_ROWS, mipBuffer->height - y)));
+
+			jobs.Clear();
+		}
+		else
+			FilterMipLevel(previousLevel, *mipBuffer, 0, mipBuffer->height);
+
+		mipChain[mipmapLevel - 1].store(mipBuffer, std::memory_order_release);
 	}
 }
 
-void Texture::GenerateMipMaps()
+void Texture::GenerateMipMapsLazy()
 {
 	assert(data != NULL);
 
-	const Buffer::ColorSpace colorSpace = Buffer::LINEAR;
-	Buffer* previousLevel = this;
-	Color samples[4];
+	DestroyMipChain();
 
-	mipChain = new Buffer*[mipmapLevels];
+	mipChain = new std::atomic<Buffer*>[mipmapLevels];
 
-	for (uint32_t mipmapLevel = 1; mipmapLevel <= mipmapLevels; ++mipmapLevel)
+	for (uint32_t mipmapLevel = 0; mipmapLevel < mipmapLevels; ++mipmapLevel)
+		mipChain[mipmapLevel].store(NULL, std::memory_order_relaxed);
+
+	log2Size = 0.5f * log2((float) width * height);
+}
+
+Buffer* Texture::AllocateMipLevel(uint32_t mipLevel) const
+{
+	// Mip levels hold linear colors, they are filtered in linear space
+	Buffer* mipBuffer = new Buffer(new MemoryBufferAllocator(), Buffer::LINEAR);
+	mipBuffer->layout = layout;
+	mipBuffer->Allocate(width >> mipLevel, height >> mipLevel, encoding);
+
+	return mipBuffer;
+}
+
+Buffer* Texture::BuildMipLevel(uint32_t mipLevel)
+{
+	// Build the previous level first if it was never requested
+	const Buffer* previousLevel = GetMipLevel(mipLevel - 1);
+
+	// Lazy levels are built by the first thread that requests them, other threads wait until it's done
+	std::lock_guard<std::mutex> lock(mipChainMutex);
+
+	Buffer* mipBuffer = mipChain[mipLevel - 1].load(std::memory_order_acquire);
+
+	if (mipBuffer == NULL)
 	{
-		Buffer* mipBuffer = new Buffer(new MemoryBufferAllocator(), colorSpace);
-		mipBuffer->Allocate(width >> mipmapLevel, height >> mipmapLevel, encoding);
+		mipBuffer = AllocateMipLevel(mipLevel);
+		FilterMipLevel(*previousLevel, *mipBuffer, 0, mipBuffer->height);
+
+		mipChain[mipLevel - 1].store(mipBuffer, std::memory_order_release);
+	}
 
-		for (uint32_t y = 0; y < mipBuffer->height; ++y)
+	return mipBuffer;
+}
+
+void Texture::FilterMipLevel(const Buffer& previousLevel, Buffer& mipLevel, uint32_t beginRow, uint32_t endRow)
+{
+	// Two rows of the previous level and one row of the current level, decoded to linear colors
+	std::vector<Color> rows[2], mipRow;
+	std::vector<uchar> staging;
+
+	rows[0].resize(previousLevel.width);
+	rows[1].resize(previousLevel.width);
+	mipRow.resize(mipLevel.width);
+
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (uint32_t y = beginRow; y < endRow; ++y)
+	{
+		for (uint32_t rowIdx = 0; rowIdx < 2; ++rowIdx)
 		{
-			for (uint32_t x = 0; x < mipBuffer->width; ++x)
-			{
-				// Sample the four pixels used for this level evenly from the previous buffer
-				uint32_t baseX = x << 1;
-				uint32_t baseY = y << 1;
-				previousLevel->GetPixel(baseX, baseY, samples[0], colorSpace);
-				previousLevel->GetPixel(baseX + 1, baseY, samples[1], colorSpace);
-				previousLevel->GetPixel(baseX, baseY + 1, samples[2], colorSpace);
-				previousLevel->GetPixel(baseX + 1, baseY + 1, samples[3], colorSpace);
-
-				Color sample = (samples[0] + samples[1] + samples[2] + samples[3]) * 0.25f;
-				mipBuffer->SetPixel(x, y, sample, colorSpace);
-			}
+			const uchar* row = previousLevel.ReadRow((y << 1) + rowIdx, staging);
+			PixelConverter::Convert(row, previousLevel.encoding, previousLevel.colorSpace,
+				reinterpret_cast<uchar*>(&rows[rowIdx][0]), FLOAT128, mipLevel.colorSpace, previousLevel.width);
 		}
 
-		mipChain[mipmapLevel - 1] = mipBuffer;
-		previousLevel = mipBuffer;
+		// Average the four pixels used for this level evenly from the previous buffer
+		for (uint32_t x = 0; x < mipLevel.width; ++x)
+		{
+			uint32_t baseX = x << 1;
+
+			__m128 sample = _mm_add_ps(_mm_loadu_ps(rows[0][baseX].data()), _mm_loadu_ps(rows[0][baseX + 1].data()));
+			sample = _mm_add_ps(sample, _mm_loadu_ps(rows[1][baseX].data()));
+			sample = _mm_add_ps(sample, _mm_loadu_ps(rows[1][baseX + 1].data()));
+
+			_mm_storeu_ps(mipRow[x].data(), _mm_mul_ps(sample, quarter));
+		}
+
+		uchar* mipPixels = mipLevel.MapRow(y, staging);
+		PixelConverter::Encode(&mipRow[0], mipLevel.width, mipLevel.encoding, mipPixels);
+		mipLevel.WriteRow(y, mipPixels);
 	}
 }
 
+void Texture::AttachCache(TextureCache& cache, TiledTextureFile& tiledFile)
+{
+	Destroy();
+	DestroyMipChain();
+
+	const TiledTextureFile::Header& header = tiledFile.header;
+
+	width = header.width;
+	height = header.height;
+	encoding = (Encoding) header.encoding;
+	colorSpace = (ColorSpace) header.colorSpace;
+
+	bpp = GetEncodingDepth(encoding);
+	pixelStride = bpp / 8;
+	stride = width * pixelStride;
+	size = 0;
+
+	mipmapLevels = header.mipmapLevels;
+	log2Size = 0.5f * log2((float) width * height);
+
+	this->cache = &cache;
+	this->tiledFile = &tiledFile;
+}
+
+const uchar* Texture::ReadRow(uint32_t y, std::vector<uchar>& staging) const
+{
+	if (cache == NULL)
+		return Buffer::ReadRow(y, staging);
+
+	staging.resize(width * pixelStride);
+	cache->ReadRow(*tiledFile, 0, y, &staging[0]);
+
+	return &staging[0];
+}
+
 Buffer* Texture::GetMipLevel(uint32_t mipLevel)
 {
+	assert(cache == NULL && "The pixels of cached textures are fetched through the texture cache");
+
 	if (mipLevel > 0)
 	{
 		assert(mipLevel <= mipmapLevels && HasMipmaps());
-		return mipChain[mipLevel - 1];
+
+		Buffer* mipBuffer = mipChain[mipLevel - 1].load(std::memory_order_acquire);
+
+		if (mipBuffer == NULL)
+			mipBuffer = BuildMipLevel(mipLevel);
+
+		return mipBuffer;
 	}
 
 	return static_cast<Buffer*>(this);
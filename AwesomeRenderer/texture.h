@@ -7,12 +7,18 @@
 namespace AwesomeRenderer
 {
 	class BufferAllocator;
+	class Scheduler;
+	class TextureCache;
+	struct TiledTextureFile;
 
 	class Texture : public Buffer, public ExtensionProvider<Texture>
 	{
 	public:
 		static const uint32_t DEFAULT_MIPMAP_LEVELS = 5;
 
+		// Number of rows of a mip level filtered by a single job
+		static const uint32_t MIPMAP_JOB_ROWS = 32;
+
 		enum Extensions
 		{
 			TEXTURE_GL
@@ -21,17 +27,51 @@ namespace AwesomeRenderer
 	private:
 		uint32_t mipmapLevels;
 
-		Buffer** mipChain;
+		// Log2 of the square root of the texel count of the first level, the mip level offset of this texture
+		float log2Size;
+
+		// Levels of lazy mip chains are NULL until they are first requested
+		std::atomic<Buffer*>* mipChain;
+		std::mutex mipChainMutex;
+
+		// Set for textures whose pixels are streamed from a tiled file instead of being kept in memory
+		TextureCache* cache;
+		TiledTextureFile* tiledFile;
 
 	public:
 		Texture(BufferAllocator* allocator, ColorSpace colorSpace);
 		~Texture();
 
-		void GenerateMipMaps();
+		// Builds all mip levels. Rows of a level are filtered in parallel if a scheduler is given
+		void GenerateMipMaps(Scheduler* scheduler = NULL);
+
+		// Allocates the mip chain without building it, every level is built the first time it is requested
+		void GenerateMipMapsLazy();
+
 		Buffer* GetMipLevel(uint32_t mipLevel);
 		
 		uint32_t GetMipmapLevels() const { return mipmapLevels; }
-		bool HasMipmaps() const { return mipmapLevels > 0 && mipChain != NULL; }
+		float GetLog2Size() const { return log2Size; }
+		bool HasMipmaps() const { return mipmapLevels > 0 && (mipChain != NULL || cache != NULL); }
+
+		// Releases the pixels and mip levels, which are read from the tiled file by the cache from now on
+		void AttachCache(TextureCache& cache, TiledTextureFile& tiledFile);
+
+		bool IsCached() const { return cache != NULL; }
+		TextureCache* GetCache() const { return cache; }
+		TiledTextureFile* GetTiledFile() const { return tiledFile; }
+
+		// Same as Buffer::ReadRow, but also reads the first level of cached textures
+		const uchar* ReadRow(uint32_t y, std::vector<uchar>& staging) const;
+
+		// Box filters a band of rows of the previous level into a mip level
+		static void FilterMipLevel(const Buffer& previousLevel, Buffer& mipLevel, uint32_t beginRow, uint32_t endRow);
+
+	private:
+		void DestroyMipChain();
+
+		Buffer* AllocateMipLevel(uint32_t mipLevel) const;
+		Buffer* BuildMipLevel(uint32_t mipLevel);
 
 	};
 
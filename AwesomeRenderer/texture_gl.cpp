@@ -50,6 +50,8 @@ void TextureGL::Create()
 
 void TextureGL::Load()
 {	
+	assert(!provider.IsCached() && "Textures streamed through the texture cache can't be uploaded");
+
 	Bind();
 		
 	GLenum internalFormat;
@@ -59,9 +61,28 @@ void TextureGL::Load()
 
 	// Upload source image
 	GLint alignment = provider.alignment;
+	const uchar* pixels = provider.data;
+
+	// OpenGL expects rows of pixels, so tiled textures are uploaded from a linear copy
+	std::vector<uchar> linearPixels;
+
+	if (provider.layout != Buffer::LAYOUT_LINEAR)
+	{
+		linearPixels.resize(provider.width * provider.height * provider.pixelStride);
+
+		for (uint32_t y = 0; y < provider.height; ++y)
+		{
+			for (uint32_t x = 0; x < provider.width; ++x)
+				memcpy(&linearPixels[(y * provider.width + x) * provider.pixelStride], provider.GetBase(x, y), provider.pixelStride);
+		}
+
+		alignment = 1;
+		pixels = &linearPixels[0];
+	}
+
 	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
 
-	GL_CHECK_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, provider.width, provider.height, dataFormat, dataType, provider.data));
+	GL_CHECK_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, provider.width, provider.height, dataFormat, dataType, pixels));
 
 	// Generate mipmaps
 	GL_CHECK_ERROR(glGenerateMipmap(GL_TEXTURE_2D));
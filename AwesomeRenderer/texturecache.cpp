@@ -0,0 +1,385 @@
+#include "awesomerenderer.h"
+
+#include "texturecache.h"
+#include "texture.h"
+#include "statistics.h"
+#include "mappedfile.h"
+#include "pixelconverter.h"
+
+using namespace AwesomeRenderer;
+
+const char* TextureCache::FILE_EXTENSION = ".tiled";
+
+TextureCache::Shard::Shard() : residentBytes(0), hits(0), misses(0), evictions(0)
+{
+
+}
+
+TextureCache::TextureCache(uint64_t budget) : budget(budget)
+{
+
+}
+
+TextureCache::~TextureCache()
+{
+	for (auto it = files.begin(); it != files.end(); ++it)
+	{
+		fclose((*it)->handle);
+		delete *it;
+	}
+}
+
+bool TextureCache::WriteTiledFile(const std::string& fileName, const std::string& sourceFileName, Texture& texture)
+{
+	assert(!texture.IsCached() && texture.HasMipmaps());
+
+	TiledTextureFile::Header header;
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.encoding = texture.encoding;
+	header.colorSpace = texture.colorSpace;
+	header.mipmapLevels = texture.GetMipmapLevels();
+	header.tileSize = TILE_SIZE;
+
+	if (!MappedFile::GetFileInfo(sourceFileName.c_str(), header.sourceSize, header.sourceTime))
+		return false;
+
+	header.sourceHash = MappedFile::HashFile(sourceFileName.c_str());
+
+	FILE* filePtr;
+	errno_t result = fopen_s(&filePtr, fileName.c_str(), "wb");
+
+	if (result != 0)
+	{
+		printf("[TextureCache]: Failed to open file \"%s\". Error code: %d\n", fileName.c_str(), result);
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, filePtr);
+
+	uint32_t pixelStride = texture.pixelStride;
+	std::vector<uchar> band, staging;
+
+	for (uint32_t level = 0; level <= header.mipmapLevels; ++level)
+	{
+		const Buffer& buffer = *texture.GetMipLevel(level);
+
+		uint32_t horizontalTiles = (buffer.width + TILE_SIZE - 1) / TILE_SIZE;
+		uint32_t verticalTiles = (buffer.height + TILE_SIZE - 1) / TILE_SIZE;
+
+		// Tiles are written a band of rows at a time, the padding of the edge tiles is zeroed
+		band.resize(horizontalTiles * TILE_SIZE * TILE_SIZE * pixelStride);
+
+		for (uint32_t tileY = 0; tileY < verticalTiles; ++tileY)
+		{
+			std::fill(band.begin(), band.end(), 0);
+
+			for (uint32_t row = 0; row < TILE_SIZE && tileY * TILE_SIZE + row < buffer.height; ++row)
+			{
+				const uchar* pixels = buffer.ReadRow(tileY * TILE_SIZE + row, staging);
+
+				for (uint32_t tileX = 0; tileX < horizontalTiles; ++tileX)
+				{
+					uint32_t tileWidth = std::min(TILE_SIZE, buffer.width - tileX * TILE_SIZE);
+					uchar* tileRow = &band[(tileX * TILE_SIZE * TILE_SIZE + row * TILE_SIZE) * pixelStride];
+
+					memcpy(tileRow, pixels + tileX * TILE_SIZE * pixelStride, tileWidth * pixelStride);
+				}
+			}
+
+			fwrite(&band[0], 1, band.size(), filePtr);
+		}
+	}
+
+	bool success = ferror(filePtr) == 0;
+	success = fclose(filePtr) == 0 && success;
+
+	if (!success)
+	{
+		printf("[TextureCache]: Failed to write file \"%s\"\n", fileName.c_str());
+		remove(fileName.c_str());
+	}
+
+	return success;
+}
+
+bool TextureCache::Attach(const std::string& fileName, const std::string& sourceFileName, Texture& texture)
+{
+	uint64_t sourceSize, sourceTime, fileSize, fileTime;
+
+	if (!MappedFile::GetFileInfo(sourceFileName.c_str(), sourceSize, sourceTime) || !MappedFile::GetFileInfo(fileName.c_str(), fileSize, fileTime))
+		return false;
+
+	FILE* filePtr;
+	errno_t result = fopen_s(&filePtr, fileName.c_str(), "rb");
+
+	if (result != 0)
+		return false;
+
+	TiledTextureFile* file = new TiledTextureFile();
+	file->handle = filePtr;
+
+	TiledTextureFile::Header& header = file->header;
+	const char* error = NULL;
+
+	if (fread(&header, sizeof(header), 1, filePtr) != 1 || header.magic != FILE_MAGIC || header.version != FILE_VERSION || header.tileSize != TILE_SIZE || header.mipmapLevels >= 32)
+		error = "invalid";
+	// The timestamp also changes when a file is copied or checked out, in that case the hash decides whether the contents changed
+	else if (header.sourceSize != sourceSize || (header.sourceTime != sourceTime && header.sourceHash != MappedFile::HashFile(sourceFileName.c_str())))
+		error = "outdated";
+	else if (texture.data != NULL && (header.width != texture.width || header.height != texture.height || header.encoding != texture.encoding))
+		error = "made for a texture with different dimensions or encoding";
+
+	if (error == NULL)
+	{
+		file->pixelStride = Buffer::GetEncodingDepth((Buffer::Encoding) header.encoding) / 8;
+		file->tileBytes = TILE_SIZE * TILE_SIZE * file->pixelStride;
+
+		// The levels are stored in order, with the same dimensions as the mip levels of a texture
+		uint64_t offset = sizeof(header);
+
+		for (uint32_t levelIdx = 0; levelIdx <= header.mipmapLevels; ++levelIdx)
+		{
+			TiledTextureFile::Level level;
+			level.width = header.width >> levelIdx;
+			level.height = header.height >> levelIdx;
+			level.horizontalTiles = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+			level.verticalTiles = (level.height + TILE_SIZE - 1) / TILE_SIZE;
+			level.colorSpace = levelIdx == 0 ? (Buffer::ColorSpace) header.colorSpace : Buffer::LINEAR;
+			level.offset = offset;
+
+			file->levels.push_back(level);
+
+			offset += (uint64_t) level.horizontalTiles * level.verticalTiles * file->tileBytes;
+		}
+
+		if (fileSize < offset)
+			error = "truncated";
+	}
+
+	if (error != NULL)
+	{
+		printf("[TextureCache]: Tiled texture file \"%s\" is %s\n", fileName.c_str(), error);
+
+		fclose(filePtr);
+		delete file;
+
+		return false;
+	}
+
+	if (header.sourceTime != sourceTime)
+	{
+		// Files opened with fopen_s aren't shared, so the read handle is closed while the header is rewritten
+		fclose(filePtr);
+		UpdateSourceTime(fileName, header, sourceTime);
+
+		if (fopen_s(&filePtr, fileName.c_str(), "rb") != 0)
+		{
+			printf("[TextureCache]: Failed to reopen tiled texture file \"%s\"\n", fileName.c_str());
+
+			delete file;
+			return false;
+		}
+
+		file->handle = filePtr;
+	}
+
+	filesMutex.lock();
+
+	// Tile keys have room for 16 bits of file ids
+	assert(files.size() < (1 << 16));
+
+	file->id = files.size();
+	files.push_back(file);
+
+	filesMutex.unlock();
+
+	texture.AttachCache(*this, *file);
+
+	return true;
+}
+
+void TextureCache::UpdateSourceTime(const std::string& fileName, TiledTextureFile::Header& header, uint64_t sourceTime)
+{
+	// Only the timestamp of the source changed, storing it saves hashing the source again on the next run
+	FILE* filePtr;
+
+	if (fopen_s(&filePtr, fileName.c_str(), "r+b") != 0)
+		return;
+
+	header.sourceTime = sourceTime;
+
+	fwrite(&header, sizeof(header), 1, filePtr);
+	fclose(filePtr);
+}
+
+TextureCache::TileRef TextureCache::GetTile(TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY)
+{
+	uint64_t key = GetKey(file, level, tileX, tileY);
+	Shard& shard = GetShard(key);
+
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.lookup.find(key);
+
+		if (it != shard.lookup.end())
+		{
+			// Move the tile to the front of the list
+			shard.tiles.splice(shard.tiles.begin(), shard.tiles, it->second);
+			++shard.hits;
+
+			AR_COUNT(TEXTURE_CACHE_HITS, 1);
+
+			return it->second->second;
+		}
+
+		++shard.misses;
+	}
+
+	AR_COUNT(TEXTURE_CACHE_MISSES, 1);
+
+	// Load the tile without holding the lock of the shard, so that other threads can still use it
+	TileRef tile = LoadTile(file, level, tileX, tileY);
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	// Another thread could have loaded the same tile in the meantime
+	auto it = shard.lookup.find(key);
+
+	if (it != shard.lookup.end())
+		return it->second->second;
+
+	shard.tiles.emplace_front(key, tile);
+	shard.lookup[key] = shard.tiles.begin();
+	shard.residentBytes += tile->pixels.size();
+
+	// Evict the least recently used tiles, but always keep the tile that was just loaded
+	while (shard.residentBytes > budget / SHARD_COUNT && shard.tiles.size() > 1)
+	{
+		const std::pair<uint64_t, TileRef>& evicted = shard.tiles.back();
+
+		shard.residentBytes -= evicted.second->pixels.size();
+		shard.lookup.erase(evicted.first);
+		shard.tiles.pop_back();
+
+		++shard.evictions;
+	}
+
+	return tile;
+}
+
+void TextureCache::GetFootprint(TiledTextureFile& file, uint32_t level, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, Color texels[4])
+{
+	const TiledTextureFile::Level& levelInfo = file.levels[level];
+	const uint32_t coordinates[4][2] = { { x0, y0 }, { x1, y0 }, { x0, y1 }, { x1, y1 } };
+
+	// 8-bit channels are converted through the same tables as the texels of in-memory textures
+	Buffer::Encoding encoding = (Buffer::Encoding) file.header.encoding;
+	bool byteChannels = encoding == Buffer::RGB24 || encoding == Buffer::BGR24 || encoding == Buffer::RGBA32 || encoding == Buffer::BGRA32;
+
+	const float* colorTable = PixelConverter::GetDecodeTable(levelInfo.colorSpace);
+	const float* alphaTable = PixelConverter::GetDecodeTable(Buffer::LINEAR);
+
+	uint32_t red = encoding == Buffer::BGR24 || encoding == Buffer::BGRA32 ? 2 : 0;
+	uint32_t blue = 2 - red;
+
+	// Footprints mostly fall within a single tile, so the last tile is reused when possible
+	TileRef tile;
+	uint32_t tileX = UINT32_MAX, tileY = UINT32_MAX;
+
+	for (uint32_t texelIdx = 0; texelIdx < 4; ++texelIdx)
+	{
+		uint32_t x = coordinates[texelIdx][0];
+		uint32_t y = coordinates[texelIdx][1];
+
+		if (x / TILE_SIZE != tileX || y / TILE_SIZE != tileY)
+		{
+			tileX = x / TILE_SIZE;
+			tileY = y / TILE_SIZE;
+			tile = GetTile(file, level, tileX, tileY);
+		}
+
+		const uchar* pixel = &tile->pixels[((y % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE)) * file.pixelStride];
+
+		Color& texel = texels[texelIdx];
+
+		if (byteChannels)
+		{
+			texel = Color(colorTable[pixel[red]], colorTable[pixel[1]], colorTable[pixel[blue]], file.pixelStride == 4 ? alphaTable[pixel[3]] : 1.0f);
+			continue;
+		}
+
+		texel = Color();
+		Buffer::DecodeColor(pixel, encoding, texel);
+
+		if (levelInfo.colorSpace == Buffer::GAMMA)
+			Buffer::AdjustGamma(texel, Buffer::DEFAULT_GAMMA);
+	}
+}
+
+void TextureCache::ReadRow(TiledTextureFile& file, uint32_t level, uint32_t y, uchar* pixels)
+{
+	const TiledTextureFile::Level& levelInfo = file.levels[level];
+
+	uint32_t tileY = y / TILE_SIZE;
+	uint32_t row = y % TILE_SIZE;
+
+	for (uint32_t tileX = 0; tileX < levelInfo.horizontalTiles; ++tileX)
+	{
+		TileRef tile = GetTile(file, level, tileX, tileY);
+		uint32_t tileWidth = std::min(TILE_SIZE, levelInfo.width - tileX * TILE_SIZE);
+
+		memcpy(pixels + tileX * TILE_SIZE * file.pixelStride, &tile->pixels[row * TILE_SIZE * file.pixelStride], tileWidth * file.pixelStride);
+	}
+}
+
+void TextureCache::GetStatistics(Statistics& statistics)
+{
+	memset(&statistics, 0, sizeof(statistics));
+
+	for (uint32_t shardIdx = 0; shardIdx < SHARD_COUNT; ++shardIdx)
+	{
+		Shard& shard = shards[shardIdx];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		statistics.hits += shard.hits;
+		statistics.misses += shard.misses;
+		statistics.evictions += shard.evictions;
+		statistics.residentBytes += shard.residentBytes;
+		statistics.residentTiles += shard.tiles.size();
+	}
+}
+
+TextureCache::Shard& TextureCache::GetShard(uint64_t key)
+{
+	// Neighbouring tiles only differ in the low bits of the key, mix them into the bits that select the shard
+	uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+
+	return shards[(hash >> 32) % SHARD_COUNT];
+}
+
+uint64_t TextureCache::GetKey(const TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY)
+{
+	return ((uint64_t) file.id << 48) | ((uint64_t) level << 44) | ((uint64_t) tileY << 22) | tileX;
+}
+
+TextureCache::TileRef TextureCache::LoadTile(TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY)
+{
+	const TiledTextureFile::Level& levelInfo = file.levels[level];
+	assert(tileX < levelInfo.horizontalTiles && tileY < levelInfo.verticalTiles);
+
+	std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+	tile->pixels.resize(file.tileBytes);
+
+	uint64_t offset = levelInfo.offset + ((uint64_t) tileY * levelInfo.horizontalTiles + tileX) * file.tileBytes;
+
+	std::lock_guard<std::mutex> lock(file.mutex);
+
+	if (_fseeki64(file.handle, (int64_t) offset, SEEK_SET) != 0 || fread(&tile->pixels[0], 1, file.tileBytes, file.handle) != file.tileBytes)
+		printf("[TextureCache]: Failed to read tile %u, %u of level %u\n", tileX, tileY, level);
+
+	return tile;
+}
\ No newline at end of file
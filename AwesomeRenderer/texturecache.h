@@ -0,0 +1,142 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include "awesomerenderer.h"
+#include "buffer.h"
+
+namespace AwesomeRenderer
+{
+	class Texture;
+
+	// Tiles of all mip levels of a texture, stored in a preprocessed file. Every tile has the same size, so its offset in the file
+	// follows from its coordinates. Tiles on the right and top edge are padded.
+	struct TiledTextureFile
+	{
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+
+			uint32_t width, height;
+			uint32_t encoding, colorSpace;
+			uint32_t mipmapLevels;
+			uint32_t tileSize;
+
+			// Identifies the source image that the file was created from
+			uint64_t sourceSize;
+			uint64_t sourceTime;
+			uint64_t sourceHash;
+		};
+
+		struct Level
+		{
+			uint32_t width, height;
+			uint32_t horizontalTiles, verticalTiles;
+
+			// Mip levels are stored in linear color space, only the first level uses the color space of the texture
+			Buffer::ColorSpace colorSpace;
+
+			uint64_t offset;
+		};
+
+		Header header;
+		std::vector<Level> levels;
+
+		uint32_t id;
+		uint32_t pixelStride, tileBytes;
+
+		// Reads are serialized since they share the file position
+		FILE* handle;
+		std::mutex mutex;
+	};
+
+	// Keeps the tiles of textures that are streamed from tiled files in memory, within a fixed memory budget. Tiles are loaded
+	// the first time they are sampled, and the least recently used tiles are evicted to make room for new ones.
+	// The cache is split in shards with their own lock and their own share of the budget, so that threads sampling different
+	// tiles rarely wait on each other.
+	class TextureCache
+	{
+	public:
+		static const uint32_t TILE_SIZE = 64;
+		static const uint32_t SHARD_COUNT = 16;
+
+		static const uint32_t FILE_MAGIC = 0x43545241; // "ARTC"
+		static const uint32_t FILE_VERSION = 2;
+
+		// Extension appended to the file name of the source image
+		static const char* FILE_EXTENSION;
+
+		struct Tile
+		{
+			std::vector<uchar> pixels;
+		};
+
+		// Tiles are shared with the threads sampling them, so evicted tiles stay valid until they are released
+		typedef std::shared_ptr<const Tile> TileRef;
+
+		struct Statistics
+		{
+			uint64_t hits, misses, evictions;
+
+			uint64_t residentBytes;
+			uint32_t residentTiles;
+		};
+
+	private:
+		struct Shard
+		{
+			std::mutex mutex;
+
+			// Most recently used tile first
+			std::list<std::pair<uint64_t, TileRef>> tiles;
+			std::unordered_map<uint64_t, std::list<std::pair<uint64_t, TileRef>>::iterator> lookup;
+
+			uint64_t residentBytes;
+			uint64_t hits, misses, evictions;
+
+			Shard();
+		};
+
+		uint64_t budget;
+
+		Shard shards[SHARD_COUNT];
+
+		std::vector<TiledTextureFile*> files;
+		std::mutex filesMutex;
+
+	public:
+		// The budget is the maximum number of bytes of tile data kept in memory
+		TextureCache(uint64_t budget);
+		~TextureCache();
+
+		// Writes all levels of a texture with mip maps to a tiled file, the file is removed if writing fails
+		static bool WriteTiledFile(const std::string& fileName, const std::string& sourceFileName, Texture& texture);
+
+		// Opens a tiled file and streams the pixels of the texture from it. The texture only keeps the dimensions and encoding.
+		// Fails if the file is invalid or truncated, if the source image changed after the file was written, or if the texture
+		// already has pixels with different dimensions or encoding.
+		bool Attach(const std::string& fileName, const std::string& sourceFileName, Texture& texture);
+
+		TileRef GetTile(TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY);
+
+		// Fetches the texels of a footprint in linear color space, in the order (x0, y0), (x1, y0), (x0, y1), (x1, y1)
+		void GetFootprint(TiledTextureFile& file, uint32_t level, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, Color texels[4]);
+
+		// Copies a row of pixels of a level, in the encoding of the texture
+		void ReadRow(TiledTextureFile& file, uint32_t level, uint32_t y, uchar* pixels);
+
+		void GetStatistics(Statistics& statistics);
+		uint64_t GetBudget() const { return budget; }
+
+	private:
+		Shard& GetShard(uint64_t key);
+
+		static void UpdateSourceTime(const std::string& fileName, TiledTextureFile::Header& header, uint64_t sourceTime);
+
+		static uint64_t GetKey(const TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY);
+
+		TileRef LoadTile(TiledTextureFile& file, uint32_t level, uint32_t tileX, uint32_t tileY);
+	};
+}
+
+#endif
\ No newline at end of file
@@ -3,11 +3,13 @@
 #include "texturefactory.h"
 #include "memorybufferallocator.h"
 #include "sampler.h"
+#include "pixelconverter.h"
+#include "texturecache.h"
 #include "lodepng\lodepng.h"
 
 using namespace AwesomeRenderer;
 
-TextureFactory::TextureFactory()
+TextureFactory::TextureFactory() : textureLayout(Buffer::LAYOUT_TILED), mipmapMode(MIPMAPS_EAGER), scheduler(NULL), textureCache(NULL)
 {
 	AddLoadFunction("bmp", &TextureFactory::LoadBMP);
 	AddLoadFunction("png", &TextureFactory::LoadPNG);
@@ -48,6 +50,9 @@ bool TextureFactory::LoadRAW(const std::string& fileName, Buffer& buffer) const
 
 bool TextureFactory::LoadBMP(const std::string& fileName, Texture** texture) const
 {
+	if (LoadTiled(fileName, texture))
+		return true;
+
 	(*texture)->Destroy();
 		
 	BmpFileHeader fileHeader;
@@ -126,6 +131,9 @@ bool TextureFactory::LoadBMP(const std::string& fileName, Texture** texture) con
 
 bool TextureFactory::LoadPNG(const std::string& fileName, Texture** texture) const
 {
+	if (LoadTiled(fileName, texture))
+		return true;
+
 	(*texture)->Destroy();
 
 	// Load the file from disk
@@ -166,9 +174,42 @@ bool TextureFactory::LoadPNG(const std::string& fileName, Texture** texture) con
 	return true;
 }
 
-void TextureFactory::PostProcessAsset(Texture* instance)
+void TextureFactory::PostProcessAsset(const std::string& fileName, Texture* instance)
+{
+	if (instance->IsCached())
+		return;
+
+	if (textureCache == NULL)
+	{
+		// Mip levels are allocated with the layout of the texture
+		instance->SetLayout(textureLayout);
+		GenerateMipMaps(instance);
+
+		return;
+	}
+
+	// The tiled file contains all mip levels
+	std::string tiledFileName = fileName + TextureCache::FILE_EXTENSION;
+	instance->GenerateMipMaps(scheduler);
+
+	if (!TextureCache::WriteTiledFile(tiledFileName, fileName, *instance) || !textureCache->Attach(tiledFileName, fileName, *instance))
+		printf("[TextureFactory]: Failed to create tiled file for \"%s\", the texture is kept in memory\n", fileName.c_str());
+}
+
+bool TextureFactory::LoadTiled(const std::string& fileName, Texture** texture) const
+{
+	if (textureCache == NULL)
+		return false;
+
+	return textureCache->Attach(fileName + TextureCache::FILE_EXTENSION, fileName, **texture);
+}
+
+void TextureFactory::GenerateMipMaps(Texture* texture)
 {
-	instance->GenerateMipMaps();
+	if (mipmapMode == MIPMAPS_LAZY)
+		texture->GenerateMipMapsLazy();
+	else
+		texture->GenerateMipMaps(scheduler);
 }
 
 Sampler* TextureFactory::GetTexture(const std::string& fileName)
@@ -200,22 +241,23 @@ Texture* TextureFactory::MergeAlphaChannel(const Texture* albedo, const Texture*
 	if (!Allocate(&target))
 		return NULL;
 
+	target->SetLayout(textureLayout);
 	target->AllocateAligned(albedo->width, albedo->height, albedo->alignment, Texture::RGBA32);
 
+	std::vector<Color> albedoColors(albedo->width), alphaColors(albedo->width);
+	std::vector<uchar> staging, targetStaging;
+
 	for (uint32_t y = 0; y < albedo->height; ++y)
 	{
-		for (uint32_t x = 0; x < albedo->width; ++x)
-		{
-			Color albedoColor;
-			albedo->GetPixel(x, y, albedoColor);
-
-			Color alphaColor;
-			alpha->GetPixel(x, y, alphaColor);
+		PixelConverter::Decode(albedo->ReadRow(y, staging), albedo->encoding, albedo->width, &albedoColors[0]);
+		PixelConverter::Decode(alpha->ReadRow(y, staging), alpha->encoding, alpha->width, &alphaColors[0]);
 
-			albedoColor[3] = alphaColor[0];
+		for (uint32_t x = 0; x < albedo->width; ++x)
+			albedoColors[x][3] = alphaColors[x][0];
 
-			target->SetPixel(x, y, albedoColor);
-		}
+		uchar* row = target->MapRow(y, targetStaging);
+		PixelConverter::Encode(&albedoColors[0], albedo->width, target->encoding, row);
+		target->WriteRow(y, row);
 	}
 
 	return target;
@@ -229,27 +271,39 @@ Texture* TextureFactory::ConvertHeightMapToNormalMap(const Texture* heightMap, f
 		return NULL;
 
 	target->colorSpace = Buffer::LINEAR;
+	target->SetLayout(textureLayout);
 	target->AllocateAligned(heightMap->width, heightMap->height, heightMap->alignment, Texture::RGB24);
 
+	int32_t width = heightMap->width, height = heightMap->height;
+
+	// Heights of every pixel, read from the red channel
+	std::vector<float> heights(width * height);
+	std::vector<Color> colors(width);
+	std::vector<uchar> staging, targetStaging;
+
+	for (int32_t y = 0; y < height; ++y)
+	{
+		PixelConverter::Decode(heightMap->ReadRow(y, staging), heightMap->encoding, width, &colors[0]);
+
+		for (int32_t x = 0; x < width; ++x)
+			heights[y * width + x] = colors[x][0] - 0.5f;
+	}
+
 	float s[9];
 
-	for (int32_t y = 0; y < heightMap->height; ++y)
+	for (int32_t y = 0; y < height; ++y)
 	{
-		for (int32_t x = 0; x < heightMap->width; ++x)
+		for (int32_t x = 0; x < width; ++x)
 		{
 			// Read all samples for the 3x3 convolution kernel
 			for (int32_t yOffset = -1; yOffset <= 1; ++yOffset)
 			{
 				for (int32_t xOffset = -1; xOffset <= 1; ++xOffset)
 				{
-					uint32_t sampleX = Util::Clamp(x + xOffset, 0, (int) heightMap->width - 1);
-					uint32_t sampleY = Util::Clamp(y + yOffset, 0, (int) heightMap->height - 1);
+					uint32_t sampleX = Util::Clamp(x + xOffset, 0, width - 1);
+					uint32_t sampleY = Util::Clamp(y + yOffset, 0, height - 1);
 
-					Color heightMapColor;
-					heightMap->GetPixel(sampleX, sampleY, heightMapColor);
-
-					// Use the red channel as height source
-					s[(yOffset + 1) * 3 + (xOffset + 1)] = heightMapColor[0] - 0.5f;
+					s[(yOffset + 1) * 3 + (xOffset + 1)] = heights[sampleY * width + sampleX];
 				}
 			}
 
@@ -265,9 +319,12 @@ Texture* TextureFactory::ConvertHeightMapToNormalMap(const Texture* heightMap, f
 			normal[1] = 0.5f + normal[1] / 2.0f;
 			normal[2] = 0.5f + normal[2] / 2.0f;
 
-			target->SetPixel(x, y, Color(normal));
+			colors[x] = Color(normal);
 		}
 
+		uchar* row = target->MapRow(y, targetStaging);
+		PixelConverter::Encode(&colors[0], width, target->encoding, row);
+		target->WriteRow(y, row);
 	}
 
 	return target;
@@ -318,4 +375,51 @@ void TextureFactory::WriteBMP(const std::string& fileName, const Buffer& buffer)
 	fwrite(buffer.GetBase(0, 0), 1, buffer.size, filePtr);
 
 	fclose(filePtr);
+}
+
+bool TextureFactory::WritePNG(const std::string& fileName, const Buffer& buffer) const
+{
+	// PNG images are stored gamma corrected, HDR buffers are tonemapped
+	bool tonemap = buffer.encoding == Buffer::FLOAT96 || buffer.encoding == Buffer::FLOAT128;
+
+	// Convert the buffer without row padding, PNG rows go from top to bottom so the row order is reversed
+	const uint32_t rowSize = buffer.width * 3;
+	std::vector<uchar> image(rowSize * buffer.height);
+	std::vector<uchar> staging;
+
+	for (uint32_t y = 0; y < buffer.height; ++y)
+	{
+		PixelConverter::Convert(buffer.ReadRow(y, staging), buffer.encoding, buffer.colorSpace,
+			&image[(buffer.height - 1 - y) * rowSize], Buffer::RGB24, Buffer::GAMMA, buffer.width, tonemap);
+	}
+
+	uint32_t error = lodepng::encode(fileName, image, buffer.width, buffer.height, LCT_RGB, 8);
+
+	if (error)
+	{
+		printf("[TextureFactory]: Error while writing PNG (%d): %s\n", error, lodepng_error_text(error));
+		return false;
+	}
+
+	return true;
+}
+
+bool TextureFactory::WriteRAW(const std::string& fileName, const Buffer& buffer) const
+{
+	FILE* filePtr;
+
+	// Open filename in write binary mode 
+	errno_t result = fopen_s(&filePtr, fileName.c_str(), "wb");
+
+	if (result != 0)
+	{
+		printf("[TextureFactory]: Failed to open file \"%s\". Error code: %d\n", fileName.c_str(), result);
+		return false;
+	}
+
+	uint32_t writtenBytes = fwrite(buffer.GetBase(0, 0), 1, buffer.size, filePtr);
+
+	fclose(filePtr);
+
+	return writtenBytes == buffer.size;
 }
\ No newline at end of file
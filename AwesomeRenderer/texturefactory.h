@@ -9,6 +9,8 @@ namespace AwesomeRenderer
 {
 	class Texture;
 	class Sampler;
+	class Scheduler;
+	class TextureCache;
 
 	class TextureFactory : public Factory<TextureFactory, Texture>
 	{
@@ -44,6 +46,25 @@ namespace AwesomeRenderer
 		};
 #pragma pack(pop)
 
+		enum MipmapMode
+		{
+			MIPMAPS_EAGER,		// All mip levels are built when the texture is loaded
+			MIPMAPS_LAZY,		// Mip levels are built the first time they are sampled
+		};
+
+	public:
+		// Layout of the loaded textures, tiled textures are faster to sample by the ray tracer and software renderer
+		Buffer::Layout textureLayout;
+
+		MipmapMode mipmapMode;
+
+		// If set, mip levels are built in parallel on the scheduler
+		Scheduler* scheduler;
+
+		// If set, loaded textures are converted to tiled files once and streamed through the cache instead of kept in memory.
+		// Tiled files are written next to the source image, and have to be removed when the image changes.
+		TextureCache* textureCache;
+
 	public:
 
 		TextureFactory();
@@ -51,11 +72,18 @@ namespace AwesomeRenderer
 		Sampler* GetTexture(const std::string& fileName);
 
 		Sampler* CreateSampler(Texture* texture);
+
+		// Sets up the mip chain of a texture according to the mipmap mode
+		void GenerateMipMaps(Texture* texture);
 		
 		Texture* MergeAlphaChannel(const Texture* albedo, const Texture* alpha);
 		Texture* ConvertHeightMapToNormalMap(const Texture* heightMap, float scale = 1.0f);
 
 		void WriteBMP(const std::string& fileName, const Buffer& buffer) const;
+		bool WritePNG(const std::string& fileName, const Buffer& buffer) const;
+
+		// Writes the pixel data of the buffer without a header, in the buffer's encoding
+		bool WriteRAW(const std::string& fileName, const Buffer& buffer) const;
 
 		bool LoadRAW(const std::string& fileName, Buffer& buffer) const;
 
@@ -65,7 +93,10 @@ namespace AwesomeRenderer
 		bool LoadBMP(const std::string& fileName, Texture** texture) const;
 		bool LoadPNG(const std::string& fileName, Texture** texture) const;
 
-		void PostProcessAsset(Texture* instance);
+		void PostProcessAsset(const std::string& fileName, Texture* instance);
+
+		// Attaches the texture to the texture cache if a tiled file was created for it before
+		bool LoadTiled(const std::string& fileName, Texture** texture) const;
 	};
 
 }
@@ -23,6 +23,13 @@ void Counter::Reset()
 	m.unlock();
 }
 
+void Counter::Increment()
+{
+	m.lock();
+	++count;
+	m.unlock();
+}
+
 void Counter::Decrement()
 {
 	m.lock();
@@ -47,6 +47,7 @@ namespace AwesomeRenderer
 		void Configure(uint32_t count, uint32_t maxCount);
 
 		void Reset();
+		void Increment();
 		void Decrement();
 		void WaitZero();
 	};
@@ -41,10 +41,10 @@ const Matrix44& Transformation::LocalMtx() const
 	return localMtx;
 }
 
-void Transformation::CalculateMtx()
+bool Transformation::CalculateMtx()
 {
 	if (!dirty)
-		return;
+		return false;
 
 	Matrix44 t, r, s;
 	cml::matrix_translation(t, position);
@@ -62,4 +62,6 @@ void Transformation::CalculateMtx()
 	worldMtx = localMtx * parentMtx;
 
 	dirty = false;
+
+	return true;
 }
\ No newline at end of file
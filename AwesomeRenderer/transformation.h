@@ -59,7 +59,10 @@ namespace AwesomeRenderer
 		const Matrix44& WorldMtx() const;
 		const Matrix44& LocalMtx() const;
 
-		void CalculateMtx();
+		// Recalculates the matrices if the transformation changed since the last call, returns whether it did
+		bool CalculateMtx();
+
+		bool IsDirty() const { return dirty; }
 	};
 
 }
@@ -120,6 +120,73 @@ namespace AwesomeRenderer
 			}
 		}
 
+		// Calculates the bounds of the part of the triangle inside a box, by clipping it against every side of the box.
+		// Returns false if the triangle lies outside the box
+		bool CalculateClippedBounds(const VectorType& boxLower, const VectorType& boxUpper, VectorType& lower, VectorType& upper) const
+		{
+			// Every side of the box adds at most one vertex to the polygon
+			const int MAX_VERTICES = 3 + 2 * VectorType::dimension;
+
+			VectorType polygons[2][MAX_VERTICES];
+			int vertexCount = 3;
+			int current = 0;
+
+			for (int cVertex = 0; cVertex < 3; ++cVertex)
+				polygons[0][cVertex] = v[cVertex];
+
+			for (int i = 0; i < 2 * VectorType::dimension; ++i)
+			{
+				int axis = i / 2;
+				float plane = (i & 1) ? boxUpper[axis] : boxLower[axis];
+				float sign = (i & 1) ? -1.0f : 1.0f;
+
+				const VectorType* input = polygons[current];
+				VectorType* output = polygons[1 - current];
+				int outputCount = 0;
+
+				for (int cVertex = 0; cVertex < vertexCount; ++cVertex)
+				{
+					const VectorType& a = input[cVertex];
+					const VectorType& b = input[(cVertex + 1) % vertexCount];
+
+					float distanceA = sign * (a[axis] - plane);
+					float distanceB = sign * (b[axis] - plane);
+
+					if (distanceA >= 0.0f)
+						output[outputCount++] = a;
+
+					// Add the intersection with the plane if the edge crosses it
+					if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+					{
+						VectorType intersection = a + (b - a) * (distanceA / (distanceA - distanceB));
+						intersection[axis] = plane;
+
+						output[outputCount++] = intersection;
+					}
+				}
+
+				vertexCount = outputCount;
+				current = 1 - current;
+
+				if (vertexCount == 0)
+					return false;
+			}
+
+			for (int i = 0; i < VectorType::dimension; ++i)
+			{
+				lower[i] = FLT_MAX;
+				upper[i] = -FLT_MAX;
+
+				for (int cVertex = 0; cVertex < vertexCount; ++cVertex)
+				{
+					lower[i] = std::min(polygons[current][cVertex][i], lower[i]);
+					upper[i] = std::max(polygons[current][cVertex][i], upper[i]);
+				}
+			}
+
+			return true;
+		}
+
 		static float Area(const VectorType& v0, const VectorType& v1, const VectorType& v2)
 		{
 			/*
@@ -48,6 +48,31 @@ void Triangle3D::Transform(const Matrix44& mtx)
 }
 
 bool Triangle3D::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const
+{
+	float t;
+	Vector3 barycentricCoords;
+
+	if (!CalculateIntersection(ray, maxDistance, t, barycentricCoords))
+		return false;
+
+	// Fill the hit info struct with gathered data
+	hitInfo.point = ray.origin + t * ray.direction;
+	hitInfo.distance = t;
+	hitInfo.normal = normal;
+	hitInfo.barycentricCoords = barycentricCoords;
+
+	return true;
+}
+
+bool Triangle3D::Occluded(const Ray& ray, float maxDistance) const
+{
+	float t;
+	Vector3 barycentricCoords;
+
+	return CalculateIntersection(ray, maxDistance, t, barycentricCoords);
+}
+
+bool Triangle3D::CalculateIntersection(const Ray& ray, float maxDistance, float& t, Vector3& barycentricCoords) const
 {
 	float dot = VectorUtil<3>::Dot(normal, ray.direction);
 
@@ -62,7 +87,7 @@ bool Triangle3D::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDist
 	if (distanceToPlane < 0.0f)
 		return false;
 
-	float t = distanceToPlane / -dot;
+	t = distanceToPlane / -dot;
 
 	if (t > maxDistance)
 		return false;
@@ -83,11 +108,7 @@ bool Triangle3D::IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDist
 	if (u < 0.0f || v < 0.0f || u + v > 1.0f)
 		return false;
 
-	// Fill the hit info struct with gathered data
-	hitInfo.point = pointOnPlane;
-	hitInfo.distance = t;
-	hitInfo.normal = normal;
-	hitInfo.barycentricCoords.set(1.0f - u - v, u, v);
+	barycentricCoords.set(1.0f - u - v, u, v);
 
 	return true;
 }
@@ -122,6 +143,17 @@ void Triangle3D::CalculateBounds(AABB& bounds) const
 	bounds.Initialize(lower, upper);
 }
 
+bool Triangle3D::CalculateClippedBounds(const AABB& box, AABB& bounds) const
+{
+	Vector3 lower, upper;
+	if (!CalculateClippedBounds(box.Min(), box.Max(), lower, upper))
+		return false;
+
+	bounds.Initialize(lower, upper);
+
+	return true;
+}
+
 float Triangle3D::Area() const
 {
 	float b = v1.length();
@@ -15,6 +15,8 @@ namespace AwesomeRenderer
 	{
 		using Triangle<Vector3>::CalculateBounds;
 		using Primitive::CalculateBounds;
+		using Triangle<Vector3>::CalculateClippedBounds;
+		using Primitive::CalculateClippedBounds;
 
 	public:
 		// Normal vector for this triangle (world space)
@@ -34,12 +36,17 @@ namespace AwesomeRenderer
 		void Transform(const Matrix44& mtx);
 
 		bool IntersectRay(const Ray& ray, RaycastHit& hitInfo, float maxDistance) const;
+		bool Occluded(const Ray& ray, float maxDistance) const;
 
 		int SideOfPlane(const Plane& plane) const;
 		int SideOfAAPlane(int axis, float position) const;
 
 		void CalculateBounds(AABB& bounds) const;
+		bool CalculateClippedBounds(const AABB& box, AABB& bounds) const;
 		float Area() const;
+
+	private:
+		bool CalculateIntersection(const Ray& ray, float maxDistance, float& t, Vector3& barycentricCoords) const;
 	};
 }
 
@@ -0,0 +1,221 @@
+#include "awesomerenderer.h"
+
+#include "triangleblock.h"
+#include "meshtriangle.h"
+#include "ray.h"
+#include "raycasthit.h"
+#include "statistics.h"
+
+using namespace AwesomeRenderer;
+
+void TriangleBlock::Initialise(MeshTriangle* const* triangles, uint32_t count)
+{
+	assert(count <= SIZE);
+
+	float data[16][SIZE];
+	memset(data, 0, sizeof(data));
+
+	for (uint32_t triangleIdx = 0; triangleIdx < SIZE; ++triangleIdx)
+	{
+		// Empty lanes keep a zero normal, which fails the facing test for every ray
+		if (triangleIdx >= count)
+		{
+			this->triangles[triangleIdx] = NULL;
+			continue;
+		}
+
+		const MeshTriangle& triangle = *triangles[triangleIdx];
+		this->triangles[triangleIdx] = &triangle;
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			data[0 + axis][triangleIdx] = triangle.normal[axis];
+			data[3 + axis][triangleIdx] = triangle.v[0][axis];
+			data[6 + axis][triangleIdx] = triangle.v0[axis];
+			data[9 + axis][triangleIdx] = triangle.v1[axis];
+		}
+
+		data[12][triangleIdx] = triangle.dot00;
+		data[13][triangleIdx] = triangle.dot01;
+		data[14][triangleIdx] = triangle.dot11;
+		data[15][triangleIdx] = triangle.invDenom;
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		normal[axis] = _mm_loadu_ps(data[0 + axis]);
+		vertex[axis] = _mm_loadu_ps(data[3 + axis]);
+		v0[axis] = _mm_loadu_ps(data[6 + axis]);
+		v1[axis] = _mm_loadu_ps(data[9 + axis]);
+	}
+
+	dot00 = _mm_loadu_ps(data[12]);
+	dot01 = _mm_loadu_ps(data[13]);
+	dot11 = _mm_loadu_ps(data[14]);
+	invDenom = _mm_loadu_ps(data[15]);
+}
+
+int TriangleBlock::IntersectRay(const Ray& ray, float maxDistance, float& distance, Vector3& barycentricCoords) const
+{
+	__m128 t, u, v;
+	uint32_t hits = CalculateIntersections(ray, maxDistance, t, u, v);
+
+	if (hits == 0)
+		return -1;
+
+	float distances[SIZE], us[SIZE], vs[SIZE];
+	_mm_storeu_ps(distances, t);
+	_mm_storeu_ps(us, u);
+	_mm_storeu_ps(vs, v);
+
+	// Select the nearest hit, later triangles win ties like they do when testing triangles one by one
+	int nearest = -1;
+	for (uint32_t triangleIdx = 0; triangleIdx < SIZE; ++triangleIdx)
+	{
+		if ((hits & (1 << triangleIdx)) != 0 && (nearest < 0 || distances[triangleIdx] <= distances[nearest]))
+			nearest = triangleIdx;
+	}
+
+	distance = distances[nearest];
+	barycentricCoords.set(1.0f - us[nearest] - vs[nearest], us[nearest], vs[nearest]);
+
+	return nearest;
+}
+
+bool TriangleBlock::Occluded(const Ray& ray, float maxDistance) const
+{
+	__m128 t, u, v;
+	return CalculateIntersections(ray, maxDistance, t, u, v) != 0;
+}
+
+TriangleBlock* TriangleBlock::PackLeaves(const std::vector<MeshTriangle*>& elements, const uint32_t* elementBuffer, uint32_t elementBufferSize)
+{
+	// Create a triangle block for every aligned group in the element buffer, leaves always start at a new block
+	uint32_t blockCount = elementBufferSize / SIZE;
+
+	if (blockCount == 0)
+		return NULL;
+
+	TriangleBlock* blocks = AllocateAligned<TriangleBlock>(16, blockCount);
+
+	for (uint32_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+	{
+		const uint32_t* blockIndices = elementBuffer + blockIdx * SIZE;
+		MeshTriangle* blockElements[SIZE];
+
+		uint32_t count = 0;
+		while (count < SIZE && blockIndices[count] != UINT32_MAX)
+		{
+			blockElements[count] = elements[blockIndices[count]];
+			++count;
+		}
+
+		blocks[blockIdx].Initialise(blockElements, count);
+	}
+
+	return blocks;
+}
+
+bool TriangleBlock::IntersectLeaf(const TriangleBlock* blocks, uint32_t elementOffset, uint32_t elementCount, const Ray& ray, RaycastHit& hitInfo, float maxDistance)
+{
+	AR_COUNT(TRIANGLES_TESTED, elementCount);
+
+	const TriangleBlock* block = blocks + elementOffset / SIZE;
+	const TriangleBlock* lastBlock = block + (elementCount + SIZE - 1) / SIZE;
+
+	const MeshTriangle* nearest = NULL;
+	float distance;
+	Vector3 barycentricCoords;
+
+	for (; block < lastBlock; ++block)
+	{
+		// Test four triangles at a time, maxDistance shrinks to the nearest hit so far
+		int hitIdx = block->IntersectRay(ray, maxDistance, distance, barycentricCoords);
+
+		if (hitIdx >= 0)
+		{
+			nearest = block->triangles[hitIdx];
+			maxDistance = distance;
+
+			hitInfo.barycentricCoords = barycentricCoords;
+		}
+	}
+
+	if (nearest == NULL)
+		return false;
+
+	// Fill the hit info struct with gathered data
+	hitInfo.point = ray.origin + maxDistance * ray.direction;
+	hitInfo.distance = maxDistance;
+	hitInfo.element = nearest;
+
+	return true;
+}
+
+bool TriangleBlock::OccludedLeaf(const TriangleBlock* blocks, uint32_t elementOffset, uint32_t elementCount, const Ray& ray, float maxDistance)
+{
+	AR_COUNT(TRIANGLES_TESTED, elementCount);
+
+	const TriangleBlock* block = blocks + elementOffset / SIZE;
+	const TriangleBlock* lastBlock = block + (elementCount + SIZE - 1) / SIZE;
+
+	for (; block < lastBlock; ++block)
+	{
+		if (block->Occluded(ray, maxDistance))
+			return true;
+	}
+
+	return false;
+}
+
+uint32_t TriangleBlock::CalculateIntersections(const Ray& ray, float maxDistance, __m128& t, __m128& u, __m128& v) const
+{
+	// This performs the same calculations as MeshTriangle::IntersectRay, for four triangles at once
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 origin[3], direction[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		origin[axis] = _mm_set1_ps(ray.origin[axis]);
+		direction[axis] = _mm_set1_ps(ray.direction[axis]);
+	}
+
+	__m128 dot = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(normal[0], direction[0]),
+		_mm_mul_ps(normal[1], direction[1])),
+		_mm_mul_ps(normal[2], direction[2]));
+
+	// Ray is parallel or hits the triangle plane from behind
+	__m128 valid = _mm_cmplt_ps(dot, zero);
+
+	__m128 distanceToPlane = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(normal[0], _mm_sub_ps(origin[0], vertex[0])),
+		_mm_mul_ps(normal[1], _mm_sub_ps(origin[1], vertex[1]))),
+		_mm_mul_ps(normal[2], _mm_sub_ps(origin[2], vertex[2])));
+
+	// Intersection point is behind the ray
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(distanceToPlane, zero));
+
+	t = _mm_div_ps(distanceToPlane, _mm_sub_ps(zero, dot));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(maxDistance)));
+
+	if (_mm_movemask_ps(valid) == 0)
+		return 0;
+
+	// Calculate barycentric coords to check if the point is within triangle boundaries
+	__m128 v2[3];
+	for (int axis = 0; axis < 3; ++axis)
+		v2[axis] = _mm_sub_ps(_mm_add_ps(origin[axis], _mm_mul_ps(t, direction[axis])), vertex[axis]);
+
+	__m128 dot02 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0[0], v2[0]), _mm_mul_ps(v0[1], v2[1])), _mm_mul_ps(v0[2], v2[2]));
+	__m128 dot12 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1[0], v2[0]), _mm_mul_ps(v1[1], v2[1])), _mm_mul_ps(v1[2], v2[2]));
+
+	u = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dot11, dot02), _mm_mul_ps(dot01, dot12)), invDenom);
+	v = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dot00, dot12), _mm_mul_ps(dot01, dot02)), invDenom);
+
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+
+	return _mm_movemask_ps(valid);
+}
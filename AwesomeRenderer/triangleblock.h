@@ -0,0 +1,53 @@
+#ifndef _TRIANGLE_BLOCK_H_
+#define _TRIANGLE_BLOCK_H_
+
+#include "awesomerenderer.h"
+
+namespace AwesomeRenderer
+{
+	class Ray;
+	class MeshTriangle;
+	struct RaycastHit;
+
+	// Precomputed data of four mesh triangles in structure of arrays layout, so that a ray can be tested against all of them at once.
+	// Must be allocated with 16 byte alignment.
+	class TriangleBlock
+	{
+	public:
+		static const uint32_t SIZE = 4;
+
+		// Plane normal and first vertex of each triangle
+		__m128 normal[3];
+		__m128 vertex[3];
+
+		// Edges and precalculated values for barycentric coordinates, same as Triangle<Vector3>
+		__m128 v0[3], v1[3];
+		__m128 dot00, dot01, dot11, invDenom;
+
+		const MeshTriangle* triangles[SIZE];
+
+	public:
+		// Fills the block with up to SIZE triangles, unused lanes never report an intersection
+		void Initialise(MeshTriangle* const* triangles, uint32_t count);
+
+		// Intersects the ray with all triangles in the block. Returns the index of the nearest hit triangle, or -1 if none was hit
+		int IntersectRay(const Ray& ray, float maxDistance, float& distance, Vector3& barycentricCoords) const;
+
+		// Returns whether the ray hits any triangle in the block within maxDistance
+		bool Occluded(const Ray& ray, float maxDistance) const;
+
+		// Creates a block for every group of SIZE indices in the element buffer of a tree, unused indices are UINT32_MAX.
+		// Returns NULL if the buffer is empty, the blocks have to be released with FreeAligned
+		static TriangleBlock* PackLeaves(const std::vector<MeshTriangle*>& elements, const uint32_t* elementBuffer, uint32_t elementBufferSize);
+
+		// Intersects the ray with the triangles of a leaf, which always starts at a new block
+		static bool IntersectLeaf(const TriangleBlock* blocks, uint32_t elementOffset, uint32_t elementCount, const Ray& ray, RaycastHit& hitInfo, float maxDistance);
+		static bool OccludedLeaf(const TriangleBlock* blocks, uint32_t elementOffset, uint32_t elementCount, const Ray& ray, float maxDistance);
+
+	private:
+		// Returns a mask of the triangles that are hit, with their hit distances and barycentric coordinates
+		uint32_t CalculateIntersections(const Ray& ray, float maxDistance, __m128& t, __m128& u, __m128& v) const;
+	};
+}
+
+#endif
@@ -10,6 +10,18 @@ namespace AwesomeRenderer
 	{
 
 	public:
+		static const uint64_t HASH_SEED = 0xCBF29CE484222325ULL;
+		
+		// 64-bit FNV-1a hash. Data in multiple parts is hashed by passing the previous result as seed
+		static uint64_t Hash(const void* data, size_t size, uint64_t hash = HASH_SEED)
+		{
+			const uchar* bytes = static_cast<const uchar*>(data);
+
+			for (size_t byteIdx = 0; byteIdx < size; ++byteIdx)
+				hash = (hash ^ bytes[byteIdx]) * 0x100000001B3ULL;
+
+			return hash;
+		}
 
 		template <typename T>
 		AR_FORCE_INLINE static void Sort(T& a, T& b)
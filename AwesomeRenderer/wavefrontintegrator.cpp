@@ -0,0 +1,471 @@
+#include "wavefrontintegrator.h"
+
+#include "raytracer.h"
+#include "raypacket.h"
+
+#include "material.h"
+#include "bsdf.h"
+#include "lambert.h"
+
+#include "renderable.h"
+#include "rendercontext.h"
+#include "rendertarget.h"
+#include "texture.h"
+#include "skybox.h"
+#include "lightdata.h"
+#include "arealight.h"
+
+#include "jobgroup.h"
+
+using namespace AwesomeRenderer;
+using namespace AwesomeRenderer::RayTracing;
+
+const uint32_t WavefrontIntegrator::WAVE_SIZE = 1 << 16;
+const uint32_t WavefrontIntegrator::JOB_COUNT = 64;
+const uint32_t WavefrontIntegrator::MIN_JOB_SIZE = 256;
+
+WavefrontIntegrator::PhaseJob::PhaseJob(WavefrontIntegrator& integrator) : integrator(integrator), phase(GENERATE), begin(0), end(0)
+{
+
+}
+
+void WavefrontIntegrator::PhaseJob::Run()
+{
+	if (!integrator.frameJob.IsInterrupted())
+	{
+		switch (phase)
+		{
+		case GENERATE:
+			integrator.Generate(begin, end);
+			break;
+
+		case EXTEND:
+			integrator.Extend(begin, end);
+			break;
+
+		case SHADE:
+			integrator.Shade(begin, end, shadowRays);
+			break;
+
+		case CONNECT:
+			integrator.Connect(shadowRays);
+			break;
+
+		case ACCUMULATE:
+			integrator.Accumulate(begin, end);
+			break;
+
+		case RESOLVE:
+			integrator.Resolve(begin, end);
+			break;
+		}
+	}
+
+	integrator.phaseJobsLeft.Decrement();
+}
+
+WavefrontIntegrator::FrameJob::FrameJob(WavefrontIntegrator& integrator) : integrator(integrator)
+{
+
+}
+
+void WavefrontIntegrator::FrameJob::Run()
+{
+	integrator.RenderFrame();
+}
+
+WavefrontIntegrator::WavefrontIntegrator(RayTracer& rayTracer) : MonteCarloIntegrator(rayTracer),
+	jobGroup(NULL), frameJob(*this), waveStart(0), waveEnd(0), pixelCount(0), samplesPerPixel(0), finishedPaths(0)
+{
+	for (uint32_t jobIdx = 0; jobIdx < JOB_COUNT; ++jobIdx)
+		phaseJobs.push_back(new PhaseJob(*this));
+}
+
+WavefrontIntegrator::~WavefrontIntegrator()
+{
+	EndFrame();
+
+	for (auto it = phaseJobs.begin(); it != phaseJobs.end(); ++it)
+		delete *it;
+
+	phaseJobs.clear();
+}
+
+bool WavefrontIntegrator::StartFrame(JobGroup* jobGroup)
+{
+	this->jobGroup = jobGroup;
+
+	frameJob.Reset();
+
+	// Only pixels that haven't converged yet receive new samples
+	const Texture* frameBuffer = rayTracer.GetRenderContext().renderTarget->frameBuffer;
+	activePixels.clear();
+
+	for (uint32_t pixelIdx = 0; pixelIdx < frameBuffer->width * frameBuffer->height; ++pixelIdx)
+	{
+		if (!rayTracer.IsConverged(Point2(pixelIdx % frameBuffer->width, pixelIdx / frameBuffer->width)))
+			activePixels.push_back(pixelIdx);
+	}
+
+	pixelCount = activePixels.size();
+	samplesPerPixel = rayTracer.samplesPerPixel;
+
+	finishedPaths = 0;
+
+	if (pixelCount == 0)
+		return false;
+
+	jobGroup->EnqueueJob(&frameJob);
+	return true;
+}
+
+void WavefrontIntegrator::EndFrame()
+{
+	// The flags are only cleared when the next frame starts, so that a frame job which hasn't started yet will return immediately
+	frameJob.Interrupt();
+	frameJob.WaitForCompletion();
+}
+
+float WavefrontIntegrator::GetProgress() const
+{
+	uint64_t totalPaths = pixelCount * (uint64_t) samplesPerPixel;
+
+	if (totalPaths == 0)
+		return 0.0f;
+
+	return (float) (finishedPaths / (double) totalPaths);
+}
+
+void WavefrontIntegrator::RenderFrame()
+{
+	uint64_t totalPaths = pixelCount * (uint64_t) samplesPerPixel;
+
+	paths.resize((uint32_t) std::min((uint64_t) WAVE_SIZE, totalPaths));
+	activePaths.reserve(paths.size());
+	PixelSamples emptySamples = { Vector3(0.0f, 0.0f, 0.0f), 0.0f, 0.0f };
+	accumulation.assign(pixelCount, emptySamples);
+
+	// Paths are numbered sample by sample, every wave contains a consecutive range of them
+	for (waveStart = 0; waveStart < totalPaths && !frameJob.IsInterrupted(); waveStart = waveEnd)
+	{
+		waveEnd = std::min(waveStart + WAVE_SIZE, totalPaths);
+		uint32_t waveSize = (uint32_t) (waveEnd - waveStart);
+
+		RunPhase(GENERATE, waveSize);
+
+		activePaths.resize(waveSize);
+		for (uint32_t pathIdx = 0; pathIdx < waveSize; ++pathIdx)
+			activePaths[pathIdx] = pathIdx;
+
+		// Each iteration extends all paths in the wave by one bounce
+		while (!activePaths.empty() && !frameJob.IsInterrupted())
+		{
+			RunPhase(EXTEND, activePaths.size());
+
+			SortByMaterial();
+
+			RunPhase(SHADE, activePaths.size());
+			RunPhase(CONNECT, activePaths.size());
+
+			activePaths.erase(std::remove_if(activePaths.begin(), activePaths.end(), [this](uint32_t pathIdx) { return !paths[pathIdx].active; }), activePaths.end());
+		}
+
+		RunPhase(ACCUMULATE, std::min(waveSize, pixelCount));
+
+		finishedPaths = waveEnd;
+	}
+
+	if (!frameJob.IsInterrupted())
+		RunPhase(RESOLVE, pixelCount);
+}
+
+void WavefrontIntegrator::RunPhase(Phase phase, uint32_t elementCount)
+{
+	uint32_t jobCount = std::min(JOB_COUNT, (elementCount + MIN_JOB_SIZE - 1) / MIN_JOB_SIZE);
+
+	if (jobCount == 0)
+		return;
+
+	uint32_t jobSize = (elementCount + jobCount - 1) / jobCount;
+
+	phaseJobsLeft.Configure(jobCount, jobCount);
+
+	// The partitioning only depends on the element count, so the shade and connect phases assign the same paths to each job
+	for (uint32_t jobIdx = 0; jobIdx < jobCount; ++jobIdx)
+	{
+		PhaseJob* job = phaseJobs[jobIdx];
+		job->Reset();
+
+		job->phase = phase;
+		job->begin = std::min(jobIdx * jobSize, elementCount);
+		job->end = std::min(job->begin + jobSize, elementCount);
+
+		jobGroup->EnqueueJob(job);
+	}
+
+	// Help with the jobs of this phase instead of blocking a worker thread
+	WorkerJob* job;
+	while ((job = jobGroup->DequeueJob()) != NULL)
+		job->Execute();
+
+	phaseJobsLeft.WaitZero();
+}
+
+void WavefrontIntegrator::SortByMaterial()
+{
+	// Group paths by material, so that each shading job accesses the same textures and BSDFs. This is a counting sort,
+	// which keeps the paths of a material in their original order
+	std::map<const Material*, uint32_t> materialOffsets;
+	auto materialIt = materialOffsets.end();
+
+	for (auto it = activePaths.begin(); it != activePaths.end(); ++it)
+	{
+		const Material* material = paths[*it].material;
+
+		// Consecutive paths often hit the same material
+		if (materialIt == materialOffsets.end() || materialIt->first != material)
+			materialIt = materialOffsets.insert(std::make_pair(material, 0)).first;
+
+		++materialIt->second;
+	}
+
+	uint32_t offset = 0;
+	for (auto it = materialOffsets.begin(); it != materialOffsets.end(); ++it)
+	{
+		uint32_t count = it->second;
+		it->second = offset;
+		offset += count;
+	}
+
+	sortedPaths.resize(activePaths.size());
+	materialIt = materialOffsets.end();
+
+	for (auto it = activePaths.begin(); it != activePaths.end(); ++it)
+	{
+		const Material* material = paths[*it].material;
+
+		if (materialIt == materialOffsets.end() || materialIt->first != material)
+			materialIt = materialOffsets.find(material);
+
+		sortedPaths[materialIt->second++] = *it;
+	}
+
+	activePaths.swap(sortedPaths);
+}
+
+void WavefrontIntegrator::Generate(uint32_t begin, uint32_t end)
+{
+	const Texture* frameBuffer = rayTracer.GetRenderContext().renderTarget->frameBuffer;
+
+	for (uint32_t pathIdx = begin; pathIdx < end; ++pathIdx)
+	{
+		uint64_t globalIdx = waveStart + pathIdx;
+		uint32_t pixelIdx = activePixels[(uint32_t) (globalIdx % pixelCount)];
+		uint32_t sample = (uint32_t) (globalIdx / pixelCount);
+
+		Point2 pixel(pixelIdx % frameBuffer->width, pixelIdx / frameBuffer->width);
+
+		Path& path = paths[pathIdx];
+		path.throughput = Vector3(1.0f, 1.0f, 1.0f);
+		path.radiance = Vector3(0.0f, 0.0f, 0.0f);
+		path.depth = 0;
+		path.active = true;
+
+		// Uses the same random stream as the per pixel renderer, so both produce the same primary rays
+		rayTracer.SeedRandom(pixel, sample, path.random);
+		rayTracer.GeneratePrimaryRay(pixel, sample, path.random, path.ray);
+	}
+}
+
+void WavefrontIntegrator::Extend(uint32_t begin, uint32_t end)
+{
+	for (uint32_t activeIdx = begin; activeIdx < end; activeIdx += RayPacket::SIZE)
+	{
+		uint32_t pathCount = std::min(RayPacket::SIZE, end - activeIdx);
+		Path* packetPaths[RayPacket::SIZE];
+
+		bool primary = pathCount == RayPacket::SIZE;
+
+		for (uint32_t rayIdx = 0; rayIdx < pathCount; ++rayIdx)
+		{
+			packetPaths[rayIdx] = &paths[activePaths[activeIdx + rayIdx]];
+			packetPaths[rayIdx]->hitInfo = RaycastHit();
+
+			primary = primary && packetPaths[rayIdx]->depth == 0;
+		}
+
+		if (primary)
+		{
+			// Primary rays of neighbouring pixels are coherent, so they can share the traversal of the scene
+			Ray rays[RayPacket::SIZE];
+			RaycastHit hitInfo[RayPacket::SIZE];
+
+			for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+				rays[rayIdx] = packetPaths[rayIdx]->ray;
+
+			uint32_t hits = rayTracer.RayCast(RayPacket(rays), hitInfo, RayPacket::FULL_MASK);
+
+			for (uint32_t rayIdx = 0; rayIdx < RayPacket::SIZE; ++rayIdx)
+			{
+				packetPaths[rayIdx]->hitInfo = hitInfo[rayIdx];
+				packetPaths[rayIdx]->hit = (hits & (1 << rayIdx)) != 0;
+			}
+		}
+		else
+		{
+			for (uint32_t rayIdx = 0; rayIdx < pathCount; ++rayIdx)
+				packetPaths[rayIdx]->hit = rayTracer.RayCast(packetPaths[rayIdx]->ray, packetPaths[rayIdx]->hitInfo);
+		}
+
+		for (uint32_t rayIdx = 0; rayIdx < pathCount; ++rayIdx)
+		{
+			Path& path = *packetPaths[rayIdx];
+
+			if (path.hit)
+				path.material = dynamic_cast<const Renderable*>(path.hitInfo.element)->material;
+			else
+				path.material = NULL;
+		}
+	}
+}
+
+void WavefrontIntegrator::Shade(uint32_t begin, uint32_t end, std::vector<ShadowRay>& shadowRays)
+{
+	const RenderContext& context = rayTracer.GetRenderContext();
+
+	shadowRays.clear();
+
+	for (uint32_t activeIdx = begin; activeIdx < end; ++activeIdx)
+	{
+		uint32_t pathIdx = activePaths[activeIdx];
+		Path& path = paths[pathIdx];
+
+		if (!path.hit)
+		{
+			if (context.skybox != NULL)
+			{
+				Color skyColor;
+				context.skybox->Sample(path.ray.direction, skyColor);
+
+				path.radiance += path.throughput * skyColor.subvector(3);
+			}
+
+			path.active = false;
+			continue;
+		}
+
+		const Material& material = *path.material;
+		RaycastHit& hitInfo = path.hitInfo;
+
+		rayTracer.CalculateTextureLod(path.ray, hitInfo);
+		rayTracer.ApplyNormalMap(material, hitInfo);
+
+		if (material.translucent)
+		{
+			// Instead of blending with the radiance behind the surface, pass through it with a probability based on the surface alpha
+			Color albedo = Lambert::SampleAlbedo(hitInfo, material, context);
+
+			if (path.random.NextFloat() >= albedo[3])
+			{
+				path.ray = Ray(hitInfo.point + path.ray.direction * 0.05f, path.ray.direction);
+				path.ray.type = Ray::TRANSMISSION;
+				path.ray.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
+				continue;
+			}
+		}
+
+		path.radiance += path.throughput * material.emission.subvector(3) * material.emissionIntensity;
+
+		if (material.bsdf == NULL)
+		{
+			path.active = false;
+			continue;
+		}
+
+		// Queue shadow rays for all lights, these are tested in the connect phase
+		ShadowRay shadowRay;
+		shadowRay.pathIdx = pathIdx;
+
+		for (uint32_t lightIdx = 0; lightIdx < LightData::MAX_LIGHTS; ++lightIdx)
+		{
+			if (!GenerateDirectLightSample(lightIdx, path.ray, hitInfo, material, context, shadowRay.sample))
+				continue;
+
+			shadowRay.sample.radiance = path.throughput * shadowRay.sample.radiance;
+			shadowRays.push_back(shadowRay);
+		}
+
+		for (uint32_t lightIdx = 0; lightIdx < context.lightData->areaLights.size(); ++lightIdx)
+		{
+			const AreaLight* light = context.lightData->areaLights[lightIdx];
+
+			LightSample samples[2];
+			uint32_t sampleCount = GenerateAreaLightSamples(*light, hitInfo.point, -path.ray.direction, hitInfo.normal, hitInfo, material, path.random, samples);
+
+			for (uint32_t sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+			{
+				shadowRay.sample = samples[sampleIdx];
+				shadowRay.sample.radiance = path.throughput * shadowRay.sample.radiance;
+				shadowRays.push_back(shadowRay);
+			}
+		}
+
+		// Continue the path in the direction of a BSDF sample
+		Ray sampleRay;
+		Vector3 weight;
+
+		if (path.depth >= rayTracer.maxDepth || !GenerateBSDFSample(hitInfo.point, -path.ray.direction, hitInfo.normal, hitInfo, material, path.random, sampleRay, weight))
+		{
+			path.active = false;
+			continue;
+		}
+
+		path.ray = sampleRay;
+		path.throughput = path.throughput * weight;
+		++path.depth;
+	}
+}
+
+void WavefrontIntegrator::Connect(const std::vector<ShadowRay>& shadowRays)
+{
+	for (auto it = shadowRays.begin(); it != shadowRays.end(); ++it)
+	{
+		if (!rayTracer.Occluded(it->sample.shadowRay, it->sample.distance))
+			paths[it->pathIdx].radiance += it->sample.radiance;
+	}
+}
+
+void WavefrontIntegrator::Accumulate(uint32_t begin, uint32_t end)
+{
+	// Every job handles a distinct set of pixels. If the wave is larger than the frame, the paths of a pixel are a frame apart
+	uint32_t waveSize = (uint32_t) (waveEnd - waveStart);
+
+	for (uint32_t firstPathIdx = begin; firstPathIdx < end; ++firstPathIdx)
+	{
+		PixelSamples& samples = accumulation[(uint32_t) ((waveStart + firstPathIdx) % pixelCount)];
+
+		for (uint32_t pathIdx = firstPathIdx; pathIdx < waveSize; pathIdx += pixelCount)
+		{
+			const Vector3& radiance = paths[pathIdx].radiance;
+			float luminance = ColorUtil::Luminance(radiance);
+
+			samples.radiance += radiance;
+			samples.luminanceSum += luminance;
+			samples.luminanceSquaredSum += luminance * luminance;
+		}
+	}
+}
+
+void WavefrontIntegrator::Resolve(uint32_t begin, uint32_t end)
+{
+	const Texture* frameBuffer = rayTracer.GetRenderContext().renderTarget->frameBuffer;
+
+	for (uint32_t activePixelIdx = begin; activePixelIdx < end; ++activePixelIdx)
+	{
+		uint32_t pixelIdx = activePixels[activePixelIdx];
+		const PixelSamples& samples = accumulation[activePixelIdx];
+
+		Point2 pixel(pixelIdx % frameBuffer->width, pixelIdx / frameBuffer->width);
+		rayTracer.AccumulatePixel(pixel, Color(samples.radiance, 0.0f), samples.luminanceSum, samples.luminanceSquaredSum, samplesPerPixel);
+	}
+}
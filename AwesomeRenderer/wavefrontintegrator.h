@@ -0,0 +1,142 @@
+#ifndef _WAVEFRONT_INTEGRATOR_H_
+#define _WAVEFRONT_INTEGRATOR_H_
+
+#include "montecarlointegrator.h"
+#include "workerjob.h"
+#include "threading.h"
+
+#include "ray.h"
+#include "raycasthit.h"
+#include "random.h"
+
+namespace AwesomeRenderer
+{
+	class JobGroup;
+
+	namespace RayTracing
+	{
+		// Path tracer that renders a frame as a stream of paths. Instead of following each path recursively, every bounce is processed
+		// in phases over a large batch of paths: extending all paths, shading them grouped by material and testing all shadow rays.
+		// This keeps the working set of each phase small and coherent. Single pixels are still shaded by the Monte Carlo integrator.
+		class WavefrontIntegrator : public MonteCarloIntegrator
+		{
+
+		private:
+			static const uint32_t WAVE_SIZE;
+			static const uint32_t JOB_COUNT;
+			static const uint32_t MIN_JOB_SIZE;
+
+			enum Phase
+			{
+				GENERATE,
+				EXTEND,
+				SHADE,
+				CONNECT,
+				ACCUMULATE,
+				RESOLVE,
+			};
+
+			struct Path
+			{
+				Ray ray;
+				RaycastHit hitInfo;
+				const Material* material;
+
+				Vector3 throughput;
+				Vector3 radiance;
+
+				Random random;
+
+				uint32_t depth;
+				bool hit, active;
+			};
+
+			// Sum of the samples of a pixel in the current frame
+			struct PixelSamples
+			{
+				Vector3 radiance;
+
+				float luminanceSum;
+				float luminanceSquaredSum;
+			};
+
+			struct ShadowRay
+			{
+				LightSample sample;
+				uint32_t pathIdx;
+			};
+
+			class PhaseJob : public WorkerJob
+			{
+			public:
+				WavefrontIntegrator& integrator;
+
+				Phase phase;
+				uint32_t begin, end;
+
+				// Shadow rays generated while shading, these are tested by the same job in the connect phase
+				std::vector<ShadowRay> shadowRays;
+
+				PhaseJob(WavefrontIntegrator& integrator);
+
+			protected:
+				void Run();
+			};
+
+			class FrameJob : public WorkerJob
+			{
+			public:
+				WavefrontIntegrator& integrator;
+
+				FrameJob(WavefrontIntegrator& integrator);
+
+			protected:
+				void Run();
+			};
+
+			JobGroup* jobGroup;
+
+			FrameJob frameJob;
+			std::vector<PhaseJob*> phaseJobs;
+			Counter phaseJobsLeft;
+
+			std::vector<Path> paths;
+			std::vector<uint32_t> activePaths, sortedPaths;
+			std::vector<uint32_t> activePixels;
+			std::vector<PixelSamples> accumulation;
+
+			uint64_t waveStart, waveEnd;
+			uint32_t pixelCount, samplesPerPixel;
+
+			uint64_t finishedPaths;
+
+		public:
+			WavefrontIntegrator(RayTracer& rayTracer);
+			~WavefrontIntegrator();
+
+			// Starts rendering a frame with jobs in the given group. Returns false if there are no pixels left that need samples
+			bool StartFrame(JobGroup* jobGroup);
+
+			// Interrupts the current frame and waits until it has stopped
+			void EndFrame();
+
+			bool IsFrameCompleted() const { return frameJob.IsCompleted(); }
+			void WaitForFrame() { frameJob.WaitUntilCompleted(); }
+			float GetProgress() const;
+
+		private:
+			void RenderFrame();
+			void RunPhase(Phase phase, uint32_t elementCount);
+			void SortByMaterial();
+
+			void Generate(uint32_t begin, uint32_t end);
+			void Extend(uint32_t begin, uint32_t end);
+			void Shade(uint32_t begin, uint32_t end, std::vector<ShadowRay>& shadowRays);
+			void Connect(const std::vector<ShadowRay>& shadowRays);
+			void Accumulate(uint32_t begin, uint32_t end);
+			void Resolve(uint32_t begin, uint32_t end);
+		};
+	}
+}
+
+#endif
@@ -21,7 +21,7 @@ WhittedIntegrator::WhittedIntegrator(RayTracer& rayTracer) : SurfaceIntegrator(r
 
 }
 
-Vector3 WhittedIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth)
+Vector3 WhittedIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth)
 {
 	Vector3 radiance = material.emission.subvector(3) * material.emissionIntensity;
 	
@@ -31,11 +31,11 @@ Vector3 WhittedIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const M
 
 		if (depth < rayTracer.maxDepth)
 		{
-			Vector3 reflection = SampleReflection(ray, hitInfo, material, context, depth);
+			Vector3 reflection = SampleReflection(ray, hitInfo, material, context, random, depth);
 
 			if (material.translucent)
 			{
-				Vector3 refraction = SampleRefraction(ray, hitInfo, material, context, depth);
+				Vector3 refraction = SampleRefraction(ray, hitInfo, material, context, random, depth);
 
 				float fresnel = RenderUtil::Fresnel(ray.direction, hitInfo.normal, material.ior);
 				radiance += reflection * fresnel + refraction * (1.0f - fresnel);
@@ -48,16 +48,18 @@ Vector3 WhittedIntegrator::Li(const Ray& ray, const RaycastHit& hitInfo, const M
 	return radiance;
 }
 
-Vector3 WhittedIntegrator::SampleReflection(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth)
+Vector3 WhittedIntegrator::SampleReflection(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth)
 {
 	Vector3 reflectionDirection;
 	VectorUtil<3>::Reflect(-ray.direction, hitInfo.normal, reflectionDirection);
 
 	// Reflection
 	Ray reflectionRay(hitInfo.point + hitInfo.normal * 1e-3f, reflectionDirection);
+	reflectionRay.type = Ray::REFLECTION;
+	reflectionRay.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
 
 	ShadingInfo reflectionShading;
-	rayTracer.CalculateShading(reflectionRay, reflectionShading, depth + 1);
+	rayTracer.CalculateShading(reflectionRay, reflectionShading, random, depth + 1);
 
 	assert(fabs(VectorUtil<3>::Dot(hitInfo.normal, reflectionDirection) - VectorUtil<3>::Dot(hitInfo.normal, -ray.direction)) < 1e-5f);
 
@@ -69,7 +71,7 @@ Vector3 WhittedIntegrator::SampleReflection(const Ray& ray, const RaycastHit& hi
 	return material.bsdf->Sample(-ray.direction, reflectionDirection, hitInfo.normal, hitInfo, material, rayTracer.GetRenderContext()) * lightRadiance * NoL / pdf;
 }
 
-Vector3 WhittedIntegrator::SampleRefraction(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth)
+Vector3 WhittedIntegrator::SampleRefraction(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth)
 {
 	if (VectorUtil<3>::Dot(-ray.direction, hitInfo.normal) < 1e-3f)
 		return Vector3(0.0f, 0.0f, 0.0f);
@@ -81,6 +83,8 @@ Vector3 WhittedIntegrator::SampleRefraction(const Ray& ray, const RaycastHit& hi
 	VectorUtil<3>::Refract(ray.direction, hitInfo.normal, ior, innerRefractionDirection);
 
 	Ray innerRefractionRay(hitInfo.point + innerRefractionDirection * 1e-3f, innerRefractionDirection);
+	innerRefractionRay.type = Ray::TRANSMISSION;
+	innerRefractionRay.SetCone(hitInfo.coneWidth, hitInfo.coneSpread);
 	Ray refractionRay;
 
 	RaycastHit refractionHit;
@@ -96,6 +100,8 @@ Vector3 WhittedIntegrator::SampleRefraction(const Ray& ray, const RaycastHit& hi
 			VectorUtil<3>::Refract(innerRefractionDirection, -refractionHit.normal, ior, outerRefractionDirection);
 
 			refractionRay = Ray(refractionHit.point + outerRefractionDirection * 1e-3f, outerRefractionDirection);
+			refractionRay.type = Ray::TRANSMISSION;
+			refractionRay.SetCone(hitInfo.coneWidth + hitInfo.coneSpread * refractionHit.distance, hitInfo.coneSpread);
 		}
 		else
 		{
@@ -105,7 +111,7 @@ Vector3 WhittedIntegrator::SampleRefraction(const Ray& ray, const RaycastHit& hi
 	}
 
 	ShadingInfo refractionShading;
-	rayTracer.CalculateShading(refractionRay, refractionShading, depth + 1);
+	rayTracer.CalculateShading(refractionRay, refractionShading, random, depth + 1);
 
 	return refractionShading.color.subvector(3);
 }
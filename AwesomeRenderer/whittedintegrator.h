@@ -13,11 +13,11 @@ namespace AwesomeRenderer
 		public:
 			WhittedIntegrator(RayTracer& rayTracer);
 
-			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth);
+			Vector3 Li(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth);
 
 		private:
-			Vector3 SampleReflection(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth);
-			Vector3 SampleRefraction(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, int depth);
+			Vector3 SampleReflection(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth);
+			Vector3 SampleRefraction(const Ray& ray, const RaycastHit& hitInfo, const Material& material, const RenderContext& context, Random& random, int depth);
 		};
 	}
 }
@@ -3,7 +3,7 @@
 
 using namespace AwesomeRenderer;
 
-WorkerJob::WorkerJob() : completed(false)
+WorkerJob::WorkerJob() : running(false), completed(false), interrupted(false)
 {
 
 }
@@ -16,10 +16,15 @@ void WorkerJob::Execute()
 
 	Run();
 
+	// Change state while holding the lock, so that waiting threads can't miss the signal or release the job while we still use it
+	m.lock();
+
 	running = false;
 	completed = true;
 
 	signal.notify_all();
+
+	m.unlock();
 }
 
 void WorkerJob::Interrupt()
@@ -38,9 +43,16 @@ void WorkerJob::Reset()
 
 void WorkerJob::WaitForCompletion()
 {
-	if (!running)
-		return;
+	m.lock();
 
+	while (running)
+		signal.wait(m);
+
+	m.unlock();
+}
+
+void WorkerJob::WaitUntilCompleted()
+{
 	m.lock();
 
 	while (!completed)
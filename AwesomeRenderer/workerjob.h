@@ -23,6 +23,7 @@ namespace AwesomeRenderer
 
 	public:
 		WorkerJob();
+		virtual ~WorkerJob() { }
 
 		void Execute();
 
@@ -32,6 +33,9 @@ namespace AwesomeRenderer
 
 		void WaitForCompletion();
 
+		// Unlike WaitForCompletion this also waits for a job that is queued but hasn't started yet
+		void WaitUntilCompleted();
+
 		bool IsRunning() const { return running; }
 		bool IsCompleted() const { return completed; }
 		bool IsInterrupted() const { return interrupted; }
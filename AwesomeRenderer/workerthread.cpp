@@ -1,4 +1,3 @@
-
 #include "workerthread.h"
 #include "jobgroup.h"
 #include "workerjob.h"
@@ -7,7 +6,15 @@ using namespace AwesomeRenderer;
 
 WorkerThread::WorkerThread(JobGroup* group) : group(group), running(false)
 {
+	workerIdx = group->AddWorker();
+}
+
+WorkerThread::~WorkerThread()
+{
+	Stop();
 
+	if (thread.joinable())
+		thread.detach();
 }
 
 void WorkerThread::Start()
@@ -15,7 +22,7 @@ void WorkerThread::Start()
 	running = true;
 	
 	// Create and start a thread for this worker
-	handle = CreateThread(NULL, 0, WorkerThread::HandleWorker, this, 0, &id);
+	thread = std::thread(&WorkerThread::Run, this);
 }
 
 void WorkerThread::Stop()
@@ -24,23 +31,21 @@ void WorkerThread::Stop()
 	running = false;
 }
 
-DWORD WorkerThread::Run()
+void WorkerThread::Join()
+{
+	if (thread.joinable())
+		thread.join();
+}
+
+void WorkerThread::Run()
 {
+	group->BindWorker(workerIdx);
+
 	while (IsRunning())
 	{
-		group->jobSignal.Wait();
-
-		WorkerJob* job = group->DequeueJob();
+		WorkerJob* job = group->WaitForJob(workerIdx);
 
 		if (job != NULL)
 			job->Execute();
 	}
-
-	return 0;
-}
-
-DWORD WINAPI WorkerThread::HandleWorker(LPVOID args)
-{
-	WorkerThread* thread = static_cast<WorkerThread*>(args);
-	return thread->Run();
 }
\ No newline at end of file
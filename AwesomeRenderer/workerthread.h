@@ -13,27 +13,28 @@ namespace AwesomeRenderer
 	{
 	private:
 		
-		HANDLE handle;
-
-		DWORD id;
+		std::thread thread;
 
 		JobGroup* group;
+		uint32_t workerIdx;
 
-		bool running;
+		std::atomic<bool> running;
 
 	public:
 		WorkerThread(JobGroup* group);
+		~WorkerThread();
 
 		void Start();
 		void Stop();
 
+		// Waits until the thread has exited, the worker has to be stopped and its group woken first
+		void Join();
+
 		bool IsRunning() const { return running; }
 
 	private:
 
-		DWORD Run();
-
-		static DWORD WINAPI HandleWorker(LPVOID args);
+		void Run();
 	};
 }
 
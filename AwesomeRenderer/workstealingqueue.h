@@ -0,0 +1,147 @@
+#ifndef _WORK_STEALING_QUEUE_H_
+#define _WORK_STEALING_QUEUE_H_
+
+namespace AwesomeRenderer
+{
+	// Lock-free Chase-Lev deque. Only the owning thread may push and pop at the bottom, any thread can steal from the top.
+	// Based on "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al., 2013)
+	template<typename T>
+	class WorkStealingQueue
+	{
+	private:
+		static const int64_t INITIAL_CAPACITY = 1024;
+
+		struct Buffer
+		{
+			int64_t capacity;
+			std::atomic<T*>* elements;
+
+			Buffer(int64_t capacity) : capacity(capacity), elements(new std::atomic<T*>[capacity])
+			{
+
+			}
+
+			~Buffer()
+			{
+				delete[] elements;
+			}
+
+			T* Get(int64_t idx) const { return elements[idx & (capacity - 1)].load(std::memory_order_relaxed); }
+			void Put(int64_t idx, T* element) { elements[idx & (capacity - 1)].store(element, std::memory_order_relaxed); }
+		};
+
+		std::atomic<int64_t> top;
+		std::atomic<int64_t> bottom;
+		std::atomic<Buffer*> buffer;
+
+		// Buffers replaced by a larger one can still be read by stealing threads, so they are only released with the queue
+		std::vector<Buffer*> retiredBuffers;
+
+	public:
+		WorkStealingQueue() : top(0), bottom(0), buffer(new Buffer(INITIAL_CAPACITY))
+		{
+
+		}
+
+		~WorkStealingQueue()
+		{
+			delete buffer.load();
+
+			for (auto it = retiredBuffers.begin(); it != retiredBuffers.end(); ++it)
+				delete *it;
+		}
+
+		// Adds an element at the bottom of the queue, may only be called by the owning thread
+		void Push(T* element)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t t = top.load(std::memory_order_acquire);
+			Buffer* currentBuffer = buffer.load(std::memory_order_relaxed);
+
+			if (b - t > currentBuffer->capacity - 1)
+				currentBuffer = Grow(currentBuffer, t, b);
+
+			currentBuffer->Put(b, element);
+
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		// Removes the most recently pushed element, may only be called by the owning thread
+		T* Pop()
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			Buffer* currentBuffer = buffer.load(std::memory_order_relaxed);
+			bottom.store(b, std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+
+			if (t > b)
+			{
+				// The queue was empty
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return NULL;
+			}
+
+			T* element = currentBuffer->Get(b);
+
+			if (t == b)
+			{
+				// This is the last element, race against stealing threads for it
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					element = NULL;
+
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+
+			return element;
+		}
+
+		// Removes the oldest element, can be called from any thread. Returns NULL if the queue is empty or another thread won the race
+		T* Steal()
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+
+			if (t >= b)
+				return NULL;
+
+			Buffer* currentBuffer = buffer.load(std::memory_order_acquire);
+			T* element = currentBuffer->Get(t);
+
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return NULL;
+
+			return element;
+		}
+
+		// Approximate number of elements, only exact when no other thread accesses the queue
+		uint32_t Size() const
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t t = top.load(std::memory_order_relaxed);
+
+			return (uint32_t) std::max(b - t, (int64_t) 0);
+		}
+
+		bool IsEmpty() const { return Size() == 0; }
+
+	private:
+		Buffer* Grow(Buffer* oldBuffer, int64_t t, int64_t b)
+		{
+			Buffer* newBuffer = new Buffer(oldBuffer->capacity * 2);
+
+			for (int64_t idx = t; idx < b; ++idx)
+				newBuffer->Put(idx, oldBuffer->Get(idx));
+
+			retiredBuffers.push_back(oldBuffer);
+			buffer.store(newBuffer, std::memory_order_release);
+
+			return newBuffer;
+		}
+	};
+}
+
+#endif